@@ -0,0 +1,46 @@
+#include "aot.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <dlfcn.h>
+
+AotCode::AotCode(const std::string &path) : handle{nullptr},
+                                            blocks{nullptr},
+                                            low{0},
+                                            high{0},
+                                            index{} {
+    // A bare name would be searched for in the library path.
+    auto name = path.find('/') == std::string::npos ? "./" + path : path;
+    handle = dlopen(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        throw std::runtime_error("cannot load " + path + ": " + dlerror());
+    }
+    auto version = static_cast<const uint32_t *>(dlsym(handle, "riscv_aot_version"));
+    auto count = static_cast<const uint64_t *>(dlsym(handle, "riscv_aot_block_count"));
+    blocks = static_cast<const AotBlock *>(dlsym(handle, "riscv_aot_blocks"));
+    if (version == nullptr || count == nullptr || blocks == nullptr) {
+        dlclose(handle);
+        throw std::runtime_error(path + " was not generated by riscv-aot");
+    }
+    if (*version != AOT_VERSION) {
+        dlclose(handle);
+        throw std::runtime_error(path + " was generated by an incompatible riscv-aot");
+    }
+
+    if (*count > 0) {
+        low = UINT64_MAX;
+        for (uint64_t i = 0; i < *count; i++) {
+            low = std::min(low, blocks[i].addr);
+            high = std::max(high, blocks[i].addr + 4);
+        }
+        index.assign((high - low) / 4, nullptr);
+        for (uint64_t i = 0; i < *count; i++) {
+            index[(blocks[i].addr - low) / 4] = &blocks[i];
+        }
+    }
+}
+
+AotCode::~AotCode() {
+    dlclose(handle);
+}
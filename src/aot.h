@@ -0,0 +1,63 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Interface between the emulator and the code riscv-aot generates. riscv-aot
+// emits its own copy of these declarations, so bump AOT_VERSION whenever they change.
+#define AOT_VERSION 1
+
+extern "C" {
+
+struct AotContext {
+    uint64_t *registers;
+    void *cpu;
+    uint64_t (*load)(void *cpu, uint64_t addr, int nBytes);
+    void (*store)(void *cpu, uint64_t addr, int nBytes, uint64_t value);
+    // In: virtual address of the block. Out: pc after the block.
+    uint64_t pc;
+    // When a load or store raises an exception: index of that instruction in
+    // the block; the ones before it have completed.
+    uint64_t retired;
+};
+
+// A basic block translated from the instruction words it was generated from.
+// The emulator only runs it while guest memory at addr still holds those words.
+struct AotBlock {
+    // Physical address.
+    uint64_t addr;
+    uint32_t length;
+    const uint32_t *words;
+    void (*function)(AotContext *context);
+};
+
+}
+
+// A shared object produced by riscv-aot, with its blocks indexed by physical address.
+class AotCode {
+private:
+    void *handle;
+    const AotBlock *blocks;
+    uint64_t low;
+    uint64_t high;
+    // One slot per instruction in [low, high); nullptr where no block starts.
+    std::vector<const AotBlock *> index;
+
+public:
+    // Throws std::runtime_error.
+    AotCode(const std::string &path);
+    AotCode(const AotCode &) = delete;
+    AotCode &operator=(const AotCode &) = delete;
+    ~AotCode();
+    // Translation is keyed by physical address, but the kernel text it covers
+    // normally runs identity-mapped, so pcs outside the translated physical
+    // range are not worth a page walk.
+    bool may_contain(uint64_t pc) const { return pc - low < high - low; };
+    const AotBlock *find(uint64_t p_addr) const {
+        return may_contain(p_addr) && (p_addr & 3) == 0 ? index[(p_addr - low) / 4] : nullptr;
+    };
+};
+
+#endif
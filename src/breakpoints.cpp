@@ -0,0 +1,117 @@
+#include "breakpoints.h"
+
+#include <algorithm>
+#include <cstring>
+
+// ebreak
+#define EBREAK 0x00100073
+
+Breakpoints::Breakpoints(Bus &bus, std::function<void()> notify) : bus{bus},
+                                                                   patches{},
+                                                                   watchpoints{},
+                                                                   notify{notify},
+                                                                   triggered{false},
+                                                                   last_hit{} {
+}
+
+bool Breakpoints::insert(uint64_t p_addr) {
+    auto it = patches.find(p_addr);
+    if (it != patches.end()) {
+        it->second.count++;
+        return true;
+    }
+    auto ram = bus.get_ram_pointer(p_addr, 4);
+    if (ram == nullptr) {
+        return false;
+    }
+    Patch patch{0, 1};
+    std::memcpy(&patch.original, ram, 4);
+    uint32_t ebreak = EBREAK;
+    std::memcpy(ram, &ebreak, 4);
+    patches.emplace(p_addr, patch);
+    return true;
+}
+
+bool Breakpoints::remove(uint64_t p_addr) {
+    auto it = patches.find(p_addr);
+    if (it == patches.end()) {
+        return false;
+    }
+    if (--it->second.count == 0) {
+        // The guest may have overwritten the ebreak since; its code wins.
+        auto ram = bus.get_ram_pointer(p_addr, 4);
+        uint32_t word;
+        std::memcpy(&word, ram, 4);
+        if (word == EBREAK) {
+            std::memcpy(ram, &it->second.original, 4);
+        }
+        patches.erase(it);
+    }
+    return true;
+}
+
+void Breakpoints::insert_watchpoint(uint64_t addr, uint64_t length, WatchType type) {
+    watchpoints.push_back({addr, std::max<uint64_t>(length, 1), type});
+}
+
+bool Breakpoints::remove_watchpoint(uint64_t addr, uint64_t length, WatchType type) {
+    length = std::max<uint64_t>(length, 1);
+    for (auto it = watchpoints.begin(); it != watchpoints.end(); it++) {
+        if (it->addr == addr && it->length == length && it->type == type) {
+            watchpoints.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Breakpoints::trap(uint64_t p_addr) {
+    if (patches.count(p_addr) == 0) {
+        return false;
+    }
+    triggered = true;
+    last_hit = {false, p_addr, WatchType::Access};
+    notify();
+    return true;
+}
+
+void Breakpoints::watch_hit(uint64_t addr, uint64_t nBytes, bool is_store) {
+    for (const auto &watchpoint : watchpoints) {
+        if (addr + nBytes <= watchpoint.addr || addr >= watchpoint.addr + watchpoint.length) {
+            continue;
+        }
+        if (watchpoint.type == (is_store ? WatchType::Read : WatchType::Write)) {
+            continue;
+        }
+        // The first access an instruction makes is the one reported.
+        if (!triggered) {
+            triggered = true;
+            last_hit = {true, std::max(addr, watchpoint.addr), watchpoint.type};
+            notify();
+        }
+        return;
+    }
+}
+
+void Breakpoints::unpatch(uint64_t p_addr, uint8_t *buffer, uint64_t nBytes) const {
+    for (const auto &[addr, patch] : patches) {
+        for (uint64_t i = 0; i < 4; i++) {
+            if (addr + i >= p_addr && addr + i < p_addr + nBytes) {
+                buffer[addr + i - p_addr] = patch.original >> (8 * i);
+            }
+        }
+    }
+}
+
+void Breakpoints::repatch(uint64_t p_addr, uint8_t *ram, uint64_t nBytes) {
+    uint32_t ebreak = EBREAK;
+    for (auto &[addr, patch] : patches) {
+        for (uint64_t i = 0; i < 4; i++) {
+            if (addr + i >= p_addr && addr + i < p_addr + nBytes) {
+                auto &byte = ram[addr + i - p_addr];
+                patch.original = (patch.original & ~((uint32_t)0xff << (8 * i))) | (uint32_t)byte << (8 * i);
+                byte = ebreak >> (8 * i);
+            }
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "bus.h"
+
+enum class WatchType {
+    Write,
+    Read,
+    // Reads and writes.
+    Access,
+};
+
+// What made run() return StopReason::Breakpoint.
+struct BreakpointHit {
+    // False for a breakpoint: pc is at the instruction, which has not run.
+    // True for a watchpoint: the instruction that touched addr has retired.
+    bool watch;
+    uint64_t addr;
+    WatchType type;
+};
+
+// Debugger breakpoints that cost nothing until one triggers. A breakpoint
+// replaces its instruction in RAM with ebreak, so the guest runs at full speed
+// and only the ebreak's trap is checked against the patched addresses. Loads
+// and stores consult the watchpoints only while the Cpu points here, which the
+// emulator arranges only while any breakpoint or watchpoint is set.
+class Breakpoints {
+private:
+    struct Patch {
+        uint32_t original;
+        // Breakpoints set at this address, which may be reached through several mappings.
+        int count;
+    };
+    struct Watchpoint {
+        uint64_t addr;
+        uint64_t length;
+        WatchType type;
+    };
+    Bus &bus;
+    // Keyed by physical address.
+    std::unordered_map<uint64_t, Patch> patches;
+    std::vector<Watchpoint> watchpoints;
+    std::function<void()> notify;
+    bool triggered;
+    BreakpointHit last_hit;
+    void watch_hit(uint64_t addr, uint64_t nBytes, bool is_store);
+
+public:
+    // notify is called when a breakpoint or watchpoint triggers.
+    Breakpoints(Bus &bus, std::function<void()> notify);
+    // Returns false if p_addr is not a word of RAM.
+    bool insert(uint64_t p_addr);
+    bool remove(uint64_t p_addr);
+    void insert_watchpoint(uint64_t addr, uint64_t length, WatchType type);
+    bool remove_watchpoint(uint64_t addr, uint64_t length, WatchType type);
+    bool empty() const { return patches.empty() && watchpoints.empty(); };
+    // Called for an ebreak at p_addr; returns true if it is a breakpoint's.
+    bool trap(uint64_t p_addr);
+    // Called with the virtual address of every load and store.
+    void access(uint64_t addr, uint64_t nBytes, bool is_store) {
+        if (!watchpoints.empty()) {
+            watch_hit(addr, nBytes, is_store);
+        }
+    };
+    // Puts the original instructions back into a copy of guest RAM at p_addr.
+    void unpatch(uint64_t p_addr, uint8_t *buffer, uint64_t nBytes) const;
+    // Called after the debugger wrote nBytes of RAM at p_addr, ram pointing to
+    // them: the written bytes become the original instructions of the
+    // breakpoints there, and their ebreaks are put back.
+    void repatch(uint64_t p_addr, uint8_t *ram, uint64_t nBytes);
+    bool is_triggered() const { return triggered; };
+    void clear_hit() { triggered = false; };
+    const BreakpointHit &get_hit() const { return last_hit; };
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "buffer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Buffer::Buffer() : bytes{nullptr},
+                   length{0},
+                   mapped{false},
+                   storage{} {
+}
+
+Buffer::Buffer(std::vector<uint8_t> bytes) : bytes{nullptr},
+                                             length{0},
+                                             mapped{false},
+                                             storage{std::move(bytes)} {
+    this->bytes = storage.data();
+    length = storage.size();
+}
+
+Buffer::Buffer(Buffer &&other) noexcept : bytes{other.bytes},
+                                          length{other.length},
+                                          mapped{other.mapped},
+                                          storage{std::move(other.storage)} {
+    other.bytes = nullptr;
+    other.length = 0;
+    other.mapped = false;
+}
+
+Buffer &Buffer::operator=(Buffer &&other) noexcept {
+    if (this != &other) {
+        release();
+        bytes = std::exchange(other.bytes, nullptr);
+        length = std::exchange(other.length, 0);
+        mapped = std::exchange(other.mapped, false);
+        storage = std::move(other.storage);
+    }
+    return *this;
+}
+
+Buffer::~Buffer() {
+    release();
+}
+
+void Buffer::release() {
+    if (mapped) {
+        munmap(bytes, length);
+    }
+    bytes = nullptr;
+    length = 0;
+    mapped = false;
+    storage.clear();
+}
+
+Buffer Buffer::map_file(const std::string &path) {
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        auto error = errno;
+        close(fd);
+        throw std::runtime_error("cannot stat " + path + ": " + std::strerror(error));
+    }
+
+    Buffer buffer;
+    if (status.st_size > 0) {
+        auto address = mmap(nullptr, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            auto error = errno;
+            close(fd);
+            throw std::runtime_error("cannot map " + path + ": " + std::strerror(error));
+        }
+        buffer.bytes = static_cast<uint8_t *>(address);
+        buffer.length = status.st_size;
+        buffer.mapped = true;
+    }
+    close(fd);
+    return buffer;
+}
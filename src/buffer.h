@@ -0,0 +1,36 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Move-only bytes handed to the machine at construction: either a vector the
+// buffer takes over, or a private copy-on-write mapping of a file, so large
+// images are never copied on the way in.
+class Buffer {
+private:
+    uint8_t *bytes;
+    size_t length;
+    bool mapped;
+    std::vector<uint8_t> storage;
+    void release();
+
+public:
+    Buffer();
+    Buffer(std::vector<uint8_t> bytes);
+    Buffer(Buffer &&other) noexcept;
+    Buffer &operator=(Buffer &&other) noexcept;
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+    ~Buffer();
+    // Maps the file privately: writes stay in this process and never reach the
+    // file. Throws std::runtime_error.
+    static Buffer map_file(const std::string &path);
+    uint8_t *data() { return bytes; };
+    const uint8_t *data() const { return bytes; };
+    size_t size() const { return length; };
+};
+
+#endif
@@ -1,88 +1,114 @@
-#include <iostream>
+#include <cstring>
+#include <new>
+#include <stdexcept>
 
 #include "bus.h"
+#include "metrics.h"
 
-Bus::Bus(std::vector<uint8_t> bytes, std::vector<uint8_t> disk_image) : memory{Memory(bytes)},
-                                                                        clint{CLINT()},
-                                                                        plic{PLIC()},
-                                                                        uart{Uart()},
-                                                                        virtio{Virtio(disk_image)} {
+Bus::Bus(const Buffer &image) : devices{},
+                                regions{},
+                                ram_regions{},
+                                page_map{static_cast<uint8_t *>(std::calloc(MMIO_PAGES, 1)), &std::free},
+                                memory{image} {
+    if (!page_map) {
+        throw std::bad_alloc();
+    }
 }
 
-std::pair<uint64_t, std::optional<Exception>> Bus::load(uint64_t addr, int N) {
-    if (CLINT_BASE <= addr && addr < CLINT_BASE + CLINT_SIZE) {
-        auto [data, err] = clint.load(addr, N);
-        if (err.has_value()) {
-            return std::make_pair(0, err);
-        }
-        return std::make_pair(data, std::nullopt);
+void Bus::attach_device(uint64_t base, uint64_t size, std::unique_ptr<Device> device) {
+    if (size == 0 || base >= MEMORY_BASE || size > MEMORY_BASE - base) {
+        throw std::invalid_argument("device range outside the MMIO window");
     }
-    if (PLIC_BASE <= addr && addr < PLIC_BASE + PLIC_SIZE) {
-        auto [data, err] = plic.load(addr, N);
-        if (err.has_value()) {
-            return std::make_pair(0, err);
-        }
-        return std::make_pair(data, std::nullopt);
+    if (regions.size() == MMIO_MAX_REGIONS) {
+        throw std::invalid_argument("too many devices");
     }
-    if (UART_BASE <= addr && addr < UART_BASE + UART_SIZE) {
-        auto [data, err] = uart.load(addr, N);
-        if (err.has_value()) {
-            return std::make_pair(0, err);
+    auto first = base >> MMIO_PAGE_SHIFT;
+    auto last = (base + size - 1) >> MMIO_PAGE_SHIFT;
+    for (auto page = first; page <= last; page++) {
+        if (page_map.get()[page] != 0) {
+            throw std::invalid_argument("device range overlaps another device");
         }
-        return std::make_pair(data, std::nullopt);
     }
-    if (VIRTIO_BASE <= addr && addr < VIRTIO_BASE + VIRTIO_SIZE) {
-        auto [data, err] = virtio.load(addr, N);
-        if (err.has_value()) {
-            return std::make_pair(0, err);
-        }
-        return std::make_pair(data, std::nullopt);
+    regions.push_back({base, size, device.get(), device->get_name()});
+    devices.push_back(std::move(device));
+    for (auto page = first; page <= last; page++) {
+        page_map.get()[page] = regions.size();
     }
-    if (MEMORY_BASE <= addr) {
-        auto [data, err] = memory.load(addr, N);
-        if (err.has_value()) {
-            return std::make_pair(0, err);
+}
+
+void Bus::map_ram(uint64_t base, uint64_t size, uint8_t *data) {
+    if (size == 0 || base < MEMORY_BASE + MEMORY_SIZE || size > UINT64_MAX - base) {
+        throw std::invalid_argument("RAM region overlaps RAM");
+    }
+    for (const auto &region : ram_regions) {
+        if (base < region.base + region.size && region.base < base + size) {
+            throw std::invalid_argument("RAM region overlaps another region");
         }
-        return std::make_pair(data, std::nullopt);
     }
-    return std::make_pair(0, Exception(ExceptionType::LoadAccessFault));
+    ram_regions.push_back({base, size, data});
 }
 
-std::optional<Exception> Bus::store(uint64_t addr, int N, uint64_t value) {
-    if (CLINT_BASE <= addr && addr < CLINT_BASE + CLINT_SIZE) {
-        auto err = clint.store(addr, N, value);
-        if (err.has_value()) {
-            return err;
+uint8_t *Bus::find_ram(uint64_t addr, uint64_t nBytes) {
+    for (const auto &region : ram_regions) {
+        if (addr - region.base < region.size && nBytes <= region.size - (addr - region.base)) {
+            return region.data + (addr - region.base);
         }
-        return std::nullopt;
     }
-    if (PLIC_BASE <= addr && addr < PLIC_BASE + PLIC_SIZE) {
-        auto err = plic.store(addr, N, value);
-        if (err.has_value()) {
-            return err;
-        }
-        return std::nullopt;
+    return nullptr;
+}
+
+Bus::MmioRegion *Bus::find_region(uint64_t addr) {
+    auto index = page_map.get()[addr >> MMIO_PAGE_SHIFT];
+    if (index == 0) {
+        return nullptr;
     }
-    if (UART_BASE <= addr && addr < UART_BASE + UART_SIZE) {
-        auto err = uart.store(addr, N, value);
-        if (err.has_value()) {
-            return err;
+    auto &region = regions[index - 1];
+    return addr - region.base < region.size ? &region : nullptr;
+}
+
+uint64_t Bus::load(uint64_t addr, int N) {
+    if (MEMORY_BASE <= addr) {
+        auto ram = addr - MEMORY_BASE < MEMORY_SIZE ? nullptr : find_ram(addr, N);
+        if (ram == nullptr) {
+            return memory.load(addr, N);
         }
-        return std::nullopt;
+        uint64_t value = 0;
+        std::memcpy(&value, ram, N);
+        return value;
     }
-    if (VIRTIO_BASE <= addr && addr < VIRTIO_BASE + VIRTIO_SIZE) {
-        auto err = virtio.store(addr, N, value);
-        if (err.has_value()) {
-            return err;
-        }
-        return std::nullopt;
+    auto region = find_region(addr);
+    if (region != nullptr) {
+        Metrics::mmio(region->name, addr - region->base, false);
+        return region->device->load(addr, N);
     }
+    raise_exception(ExceptionType::LoadAccessFault, addr);
+}
+
+void Bus::store(uint64_t addr, int N, uint64_t value) {
     if (MEMORY_BASE <= addr) {
-        auto err = memory.store(addr, N, value);
-        if (err.has_value()) {
-            return err;
+        auto ram = addr - MEMORY_BASE < MEMORY_SIZE ? nullptr : find_ram(addr, N);
+        if (ram == nullptr) {
+            memory.store(addr, N, value);
+        } else {
+            std::memcpy(ram, &value, N);
         }
-        return std::nullopt;
+        return;
     }
-    return Exception(ExceptionType::StoreAMOAccessFault);
+    auto region = find_region(addr);
+    if (region != nullptr) {
+        Metrics::mmio(region->name, addr - region->base, true);
+        region->device->store(addr, N, value);
+        return;
+    }
+    raise_exception(ExceptionType::StoreAMOAccessFault, addr);
+}
+
+uint8_t *Bus::get_ram_pointer(uint64_t addr, uint64_t nBytes) {
+    auto ram = memory.get_pointer(addr, nBytes);
+    return ram != nullptr || ram_regions.empty() ? ram : find_ram(addr, nBytes);
+}
+
+const uint8_t *Bus::view_ram(uint64_t addr, uint64_t nBytes) {
+    auto ram = memory.view(addr, nBytes);
+    return ram != nullptr || ram_regions.empty() ? ram : find_ram(addr, nBytes);
 }
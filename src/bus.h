@@ -2,25 +2,64 @@
 #define BUS_H
 
 #include <cstdint>
+#include <cstdlib>
+#include <memory>
 #include <vector>
 
-#include "clint.h"
+#include "device.h"
 #include "exception.h"
 #include "memory.h"
-#include "plic.h"
-#include "uart.h"
-#include "virtio.h"
+
+// MMIO is mapped at page granularity below MEMORY_BASE.
+#define MMIO_PAGE_SHIFT 12
+#define MMIO_PAGES (MEMORY_BASE >> MMIO_PAGE_SHIFT)
+#define MMIO_MAX_REGIONS 255
 
 class Bus {
+private:
+    struct MmioRegion {
+        uint64_t base;
+        uint64_t size;
+        Device *device;
+        const char *name;
+    };
+    // Host memory mapped as guest RAM above Memory.
+    struct RamRegion {
+        uint64_t base;
+        uint64_t size;
+        uint8_t *data;
+    };
+    std::vector<std::unique_ptr<Device>> devices;
+    std::vector<MmioRegion> regions;
+    std::vector<RamRegion> ram_regions;
+    // Flat page -> region index + 1 table, 0 meaning unmapped. calloc'd so only
+    // the pages covering attached devices are ever committed.
+    std::unique_ptr<uint8_t, decltype(&std::free)> page_map;
+    MmioRegion *find_region(uint64_t addr);
+    uint8_t *find_ram(uint64_t addr, uint64_t nBytes);
+
 public:
     Memory memory;
-    CLINT clint;
-    PLIC plic;
-    Uart uart;
-    Virtio virtio;
-    Bus(std::vector<uint8_t> bytes, std::vector<uint8_t> disk_image);
-    std::pair<uint64_t, std::optional<Exception>> load(uint64_t addr, int N);
-    std::optional<Exception> store(uint64_t addr, int N, uint64_t value);
+    Bus(const Buffer &image);
+    uint64_t load(uint64_t addr, int N);
+    void store(uint64_t addr, int N, uint64_t value);
+    // RAM and mapped regions alike; nullptr if the range is not all in one of them.
+    uint8_t *get_ram_pointer(uint64_t addr, uint64_t nBytes);
+    const uint8_t *view_ram(uint64_t addr, uint64_t nBytes);
+    // Maps size bytes at data as more RAM at base, above Memory. The guest
+    // reads and writes them in place, and they are not part of snapshots. data
+    // must outlive the bus. Throws std::invalid_argument if the range overlaps
+    // RAM or another mapped region.
+    void map_ram(uint64_t base, uint64_t size, uint8_t *data);
+    // Maps [base, base + size) to the device, which the bus then owns.
+    // Throws std::invalid_argument if the range overlaps RAM or another device.
+    void attach_device(uint64_t base, uint64_t size, std::unique_ptr<Device> device);
+    template <typename T>
+    T *attach(uint64_t base, uint64_t size, std::unique_ptr<T> device) {
+        auto pointer = device.get();
+        attach_device(base, size, std::move(device));
+        return pointer;
+    }
 };
 
 #endif
@@ -0,0 +1,214 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#define INVALID_TAG UINT64_MAX
+
+namespace {
+
+bool is_power_of_two(uint64_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+uint64_t parse_size(const std::string &text) {
+    size_t end = 0;
+    uint64_t value = std::stoull(text, &end, 0);
+    auto suffix = text.substr(end);
+    if (suffix == "k" || suffix == "K") {
+        value *= 1024;
+    } else if (suffix == "m" || suffix == "M") {
+        value *= 1024 * 1024;
+    } else if (!suffix.empty()) {
+        throw std::invalid_argument("bad cache size: " + text);
+    }
+    return value;
+}
+
+ReplacementPolicy parse_policy(const std::string &text) {
+    if (text == "lru") {
+        return ReplacementPolicy::Lru;
+    }
+    if (text == "fifo") {
+        return ReplacementPolicy::Fifo;
+    }
+    if (text == "random") {
+        return ReplacementPolicy::Random;
+    }
+    throw std::invalid_argument("bad replacement policy: " + text);
+}
+
+double miss_rate(uint64_t misses, uint64_t accesses) {
+    return accesses == 0 ? 0.0 : 100.0 * misses / accesses;
+}
+
+void print_level(std::ostream &out, const char *name, const Cache &cache) {
+    out << std::left << std::setw(4) << name << std::right
+        << std::setw(16) << cache.accesses << " accesses"
+        << std::setw(14) << cache.misses << " misses"
+        << std::setw(9) << std::fixed << std::setprecision(2) << miss_rate(cache.misses, cache.accesses) << "%" << std::endl;
+}
+
+} // namespace
+
+Cache::Cache(const CacheConfig &config) : config{config},
+                                          clock{0},
+                                          random_state{0x9e3779b97f4a7c15},
+                                          accesses{0},
+                                          misses{0} {
+    if (!is_power_of_two(config.line_size) || config.ways == 0 ||
+        config.size % (config.ways * config.line_size) != 0 ||
+        !is_power_of_two(config.size / (config.ways * config.line_size))) {
+        throw std::invalid_argument("cache geometry must give a power-of-two number of sets");
+    }
+    sets = config.size / (config.ways * config.line_size);
+    line_shift = __builtin_ctzll(config.line_size);
+    tags.assign(sets * config.ways, INVALID_TAG);
+    stamps.assign(sets * config.ways, 0);
+}
+
+bool Cache::access(uint64_t p_addr) {
+    accesses++;
+    clock++;
+    auto line = p_addr >> line_shift;
+    auto base = (line & (sets - 1)) * config.ways;
+    auto victim = base;
+    for (auto way = base; way < base + config.ways; way++) {
+        if (tags[way] == line) {
+            if (config.policy == ReplacementPolicy::Lru) {
+                stamps[way] = clock;
+            }
+            return true;
+        }
+        if (tags[victim] != INVALID_TAG && (tags[way] == INVALID_TAG || stamps[way] < stamps[victim])) {
+            victim = way;
+        }
+    }
+
+    misses++;
+    if (config.policy == ReplacementPolicy::Random && tags[victim] != INVALID_TAG) {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 7;
+        random_state ^= random_state << 17;
+        victim = base + random_state % config.ways;
+    }
+    tags[victim] = line;
+    stamps[victim] = clock;
+    return false;
+}
+
+CacheHierarchy::Config CacheHierarchy::parse(const std::string &spec) {
+    Config config;
+    if (spec == "default") {
+        return config;
+    }
+    std::stringstream entries(spec);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        auto equals = entry.find('=');
+        if (equals == std::string::npos) {
+            throw std::invalid_argument("bad cache spec: " + entry);
+        }
+        auto level = entry.substr(0, equals);
+        CacheConfig *target;
+        if (level == "l1i") {
+            target = &config.l1i;
+        } else if (level == "l1d") {
+            target = &config.l1d;
+        } else if (level == "l2") {
+            target = &config.l2;
+        } else {
+            throw std::invalid_argument("unknown cache level: " + level);
+        }
+
+        std::vector<std::string> fields;
+        std::stringstream values(entry.substr(equals + 1));
+        std::string field;
+        while (std::getline(values, field, ':')) {
+            fields.push_back(field);
+        }
+        if (fields.size() != 4) {
+            throw std::invalid_argument("expected size:ways:line:policy: " + entry);
+        }
+        target->size = parse_size(fields[0]);
+        target->ways = parse_size(fields[1]);
+        target->line_size = parse_size(fields[2]);
+        target->policy = parse_policy(fields[3]);
+    }
+    return config;
+}
+
+CacheHierarchy::CacheHierarchy(const Config &config) : l1i{config.l1i},
+                                                       l1d{config.l1d},
+                                                       l2{config.l2},
+                                                       recent(CACHE_RECENT_PCS, {0, nullptr}) {
+}
+
+CacheHierarchy::PcStats &CacheHierarchy::stats_for(uint64_t pc) {
+    auto &entry = recent[(pc >> 2) % CACHE_RECENT_PCS];
+    if (entry.second == nullptr || entry.first != pc) {
+        entry = {pc, &pcs[pc]};
+    }
+    return *entry.second;
+}
+
+void CacheHierarchy::fetch(uint64_t pc, uint64_t p_addr) {
+    auto &stats = stats_for(pc);
+    stats.fetches++;
+    if (l1i.access(p_addr)) {
+        return;
+    }
+    stats.fetch_misses++;
+    if (!l2.access(p_addr)) {
+        stats.l2_misses++;
+    }
+}
+
+void CacheHierarchy::data(uint64_t pc, uint64_t p_addr, uint64_t nBytes) {
+    auto &stats = stats_for(pc);
+    // Every L1D line the access touches counts, so misaligned and vector
+    // accesses can miss more than once.
+    auto line_size = l1d.get_config().line_size;
+    auto first = p_addr & ~(line_size - 1);
+    for (auto line = first; line < p_addr + nBytes; line += line_size) {
+        stats.data_accesses++;
+        if (l1d.access(line)) {
+            continue;
+        }
+        stats.data_misses++;
+        if (!l2.access(line)) {
+            stats.l2_misses++;
+        }
+    }
+}
+
+void CacheHierarchy::report(std::ostream &out, size_t top_n) const {
+    print_level(out, "l1i", l1i);
+    print_level(out, "l1d", l1d);
+    print_level(out, "l2", l2);
+
+    std::vector<std::pair<uint64_t, PcStats>> sorted(pcs.begin(), pcs.end());
+    auto misses = [](const PcStats &stats) { return stats.fetch_misses + stats.data_misses; };
+    std::sort(sorted.begin(), sorted.end(), [&](const auto &a, const auto &b) {
+        return misses(a.second) != misses(b.second) ? misses(a.second) > misses(b.second) : a.first < b.first;
+    });
+    if (sorted.size() > top_n) {
+        sorted.resize(top_n);
+    }
+
+    out << std::endl
+        << std::setw(18) << "pc" << std::setw(12) << "fetches" << std::setw(12) << "l1i misses" << std::setw(10) << "l1i rate"
+        << std::setw(12) << "l1d access" << std::setw(12) << "l1d misses" << std::setw(10) << "l1d rate"
+        << std::setw(12) << "l2 misses" << std::endl;
+    for (const auto &[pc, stats] : sorted) {
+        out << "0x" << std::hex << std::setfill('0') << std::setw(16) << pc << std::dec << std::setfill(' ')
+            << std::fixed << std::setprecision(2)
+            << std::setw(12) << stats.fetches << std::setw(12) << stats.fetch_misses
+            << std::setw(9) << miss_rate(stats.fetch_misses, stats.fetches) << "%"
+            << std::setw(12) << stats.data_accesses << std::setw(12) << stats.data_misses
+            << std::setw(9) << miss_rate(stats.data_misses, stats.data_accesses) << "%"
+            << std::setw(12) << stats.l2_misses << std::endl;
+    }
+}
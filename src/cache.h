@@ -0,0 +1,91 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Entries in the direct-mapped lookup in front of the per-pc statistics.
+#define CACHE_RECENT_PCS 4096
+
+enum class ReplacementPolicy {
+    Lru,
+    Fifo,
+    Random,
+};
+
+struct CacheConfig {
+    uint64_t size;
+    uint64_t ways;
+    uint64_t line_size;
+    ReplacementPolicy policy;
+};
+
+// One set-associative cache level. Only tags are modelled; data always comes
+// from RAM.
+class Cache {
+private:
+    CacheConfig config;
+    uint64_t sets;
+    uint64_t line_shift;
+    // ways entries per set; INVALID_TAG marks an empty way.
+    std::vector<uint64_t> tags;
+    // Last use (LRU) or fill (FIFO) time of each way.
+    std::vector<uint64_t> stamps;
+    uint64_t clock;
+    uint64_t random_state;
+
+public:
+    uint64_t accesses;
+    uint64_t misses;
+
+    Cache(const CacheConfig &config);
+    // Returns true on a hit; a miss fills the line.
+    bool access(uint64_t p_addr);
+    const CacheConfig &get_config() const { return config; };
+};
+
+// Split L1 instruction and data caches backed by a shared L2. L1 misses go to
+// the L2; stores allocate like loads and write-backs are not modelled.
+class CacheHierarchy {
+public:
+    struct Config {
+        CacheConfig l1i = {32 * 1024, 8, 64, ReplacementPolicy::Lru};
+        CacheConfig l1d = {32 * 1024, 8, 64, ReplacementPolicy::Lru};
+        CacheConfig l2 = {1024 * 1024, 16, 64, ReplacementPolicy::Lru};
+    };
+
+    // Parses "level=size:ways:line:policy[,...]" over the defaults, e.g.
+    // "l1d=64k:8:64:lru,l2=2m:16:64:random", or "default" to keep them all.
+    // Throws std::invalid_argument.
+    static Config parse(const std::string &spec);
+
+    CacheHierarchy(const Config &config);
+    void fetch(uint64_t pc, uint64_t p_addr);
+    void data(uint64_t pc, uint64_t p_addr, uint64_t nBytes);
+    uint64_t l1_misses() const { return l1i.misses + l1d.misses; };
+    uint64_t l2_misses() const { return l2.misses; };
+    // Totals per level, then the top_n instructions by misses.
+    void report(std::ostream &out, size_t top_n) const;
+
+private:
+    struct PcStats {
+        uint64_t fetches = 0;
+        uint64_t fetch_misses = 0;
+        uint64_t data_accesses = 0;
+        uint64_t data_misses = 0;
+        uint64_t l2_misses = 0;
+    };
+
+    Cache l1i;
+    Cache l1d;
+    Cache l2;
+    std::unordered_map<uint64_t, PcStats> pcs;
+    // Direct-mapped front of pcs; entries stay valid since map nodes never move.
+    std::vector<std::pair<uint64_t, PcStats *>> recent;
+    PcStats &stats_for(uint64_t pc);
+};
+
+#endif
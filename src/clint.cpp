@@ -1,31 +1,44 @@
 #include "clint.h"
 
-#include <iostream>
+CLINT::CLINT() : instret{nullptr}, offset{0}, mtimecmp{0}, listener{nullptr} {}
 
-CLINT::CLINT() : mtime{0}, mtimecmp{0} {}
-
-std::pair<uint64_t, std::optional<Exception>> CLINT::load(uint64_t addr, int nBytes) {
+uint64_t CLINT::load(uint64_t addr, int nBytes) {
     if (nBytes == 8) {
         if (addr == CLINT_MTIMECMP) {
-            return std::make_pair(mtimecmp, std::nullopt);
+            return mtimecmp;
         } else if (addr == CLINT_MTIME) {
-            return std::make_pair(mtime, std::nullopt);
+            return get_mtime();
         }
-        return std::make_pair(0, std::nullopt);
+        return 0;
     }
-    return std::make_pair(0, Exception(ExceptionType::LoadAccessFault));
+    raise_exception(ExceptionType::LoadAccessFault, addr);
 }
 
-std::optional<Exception> CLINT::store(uint64_t addr, int nBytes, uint64_t value) {
+void CLINT::store(uint64_t addr, int nBytes, uint64_t value) {
     if (nBytes == 8) {
         if (addr == CLINT_MTIMECMP) {
             mtimecmp = value;
-            return std::nullopt;
         } else if (addr == CLINT_MTIME) {
-            mtime = value;
-            return std::nullopt;
+            offset = value - get_mtime() + offset;
+        } else {
+            return;
+        }
+        if (listener) {
+            listener();
         }
-        return std::nullopt;
+        return;
     }
-    return Exception(ExceptionType::StoreAMOAccessFault);
+    raise_exception(ExceptionType::StoreAMOAccessFault, addr);
+}
+
+void CLINT::set_clock(const uint64_t *instret) {
+    this->instret = instret;
+}
+
+void CLINT::set_listener(std::function<void()> callback) {
+    listener = callback;
+}
+
+void CLINT::advance(uint64_t ticks) {
+    offset += ticks;
 }
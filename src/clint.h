@@ -1,6 +1,8 @@
 #ifndef CLINT_H
 #define CLINT_H
 
+#include <functional>
+
 #include "device.h"
 
 #define CLINT_BASE 0x2000000
@@ -8,15 +10,40 @@
 #define CLINT_MTIMECMP (CLINT_BASE + 0x4000)
 #define CLINT_MTIME (CLINT_BASE + 0xbff8)
 
+// Nominal mtime frequency, used only to convert idle time into host sleeps.
+#define TIMEBASE_FREQUENCY 10000000
+
+// mtime advances by one per retired instruction, plus whatever idle time the
+// emulator skipped, so timer interrupts are a deterministic function of the
+// instruction stream.
 class CLINT : public Device {
 private:
-    uint64_t mtime;
+    const uint64_t *instret;
+    uint64_t offset;
     uint64_t mtimecmp;
+    std::function<void()> listener;
 
 public:
+    struct State {
+        uint64_t offset;
+        uint64_t mtimecmp;
+    };
     CLINT();
-    std::pair<uint64_t, std::optional<Exception>> load(uint64_t addr, int nBytes);
-    std::optional<Exception> store(uint64_t addr, int nBytes, uint64_t value);
+    const char *get_name() { return "clint"; };
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
+    // Binds mtime to the owner's retired-instruction counter.
+    void set_clock(const uint64_t *instret);
+    // Called whenever the guest rewrites mtime or mtimecmp.
+    void set_listener(std::function<void()> callback);
+    void advance(uint64_t ticks);
+    uint64_t get_mtime() { return (instret != nullptr ? *instret : 0) + offset; };
+    uint64_t get_mtimecmp() { return mtimecmp; };
+    State save() { return {offset, mtimecmp}; };
+    void restore(const State &state) {
+        offset = state.offset;
+        mtimecmp = state.mtimecmp;
+    };
 };
 
 #endif
@@ -0,0 +1,90 @@
+#include "coverage.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/shm.h>
+
+Coverage::Coverage(const Filter &filter) : bitmap{nullptr},
+                                           size{COVERAGE_MAP_SIZE},
+                                           shared{false},
+                                           storage{},
+                                           filter{filter},
+                                           previous{0} {
+    auto map_size = std::getenv("AFL_MAP_SIZE");
+    if (map_size != nullptr && std::strtoull(map_size, nullptr, 0) > 0) {
+        // Round down: the hash is masked rather than divided.
+        auto requested = std::strtoull(map_size, nullptr, 0);
+        size = 1;
+        while (size * 2 <= requested) {
+            size *= 2;
+        }
+    }
+
+    auto id = std::getenv("__AFL_SHM_ID");
+    if (id == nullptr) {
+        storage.assign(size, 0);
+        bitmap = storage.data();
+        return;
+    }
+    auto address = shmat(std::atoi(id), nullptr, 0);
+    if (address == (void *)-1) {
+        throw std::runtime_error(std::string("cannot attach coverage bitmap ") + id + ": " + std::strerror(errno));
+    }
+    bitmap = static_cast<uint8_t *>(address);
+    shared = true;
+}
+
+Coverage::~Coverage() {
+    if (shared) {
+        shmdt(bitmap);
+    }
+}
+
+Coverage::Filter Coverage::parse(const std::string &spec) {
+    Filter filter;
+    auto colon = spec.find(':');
+    auto modes = spec.substr(0, colon);
+    if (modes != "all") {
+        filter.modes = 0;
+        for (char c : modes) {
+            if (c == 'u') {
+                filter.modes |= 1 << 0;
+            } else if (c == 's') {
+                filter.modes |= 1 << 1;
+            } else if (c == 'm') {
+                filter.modes |= 1 << 3;
+            } else {
+                throw std::invalid_argument("bad coverage mode: " + std::string(1, c));
+            }
+        }
+    }
+    if (colon != std::string::npos) {
+        auto range = spec.substr(colon + 1);
+        auto dash = range.find('-');
+        if (dash == std::string::npos) {
+            throw std::invalid_argument("bad coverage range: " + range);
+        }
+        filter.start = std::stoull(range.substr(0, dash), nullptr, 0);
+        filter.end = std::stoull(range.substr(dash + 1), nullptr, 0);
+        if (filter.end <= filter.start) {
+            throw std::invalid_argument("empty coverage range: " + range);
+        }
+    }
+    return filter;
+}
+
+void Coverage::clear() {
+    std::memset(bitmap, 0, size);
+    previous = 0;
+}
+
+uint64_t Coverage::edges() const {
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        count += bitmap[i] != 0;
+    }
+    return count;
+}
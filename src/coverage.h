@@ -0,0 +1,62 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// AFL's default bitmap size; AFL_MAP_SIZE overrides it.
+#define COVERAGE_MAP_SIZE 65536
+
+// AFL-style edge coverage: every control transfer the guest makes bumps the
+// counter for the pair (previous block, next block) in a bitmap. With
+// __AFL_SHM_ID in the environment the bitmap is that System V shared memory
+// segment, so afl-fuzz and afl-showmap read it directly; otherwise it is private.
+class Coverage {
+public:
+    struct Filter {
+        // Bit n set: record transfers to code running in privilege mode n.
+        uint32_t modes = (1 << 0) | (1 << 1) | (1 << 3);
+        // Only targets in [start, end) count.
+        uint64_t start = 0;
+        uint64_t end = UINT64_MAX;
+    };
+
+private:
+    uint8_t *bitmap;
+    // A power of two.
+    uint64_t size;
+    bool shared;
+    std::vector<uint8_t> storage;
+    Filter filter;
+    uint64_t previous;
+
+public:
+    // Throws std::runtime_error if the shared segment cannot be attached.
+    Coverage(const Filter &filter);
+    Coverage(const Coverage &) = delete;
+    Coverage &operator=(const Coverage &) = delete;
+    ~Coverage();
+    // "all", or any of the letters m, s and u for the modes to record, optionally
+    // followed by ":<start>-<end>" to limit the target pcs. Throws std::invalid_argument.
+    static Filter parse(const std::string &spec);
+    // Called with the pc a branch, jump or trap has just moved to.
+    void edge(uint64_t pc, int mode) {
+        if (((filter.modes >> mode) & 1) == 0 || pc - filter.start >= filter.end - filter.start) {
+            return;
+        }
+        auto location = ((pc >> 4) ^ (pc << 8)) & (size - 1);
+        bitmap[location ^ previous]++;
+        previous = location >> 1;
+    };
+    // Forgets the previous block, so a new input's first edge does not depend on the last one's.
+    void restart() { previous = 0; };
+    // Clears the counters, as afl-fuzz does before each input.
+    void clear();
+    // Entries with a nonzero counter.
+    uint64_t edges() const;
+    bool is_shared() const { return shared; };
+};
+
+#endif
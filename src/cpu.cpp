@@ -1,69 +1,183 @@
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 
 #include "cpu.h"
+#include "metrics.h"
 
-Cpu::Cpu(std::vector<uint8_t> bytes, std::vector<uint8_t> disk_image) : registers{0},
-                                                                        csrs{0},
-                                                                        pc{MEMORY_BASE},
-                                                                        mode{Mode::Machine},
-                                                                        bus{Bus(bytes, disk_image)},
-                                                                        enable_paging{false},
-                                                                        page_table{0} {
-    registers[2] = MEMORY_BASE + MEMORY_SIZE;
-}
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
 
-std::pair<uint64_t, std::optional<Exception>> Cpu::load(uint64_t addr, int nBytes) {
-    auto [p_addr, err] = translate(addr, AccessType::Load);
-    if (err.has_value()) {
-        return std::make_pair(p_addr, err);
+[[noreturn]] void raise_page_fault(uint64_t addr, AccessType access_type) {
+    switch (access_type) {
+    case AccessType::Instruction:
+        raise_exception(ExceptionType::InstructionPageFault, addr);
+    case AccessType::Load:
+        raise_exception(ExceptionType::LoadPageFault, addr);
+    default:
+        raise_exception(ExceptionType::StoreAMOPageFault, addr);
     }
-    auto [data, errr] = bus.load(p_addr, nBytes);
-    return std::make_pair(data, errr);
 }
 
-std::optional<Exception> Cpu::store(uint64_t addr, int nBytes, uint64_t value) {
-    auto [p_addr, err] = translate(addr, AccessType::Store);
-    if (err.has_value()) {
-        return err;
+// Zbb counting primitives. With -DHOST_BITMANIP=ON (-mlzcnt/-mbmi/-mpopcnt) these
+// are single host instructions.
+inline uint64_t clz64(uint64_t x) {
+#if defined(__LZCNT__)
+    return _lzcnt_u64(x);
+#else
+    return x == 0 ? 64 : __builtin_clzll(x);
+#endif
+}
+
+inline uint64_t clz32(uint32_t x) {
+#if defined(__LZCNT__)
+    return _lzcnt_u32(x);
+#else
+    return x == 0 ? 32 : __builtin_clz(x);
+#endif
+}
+
+inline uint64_t ctz64(uint64_t x) {
+#if defined(__BMI__)
+    return _tzcnt_u64(x);
+#else
+    return x == 0 ? 64 : __builtin_ctzll(x);
+#endif
+}
+
+inline uint64_t ctz32(uint32_t x) {
+#if defined(__BMI__)
+    return _tzcnt_u32(x);
+#else
+    return x == 0 ? 32 : __builtin_ctz(x);
+#endif
+}
+
+inline uint64_t cpop64(uint64_t x) {
+#if defined(__POPCNT__)
+    return _mm_popcnt_u64(x);
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+inline uint64_t rotr64(uint64_t x, uint32_t shamt) {
+    return (x >> shamt) | (x << ((64 - shamt) & 63));
+}
+
+inline uint32_t rotr32(uint32_t x, uint32_t shamt) {
+    return (x >> shamt) | (x << ((32 - shamt) & 31));
+}
+
+// orc.b: every non-zero byte becomes 0xff.
+inline uint64_t orc_b(uint64_t x) {
+    auto high = (((x & 0x7f7f7f7f7f7f7f7f) + 0x7f7f7f7f7f7f7f7f) | x) & 0x8080808080808080;
+    return (high >> 7) * 0xff;
+}
+
+} // namespace
+
+Cpu::Cpu(const Buffer &binary, Buffer disk_image) : registers{0},
+                                                    pc{MEMORY_BASE},
+                                                    page_table{0},
+                                                    mip{0},
+                                                    mode{Mode::Machine},
+                                                    enable_paging{false},
+                                                    interrupt_check_needed{true},
+                                                    waiting{false},
+                                                    timer_interrupt{MIP_MTIP},
+                                                    sbi{nullptr},
+                                                    process{nullptr},
+                                                    coverage{nullptr},
+                                                    breakpoints{nullptr},
+                                                    vstart{0},
+                                                    vl{0},
+                                                    vtype{VTYPE_VILL},
+                                                    vregs{0},
+                                                    bus{binary},
+                                                    clint{nullptr},
+                                                    plic{nullptr},
+                                                    uart{nullptr},
+                                                    virtio{nullptr},
+                                                    interrupt_sources{},
+                                                    retired{nullptr},
+                                                    stall_cycles{0},
+                                                    mcycle_offset{0},
+                                                    minstret_offset{0},
+                                                    detect_idle{false},
+                                                    idle_progress{0},
+                                                    idle_sites{},
+                                                    idle_next{0} {
+    // The board: a virt-like machine with the devices xv6 expects.
+    clint = bus.attach(CLINT_BASE, CLINT_SIZE, std::make_unique<CLINT>());
+    plic = bus.attach(PLIC_BASE, PLIC_SIZE, std::make_unique<PLIC>());
+    uart = bus.attach(UART_BASE, UART_SIZE, std::make_unique<Uart>());
+    virtio = bus.attach(VIRTIO_BASE, VIRTIO_SIZE, std::make_unique<Virtio>(std::move(disk_image)));
+#ifdef CACHE_SIM
+    caches = nullptr;
+#endif
+
+    for (int i = 0; i < CsrSlotCount; i++) {
+        csrs[i] = csr_descriptors[i].reset_value;
     }
-    return bus.store(p_addr, nBytes, value);
+    registers[2] = MEMORY_BASE + MEMORY_SIZE;
 }
 
-uint64_t Cpu::load_csr(uint64_t addr) {
-    switch (addr) {
-    case SIE:
-        return csrs[MIE] & csrs[MIDELEG];
-    default:
-        return csrs[addr];
+uint64_t Cpu::load(uint64_t addr, int nBytes) {
+    auto p_addr = translate(addr, AccessType::Load);
+    if (breakpoints != nullptr) {
+        breakpoints->access(addr, nBytes, false);
+    }
+    if (p_addr < MEMORY_BASE) {
+        interrupt_check_needed = true;
+        idle_progress++;
     }
+#ifdef CACHE_SIM
+    if (caches != nullptr && p_addr >= MEMORY_BASE) {
+        caches->data(pc - 4, p_addr, nBytes);
+    }
+#endif
+    return bus.load(p_addr, nBytes);
 }
 
-void Cpu::store_csr(uint64_t addr, uint64_t value) {
-    switch (addr) {
-    case SIE:
-        csrs[MIE] = (csrs[MIE] & ~csrs[MIDELEG]) | (value & csrs[MIDELEG]);
-        return;
-    default:
-        csrs[addr] = value;
-        return;
+void Cpu::store(uint64_t addr, int nBytes, uint64_t value) {
+    auto p_addr = translate(addr, AccessType::Store);
+    if (breakpoints != nullptr) {
+        breakpoints->access(addr, nBytes, true);
+    }
+    if (p_addr < MEMORY_BASE) {
+        interrupt_check_needed = true;
+        idle_progress++;
     }
+#ifdef CACHE_SIM
+    if (caches != nullptr && p_addr >= MEMORY_BASE) {
+        caches->data(pc - 4, p_addr, nBytes);
+    }
+#endif
+    bus.store(p_addr, nBytes, value);
 }
 
-std::pair<uint32_t, std::optional<Exception>> Cpu::fetch() {
-    auto [p_pc, translate_err] = translate(pc, AccessType::Instruction);
-    if (translate_err.has_value()) {
-        return std::make_pair(0, translate_err);
+uint32_t Cpu::fetch() {
+    auto p_pc = translate(pc, AccessType::Instruction);
+#ifdef CACHE_SIM
+    if (caches != nullptr && p_pc >= MEMORY_BASE) {
+        caches->fetch(pc, p_pc);
     }
-    auto [instruction, load_err] = bus.load(p_pc, 4);
-    if (load_err.has_value()) {
-        return std::make_pair(0, Exception(ExceptionType::InstructionAccessFault));
+#endif
+    try {
+        return bus.load(p_pc, 4);
+    } catch (const Exception &) {
+        raise_exception(ExceptionType::InstructionAccessFault, pc);
     }
-    return std::make_pair(instruction, std::nullopt);
 }
 
-std::optional<Exception> Cpu::execute(uint32_t instruction) {
+void Cpu::execute(uint32_t instruction) {
     registers[0] = 0;
 
     auto opcode = instruction & 0x0000007f;
@@ -81,80 +195,55 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
         switch (funct3) {
         case 0x0: {
             // lb
-            auto [data, err] = load(addr, 1);
-            if (err.has_value()) {
-                return err;
-            }
-            registers[rd] = (int64_t)(int8_t)data;
-            return std::nullopt;
+            registers[rd] = (int64_t)(int8_t)load(addr, 1);
+            return;
         }
         case 0x1: {
             // lh
-            auto [data, err] = load(addr, 2);
-            if (err.has_value()) {
-                return err;
-            }
-            registers[rd] = (int64_t)(int16_t)data;
-            return std::nullopt;
+            registers[rd] = (int64_t)(int16_t)load(addr, 2);
+            return;
         }
         case 0x2: {
             // lw
-            auto [data, err] = load(addr, 4);
-            if (err.has_value()) {
-                return err;
-            }
-            registers[rd] = (int64_t)(int32_t)data;
-            return std::nullopt;
+            registers[rd] = (int64_t)(int32_t)load(addr, 4);
+            return;
         }
         case 0x3: {
             // ld
-            auto [data, err] = load(addr, 8);
-            if (err.has_value()) {
-                return err;
-            }
-            registers[rd] = data;
-            return std::nullopt;
+            registers[rd] = load(addr, 8);
+            return;
         }
         case 0x4: {
             // lbu
-            auto [data, err] = load(addr, 1);
-            if (err.has_value()) {
-                return err;
-            }
-            registers[rd] = data;
-            return std::nullopt;
+            registers[rd] = load(addr, 1);
+            return;
         }
         case 0x5: {
             // lhu
-            auto [data, err] = load(addr, 2);
-            if (err.has_value()) {
-                return err;
-            }
-            registers[rd] = data;
-            return std::nullopt;
+            registers[rd] = load(addr, 2);
+            return;
         }
         case 0x6: {
             // lwu
-            auto [data, err] = load(addr, 4);
-            if (err.has_value()) {
-                return err;
-            }
-            registers[rd] = data;
-            return std::nullopt;
+            registers[rd] = load(addr, 4);
+            return;
         }
         default:
             std::cout << "IllegalInstruction(1): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
+    case 0x7:
+        // vector loads
+        return execute_vector_memory(instruction, false);
     case 0xf: {
         switch (funct3) {
         case 0x0:
             // fence
-            return std::nullopt;
+            return;
         default:
             std::cout << "IllegalInstruction(2): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
     case 0x13: {
@@ -165,54 +254,115 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
         case 0x0:
             // addi
             registers[rd] = registers[rs1] + imm;
-            return std::nullopt;
+            return;
         case 0x1:
-            // slli
-            registers[rd] = registers[rs1] << shamt;
-            return std::nullopt;
+            switch (funct7 >> 1) {
+            case 0x00:
+                // slli
+                registers[rd] = registers[rs1] << shamt;
+                return;
+            case 0x0a:
+                // bseti
+                registers[rd] = registers[rs1] | ((uint64_t)1 << shamt);
+                return;
+            case 0x12:
+                // bclri
+                registers[rd] = registers[rs1] & ~((uint64_t)1 << shamt);
+                return;
+            case 0x1a:
+                // binvi
+                registers[rd] = registers[rs1] ^ ((uint64_t)1 << shamt);
+                return;
+            case 0x18:
+                if (funct7 == 0x30) {
+                    switch (rs2) {
+                    case 0x0:
+                        // clz
+                        registers[rd] = clz64(registers[rs1]);
+                        return;
+                    case 0x1:
+                        // ctz
+                        registers[rd] = ctz64(registers[rs1]);
+                        return;
+                    case 0x2:
+                        // cpop
+                        registers[rd] = cpop64(registers[rs1]);
+                        return;
+                    case 0x4:
+                        // sext.b
+                        registers[rd] = (int64_t)(int8_t)registers[rs1];
+                        return;
+                    case 0x5:
+                        // sext.h
+                        registers[rd] = (int64_t)(int16_t)registers[rs1];
+                        return;
+                    }
+                }
+                std::cout << "IllegalInstruction(37): " << instruction << std::endl;
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
+            default:
+                std::cout << "IllegalInstruction(38): " << instruction << std::endl;
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
+            }
         case 0x2:
             // slti
             registers[rd] = (int64_t)registers[rs1] < (int64_t)imm ? 1 : 0;
-            return std::nullopt;
+            return;
         case 0x3:
             // sltiu
             registers[rd] = registers[rs1] < imm ? 1 : 0;
-            return std::nullopt;
+            return;
         case 0x4:
             // xori
             registers[rd] = registers[rs1] ^ imm;
-            return std::nullopt;
+            return;
         case 0x5:
             if (funct7 >> 1 == 0x00) {
                 // srli
                 registers[rd] = registers[rs1] >> shamt;
-                return std::nullopt;
+                return;
             } else if (funct7 >> 1 == 0x10) {
                 // srai
                 registers[rd] = (uint64_t)((int64_t)registers[rs1] >> shamt);
-                return std::nullopt;
+                return;
+            } else if (funct7 >> 1 == 0x12) {
+                // bexti
+                registers[rd] = (registers[rs1] >> shamt) & 1;
+                return;
+            } else if (funct7 >> 1 == 0x18) {
+                // rori
+                registers[rd] = rotr64(registers[rs1], shamt);
+                return;
+            } else if ((instruction >> 20) == 0x287) {
+                // orc.b
+                registers[rd] = orc_b(registers[rs1]);
+                return;
+            } else if ((instruction >> 20) == 0x6b8) {
+                // rev8
+                registers[rd] = __builtin_bswap64(registers[rs1]);
+                return;
             } else {
                 std::cout << "IllegalInstruction(3): " << instruction << std::endl;
-                return Exception(ExceptionType::IllegalInstruction);
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
             }
         case 0x6:
             // ori
             registers[rd] = registers[rs1] | imm;
-            return std::nullopt;
+            return;
         case 0x7:
             // andi
             registers[rd] = registers[rs1] & imm;
-            return std::nullopt;
+            return;
         default:
             std::cout << "IllegalInstruction(4): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
     case 0x17: {
         // auip
         uint64_t imm = (int64_t)(int32_t)(instruction & 0xfffff000);
         registers[rd] = pc + imm - 4;
-        return std::nullopt;
+        return;
     }
     case 0x1b: {
         uint64_t imm = (int64_t)(int32_t)instruction >> 20;
@@ -222,27 +372,51 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
         case 0x0:
             // addiw
             registers[rd] = (int64_t)(int32_t)(registers[rs1] + imm);
-            return std::nullopt;
+            return;
         case 0x1:
-            // slliw
-            registers[rd] = (int64_t)(int32_t)(registers[rs1] << shamt);
-            return std::nullopt;
+            if (funct7 == 0x00) {
+                // slliw
+                registers[rd] = (int64_t)(int32_t)(registers[rs1] << shamt);
+                return;
+            } else if (funct7 >> 1 == 0x02) {
+                // slli.uw
+                registers[rd] = (registers[rs1] & 0xffffffff) << (imm & 0x3f);
+                return;
+            } else if (funct7 == 0x30 && rs2 == 0x0) {
+                // clzw
+                registers[rd] = clz32(registers[rs1]);
+                return;
+            } else if (funct7 == 0x30 && rs2 == 0x1) {
+                // ctzw
+                registers[rd] = ctz32(registers[rs1]);
+                return;
+            } else if (funct7 == 0x30 && rs2 == 0x2) {
+                // cpopw
+                registers[rd] = cpop64(registers[rs1] & 0xffffffff);
+                return;
+            }
+            std::cout << "IllegalInstruction(39): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x5:
             if (funct7 == 0x00) {
                 // srliw
                 registers[rd] = (int64_t)(int32_t)((uint32_t)registers[rs1] >> shamt);
-                return std::nullopt;
+                return;
             } else if (funct7 == 0x20) {
                 // sraiw
                 registers[rd] = (int64_t)((int32_t)registers[rs1] >> shamt);
-                return std::nullopt;
+                return;
+            } else if (funct7 == 0x30) {
+                // roriw
+                registers[rd] = (int64_t)(int32_t)rotr32(registers[rs1], shamt);
+                return;
             } else {
                 std::cout << "IllegalInstruction(5): " << instruction << std::endl;
-                return Exception(ExceptionType::IllegalInstruction);
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
             }
         default:
             std::cout << "IllegalInstruction(6): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
     case 0x23: {
@@ -252,41 +426,32 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
         switch (funct3) {
         case 0x0: {
             // sb
-            auto err = store(addr, 1, registers[rs2]);
-            if (err.has_value()) {
-                return err;
-            }
-            return std::nullopt;
+            store(addr, 1, registers[rs2]);
+            return;
         }
         case 0x1: {
             // sh
-            auto err = store(addr, 2, registers[rs2]);
-            if (err.has_value()) {
-                return err;
-            }
-            return std::nullopt;
+            store(addr, 2, registers[rs2]);
+            return;
         }
         case 0x2: {
             // sw
-            auto err = store(addr, 4, registers[rs2]);
-            if (err.has_value()) {
-                return err;
-            }
-            return std::nullopt;
+            store(addr, 4, registers[rs2]);
+            return;
         }
         case 0x3: {
             // sd
-            auto err = store(addr, 8, registers[rs2]);
-            if (err.has_value()) {
-                return err;
-            }
-            return std::nullopt;
+            store(addr, 8, registers[rs2]);
+            return;
         }
         default:
             std::cout << "IllegalInstruction(7): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
+    case 0x27:
+        // vector stores
+        return execute_vector_memory(instruction, true);
     case 0x2f: {
         auto funct5 = (funct7 & 0b1111100) >> 2;
         switch (funct3) {
@@ -294,69 +459,45 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
             switch (funct5) {
             case 0x00: {
                 // amoadd.w
-                auto [temp, ld_err] = load(registers[rs1], 4);
-                if (ld_err.has_value()) {
-                    return ld_err;
-                }
-                auto st_err = store(registers[rs1], 4, temp + registers[rs2]);
-                if (st_err.has_value()) {
-                    return st_err;
-                }
+                auto temp = load(registers[rs1], 4);
+                store(registers[rs1], 4, temp + registers[rs2]);
                 registers[rd] = temp;
-                return std::nullopt;
+                return;
             }
             case 0x01: {
                 // amoswap.w
-                auto [temp, ld_err] = load(registers[rs1], 4);
-                if (ld_err.has_value()) {
-                    return ld_err;
-                }
-                auto st_err = store(registers[rs1], 4, registers[rs2]);
-                if (st_err.has_value()) {
-                    return st_err;
-                }
+                auto temp = load(registers[rs1], 4);
+                store(registers[rs1], 4, registers[rs2]);
                 registers[rd] = temp;
-                return std::nullopt;
+                return;
             }
             default:
                 std::cout << "IllegalInstruction(8): " << instruction << std::endl;
-                return Exception(ExceptionType::IllegalInstruction);
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
             }
         case 0x3:
             switch (funct5) {
             case 0x00: {
                 // amoadd.d
-                auto [temp, ld_err] = load(registers[rs1], 8);
-                if (ld_err.has_value()) {
-                    return ld_err;
-                }
-                auto st_err = store(registers[rs1], 8, temp + registers[rs2]);
-                if (st_err.has_value()) {
-                    return st_err;
-                }
+                auto temp = load(registers[rs1], 8);
+                store(registers[rs1], 8, temp + registers[rs2]);
                 registers[rd] = temp;
-                return std::nullopt;
+                return;
             }
             case 0x01: {
                 // amoswap.d
-                auto [temp, ld_err] = load(registers[rs1], 8);
-                if (ld_err.has_value()) {
-                    return ld_err;
-                }
-                auto st_err = store(registers[rs1], 8, registers[rs2]);
-                if (st_err.has_value()) {
-                    return st_err;
-                }
+                auto temp = load(registers[rs1], 8);
+                store(registers[rs1], 8, registers[rs2]);
                 registers[rd] = temp;
-                return std::nullopt;
+                return;
             }
             default:
                 std::cout << "IllegalInstruction(9): " << instruction << std::endl;
-                return Exception(ExceptionType::IllegalInstruction);
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
             }
         default:
             std::cout << "IllegalInstruction(10): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
     case 0x33: {
@@ -367,64 +508,148 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
             if (funct7 == 0x00) {
                 // add
                 registers[rd] = registers[rs1] + registers[rs2];
-                return std::nullopt;
+                return;
             } else if (funct7 == 0x01) {
                 // mul
                 registers[rd] = registers[rs1] * registers[rs2];
-                return std::nullopt;
+                return;
             } else if (funct7 == 0x20) {
                 // sub
                 registers[rd] = registers[rs1] - registers[rs2];
-                return std::nullopt;
+                return;
             } else {
                 std::cout << "IllegalInstruction(11): " << instruction << std::endl;
-                return Exception(ExceptionType::IllegalInstruction);
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
             }
         case 0x1:
-            // sll
-            registers[rd] = registers[rs1] << shamt;
-            return std::nullopt;
+            if (funct7 == 0x00) {
+                // sll
+                registers[rd] = registers[rs1] << shamt;
+                return;
+            } else if (funct7 == 0x14) {
+                // bset
+                registers[rd] = registers[rs1] | ((uint64_t)1 << shamt);
+                return;
+            } else if (funct7 == 0x24) {
+                // bclr
+                registers[rd] = registers[rs1] & ~((uint64_t)1 << shamt);
+                return;
+            } else if (funct7 == 0x34) {
+                // binv
+                registers[rd] = registers[rs1] ^ ((uint64_t)1 << shamt);
+                return;
+            } else if (funct7 == 0x30) {
+                // rol
+                registers[rd] = rotr64(registers[rs1], (64 - shamt) & 63);
+                return;
+            }
+            std::cout << "IllegalInstruction(40): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x2:
-            // slt
-            registers[rd] = (int64_t)registers[rs1] < (int64_t)registers[rs2] ? 1 : 0;
-            return std::nullopt;
+            if (funct7 == 0x00) {
+                // slt
+                registers[rd] = (int64_t)registers[rs1] < (int64_t)registers[rs2] ? 1 : 0;
+                return;
+            } else if (funct7 == 0x10) {
+                // sh1add
+                registers[rd] = registers[rs2] + (registers[rs1] << 1);
+                return;
+            }
+            std::cout << "IllegalInstruction(41): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x3:
             // sltu
             registers[rd] = registers[rs1] < registers[rs2] ? 1 : 0;
-            return std::nullopt;
+            return;
         case 0x4:
-            // xor
-            registers[rd] = registers[rs1] ^ registers[rs2];
-            return std::nullopt;
+            if (funct7 == 0x00) {
+                // xor
+                registers[rd] = registers[rs1] ^ registers[rs2];
+                return;
+            } else if (funct7 == 0x10) {
+                // sh2add
+                registers[rd] = registers[rs2] + (registers[rs1] << 2);
+                return;
+            } else if (funct7 == 0x20) {
+                // xnor
+                registers[rd] = ~(registers[rs1] ^ registers[rs2]);
+                return;
+            } else if (funct7 == 0x05) {
+                // min
+                registers[rd] = (int64_t)registers[rs1] < (int64_t)registers[rs2] ? registers[rs1] : registers[rs2];
+                return;
+            }
+            std::cout << "IllegalInstruction(42): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x5:
             if (funct7 == 0x00) {
                 // srl
                 registers[rd] = registers[rs1] >> shamt;
-                return std::nullopt;
+                return;
             } else if (funct7 == 0x20) {
                 // sra
                 registers[rd] = (int64_t)registers[rs1] >> shamt;
-                return std::nullopt;
+                return;
+            } else if (funct7 == 0x24) {
+                // bext
+                registers[rd] = (registers[rs1] >> shamt) & 1;
+                return;
+            } else if (funct7 == 0x30) {
+                // ror
+                registers[rd] = rotr64(registers[rs1], shamt);
+                return;
+            } else if (funct7 == 0x05) {
+                // minu
+                registers[rd] = registers[rs1] < registers[rs2] ? registers[rs1] : registers[rs2];
+                return;
             }
             std::cout << "IllegalInstruction(12): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x6:
-            // or
-            registers[rd] = registers[rs1] | registers[rs2];
-            return std::nullopt;
+            if (funct7 == 0x00) {
+                // or
+                registers[rd] = registers[rs1] | registers[rs2];
+                return;
+            } else if (funct7 == 0x10) {
+                // sh3add
+                registers[rd] = registers[rs2] + (registers[rs1] << 3);
+                return;
+            } else if (funct7 == 0x20) {
+                // orn
+                registers[rd] = registers[rs1] | ~registers[rs2];
+                return;
+            } else if (funct7 == 0x05) {
+                // max
+                registers[rd] = (int64_t)registers[rs1] > (int64_t)registers[rs2] ? registers[rs1] : registers[rs2];
+                return;
+            }
+            std::cout << "IllegalInstruction(43): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x7:
-            // and
-            registers[rd] = registers[rs1] & registers[rs2];
-            return std::nullopt;
+            if (funct7 == 0x00) {
+                // and
+                registers[rd] = registers[rs1] & registers[rs2];
+                return;
+            } else if (funct7 == 0x20) {
+                // andn
+                registers[rd] = registers[rs1] & ~registers[rs2];
+                return;
+            } else if (funct7 == 0x05) {
+                // maxu
+                registers[rd] = registers[rs1] > registers[rs2] ? registers[rs1] : registers[rs2];
+                return;
+            }
+            std::cout << "IllegalInstruction(44): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         default:
             std::cout << "IllegalInstruction(13): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
     case 0x37: {
         // lu
         registers[rd] = (int64_t)(int32_t)(instruction & 0xfffff000);
-        return std::nullopt;
+        return;
     }
     case 0x3b: {
         uint32_t shamt = registers[rs2] & 0x1f;
@@ -434,23 +659,49 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
             if (funct7 == 0x00) {
                 // addw
                 registers[rd] = (int64_t)(int32_t)(registers[rs1] + registers[rs2]);
-                return std::nullopt;
+                return;
             } else if (funct7 == 0x20) {
                 // subw
                 registers[rd] = (int32_t)(registers[rs1] - registers[rs2]);
-                return std::nullopt;
+                return;
+            } else if (funct7 == 0x04) {
+                // add.uw
+                registers[rd] = registers[rs2] + (registers[rs1] & 0xffffffff);
+                return;
             }
             std::cout << "IllegalInstruction(14): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x1:
-            // sllw
-            registers[rd] = (int32_t)((uint32_t)registers[rs1] << shamt);
-            return std::nullopt;
+            if (funct7 == 0x00) {
+                // sllw
+                registers[rd] = (int32_t)((uint32_t)registers[rs1] << shamt);
+                return;
+            } else if (funct7 == 0x30) {
+                // rolw
+                registers[rd] = (int64_t)(int32_t)rotr32(registers[rs1], (32 - shamt) & 31);
+                return;
+            }
+            std::cout << "IllegalInstruction(45): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
+        case 0x2:
+        case 0x4:
+        case 0x6:
+            if (funct7 == 0x10) {
+                // sh1add.uw / sh2add.uw / sh3add.uw
+                registers[rd] = registers[rs2] + ((registers[rs1] & 0xffffffff) << (funct3 >> 1));
+                return;
+            } else if (funct7 == 0x04 && funct3 == 0x4 && rs2 == 0x0) {
+                // zext.h
+                registers[rd] = registers[rs1] & 0xffff;
+                return;
+            }
+            std::cout << "IllegalInstruction(46): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x5:
             if (funct7 == 0x00) {
                 // srlw
                 registers[rd] = (int32_t)((uint32_t)registers[rs1] >> shamt);
-                return std::nullopt;
+                return;
             } else if (funct7 == 0x01) {
                 // divu
                 if (registers[rs2] == 0) {
@@ -460,14 +711,18 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
                     auto divisor = registers[rs2];
                     registers[rd] = dividend / divisor;
                 }
-                return std::nullopt;
+                return;
             } else if (funct7 == 0x20) {
                 // sraw
                 registers[rd] = (int32_t)registers[rs1] >> (int32_t)shamt;
-                return std::nullopt;
+                return;
+            } else if (funct7 == 0x30) {
+                // rorw
+                registers[rd] = (int64_t)(int32_t)rotr32(registers[rs1], shamt);
+                return;
             }
             std::cout << "IllegalInstruction(15): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         case 0x7: {
             // remuw
             if (registers[rs2] == 0) {
@@ -477,57 +732,53 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
                 uint32_t divisor = registers[rs2];
                 registers[rd] = (int32_t)(dividend % divisor);
             }
-            return std::nullopt;
+            return;
         }
         default:
             std::cout << "IllegalInstruction(16): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
+    case 0x57:
+        return execute_vector(instruction);
     case 0x63: {
         uint64_t imm = (uint64_t)((int64_t)(int32_t)(instruction & 0x80000000) >> 19) | ((instruction & 0x80) << 4) | ((instruction >> 20) & 0x7e0) | ((instruction >> 7) & 0x1e);
 
+        bool taken;
         switch (funct3) {
         case 0x0:
             // beq
-            if (registers[rs1] == registers[rs2]) {
-                pc = pc + imm - 4;
-            }
-            return std::nullopt;
+            taken = registers[rs1] == registers[rs2];
+            break;
         case 0x1:
             // bne
-            if (registers[rs1] != registers[rs2]) {
-                pc = pc + imm - 4;
-            }
-            return std::nullopt;
+            taken = registers[rs1] != registers[rs2];
+            break;
         case 0x4:
             // blt
-            if ((int64_t)registers[rs1] < (int64_t)registers[rs2]) {
-                pc = pc + imm - 4;
-            }
-            return std::nullopt;
+            taken = (int64_t)registers[rs1] < (int64_t)registers[rs2];
+            break;
         case 0x5:
             // bge
-            if ((int64_t)registers[rs1] >= (int64_t)registers[rs2]) {
-                pc = pc + imm - 4;
-            }
-            return std::nullopt;
+            taken = (int64_t)registers[rs1] >= (int64_t)registers[rs2];
+            break;
         case 0x6:
             // bltu
-            if (registers[rs1] < registers[rs2]) {
-                pc = pc + imm - 4;
-            }
-            return std::nullopt;
+            taken = registers[rs1] < registers[rs2];
+            break;
         case 0x7:
             // bgeu
-            if (registers[rs1] >= registers[rs2]) {
-                pc = pc + imm - 4;
-            }
-            return std::nullopt;
+            taken = registers[rs1] >= registers[rs2];
+            break;
         default:
             std::cout << "IllegalInstruction(17): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
+        if (taken) {
+            pc = pc + imm - 4;
+        }
+        record_edge();
+        return;
     }
     case 0x67: {
         // jalr
@@ -535,14 +786,16 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
         uint64_t imm = (int64_t)(int32_t)(instruction & 0xfff00000) >> 20;
         pc = (registers[rs1] + imm) & ~1;
         registers[rd] = temp;
-        return std::nullopt;
+        record_edge();
+        return;
     }
     case 0x6f: {
         // jal
         registers[rd] = pc;
         uint64_t imm = (uint64_t)((int64_t)(int32_t)(instruction & 0x80000000) >> 11) | (instruction & 0xff000) | ((instruction >> 9) & 0x800) | ((instruction >> 20) & 0x7fe);
         pc = pc + imm - 4;
-        return std::nullopt;
+        record_edge();
+        return;
     }
     case 0x73: {
         uint64_t csr_addr = (instruction & 0xfff00000) >> 20;
@@ -553,15 +806,19 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
                 // ecall
                 switch (mode) {
                 case Mode::User:
-                    return Exception(ExceptionType::EnvironmentCallFromUMode);
+                    raise_exception(ExceptionType::EnvironmentCallFromUMode, 0);
                 case Mode::Supervisor:
-                    return Exception(ExceptionType::EnvironmentCallFromSMode);
+                    raise_exception(ExceptionType::EnvironmentCallFromSMode, 0);
                 case Mode::Machine:
-                    return Exception(ExceptionType::EnvironmentCallFromMMode);
+                    raise_exception(ExceptionType::EnvironmentCallFromMMode, 0);
                 }
             } else if (rs2 == 0x1 && funct7 == 0x0) {
                 // ebreak
-                return Exception(ExceptionType::Breakpoint);
+                raise_exception(ExceptionType::Breakpoint, pc - 4);
+            } else if (rs2 == 0x5 && funct7 == 0x8) {
+                // wfi
+                waiting = true;
+                return;
             } else if (rs2 == 0x2) {
                 if (funct7 == 0x8) {
                     // sret
@@ -578,7 +835,7 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
                     store_csr(SSTATUS, load_csr(SSTATUS) | (1 << 5));
                     store_csr(SSTATUS, load_csr(SSTATUS) & ~(1 << 8));
 
-                    return std::nullopt;
+                    return;
                 } else if (funct7 == 0x18) {
                     // mret
                     pc = load_csr(MEPC);
@@ -600,91 +857,122 @@ std::optional<Exception> Cpu::execute(uint32_t instruction) {
                     store_csr(MSTATUS, load_csr(MSTATUS) | (1 << 7));
                     store_csr(MSTATUS, load_csr(MSTATUS) & ~(0b11 << 11));
 
-                    return std::nullopt;
+                    return;
                 } else {
                     std::cout << "IllegalInstruction(18): " << instruction << std::endl;
-                    return Exception(ExceptionType::IllegalInstruction);
+                    raise_exception(ExceptionType::IllegalInstruction, instruction);
                 }
             } else if (funct7 == 0x9) {
                 // sfence.vma
-                return std::nullopt;
+                return;
             } else {
                 std::cout << "IllegalInstruction(19): " << instruction << std::endl;
-                return Exception(ExceptionType::IllegalInstruction);
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
             }
         }
         case 0x1: {
             // csrrw
-            auto temp = load_csr(csr_addr);
+            check_csr_access(csr_addr, true, instruction);
+            auto temp = rd != 0 ? load_csr(csr_addr) : 0;
             store_csr(csr_addr, registers[rs1]);
             registers[rd] = temp;
-            update_paging(csr_addr);
-            return std::nullopt;
+            note_interrupt_enable(csr_addr);
+            return;
         }
         case 0x2: {
             // csrrs
+            check_csr_access(csr_addr, rs1 != 0, instruction);
             auto temp = load_csr(csr_addr);
-            store_csr(csr_addr, temp | registers[rs1]);
+            if (rs1 != 0) {
+                store_csr(csr_addr, temp | registers[rs1]);
+                note_interrupt_enable(csr_addr);
+            }
             registers[rd] = temp;
-            update_paging(csr_addr);
-            return std::nullopt;
+            return;
         }
         case 0x3: {
             // csrrc
+            check_csr_access(csr_addr, rs1 != 0, instruction);
             auto temp = load_csr(csr_addr);
-            store_csr(csr_addr, temp & ~registers[rs1]);
+            if (rs1 != 0) {
+                store_csr(csr_addr, temp & ~registers[rs1]);
+            }
             registers[rd] = temp;
-            update_paging(csr_addr);
-            return std::nullopt;
+            return;
         }
         case 0x5: {
             // csrrwi
             uint64_t zimm = rs1;
-            registers[rd] = load_csr(csr_addr);
+            check_csr_access(csr_addr, true, instruction);
+            auto temp = rd != 0 ? load_csr(csr_addr) : 0;
             store_csr(csr_addr, zimm);
-            update_paging(csr_addr);
-            return std::nullopt;
+            registers[rd] = temp;
+            note_interrupt_enable(csr_addr);
+            return;
         }
         case 0x6: {
             // csrrsi
             uint64_t zimm = rs1;
+            check_csr_access(csr_addr, zimm != 0, instruction);
             auto temp = load_csr(csr_addr);
-            store_csr(csr_addr, temp | zimm);
+            if (zimm != 0) {
+                store_csr(csr_addr, temp | zimm);
+                note_interrupt_enable(csr_addr);
+            }
             registers[rd] = temp;
-            update_paging(csr_addr);
-            return std::nullopt;
+            return;
         }
         case 0x7: {
             // csrrci
             uint64_t zimm = rs1;
+            check_csr_access(csr_addr, zimm != 0, instruction);
             auto temp = load_csr(csr_addr);
-            store_csr(csr_addr, temp & ~zimm);
+            if (zimm != 0) {
+                store_csr(csr_addr, temp & ~zimm);
+            }
             registers[rd] = temp;
-            update_paging(csr_addr);
-            return std::nullopt;
+            return;
         }
         default:
             std::cout << "IllegalInstruction(20): " << instruction << std::endl;
-            return Exception(ExceptionType::IllegalInstruction);
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
         }
     }
     default:
         std::cout << "IllegalInstruction(21): " << instruction << std::endl;
-        return Exception(ExceptionType::IllegalInstruction);
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
     }
 }
 
-void Cpu::take_trap(Trap &trap, bool is_interrupt) {
-    uint64_t exception_pc = pc - 4;
+void Cpu::take_trap(const Trap &trap, bool is_interrupt) {
+    // The ebreak of a debugger breakpoint stops the emulator before the
+    // instruction it replaced, which the guest never sees trap.
+    if (breakpoints != nullptr && !is_interrupt && trap.get_code() == ExceptionType::Breakpoint && breakpoints->trap(translate(pc - 4, AccessType::Instruction))) {
+        setPc(pc - 4);
+        return;
+    }
+    if (sbi != nullptr && !is_interrupt && trap.get_code() == ExceptionType::EnvironmentCallFromSMode) {
+        sbi->call(*this);
+        return;
+    }
+    if (process != nullptr && !is_interrupt) {
+        process->trap(trap);
+        return;
+    }
+    // Interrupts are taken between instructions, so pc already is the next one.
+    uint64_t exception_pc = is_interrupt ? pc : pc - 4;
     Mode previous_mode = mode;
+    idle_progress++;
 
     auto cause = trap.get_code();
+    Metrics::trap(cause, is_interrupt);
 
     if (is_interrupt) {
         cause = ((uint64_t)1 << 63) | cause;
     }
 
-    if (previous_mode <= Mode::Supervisor && ((load_csr(MEDELEG) >> (uint32_t)cause) & 1) != 0) {
+    auto delegation = is_interrupt ? load_csr(MIDELEG) : load_csr(MEDELEG);
+    if (previous_mode <= Mode::Supervisor && ((delegation >> (uint32_t)cause) & 1) != 0) {
         setMode(Mode::Supervisor);
 
         if (is_interrupt) {
@@ -696,7 +984,7 @@ void Cpu::take_trap(Trap &trap, bool is_interrupt) {
 
         store_csr(SEPC, exception_pc & ~1);
         store_csr(SCAUSE, cause);
-        store_csr(STVAL, 0);
+        store_csr(STVAL, trap.get_tval());
 
         store_csr(SSTATUS, ((load_csr(SSTATUS) >> 1) & 1) == 1 ? load_csr(SSTATUS) | (1 << 5) : load_csr(SSTATUS) & ~(1 << 5));
         store_csr(SSTATUS, load_csr(SSTATUS) & ~(1 << 1));
@@ -718,166 +1006,177 @@ void Cpu::take_trap(Trap &trap, bool is_interrupt) {
 
         store_csr(MEPC, exception_pc & ~1);
         store_csr(MCAUSE, cause);
-        store_csr(MTVAL, 0);
+        store_csr(MTVAL, trap.get_tval());
         store_csr(MSTATUS, ((load_csr(MSTATUS) >> 3) & 1) == 1 ? load_csr(MSTATUS) | (1 << 7) : load_csr(MSTATUS) & ~(1 << 7));
         store_csr(MSTATUS, load_csr(MSTATUS) & ~(1 << 3));
-        store_csr(MSTATUS, load_csr(MSTATUS) & ~(0b11 << 11));
+        store_csr(MSTATUS, (load_csr(MSTATUS) & ~(0b11 << 11)) | ((uint64_t)previous_mode << 11));
     }
+    record_edge();
 }
 
 std::optional<Interrupt> Cpu::check_pending_interrupt() {
-    if (
-        (mode == Mode::Machine && ((load_csr(MSTATUS) >> 3) & 1) == 0) ||
-        (mode == Mode::Supervisor && ((load_csr(SSTATUS) >> 1) & 1) == 0)) {
+    if (!interrupt_check_needed) {
         return std::nullopt;
     }
+    interrupt_check_needed = false;
 
     uint64_t irq;
-    if (bus.uart.is_interrupting()) {
+    if (uart->is_interrupting()) {
         irq = UART_IRQ;
-    } else if (bus.virtio.is_interrupting()) {
+    } else if (virtio->is_interrupting()) {
         disk_access();
         irq = VIRTIO_IRQ;
     } else {
         irq = 0;
+        for (auto &[source, is_interrupting] : interrupt_sources) {
+            if (is_interrupting()) {
+                irq = source;
+                break;
+            }
+        }
     }
 
     if (irq != 0) {
+        Metrics::irq(irq);
         store(PLIC_SCLAIM, 4, irq);
-        store_csr(MIP, load_csr(MIP) | MIP_SEIP);
+        mip |= MIP_SEIP;
     }
 
-    auto pending = load_csr(MIE) & load_csr(MIP);
+    // Machine-level interrupts are always enabled below M-mode, supervisor-level
+    // (delegated) ones below S-mode, and both follow the xIE bit in their own mode.
+    auto mstatus = csrs[CsrMstatus];
+    auto machine_enabled = mode != Mode::Machine || ((mstatus >> 3) & 1) == 1;
+    auto supervisor_enabled = mode == Mode::User || (mode == Mode::Supervisor && ((mstatus >> 1) & 1) == 1);
+    auto pending = csrs[CsrMie] & mip;
+    auto delegated = csrs[CsrMideleg];
+    pending = (machine_enabled ? pending & ~delegated : 0) | (supervisor_enabled ? pending & delegated : 0);
 
     if ((pending & MIP_MEIP) != 0) {
-        store_csr(MIP, load_csr(MIP) & ~MIP_MEIP);
+        mip &= ~MIP_MEIP;
         return Interrupt(InterruptType::MachineExternalInterrupt);
     }
     if ((pending & MIP_MSIP) != 0) {
-        store_csr(MIP, load_csr(MIP) & ~MIP_MSIP);
+        mip &= ~MIP_MSIP;
         return Interrupt(InterruptType::MachineSoftwareInterrupt);
     }
     if ((pending & MIP_MTIP) != 0) {
-        store_csr(MIP, load_csr(MIP) & ~MIP_MTIP);
+        // Level-triggered: stays pending until mtimecmp moves past mtime.
         return Interrupt(InterruptType::MachineTimerInterrupt);
     }
     if ((pending & MIP_SEIP) != 0) {
-        store_csr(MIP, load_csr(MIP) & ~MIP_SEIP);
+        mip &= ~MIP_SEIP;
         return Interrupt(InterruptType::SupervisorExternalInterrupt);
     }
     if ((pending & MIP_SSIP) != 0) {
-        store_csr(MIP, load_csr(MIP) & ~MIP_SSIP);
+        mip &= ~MIP_SSIP;
         return Interrupt(InterruptType::SupervisorSoftwareInterrupt);
     }
     if ((pending & MIP_STIP) != 0) {
-        store_csr(MIP, load_csr(MIP) & ~MIP_STIP);
+        if (timer_interrupt != MIP_STIP) {
+            mip &= ~MIP_STIP;
+        }
         return Interrupt(InterruptType::SupervisorTimerInterrupt);
     }
     return std::nullopt;
 }
 
-void Cpu::disk_access() {
-    auto desc_addr = bus.virtio.desc_addr();
-    auto avail_addr = bus.virtio.desc_addr() + 0x40;
-    auto used_addr = bus.virtio.desc_addr() + 4096;
-
-    auto [offset, offset_err] = load(avail_addr + 1, 2);
-    if (offset_err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
-
-    auto [index, index_err] = load(avail_addr + (offset % DESC_NUM) + 2, 2);
-    if (index_err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
+void Cpu::setTimerPending(bool pending) {
+    auto updated = pending ? mip | timer_interrupt : mip & ~timer_interrupt;
+    if (updated != mip) {
+        mip = updated;
+        interrupt_check_needed = true;
     }
+}
 
-    auto desc_addr0 = desc_addr + VRING_DESC_SIZE * index;
-    auto [addr0, addr0_err] = load(desc_addr0, 8);
-    if (addr0_err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
+bool Cpu::hasPendingInterrupt() {
+    return interrupt_check_needed || (csrs[CsrMie] & mip) != 0;
+}
 
-    auto [next0, next_err] = load(desc_addr0 + 14, 2);
-    if (next_err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
+void Cpu::note_interrupt_enable(uint64_t csr_addr) {
+    if (!detect_idle || (csr_addr != SSTATUS && csr_addr != MSTATUS)) {
+        return;
     }
-
-    auto desc_addr1 = desc_addr + VRING_DESC_SIZE * next0;
-
-    auto [addr1, addr1_err] = load(desc_addr1, 8);
-    if (addr1_err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
+    auto enable_bit = mode == Mode::Machine ? 3 : 1;
+    if (mode == Mode::User || ((csrs[CsrMstatus] >> enable_bit) & 1) == 0) {
+        return;
     }
 
-    auto [len1, len1_err] = load(desc_addr1 + 8, 4);
-    if (len1_err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
+    // Busy code re-enables interrupts too (every lock release does), but with
+    // different register contents each time. An idle loop arrives at the same
+    // site in the same state, having done no I/O and taken no trap.
+    auto instruction_pc = pc - 4;
+    uint64_t state = 0xcbf29ce484222325;
+    for (int i = 1; i < 32; i++) {
+        state = (state ^ registers[i]) * 0x100000001b3;
     }
-
-    auto [flags1, flags1_err] = load(desc_addr1 + 12, 2);
-    if (flags1_err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
+    IdleSite *site = nullptr;
+    for (auto &candidate : idle_sites) {
+        if (candidate.pc == instruction_pc) {
+            site = &candidate;
+        }
     }
-
-    auto [blk_sector, blk_sector_err] = load(addr0 + 8, 8);
-    if (blk_sector_err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
+    if (site == nullptr) {
+        site = &idle_sites[idle_next++ % IDLE_SITES];
+        *site = {instruction_pc, state, idle_progress, 0};
+        return;
     }
-
-    if ((flags1 & 2) == 0) {
-        for (uint64_t i = 0; i < len1; i++) {
-            auto [data, data_err] = load(addr1 + i, 1);
-            if (data_err.has_value()) {
-                std::cerr << "error: disk_access()" << std::endl;
-                std::exit(EXIT_FAILURE);
-            }
-            bus.virtio.write_disk(blk_sector * 512 + i, data);
+    if (site->state == state && site->progress == idle_progress) {
+        if (++site->repeats >= IDLE_LOOP_THRESHOLD) {
+            site->repeats = 0;
+            waiting = true;
         }
     } else {
-        for (uint64_t i = 0; i < len1; i++) {
-            auto data = bus.virtio.read_disk(blk_sector * 512 + i);
-            auto data_err = store(addr1 + i, 1, data);
-            if (data_err.has_value()) {
-                std::cerr << "error: disk_access()" << std::endl;
-                std::exit(EXIT_FAILURE);
-            }
-        }
-    }
-
-    auto new_id = bus.virtio.get_new_id();
-    auto err = store(used_addr + 2, 2, new_id % 8);
-    if (err.has_value()) {
-        std::cerr << "error: disk_access()" << std::endl;
-        std::exit(EXIT_FAILURE);
+        site->repeats = 0;
     }
+    site->state = state;
+    site->progress = idle_progress;
 }
 
-void Cpu::update_paging(uint64_t csr_addr) {
-    if (csr_addr != SATP) {
-        return;
-    }
+void Cpu::disk_access() {
+    auto desc_addr = virtio->desc_addr();
+    auto avail_addr = virtio->desc_addr() + 0x40;
+    auto used_addr = virtio->desc_addr() + 4096;
 
-    page_table = (load_csr(SATP) & (((uint64_t)1 << 44) - 1)) * PAGE_SIZE;
+    try {
+        auto offset = load(avail_addr + 1, 2);
+        auto index = load(avail_addr + (offset % DESC_NUM) + 2, 2);
 
-    if ((load_csr(SATP) >> 60) == 8) {
-        enable_paging = true;
-    } else {
-        enable_paging = false;
+        auto desc_addr0 = desc_addr + VRING_DESC_SIZE * index;
+        auto addr0 = load(desc_addr0, 8);
+        auto next0 = load(desc_addr0 + 14, 2);
+
+        auto desc_addr1 = desc_addr + VRING_DESC_SIZE * next0;
+        auto addr1 = load(desc_addr1, 8);
+        auto len1 = load(desc_addr1 + 8, 4);
+        auto flags1 = load(desc_addr1 + 12, 2);
+
+        auto blk_sector = load(addr0 + 8, 8);
+
+        if ((flags1 & 2) == 0) {
+            for (uint64_t i = 0; i < len1; i++) {
+                virtio->write_disk(blk_sector * 512 + i, load(addr1 + i, 1));
+            }
+            Metrics::add(Metric::VirtioBytesWritten, len1);
+        } else {
+            for (uint64_t i = 0; i < len1; i++) {
+                store(addr1 + i, 1, virtio->read_disk(blk_sector * 512 + i));
+            }
+            Metrics::add(Metric::VirtioBytesRead, len1);
+        }
+        Metrics::add(Metric::VirtioRequests);
+
+        auto new_id = virtio->get_new_id();
+        store(used_addr + 2, 2, new_id % 8);
+    } catch (const Exception &) {
+        throw std::runtime_error("disk_access()");
     }
 }
 
-std::pair<uint64_t, std::optional<Exception>> Cpu::translate(uint64_t addr, AccessType access_type) {
+uint64_t Cpu::translate(uint64_t addr, AccessType access_type) {
     if (!enable_paging) {
-        return std::make_pair(addr, std::nullopt);
+        return addr;
     }
+    Metrics::add(Metric::PageWalks);
 
     auto levels = 3;
     uint64_t vpn[] = {
@@ -891,29 +1190,18 @@ std::pair<uint64_t, std::optional<Exception>> Cpu::translate(uint64_t addr, Acce
     uint64_t pte;
 
     while (true) {
-        auto [data, err] = bus.load(a + vpn[i] * 8, 8);
-        if (err.has_value()) {
-            std::cerr << "error: translate()" << std::endl;
-            std::exit(EXIT_FAILURE);
+        try {
+            pte = bus.load(a + vpn[i] * 8, 8);
+        } catch (const Exception &) {
+            throw std::runtime_error("translate()");
         }
-        pte = data;
 
         auto v = pte & 1;
         auto r = (pte >> 1) & 1;
         auto w = (pte >> 2) & 1;
         auto x = (pte >> 3) & 1;
         if (v == 0 || (r == 0 && w == 1)) {
-            switch (access_type) {
-            case AccessType::Instruction:
-                return std::make_pair(0, Exception(ExceptionType::InstructionPageFault));
-            case AccessType::Load:
-                return std::make_pair(0, Exception(ExceptionType::LoadPageFault));
-            case AccessType::Store:
-                return std::make_pair(0, Exception(ExceptionType::StoreAMOPageFault));
-            default:
-                std::cerr << "error: illegal AccessType" << std::endl;
-                std::exit(EXIT_FAILURE);
-            }
+            raise_page_fault(addr, access_type);
         }
 
         if (r == 1 || x == 1) {
@@ -923,17 +1211,7 @@ std::pair<uint64_t, std::optional<Exception>> Cpu::translate(uint64_t addr, Acce
         auto ppn = (pte >> 10) & 0x0fff'ffff'ffff;
         a = ppn * PAGE_SIZE;
         if (i < 0) {
-            switch (access_type) {
-            case AccessType::Instruction:
-                return std::make_pair(0, Exception(ExceptionType::InstructionPageFault));
-            case AccessType::Load:
-                return std::make_pair(0, Exception(ExceptionType::LoadPageFault));
-            case AccessType::Store:
-                return std::make_pair(0, Exception(ExceptionType::StoreAMOPageFault));
-            default:
-                std::cerr << "error: illegal AccessType" << std::endl;
-                std::exit(EXIT_FAILURE);
-            }
+            raise_page_fault(addr, access_type);
         }
     }
 
@@ -942,7 +1220,7 @@ std::pair<uint64_t, std::optional<Exception>> Cpu::translate(uint64_t addr, Acce
     switch (i) {
     case 0: {
         auto ppn = (pte >> 10) & 0x0fff'ffff'ffff;
-        return std::make_pair((ppn << 12) | offset, std::nullopt);
+        return (ppn << 12) | offset;
     }
     case 1:
     case 2: {
@@ -951,19 +1229,67 @@ std::pair<uint64_t, std::optional<Exception>> Cpu::translate(uint64_t addr, Acce
             (pte >> 19) & 0x1ff,
             (pte >> 28) & 0x03ffffff,
         };
-        return std::make_pair((ppn[2] << 30) | (ppn[1] << 21) | (vpn[0] << 12) | offset, std::nullopt);
+        return (ppn[2] << 30) | (ppn[1] << 21) | (vpn[0] << 12) | offset;
     }
     default:
-        switch (access_type) {
-        case AccessType::Instruction:
-            return std::make_pair(0, Exception(ExceptionType::InstructionPageFault));
-        case AccessType::Load:
-            return std::make_pair(0, Exception(ExceptionType::LoadPageFault));
-        case AccessType::Store:
-            return std::make_pair(0, Exception(ExceptionType::StoreAMOPageFault));
-        default:
-            std::cerr << "error: illegal AccessType" << std::endl;
-            std::exit(EXIT_FAILURE);
-        }
+        raise_page_fault(addr, access_type);
     }
 }
+
+Cpu::State Cpu::save_state() {
+    State state;
+    std::memcpy(state.registers, registers, sizeof(registers));
+    state.pc = pc;
+    state.page_table = page_table;
+    state.mip = mip;
+    state.mode = mode;
+    state.enable_paging = enable_paging;
+    state.waiting = waiting;
+    std::memcpy(state.csrs, csrs, sizeof(csrs));
+    state.vstart = vstart;
+    state.vl = vl;
+    state.vtype = vtype;
+    state.vregs.assign(vregs, vregs + sizeof(vregs));
+    state.stall_cycles = stall_cycles;
+    state.mcycle_offset = mcycle_offset;
+    state.minstret_offset = minstret_offset;
+    state.clint = clint->save();
+    state.plic = plic->save();
+    state.uart = uart->save();
+    state.virtio = virtio->save();
+    return state;
+}
+
+void Cpu::restore_state(const State &state) {
+    std::memcpy(registers, state.registers, sizeof(registers));
+    pc = state.pc;
+    page_table = state.page_table;
+    mip = state.mip;
+    mode = state.mode;
+    enable_paging = state.enable_paging;
+    waiting = state.waiting;
+    std::memcpy(csrs, state.csrs, sizeof(csrs));
+    vstart = state.vstart;
+    vl = state.vl;
+    vtype = state.vtype;
+    std::memcpy(vregs, state.vregs.data(), sizeof(vregs));
+    stall_cycles = state.stall_cycles;
+    mcycle_offset = state.mcycle_offset;
+    minstret_offset = state.minstret_offset;
+    clint->restore(state.clint);
+    plic->restore(state.plic);
+    uart->restore(state.uart);
+    virtio->restore(state.virtio);
+    interrupt_check_needed = true;
+    idle_progress++;
+}
+
+void Cpu::track_writes() {
+    bus.memory.track_writes();
+    virtio->track_disk_writes();
+}
+
+void Cpu::roll_back_writes() {
+    bus.memory.roll_back();
+    virtio->roll_back_disk();
+}
@@ -2,16 +2,32 @@
 #define CPU_H
 
 #include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
 #include <vector>
 
+#include "breakpoints.h"
 #include "bus.h"
+#include "cache.h"
+#include "clint.h"
+#include "coverage.h"
+#include "linux_process.h"
+#include "plic.h"
+#include "sbi.h"
+#include "uart.h"
+#include "virtio.h"
 #include "exception.h"
 #include "interrupt.h"
 
 #define PAGE_SIZE 4096
 
+#define MVENDORID 0xf11
+#define MARCHID 0xf12
+#define MIMPID 0xf13
 #define MHARTID 0xf14
 #define MSTATUS 0x300
+#define MISA 0x301
 #define MEDELEG 0x302
 #define MIDELEG 0x303
 #define MIE 0x304
@@ -22,6 +38,10 @@
 #define MCAUSE 0x342
 #define MTVAL 0x343
 #define MIP 0x344
+#define PMPCFG0 0x3a0
+#define PMPADDR0 0x3b0
+#define MCYCLE 0xb00
+#define MINSTRET 0xb02
 
 #define MIP_SSIP (1 << 1)
 #define MIP_MSIP (1 << 3)
@@ -33,6 +53,7 @@
 #define SSTATUS 0x100
 #define SIE 0x104
 #define STVEC 0x105
+#define SCOUNTEREN 0x106
 #define SSCRATCH 0x140
 #define SEPC 0x141
 #define SCAUSE 0x142
@@ -40,6 +61,27 @@
 #define SIP 0x144
 #define SATP 0x180
 
+#define CYCLE 0xc00
+#define TIME 0xc01
+#define INSTRET 0xc02
+
+#define VSTART 0x008
+#define VXSAT 0x009
+#define VXRM 0x00a
+#define VCSR 0x00f
+#define VL 0xc20
+#define VTYPE 0xc21
+#define VLENB 0xc22
+
+#define VLEN 256
+#define VLEN_BYTES (VLEN / 8)
+#define VTYPE_VILL ((uint64_t)1 << 63)
+
+// Iterations of an idle loop before the hart is treated as waiting.
+#define IDLE_LOOP_THRESHOLD 8
+// Interrupt-enable sites tracked at once by the idle-loop detector.
+#define IDLE_SITES 4
+
 enum Mode {
     User = 0b00,
     Supervisor = 0b01,
@@ -52,33 +94,245 @@ enum AccessType {
     Store,
 };
 
+// Storage slots of the implemented CSRs, in the order of Cpu::csr_descriptors.
+enum CsrSlot {
+    CsrMvendorid,
+    CsrMarchid,
+    CsrMimpid,
+    CsrMhartid,
+    CsrMstatus,
+    CsrMisa,
+    CsrMedeleg,
+    CsrMideleg,
+    CsrMie,
+    CsrMtvec,
+    CsrMcounteren,
+    CsrMscratch,
+    CsrMepc,
+    CsrMcause,
+    CsrMtval,
+    CsrMip,
+    CsrPmpcfg0,
+    CsrPmpaddr0,
+    CsrMcycle,
+    CsrMinstret,
+    CsrSstatus,
+    CsrSie,
+    CsrStvec,
+    CsrScounteren,
+    CsrSscratch,
+    CsrSepc,
+    CsrScause,
+    CsrStval,
+    CsrSip,
+    CsrSatp,
+    CsrCycle,
+    CsrTime,
+    CsrInstret,
+    CsrVstart,
+    CsrVxsat,
+    CsrVxrm,
+    CsrVcsr,
+    CsrVl,
+    CsrVtype,
+    CsrVlenb,
+    CsrSlotCount,
+};
+
 class Cpu {
 private:
-    uint64_t registers[32];
-    uint64_t csrs[4096];
+    // Hot architectural state, packed at the start of the object so the interpreter
+    // touches as few cache lines as possible.
+    alignas(64) uint64_t registers[32];
     uint64_t pc;
+    uint64_t page_table;
+    uint64_t mip;
     Mode mode;
-    Bus bus;
     bool enable_paging;
-    uint64_t page_table;
+    // Set by anything that can change which interrupts are pending or enabled
+    // (CSR writes, MMIO, device and timer events); check_pending_interrupt()
+    // does nothing while it is clear.
+    bool interrupt_check_needed;
+    // Set by wfi or a detected idle loop until the emulator resumes the hart.
+    bool waiting;
+    // The mip bit driven by mtime >= mtimecmp: MTIP, or STIP under the host SBI.
+    uint64_t timer_interrupt;
+    // Serves ecalls from S-mode when set.
+    Sbi *sbi;
+    // Handles every exception, in place of a guest kernel, when set.
+    LinuxProcess *process;
+    // Edge coverage, fed at branches, jumps and traps when set.
+    Coverage *coverage;
+    // Debugger breakpoints and watchpoints; nullptr while none are set.
+    Breakpoints *breakpoints;
+    void record_edge() {
+        if (coverage != nullptr) {
+            coverage->edge(pc, mode);
+        }
+    };
+
+    uint64_t csrs[CsrSlotCount];
+    uint64_t vstart;
+    uint64_t vl;
+    uint64_t vtype;
+    alignas(64) uint8_t vregs[32 * VLEN_BYTES];
+    Bus bus;
+    CLINT *clint;
+    PLIC *plic;
+    Uart *uart;
+    Virtio *virtio;
+    // Devices attached after construction that interrupt through the PLIC:
+    // irq and whether the device has raised it since last asked.
+    std::vector<std::pair<uint64_t, std::function<bool()>>> interrupt_sources;
+    // Counters: instructions retired, owned by the emulator, plus the cycles
+    // beyond one per instruction charged by the timing model.
+    const uint64_t *retired;
+    uint64_t stall_cycles;
+    uint64_t mcycle_offset;
+    uint64_t minstret_offset;
+    uint64_t retired_count() { return retired != nullptr ? *retired : 0; };
+#ifdef CACHE_SIM
+    // Optional cache model fed with every RAM fetch, load and store.
+    CacheHierarchy *caches;
+#endif
+
+    // Idle-loop detection: a loop that keeps re-enabling interrupts at the same
+    // pc and in the same register state, with no trap or MMIO in between, is
+    // only waiting for an interrupt.
+    struct IdleSite {
+        uint64_t pc;
+        uint64_t state;
+        uint64_t progress;
+        uint64_t repeats;
+    };
+    bool detect_idle;
+    // Counts traps and MMIO accesses.
+    uint64_t idle_progress;
+    IdleSite idle_sites[IDLE_SITES];
+    uint64_t idle_next;
+    void note_interrupt_enable(uint64_t csr_addr);
+
+    struct CsrDescriptor {
+        uint16_t addr;
+        // WARL: bits outside the mask keep their value on writes.
+        uint64_t write_mask;
+        uint64_t reset_value;
+        // Side-effect hooks; nullptr means plain storage in csrs[slot].
+        uint64_t (Cpu::*read)();
+        void (Cpu::*write)(uint64_t value);
+    };
+    static const CsrDescriptor csr_descriptors[CsrSlotCount];
+    static int csr_slot(uint64_t addr);
+    void check_csr_access(uint64_t addr, bool is_write, uint32_t instruction);
+    uint64_t read_sstatus();
+    void write_sstatus(uint64_t value);
+    uint64_t read_sie();
+    void write_sie(uint64_t value);
+    uint64_t read_sip();
+    void write_sip(uint64_t value);
+    uint64_t read_mip();
+    void write_mip(uint64_t value);
+    void write_satp(uint64_t value);
+    uint64_t read_mcycle();
+    void write_mcycle(uint64_t value);
+    uint64_t read_minstret();
+    void write_minstret(uint64_t value);
+    uint64_t read_time();
+    uint64_t read_vstart();
+    void write_vstart(uint64_t value);
+    uint64_t read_vcsr();
+    void write_vcsr(uint64_t value);
+    uint64_t read_vl();
+    uint64_t read_vtype();
+    uint64_t read_vlenb();
+
+    uint64_t vreg_get(uint64_t reg, uint64_t i, uint64_t eew);
+    void vreg_set(uint64_t reg, uint64_t i, uint64_t eew, uint64_t value);
+    bool vmask_get(uint64_t reg, uint64_t i);
+    void vmask_set(uint64_t reg, uint64_t i, bool value);
+    void vector_transfer(uint64_t addr, uint8_t *buffer, uint64_t nBytes, AccessType access_type, uint64_t &done);
+    void execute_vsetvl(uint32_t instruction);
+    void execute_vector_memory(uint32_t instruction, bool is_store);
+    void execute_vector_integer(uint32_t instruction);
+    void execute_vector_mask(uint32_t instruction);
+    void execute_vector_float(uint32_t instruction);
 
 public:
-    Cpu(std::vector<uint8_t> bytes, std::vector<uint8_t> disk_image);
-    std::pair<uint64_t, std::optional<Exception>> load(uint64_t addr, int nBytes);
-    std::optional<Exception> store(uint64_t addr, int nBytes, uint64_t value);
+    // Everything a snapshot restores besides RAM and disk contents.
+    struct State {
+        uint64_t registers[32];
+        uint64_t pc;
+        uint64_t page_table;
+        uint64_t mip;
+        Mode mode;
+        bool enable_paging;
+        bool waiting;
+        uint64_t csrs[CsrSlotCount];
+        uint64_t vstart;
+        uint64_t vl;
+        uint64_t vtype;
+        std::vector<uint8_t> vregs;
+        uint64_t stall_cycles;
+        uint64_t mcycle_offset;
+        uint64_t minstret_offset;
+        CLINT::State clint;
+        PLIC::State plic;
+        Uart::State uart;
+        Virtio::State virtio;
+    };
+
+    // The binary is copied into RAM at MEMORY_BASE; the disk image is taken over.
+    Cpu(const Buffer &binary, Buffer disk_image);
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
     uint64_t load_csr(uint64_t addr);
     void store_csr(uint64_t addr, uint64_t value);
-    std::pair<uint32_t, std::optional<Exception>> fetch();
-    std::optional<Exception> execute(uint32_t instruction);
-    void take_trap(Trap &trap, bool is_interrupt);
+    uint32_t fetch();
+    void execute(uint32_t instruction);
+    void execute_vector(uint32_t instruction);
+    void take_trap(const Trap &trap, bool is_interrupt);
     std::optional<Interrupt> check_pending_interrupt();
     void disk_access();
-    void update_paging(uint64_t csr_addr);
-    std::pair<uint64_t, std::optional<Exception>> translate(uint64_t addr, AccessType access_type);
+    uint64_t translate(uint64_t addr, AccessType access_type);
+    uint64_t getRegister(int index) { return registers[index & 0x1f]; };
+    void setRegister(int index, uint64_t value) { registers[index & 0x1f] = value; };
+    // For translated code, which reads x0 as zero itself.
+    uint64_t *getRegisterFile() { return registers; };
     uint64_t getPc() { return pc; };
     void setPc(uint64_t pc) { this->pc = pc; };
     Mode getMode() { return mode; };
     void setMode(Mode mode) { this->mode = mode; };
+    Bus &getBus() { return bus; };
+    CLINT &getClint() { return *clint; };
+    Uart &getUart() { return *uart; };
+    bool isWaiting() { return waiting; };
+    void setWaiting(bool waiting) { this->waiting = waiting; };
+    void setIdleDetection(bool enabled) { detect_idle = enabled; };
+    void setInstretCounter(const uint64_t *retired) { this->retired = retired; };
+    void addStallCycles(uint64_t cycles) { stall_cycles += cycles; };
+#ifdef CACHE_SIM
+    void setCaches(CacheHierarchy *caches) { this->caches = caches; };
+#endif
+    void setSbi(Sbi *sbi) { this->sbi = sbi; };
+    void setProcess(LinuxProcess *process) { this->process = process; };
+    void setCoverage(Coverage *coverage) { this->coverage = coverage; };
+    void setBreakpoints(Breakpoints *breakpoints) { this->breakpoints = breakpoints; };
+    // Level of the timer interrupt, driven by the emulator from mtime.
+    void setTimerPending(bool pending);
+    uint64_t getTimerInterrupt() { return timer_interrupt; };
+    void setTimerInterrupt(uint64_t bit) { timer_interrupt = bit; };
+    void requestInterruptCheck() { interrupt_check_needed = true; };
+    // Claims irq in the PLIC whenever is_interrupting() returns true, which it
+    // is asked after MMIO and other interrupt checks, below the UART and disk.
+    void addInterruptSource(uint64_t irq, std::function<bool()> is_interrupting) { interrupt_sources.emplace_back(irq, is_interrupting); };
+    // True if an interrupt enabled in mie is or may be pending, which ends a wfi.
+    bool hasPendingInterrupt();
+    State save_state();
+    void restore_state(const State &state);
+    // Takes the current RAM and disk contents as a snapshot and tracks writes to them.
+    void track_writes();
+    // Returns RAM and disk to the snapshot, copying back only what was written since.
+    void roll_back_writes();
 };
 
 #endif
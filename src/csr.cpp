@@ -0,0 +1,227 @@
+#include <array>
+#include <cstdint>
+#include <iostream>
+
+#include "cpu.h"
+
+#define MSTATUS_SIE ((uint64_t)1 << 1)
+#define MSTATUS_MIE ((uint64_t)1 << 3)
+#define MSTATUS_SPIE ((uint64_t)1 << 5)
+#define MSTATUS_MPIE ((uint64_t)1 << 7)
+#define MSTATUS_SPP ((uint64_t)1 << 8)
+#define MSTATUS_VS ((uint64_t)0b11 << 9)
+#define MSTATUS_MPP ((uint64_t)0b11 << 11)
+#define MSTATUS_FS ((uint64_t)0b11 << 13)
+#define MSTATUS_MPRV ((uint64_t)1 << 17)
+#define MSTATUS_SUM ((uint64_t)1 << 18)
+#define MSTATUS_MXR ((uint64_t)1 << 19)
+#define MSTATUS_TVM ((uint64_t)1 << 20)
+#define MSTATUS_TW ((uint64_t)1 << 21)
+#define MSTATUS_TSR ((uint64_t)1 << 22)
+#define MSTATUS_UXL ((uint64_t)0b11 << 32)
+#define MSTATUS_SXL ((uint64_t)0b11 << 34)
+
+#define SSTATUS_MASK (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_VS | MSTATUS_FS | MSTATUS_SUM | MSTATUS_MXR | MSTATUS_UXL)
+#define SSTATUS_WRITE_MASK (SSTATUS_MASK & ~MSTATUS_UXL)
+#define MSTATUS_WRITE_MASK (SSTATUS_WRITE_MASK | MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPP | MSTATUS_MPRV | MSTATUS_TVM | MSTATUS_TW | MSTATUS_TSR)
+// UXL and SXL are read-only 2 (XLEN=64).
+#define MSTATUS_RESET (((uint64_t)2 << 32) | ((uint64_t)2 << 34))
+
+#define MISA_RESET (((uint64_t)2 << 62) | (1 << 0) | (1 << 8) | (1 << 12) | (1 << 18) | (1 << 20) | (1 << 21))
+
+#define SUPERVISOR_INTERRUPTS (MIP_SSIP | MIP_STIP | MIP_SEIP)
+#define DELEGABLE_EXCEPTIONS 0xb3ff
+
+const Cpu::CsrDescriptor Cpu::csr_descriptors[CsrSlotCount] = {
+    {MVENDORID, 0, 0, nullptr, nullptr},
+    {MARCHID, 0, 0, nullptr, nullptr},
+    {MIMPID, 0, 0, nullptr, nullptr},
+    {MHARTID, 0, 0, nullptr, nullptr},
+    {MSTATUS, MSTATUS_WRITE_MASK, MSTATUS_RESET, nullptr, nullptr},
+    {MISA, 0, MISA_RESET, nullptr, nullptr},
+    {MEDELEG, DELEGABLE_EXCEPTIONS, 0, nullptr, nullptr},
+    {MIDELEG, SUPERVISOR_INTERRUPTS, 0, nullptr, nullptr},
+    {MIE, SUPERVISOR_INTERRUPTS | MIP_MSIP | MIP_MTIP | MIP_MEIP, 0, nullptr, nullptr},
+    {MTVEC, ~(uint64_t)0b10, 0, nullptr, nullptr},
+    {MCOUNTEREN, 0xffffffff, 0, nullptr, nullptr},
+    {MSCRATCH, UINT64_MAX, 0, nullptr, nullptr},
+    {MEPC, ~(uint64_t)0b11, 0, nullptr, nullptr},
+    {MCAUSE, UINT64_MAX, 0, nullptr, nullptr},
+    {MTVAL, UINT64_MAX, 0, nullptr, nullptr},
+    {MIP, SUPERVISOR_INTERRUPTS, 0, &Cpu::read_mip, &Cpu::write_mip},
+    {PMPCFG0, UINT64_MAX, 0, nullptr, nullptr},
+    {PMPADDR0, ((uint64_t)1 << 54) - 1, 0, nullptr, nullptr},
+    {MCYCLE, UINT64_MAX, 0, &Cpu::read_mcycle, &Cpu::write_mcycle},
+    {MINSTRET, UINT64_MAX, 0, &Cpu::read_minstret, &Cpu::write_minstret},
+    {SSTATUS, SSTATUS_WRITE_MASK, 0, &Cpu::read_sstatus, &Cpu::write_sstatus},
+    {SIE, SUPERVISOR_INTERRUPTS, 0, &Cpu::read_sie, &Cpu::write_sie},
+    {STVEC, ~(uint64_t)0b10, 0, nullptr, nullptr},
+    {SCOUNTEREN, 0xffffffff, 0, nullptr, nullptr},
+    {SSCRATCH, UINT64_MAX, 0, nullptr, nullptr},
+    {SEPC, ~(uint64_t)0b11, 0, nullptr, nullptr},
+    {SCAUSE, UINT64_MAX, 0, nullptr, nullptr},
+    {STVAL, UINT64_MAX, 0, nullptr, nullptr},
+    {SIP, MIP_SSIP, 0, &Cpu::read_sip, &Cpu::write_sip},
+    {SATP, UINT64_MAX, 0, nullptr, &Cpu::write_satp},
+    {CYCLE, 0, 0, &Cpu::read_mcycle, nullptr},
+    {TIME, 0, 0, &Cpu::read_time, nullptr},
+    {INSTRET, 0, 0, &Cpu::read_minstret, nullptr},
+    {VSTART, VLEN - 1, 0, &Cpu::read_vstart, &Cpu::write_vstart},
+    {VXSAT, 0b1, 0, nullptr, nullptr},
+    {VXRM, 0b11, 0, nullptr, nullptr},
+    {VCSR, 0b111, 0, &Cpu::read_vcsr, &Cpu::write_vcsr},
+    {VL, 0, 0, &Cpu::read_vl, nullptr},
+    {VTYPE, 0, 0, &Cpu::read_vtype, nullptr},
+    {VLENB, 0, 0, &Cpu::read_vlenb, nullptr},
+};
+
+int Cpu::csr_slot(uint64_t addr) {
+    // Shared by every hart: maps the 12-bit CSR space onto the compact slot array.
+    static const auto slots = [] {
+        std::array<uint8_t, 4096> table;
+        table.fill(UINT8_MAX);
+        for (int i = 0; i < CsrSlotCount; i++) {
+            table[csr_descriptors[i].addr] = i;
+        }
+        return table;
+    }();
+    auto slot = slots[addr & 0xfff];
+    return slot == UINT8_MAX ? -1 : slot;
+}
+
+void Cpu::check_csr_access(uint64_t addr, bool is_write, uint32_t instruction) {
+    auto min_mode = (addr >> 8) & 0b11;
+    auto read_only = ((addr >> 10) & 0b11) == 0b11;
+    // cycle, time and instret are visible below M-mode only if mcounteren
+    // (and for U-mode also scounteren) enables them.
+    auto counter_disabled = false;
+    if (addr >= CYCLE && addr <= INSTRET) {
+        auto bit = (uint64_t)1 << (addr - CYCLE);
+        counter_disabled = (mode != Mode::Machine && (csrs[CsrMcounteren] & bit) == 0) ||
+                           (mode == Mode::User && (csrs[CsrScounteren] & bit) == 0);
+    }
+    if (csr_slot(addr) < 0 || (uint64_t)mode < min_mode || (is_write && read_only) || counter_disabled) {
+        std::cout << "IllegalInstruction(47): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+}
+
+uint64_t Cpu::load_csr(uint64_t addr) {
+    auto slot = csr_slot(addr);
+    if (slot < 0) {
+        return 0;
+    }
+    auto &descriptor = csr_descriptors[slot];
+    if (descriptor.read != nullptr) {
+        return (this->*descriptor.read)();
+    }
+    return csrs[slot];
+}
+
+void Cpu::store_csr(uint64_t addr, uint64_t value) {
+    interrupt_check_needed = true;
+    auto slot = csr_slot(addr);
+    if (slot < 0) {
+        return;
+    }
+    auto &descriptor = csr_descriptors[slot];
+    if (descriptor.write != nullptr) {
+        (this->*descriptor.write)(value);
+        return;
+    }
+    csrs[slot] = (csrs[slot] & ~descriptor.write_mask) | (value & descriptor.write_mask);
+}
+
+uint64_t Cpu::read_sstatus() {
+    return csrs[CsrMstatus] & SSTATUS_MASK;
+}
+
+void Cpu::write_sstatus(uint64_t value) {
+    csrs[CsrMstatus] = (csrs[CsrMstatus] & ~SSTATUS_WRITE_MASK) | (value & SSTATUS_WRITE_MASK);
+}
+
+uint64_t Cpu::read_sie() {
+    return csrs[CsrMie] & csrs[CsrMideleg];
+}
+
+void Cpu::write_sie(uint64_t value) {
+    csrs[CsrMie] = (csrs[CsrMie] & ~csrs[CsrMideleg]) | (value & csrs[CsrMideleg]);
+}
+
+uint64_t Cpu::read_sip() {
+    return mip & csrs[CsrMideleg];
+}
+
+void Cpu::write_sip(uint64_t value) {
+    auto mask = csrs[CsrMideleg] & MIP_SSIP;
+    mip = (mip & ~mask) | (value & mask);
+}
+
+uint64_t Cpu::read_mip() {
+    return mip;
+}
+
+void Cpu::write_mip(uint64_t value) {
+    mip = (mip & ~SUPERVISOR_INTERRUPTS) | (value & SUPERVISOR_INTERRUPTS);
+}
+
+void Cpu::write_satp(uint64_t value) {
+    auto satp_mode = value >> 60;
+    if (satp_mode != 0 && satp_mode != 8) {
+        // Unsupported modes leave satp unchanged.
+        return;
+    }
+    csrs[CsrSatp] = value;
+    page_table = (value & (((uint64_t)1 << 44) - 1)) * PAGE_SIZE;
+    enable_paging = satp_mode == 8;
+}
+
+// mcycle is one cycle per retired instruction plus the timing model's stalls.
+uint64_t Cpu::read_mcycle() {
+    return retired_count() + stall_cycles + mcycle_offset;
+}
+
+void Cpu::write_mcycle(uint64_t value) {
+    mcycle_offset = value - (retired_count() + stall_cycles);
+}
+
+uint64_t Cpu::read_minstret() {
+    return retired_count() + minstret_offset;
+}
+
+void Cpu::write_minstret(uint64_t value) {
+    minstret_offset = value - retired_count();
+}
+
+uint64_t Cpu::read_time() {
+    return clint->get_mtime();
+}
+
+uint64_t Cpu::read_vstart() {
+    return vstart;
+}
+
+void Cpu::write_vstart(uint64_t value) {
+    vstart = value & (VLEN - 1);
+}
+
+uint64_t Cpu::read_vcsr() {
+    return (csrs[CsrVxrm] << 1) | csrs[CsrVxsat];
+}
+
+void Cpu::write_vcsr(uint64_t value) {
+    csrs[CsrVxsat] = value & 0b1;
+    csrs[CsrVxrm] = (value >> 1) & 0b11;
+}
+
+uint64_t Cpu::read_vl() {
+    return vl;
+}
+
+uint64_t Cpu::read_vtype() {
+    return vtype;
+}
+
+uint64_t Cpu::read_vlenb() {
+    return VLEN_BYTES;
+}
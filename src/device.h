@@ -1,15 +1,17 @@
 #ifndef DEVICE_H
 #define DEVICE_H
 
-#include <optional>
-#include <utility>
+#include <cstdint>
 
 #include "exception.h"
 
 class Device {
 public:
-    virtual std::pair<uint64_t, std::optional<Exception>> load(uint64_t addr, int nBytes) = 0;
-    virtual std::optional<Exception> store(uint64_t addr, int nBytes, uint64_t value) = 0;
+    virtual ~Device() = default;
+    // Labels the device in metrics; must outlive the device.
+    virtual const char *get_name() { return "device"; };
+    virtual uint64_t load(uint64_t addr, int nBytes) = 0;
+    virtual void store(uint64_t addr, int nBytes, uint64_t value) = 0;
 };
 
 #endif
@@ -0,0 +1,114 @@
+#include "device_tree.h"
+
+#include <stdexcept>
+
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_VERSION 17
+#define FDT_LAST_COMPATIBLE_VERSION 16
+#define FDT_HEADER_SIZE 40
+// An empty memory reservation map: one all-zero entry.
+#define FDT_RESERVE_MAP_SIZE 16
+
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_END 9
+
+namespace {
+
+void put_be32(std::vector<uint8_t> &out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+} // namespace
+
+DeviceTree::DeviceTree() : structure{},
+                           strings{},
+                           string_offsets{},
+                           depth{0} {
+}
+
+void DeviceTree::token(uint32_t value) {
+    put_be32(structure, value);
+}
+
+void DeviceTree::pad() {
+    while (structure.size() % 4 != 0) {
+        structure.push_back(0);
+    }
+}
+
+void DeviceTree::begin_node(const std::string &name) {
+    token(FDT_BEGIN_NODE);
+    structure.insert(structure.end(), name.begin(), name.end());
+    structure.push_back(0);
+    pad();
+    depth++;
+}
+
+void DeviceTree::end_node() {
+    token(FDT_END_NODE);
+    depth--;
+}
+
+void DeviceTree::raw_property(const std::string &name, const std::vector<uint8_t> &value) {
+    auto found = string_offsets.find(name);
+    if (found == string_offsets.end()) {
+        found = string_offsets.emplace(name, strings.size()).first;
+        strings.append(name).push_back('\0');
+    }
+    token(FDT_PROP);
+    token(value.size());
+    token(found->second);
+    structure.insert(structure.end(), value.begin(), value.end());
+    pad();
+}
+
+void DeviceTree::property(const std::string &name) {
+    raw_property(name, {});
+}
+
+void DeviceTree::property(const std::string &name, const std::string &value) {
+    std::vector<uint8_t> bytes(value.begin(), value.end());
+    bytes.push_back(0);
+    raw_property(name, bytes);
+}
+
+void DeviceTree::cells(const std::string &name, const std::vector<uint32_t> &values) {
+    std::vector<uint8_t> bytes;
+    for (auto value : values) {
+        put_be32(bytes, value);
+    }
+    raw_property(name, bytes);
+}
+
+std::vector<uint8_t> DeviceTree::finish() {
+    if (depth != 0) {
+        throw std::logic_error("device tree node left open");
+    }
+    token(FDT_END);
+
+    uint32_t structure_offset = FDT_HEADER_SIZE + FDT_RESERVE_MAP_SIZE;
+    uint32_t strings_offset = structure_offset + structure.size();
+    uint32_t total_size = strings_offset + strings.size();
+
+    std::vector<uint8_t> blob;
+    put_be32(blob, FDT_MAGIC);
+    put_be32(blob, total_size);
+    put_be32(blob, structure_offset);
+    put_be32(blob, strings_offset);
+    put_be32(blob, FDT_HEADER_SIZE);
+    put_be32(blob, FDT_VERSION);
+    put_be32(blob, FDT_LAST_COMPATIBLE_VERSION);
+    // Boot hart.
+    put_be32(blob, 0);
+    put_be32(blob, strings.size());
+    put_be32(blob, structure.size());
+    blob.resize(structure_offset, 0);
+    blob.insert(blob.end(), structure.begin(), structure.end());
+    blob.insert(blob.end(), strings.begin(), strings.end());
+    return blob;
+}
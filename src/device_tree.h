@@ -0,0 +1,34 @@
+#ifndef DEVICE_TREE_H
+#define DEVICE_TREE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Builds a flattened device tree blob (DTB, version 17) node by node, in the
+// order nodes and properties appear in the source.
+class DeviceTree {
+private:
+    std::vector<uint8_t> structure;
+    std::string strings;
+    std::map<std::string, uint32_t> string_offsets;
+    int depth;
+    void token(uint32_t value);
+    void pad();
+    void raw_property(const std::string &name, const std::vector<uint8_t> &value);
+
+public:
+    DeviceTree();
+    void begin_node(const std::string &name);
+    void end_node();
+    // An empty property, e.g. "ranges" or "interrupt-controller".
+    void property(const std::string &name);
+    void property(const std::string &name, const std::string &value);
+    // Big-endian cells; a 64-bit address is two of them.
+    void cells(const std::string &name, const std::vector<uint32_t> &values);
+    // Throws std::logic_error if a node is still open.
+    std::vector<uint8_t> finish();
+};
+
+#endif
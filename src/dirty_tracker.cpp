@@ -0,0 +1,48 @@
+#include "dirty_tracker.h"
+
+#include <algorithm>
+#include <cstring>
+
+DirtyTracker::DirtyTracker(int block_shift) : base{nullptr},
+                                              size{0},
+                                              block_shift{block_shift},
+                                              tracking{false},
+                                              dirty{},
+                                              written{},
+                                              slots{},
+                                              saved{} {
+}
+
+void DirtyTracker::start(uint8_t *base, uint64_t size) {
+    this->base = base;
+    this->size = size;
+    auto blocks = (size + (1 << block_shift) - 1) >> block_shift;
+    dirty.assign((blocks + 63) / 64, 0);
+    written.clear();
+    slots.assign(blocks, 0);
+    saved.clear();
+    tracking = true;
+}
+
+void DirtyTracker::save(uint64_t block) {
+    dirty[block / 64] |= (uint64_t)1 << (block % 64);
+    written.push_back(block);
+    if (slots[block] != 0) {
+        return;
+    }
+    auto offset = block << block_shift;
+    auto length = std::min<uint64_t>(1 << block_shift, size - offset);
+    slots[block] = saved.size() / (1 << block_shift) + 1;
+    saved.resize(saved.size() + (1 << block_shift));
+    std::memcpy(saved.data() + (slots[block] - 1) * (1 << block_shift), base + offset, length);
+}
+
+void DirtyTracker::roll_back() {
+    for (auto block : written) {
+        auto offset = block << block_shift;
+        auto length = std::min<uint64_t>(1 << block_shift, size - offset);
+        std::memcpy(base + offset, saved.data() + (slots[block] - 1) * (1 << block_shift), length);
+        dirty[block / 64] &= ~((uint64_t)1 << (block % 64));
+    }
+    written.clear();
+}
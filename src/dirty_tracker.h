@@ -0,0 +1,53 @@
+#ifndef DIRTY_TRACKER_H
+#define DIRTY_TRACKER_H
+
+#include <cstdint>
+#include <vector>
+
+// Rolls a byte array back to a snapshot in time proportional to what changed:
+// once started, the first write to each block saves the block's contents from
+// the snapshot and sets its bit in a dirty bitmap, and roll_back() copies only
+// the dirty blocks back. Saved blocks are kept across roll-backs, so a block
+// is copied out once per snapshot, not once per iteration.
+class DirtyTracker {
+private:
+    uint8_t *base;
+    uint64_t size;
+    int block_shift;
+    bool tracking;
+    std::vector<uint64_t> dirty;
+    std::vector<uint32_t> written;
+    // Per block: 1 + index of its saved copy, or 0.
+    std::vector<uint32_t> slots;
+    std::vector<uint8_t> saved;
+    void save(uint64_t block);
+
+public:
+    DirtyTracker(int block_shift);
+    // Takes [base, base + size) as the snapshot and starts tracking writes to it.
+    void start(uint8_t *base, uint64_t size);
+    // Call before writing the byte at offset.
+    void mark(uint64_t offset) {
+        if (!tracking) {
+            return;
+        }
+        auto block = offset >> block_shift;
+        if (block < slots.size() && ((dirty[block / 64] >> (block % 64)) & 1) == 0) {
+            save(block);
+        }
+    };
+    // Call before writing [offset, offset + nBytes).
+    void mark_range(uint64_t offset, uint64_t nBytes) {
+        if (!tracking || nBytes == 0) {
+            return;
+        }
+        for (auto block = offset >> block_shift; block <= (offset + nBytes - 1) >> block_shift; block++) {
+            mark(block << block_shift);
+        }
+    };
+    void roll_back();
+    // Blocks written since the snapshot or the last roll-back.
+    uint64_t dirty_blocks() const { return written.size(); };
+};
+
+#endif
@@ -0,0 +1,899 @@
+#include "emulator.h"
+#include "device_tree.h"
+#include "metrics.h"
+#include "syscon.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <elf.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#else
+#include <thread>
+#endif
+
+Emulator::Emulator(Buffer binary, Buffer disk_image) : cpu{binary, std::move(disk_image)},
+                                                       halted{false},
+                                                       exit_status{EXIT_SUCCESS},
+                                                       error{},
+                                                       instret{0},
+                                                       attention{0},
+                                                       idle_policy{IdlePolicy::Sleep},
+                                                       stop_requested{false},
+                                                       input_lock{},
+                                                       host_input{},
+                                                       recorder{nullptr},
+                                                       replayer{nullptr},
+                                                       tracer{nullptr},
+                                                       caches{nullptr},
+                                                       timing{nullptr},
+                                                       aot{nullptr},
+                                                       sbi{nullptr},
+                                                       process{nullptr},
+                                                       coverage{nullptr},
+                                                       breakpoints{nullptr},
+                                                       htif{nullptr},
+                                                       shared_directory{nullptr},
+                                                       shared_memory{nullptr},
+                                                       exit_callback{nullptr},
+                                                       snapshot{nullptr} {
+    cpu.getClint().set_clock(&instret);
+    cpu.setInstretCounter(&instret);
+    // A new mtime or mtimecmp moves the timer deadline the run loop is working towards.
+    cpu.getClint().set_listener([this] { attention.store(1, std::memory_order_relaxed); });
+    cpu.getBus().attach_device(SYSCON_BASE, SYSCON_SIZE, std::make_unique<Syscon>([this](int status) { halt(status); }));
+}
+
+namespace {
+
+bool writes_rd(uint32_t instruction) {
+    switch (instruction & 0x7f) {
+    case 0x03:
+    case 0x13:
+    case 0x17:
+    case 0x1b:
+    case 0x2f:
+    case 0x33:
+    case 0x37:
+    case 0x3b:
+    case 0x67:
+    case 0x6f:
+        return true;
+    case 0x57: {
+        auto funct3 = (instruction >> 12) & 0x7;
+        // vsetvl{i}, and vmv.x.s/vcpop.m/vfirst.m in OPMVV
+        return funct3 == 0x7 || (funct3 == 0x2 && (instruction >> 26) == 0x10);
+    }
+    case 0x73:
+        return ((instruction >> 12) & 0x7) != 0;
+    default:
+        return false;
+    }
+}
+
+std::optional<uint64_t> memory_address(uint32_t instruction, uint64_t base) {
+    switch (instruction & 0x7f) {
+    case 0x03:
+        return base + ((int64_t)(int32_t)instruction >> 20);
+    case 0x23:
+        return base + (((int64_t)(int32_t)(instruction & 0xfe000000) >> 20) | ((instruction >> 7) & 0x1f));
+    case 0x07:
+    case 0x27:
+    case 0x2f:
+        return base;
+    default:
+        return std::nullopt;
+    }
+}
+
+#define CPU_INTC_PHANDLE 1
+#define PLIC_PHANDLE 2
+#define SYSCON_PHANDLE 3
+// Interrupt sources the PLIC claims to have.
+#define PLIC_SOURCES 31
+
+std::string node_name(const char *name, uint64_t addr) {
+    std::ostringstream out;
+    out << name << "@" << std::hex << addr;
+    return out.str();
+}
+
+std::vector<uint32_t> reg(uint64_t addr, uint64_t size) {
+    return {(uint32_t)(addr >> 32), (uint32_t)addr, (uint32_t)(size >> 32), (uint32_t)size};
+}
+
+// The board, without devices added by attach_device(), plus the shared
+// directory if there is one and the shared memory if its size is not 0.
+std::vector<uint8_t> board_device_tree(bool shared_directory, uint64_t shared_memory_size) {
+    DeviceTree tree;
+    tree.begin_node("");
+    tree.cells("#address-cells", {2});
+    tree.cells("#size-cells", {2});
+    tree.property("compatible", "riscv-virtio");
+    tree.property("model", "riscv-emulator");
+
+    tree.begin_node("chosen");
+    tree.property("stdout-path", "/soc/" + node_name("serial", UART_BASE));
+    tree.end_node();
+
+    tree.begin_node("cpus");
+    tree.cells("#address-cells", {1});
+    tree.cells("#size-cells", {0});
+    tree.cells("timebase-frequency", {TIMEBASE_FREQUENCY});
+    tree.begin_node("cpu@0");
+    tree.property("device_type", "cpu");
+    tree.cells("reg", {0});
+    tree.property("status", "okay");
+    tree.property("compatible", "riscv");
+    tree.property("riscv,isa", "rv64imav_zba_zbb_zbs");
+    tree.property("mmu-type", "riscv,sv39");
+    tree.begin_node("interrupt-controller");
+    tree.cells("#interrupt-cells", {1});
+    tree.property("interrupt-controller");
+    tree.property("compatible", "riscv,cpu-intc");
+    tree.cells("phandle", {CPU_INTC_PHANDLE});
+    tree.end_node();
+    tree.end_node();
+    tree.end_node();
+
+    tree.begin_node(node_name("memory", MEMORY_BASE));
+    tree.property("device_type", "memory");
+    tree.cells("reg", reg(MEMORY_BASE, MEMORY_SIZE));
+    tree.end_node();
+
+    tree.begin_node("soc");
+    tree.cells("#address-cells", {2});
+    tree.cells("#size-cells", {2});
+    tree.property("compatible", "simple-bus");
+    tree.property("ranges");
+
+    tree.begin_node(node_name("test", SYSCON_BASE));
+    tree.property("compatible", std::string("sifive,test1") + '\0' + "sifive,test0" + '\0' + "syscon");
+    tree.cells("reg", reg(SYSCON_BASE, SYSCON_SIZE));
+    tree.cells("phandle", {SYSCON_PHANDLE});
+    tree.end_node();
+
+    tree.begin_node(node_name("clint", CLINT_BASE));
+    tree.property("compatible", "riscv,clint0");
+    tree.cells("reg", reg(CLINT_BASE, CLINT_SIZE));
+    tree.cells("interrupts-extended", {CPU_INTC_PHANDLE, 3, CPU_INTC_PHANDLE, 7});
+    tree.end_node();
+
+    tree.begin_node(node_name("plic", PLIC_BASE));
+    tree.property("compatible", "riscv,plic0");
+    tree.cells("reg", reg(PLIC_BASE, PLIC_SIZE));
+    tree.cells("#address-cells", {0});
+    tree.cells("#interrupt-cells", {1});
+    tree.property("interrupt-controller");
+    // Context 0 is M-mode, context 1 S-mode.
+    tree.cells("interrupts-extended", {CPU_INTC_PHANDLE, 11, CPU_INTC_PHANDLE, 9});
+    tree.cells("riscv,ndev", {PLIC_SOURCES});
+    tree.cells("phandle", {PLIC_PHANDLE});
+    tree.end_node();
+
+    tree.begin_node(node_name("serial", UART_BASE));
+    tree.property("compatible", "ns16550a");
+    tree.cells("reg", reg(UART_BASE, UART_SIZE));
+    tree.cells("clock-frequency", {3686400});
+    tree.cells("interrupt-parent", {PLIC_PHANDLE});
+    tree.cells("interrupts", {(uint32_t)UART_IRQ});
+    tree.end_node();
+
+    tree.begin_node(node_name("virtio_mmio", VIRTIO_BASE));
+    tree.property("compatible", "virtio,mmio");
+    tree.cells("reg", reg(VIRTIO_BASE, VIRTIO_SIZE));
+    tree.cells("interrupt-parent", {PLIC_PHANDLE});
+    tree.cells("interrupts", {VIRTIO_IRQ});
+    tree.end_node();
+
+    if (shared_directory) {
+        tree.begin_node(node_name("virtio_mmio", VIRTIO_9P_BASE));
+        tree.property("compatible", "virtio,mmio");
+        tree.cells("reg", reg(VIRTIO_9P_BASE, VIRTIO_9P_SIZE));
+        tree.cells("interrupt-parent", {PLIC_PHANDLE});
+        tree.cells("interrupts", {VIRTIO_9P_IRQ});
+        tree.end_node();
+    }
+
+    if (shared_memory_size != 0) {
+        // The registers, then the region.
+        auto regs = reg(SHMEM_BASE, SHMEM_SIZE);
+        auto region = reg(SHMEM_MEMORY_BASE, shared_memory_size);
+        regs.insert(regs.end(), region.begin(), region.end());
+        tree.begin_node(node_name("shmem", SHMEM_BASE));
+        tree.property("compatible", "riscv-emulator,shmem");
+        tree.cells("reg", regs);
+        tree.cells("interrupt-parent", {PLIC_PHANDLE});
+        tree.cells("interrupts", {SHMEM_IRQ});
+        tree.end_node();
+    }
+
+    tree.end_node();
+
+    tree.begin_node("poweroff");
+    tree.property("compatible", "syscon-poweroff");
+    tree.cells("regmap", {SYSCON_PHANDLE});
+    tree.cells("offset", {0});
+    tree.cells("value", {SYSCON_PASS});
+    tree.end_node();
+
+    tree.begin_node("reboot");
+    tree.property("compatible", "syscon-reboot");
+    tree.cells("regmap", {SYSCON_PHANDLE});
+    tree.cells("offset", {0});
+    tree.cells("value", {SYSCON_RESET});
+    tree.end_node();
+    tree.end_node();
+    return tree.finish();
+}
+
+uint64_t aot_load(void *cpu, uint64_t addr, int nBytes) {
+    return static_cast<Cpu *>(cpu)->load(addr, nBytes);
+}
+
+void aot_store(void *cpu, uint64_t addr, int nBytes, uint64_t value) {
+    static_cast<Cpu *>(cpu)->store(addr, nBytes, value);
+}
+
+} // namespace
+
+template <bool Traced, bool Timed>
+void Emulator::step() {
+    auto pc = cpu.getPc();
+    [[maybe_unused]] auto user = cpu.getMode() == Mode::User;
+    [[maybe_unused]] uint32_t word = 0;
+    [[maybe_unused]] auto trapped = false;
+    [[maybe_unused]] uint64_t l1_misses = 0;
+    [[maybe_unused]] uint64_t l2_misses = 0;
+    if constexpr (Timed) {
+        if (caches) {
+            l1_misses = caches->l1_misses();
+            l2_misses = caches->l2_misses();
+        }
+    }
+    TraceRecord record;
+    if constexpr (Traced) {
+        record.flags = 0;
+        record.pc = pc;
+        record.instruction = 0;
+    }
+    try {
+        auto instruction = cpu.fetch();
+        if constexpr (Timed) {
+            word = instruction;
+        }
+        if constexpr (Traced) {
+            record.instruction = instruction;
+            auto addr = memory_address(instruction, cpu.getRegister((instruction >> 15) & 0x1f));
+            if (addr.has_value()) {
+                record.flags |= TRACE_MEMORY;
+                record.memory_addr = addr.value();
+            }
+        }
+        cpu.setPc(pc + 4);
+        cpu.execute(instruction);
+        if constexpr (Traced) {
+            record.rd = (instruction >> 7) & 0x1f;
+            if (record.rd != 0 && writes_rd(instruction)) {
+                record.flags |= TRACE_RD;
+                record.rd_value = cpu.getRegister(record.rd);
+            }
+        }
+    } catch (const Exception &exception) {
+        // Rewind in case the instruction redirected pc before trapping.
+        cpu.setPc(pc + 4);
+        cpu.take_trap(exception, false);
+        if constexpr (Timed) {
+            trapped = true;
+        }
+        if constexpr (Traced) {
+            record.flags |= TRACE_EXCEPTION;
+            record.cause = exception.get_code();
+            record.tval = exception.get_tval();
+        }
+        if (exception.is_fatal()) {
+            if constexpr (Traced) {
+                record.mode = cpu.getMode();
+                tracer->append(record);
+            }
+            halt(EXIT_FAILURE);
+            return;
+        }
+    }
+
+    if constexpr (Timed) {
+        if (caches) {
+            l1_misses = caches->l1_misses() - l1_misses;
+            l2_misses = caches->l2_misses() - l2_misses;
+        }
+        cpu.addStallCycles(timing->retire(pc, user, word, cpu.getPc(), trapped, l1_misses, l2_misses) - 1);
+    }
+
+    auto interrupt = cpu.check_pending_interrupt();
+    if (interrupt.has_value()) {
+        if constexpr (Timed) {
+            cpu.addStallCycles(timing->interrupt(cpu.getPc(), cpu.getMode() == Mode::User));
+        }
+        cpu.take_trap(interrupt.value(), true);
+        if constexpr (Traced) {
+            record.flags |= TRACE_INTERRUPT;
+            record.interrupt_cause = interrupt.value().get_code();
+        }
+    }
+    if constexpr (Traced) {
+        record.mode = cpu.getMode();
+        tracer->append(record);
+    }
+}
+
+template <bool Traced, bool Timed>
+void Emulator::run_chunk(uint64_t chunk_end) {
+    auto start = instret;
+    while (!halted && instret < chunk_end && !cpu.isWaiting() && !attention.load(std::memory_order_relaxed)) {
+        step<Traced, Timed>();
+        instret++;
+    }
+    Metrics::add(Metric::InstructionsRetired, instret - start);
+}
+
+void Emulator::run_chunk_translated(uint64_t chunk_end) {
+    auto start = instret;
+    while (!halted && instret < chunk_end && !cpu.isWaiting() && !attention.load(std::memory_order_relaxed)) {
+        auto block = find_block();
+        // A block never runs past the chunk end, so timer deadlines stay exact.
+        if (block != nullptr && block->length <= chunk_end - instret) {
+            run_block(*block);
+        } else {
+            step<false, false>();
+            instret++;
+        }
+    }
+    Metrics::add(Metric::InstructionsRetired, instret - start);
+}
+
+// The translated block at pc, if guest memory still holds its instructions.
+const AotBlock *Emulator::find_block() {
+    auto pc = cpu.getPc();
+    if (!aot->may_contain(pc)) {
+        return nullptr;
+    }
+    uint64_t p_pc;
+    try {
+        p_pc = cpu.translate(pc, AccessType::Instruction);
+    } catch (const Exception &) {
+        // Left to step() to raise.
+        return nullptr;
+    }
+    auto block = aot->find(p_pc);
+    if (block == nullptr) {
+        return nullptr;
+    }
+    auto code = cpu.getBus().view_ram(p_pc, block->length * 4);
+    if (code == nullptr || std::memcmp(code, block->words, block->length * 4) != 0) {
+        return nullptr;
+    }
+    return block;
+}
+
+void Emulator::run_block(const AotBlock &block) {
+    auto pc = cpu.getPc();
+    AotContext context = {cpu.getRegisterFile(), &cpu, aot_load, aot_store, pc, 0};
+    try {
+        block.function(&context);
+        cpu.setPc(context.pc);
+        instret += block.length;
+    } catch (const Exception &exception) {
+        // The instructions before the faulting one retired; it traps as in step().
+        cpu.setPc(pc + context.retired * 4 + 4);
+        instret += context.retired + 1;
+        cpu.take_trap(exception, false);
+        if (exception.is_fatal()) {
+            halt(EXIT_FAILURE);
+            return;
+        }
+    }
+
+    auto interrupt = cpu.check_pending_interrupt();
+    if (interrupt.has_value()) {
+        cpu.take_trap(interrupt.value(), true);
+    }
+}
+
+void Emulator::halt(int status) {
+    // The first reason to stop wins, such as a process exit before a fatal trap.
+    if (halted) {
+        return;
+    }
+    halted = true;
+    exit_status = status;
+    if (exit_callback) {
+        exit_callback(status);
+    }
+}
+
+StopReason Emulator::run(uint64_t budget) {
+    auto end = budget > UINT64_MAX - instret ? UINT64_MAX : instret + budget;
+    if (breakpoints) {
+        breakpoints->clear_hit();
+    }
+    try {
+        while (!halted && instret < end) {
+            if (attention.load(std::memory_order_relaxed) && service_attention()) {
+                return StopReason::Requested;
+            }
+            if (breakpoints && breakpoints->is_triggered()) {
+                return StopReason::Breakpoint;
+            }
+            auto chunk_end = end;
+            if (replayer) {
+                while (replayer->next_instret() <= instret) {
+                    deliver_input(replayer->pop());
+                }
+                chunk_end = std::min(end, replayer->next_instret());
+            }
+            if (htif) {
+                htif->poll();
+                if (halted) {
+                    break;
+                }
+                chunk_end = std::min(chunk_end, instret + HTIF_INTERVAL);
+            }
+            chunk_end = update_timer(chunk_end);
+            if (cpu.isWaiting()) {
+                idle();
+                continue;
+            }
+            if (tracer && timing) {
+                run_chunk<true, true>(chunk_end);
+            } else if (tracer) {
+                run_chunk<true, false>(chunk_end);
+            } else if (timing) {
+                run_chunk<false, true>(chunk_end);
+            } else if (aot && !caches && !coverage) {
+                run_chunk_translated(chunk_end);
+            } else {
+                run_chunk<false, false>(chunk_end);
+            }
+        }
+    } catch (const std::runtime_error &failure) {
+        error = failure.what();
+        halt(EXIT_FAILURE);
+    }
+    if (halted) {
+        return StopReason::Halted;
+    }
+    // The budget may have ended with the instruction that hit a watchpoint.
+    return breakpoints && breakpoints->is_triggered() ? StopReason::Breakpoint : StopReason::Budget;
+}
+
+// Returns true if the caller asked run() to stop.
+bool Emulator::service_attention() {
+    attention.store(0, std::memory_order_relaxed);
+    if (shared_memory != nullptr && shared_memory->has_incoming()) {
+        cpu.requestInterruptCheck();
+    }
+    {
+        std::lock_guard<std::mutex> guard(input_lock);
+        while (!host_input.empty()) {
+            if (!replayer) {
+                deliver_input({instret, InputEventType::UartRx, host_input.front()});
+            }
+            host_input.pop_front();
+        }
+    }
+    return stop_requested.exchange(false, std::memory_order_relaxed);
+}
+
+void Emulator::deliver_input(const InputEvent &event) {
+    if (recorder) {
+        recorder->record(event);
+    }
+    switch (event.type) {
+    case InputEventType::UartRx:
+        cpu.getUart().receive(event.value);
+        cpu.requestInterruptCheck();
+        return;
+    case InputEventType::IdleSkip:
+        cpu.getClint().advance(event.value);
+        return;
+    default:
+        throw std::runtime_error("unknown input event type " + std::to_string(event.type));
+    }
+}
+
+void Emulator::request_stop() {
+    stop_requested.store(true, std::memory_order_relaxed);
+    notify();
+}
+
+// Async-signal-safe, so request_stop() may be called from a signal handler.
+void Emulator::notify() {
+    attention.store(1, std::memory_order_release);
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&attention), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+// Drives the machine timer level from mtime and returns the chunk end clipped
+// to the instruction count at which mtime reaches mtimecmp.
+uint64_t Emulator::update_timer(uint64_t chunk_end) {
+    auto &clint = cpu.getClint();
+    auto mtime = clint.get_mtime();
+    auto mtimecmp = clint.get_mtimecmp();
+    if (mtime >= mtimecmp) {
+        cpu.setTimerPending(true);
+        return chunk_end;
+    }
+    cpu.setTimerPending(false);
+    return std::min(chunk_end, instret + (mtimecmp - mtime));
+}
+
+void Emulator::idle() {
+    cpu.setWaiting(false);
+    if (cpu.hasPendingInterrupt() || replayer) {
+        // While replaying, idle time comes from the log as IdleSkip events.
+        return;
+    }
+
+    auto &clint = cpu.getClint();
+    auto deadline = UINT64_MAX;
+    if ((cpu.load_csr(MIE) & cpu.getTimerInterrupt()) != 0 && clint.get_mtimecmp() > clint.get_mtime()) {
+        deadline = clint.get_mtimecmp() - clint.get_mtime();
+    }
+
+    uint64_t skipped;
+    if (idle_policy == IdlePolicy::FastForward) {
+        skipped = deadline == UINT64_MAX ? 0 : deadline;
+    } else {
+        skipped = std::min(sleep(deadline), deadline);
+    }
+    skipped = std::min<uint64_t>(skipped, UINT32_MAX);
+    if (skipped != 0) {
+        InputEvent event = {instret, InputEventType::IdleSkip, (uint32_t)skipped};
+        if (recorder) {
+            recorder->record(event);
+        }
+        clint.advance(skipped);
+    }
+}
+
+// Blocks for up to ticks mtime ticks, or until notify(). Returns the ticks that passed.
+uint64_t Emulator::sleep(uint64_t ticks) {
+    auto start = std::chrono::steady_clock::now();
+    auto limit = std::chrono::nanoseconds::max();
+    if (ticks < (uint64_t)limit.count() / (1000000000 / TIMEBASE_FREQUENCY)) {
+        limit = std::chrono::nanoseconds(ticks * (1000000000 / TIMEBASE_FREQUENCY));
+    }
+    while (attention.load(std::memory_order_acquire) == 0) {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed >= limit) {
+            break;
+        }
+#if defined(__linux__)
+        const timespec *timeout = nullptr;
+        timespec remaining;
+        if (limit != std::chrono::nanoseconds::max()) {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(limit - elapsed).count();
+            remaining = {(time_t)(left / 1000000000), (long)(left % 1000000000)};
+            timeout = &remaining;
+        }
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&attention), FUTEX_WAIT_PRIVATE, 0, timeout, nullptr, 0);
+#else
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(limit - elapsed, std::chrono::milliseconds(1)));
+#endif
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return elapsed.count() / (1000000000 / TIMEBASE_FREQUENCY);
+}
+
+uint64_t Emulator::get_register(int index) {
+    return index == 0 ? 0 : cpu.getRegister(index);
+}
+
+void Emulator::set_register(int index, uint64_t value) {
+    if (index != 0) {
+        cpu.setRegister(index, value);
+    }
+}
+
+bool Emulator::read_memory(uint64_t addr, void *buffer, uint64_t nBytes) {
+    auto ram = cpu.getBus().view_ram(addr, nBytes);
+    if (ram == nullptr) {
+        return false;
+    }
+    std::memcpy(buffer, ram, nBytes);
+    if (breakpoints) {
+        breakpoints->unpatch(addr, static_cast<uint8_t *>(buffer), nBytes);
+    }
+    return true;
+}
+
+bool Emulator::write_memory(uint64_t addr, const void *buffer, uint64_t nBytes) {
+    auto ram = cpu.getBus().get_ram_pointer(addr, nBytes);
+    if (ram == nullptr) {
+        return false;
+    }
+    std::memcpy(ram, buffer, nBytes);
+    if (breakpoints) {
+        breakpoints->repatch(addr, ram, nBytes);
+    }
+    return true;
+}
+
+std::optional<uint64_t> Emulator::translate_address(uint64_t addr) {
+    try {
+        return cpu.translate(addr, AccessType::Load);
+    } catch (const Exception &) {
+        return std::nullopt;
+    } catch (const std::runtime_error &) {
+        // The page tables themselves are outside RAM.
+        return std::nullopt;
+    }
+}
+
+Breakpoints &Emulator::get_breakpoints() {
+    if (!breakpoints) {
+        breakpoints = std::make_unique<Breakpoints>(cpu.getBus(), [this] { attention.store(1, std::memory_order_relaxed); });
+    }
+    return *breakpoints;
+}
+
+// Loads and stores only check for watchpoints while something is set.
+void Emulator::update_breakpoints() {
+    cpu.setBreakpoints(get_breakpoints().empty() ? nullptr : breakpoints.get());
+}
+
+bool Emulator::insert_breakpoint(uint64_t p_addr) {
+    auto inserted = get_breakpoints().insert(p_addr);
+    update_breakpoints();
+    return inserted;
+}
+
+bool Emulator::remove_breakpoint(uint64_t p_addr) {
+    auto removed = get_breakpoints().remove(p_addr);
+    update_breakpoints();
+    return removed;
+}
+
+void Emulator::insert_watchpoint(uint64_t addr, uint64_t length, WatchType type) {
+    get_breakpoints().insert_watchpoint(addr, length, type);
+    update_breakpoints();
+}
+
+bool Emulator::remove_watchpoint(uint64_t addr, uint64_t length, WatchType type) {
+    auto removed = get_breakpoints().remove_watchpoint(addr, length, type);
+    update_breakpoints();
+    return removed;
+}
+
+void Emulator::attach_device(uint64_t base, uint64_t size, std::unique_ptr<Device> device) {
+    cpu.getBus().attach_device(base, size, std::move(device));
+}
+
+void Emulator::set_console_output(std::function<void(uint8_t)> callback) {
+    cpu.getUart().set_output(callback);
+}
+
+void Emulator::console_input(uint8_t c) {
+    {
+        std::lock_guard<std::mutex> guard(input_lock);
+        host_input.push_back(c);
+    }
+    notify();
+}
+
+pid_t Emulator::fork_clone() {
+    if (tracer || recorder || replayer) {
+        throw std::runtime_error("cannot clone while tracing, recording or replaying");
+    }
+    std::cout.flush();
+    std::cerr.flush();
+    // Held across fork() so the child never inherits it locked by another thread.
+    std::unique_lock<std::mutex> guard(input_lock);
+    auto pid = fork();
+    if (pid < 0) {
+        throw std::runtime_error(std::string("fork: ") + std::strerror(errno));
+    }
+    if (pid == 0) {
+        host_input.clear();
+        attention.store(0, std::memory_order_relaxed);
+        stop_requested.store(false, std::memory_order_relaxed);
+    }
+    return pid;
+}
+
+void Emulator::trace_to(const std::string &path) {
+    tracer = std::make_unique<TraceWriter>(path);
+}
+
+void Emulator::simulate_caches(const CacheHierarchy::Config &config) {
+#ifdef CACHE_SIM
+    caches = std::make_unique<CacheHierarchy>(config);
+    cpu.setCaches(caches.get());
+#else
+    (void)config;
+    throw std::runtime_error("cache simulation needs a build with -DCACHE_SIM=ON");
+#endif
+}
+
+TimingModel &Emulator::model_timing(const TimingConfig &config) {
+    timing = std::make_unique<TimingModel>(config);
+    return *timing;
+}
+
+void Emulator::boot_supervisor() {
+    sbi = std::make_unique<Sbi>([this](int status) { halt(status); });
+    cpu.setSbi(sbi.get());
+    cpu.setTimerInterrupt(MIP_STIP);
+    // Delegate everything S-mode can handle, like firmware does.
+    cpu.store_csr(MEDELEG, UINT64_MAX & ~((uint64_t)1 << ExceptionType::EnvironmentCallFromSMode));
+    cpu.store_csr(MIDELEG, MIP_SSIP | MIP_STIP | MIP_SEIP);
+    cpu.store_csr(MCOUNTEREN, UINT64_MAX);
+    // No timer interrupt until the kernel asks for one.
+    cpu.getClint().store(CLINT_MTIMECMP, 8, UINT64_MAX);
+
+    auto tree = board_device_tree(shared_directory != nullptr, shared_memory != nullptr ? shared_memory->get_size() : 0);
+    auto tree_addr = (MEMORY_BASE + MEMORY_SIZE - tree.size()) & ~(uint64_t)(PAGE_SIZE - 1);
+    write_memory(tree_addr, tree.data(), tree.size());
+    cpu.setRegister(2, tree_addr);
+    cpu.setRegister(10, 0);
+    cpu.setRegister(11, tree_addr);
+    cpu.setMode(Mode::Supervisor);
+}
+
+void Emulator::share_directory(const std::string &path) {
+    auto &bus = cpu.getBus();
+    shared_directory = bus.attach(VIRTIO_9P_BASE, VIRTIO_9P_SIZE, std::make_unique<Virtio9p>(bus, path));
+    auto device = shared_directory;
+    cpu.addInterruptSource(VIRTIO_9P_IRQ, [device] { return device->is_interrupting(); });
+}
+
+SharedMemory &Emulator::share_memory(uint64_t size) {
+    if (shared_memory != nullptr) {
+        throw std::runtime_error("the guest already has shared memory");
+    }
+    auto &bus = cpu.getBus();
+    auto device = bus.attach(SHMEM_BASE, SHMEM_SIZE, std::make_unique<SharedMemory>(size, [this] { notify(); }));
+    bus.map_ram(SHMEM_MEMORY_BASE, device->get_size(), device->data());
+    cpu.addInterruptSource(SHMEM_IRQ, [device] { return device->is_interrupting(); });
+    shared_memory = device;
+    return *device;
+}
+
+std::map<std::string, uint64_t> Emulator::load_elf(const Buffer &elf) {
+    Elf64_Ehdr header;
+    if (elf.size() < sizeof(header) || std::memcmp(elf.data(), ELFMAG, SELFMAG) != 0) {
+        throw std::runtime_error("not an ELF file");
+    }
+    std::memcpy(&header, elf.data(), sizeof(header));
+    if (header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_machine != EM_RISCV) {
+        throw std::runtime_error("not a RISC-V ELF64 executable");
+    }
+
+    for (int i = 0; i < header.e_phnum; i++) {
+        Elf64_Phdr segment;
+        auto offset = header.e_phoff + (uint64_t)i * header.e_phentsize;
+        if (offset + sizeof(segment) > elf.size()) {
+            throw std::runtime_error("truncated ELF program header");
+        }
+        std::memcpy(&segment, elf.data() + offset, sizeof(segment));
+        if (segment.p_type != PT_LOAD || segment.p_memsz == 0) {
+            continue;
+        }
+        if (segment.p_filesz > elf.size() || segment.p_offset > elf.size() - segment.p_filesz || segment.p_filesz > segment.p_memsz) {
+            throw std::runtime_error("truncated ELF segment");
+        }
+        auto ram = cpu.getBus().get_ram_pointer(segment.p_paddr, segment.p_memsz);
+        if (ram == nullptr) {
+            throw std::runtime_error("ELF segment outside RAM");
+        }
+        std::memcpy(ram, elf.data() + segment.p_offset, segment.p_filesz);
+        std::memset(ram + segment.p_filesz, 0, segment.p_memsz - segment.p_filesz);
+    }
+
+    std::map<std::string, uint64_t> symbols;
+    for (int i = 0; i < header.e_shnum; i++) {
+        Elf64_Shdr table, names;
+        auto offset = header.e_shoff + (uint64_t)i * header.e_shentsize;
+        if (offset + sizeof(table) > elf.size()) {
+            break;
+        }
+        std::memcpy(&table, elf.data() + offset, sizeof(table));
+        auto names_offset = header.e_shoff + (uint64_t)table.sh_link * header.e_shentsize;
+        if (table.sh_type != SHT_SYMTAB || names_offset + sizeof(names) > elf.size()) {
+            continue;
+        }
+        std::memcpy(&names, elf.data() + names_offset, sizeof(names));
+        for (uint64_t at = table.sh_offset; at + sizeof(Elf64_Sym) <= table.sh_offset + table.sh_size && at + sizeof(Elf64_Sym) <= elf.size(); at += sizeof(Elf64_Sym)) {
+            Elf64_Sym symbol;
+            std::memcpy(&symbol, elf.data() + at, sizeof(symbol));
+            auto name = names.sh_offset + symbol.st_name;
+            if (symbol.st_shndx == SHN_UNDEF || symbol.st_name == 0 || name >= elf.size()) {
+                continue;
+            }
+            auto text = reinterpret_cast<const char *>(elf.data() + name);
+            symbols[std::string(text, strnlen(text, elf.size() - name))] = symbol.st_value;
+        }
+    }
+
+    cpu.setPc(header.e_entry);
+    auto tohost = symbols.find("tohost");
+    if (tohost != symbols.end()) {
+        auto fromhost = symbols.find("fromhost");
+        htif = std::make_unique<Htif>(cpu.getBus(), tohost->second, fromhost != symbols.end() ? fromhost->second : 0, [this](int status) { halt(status); });
+    }
+    return symbols;
+}
+
+void Emulator::load_linux_program(const Buffer &elf, const std::vector<std::string> &args, const std::vector<std::string> &env) {
+    process = std::make_unique<LinuxProcess>(cpu, [this](int status) { halt(status); });
+    process->load(elf, args, env);
+    cpu.setProcess(process.get());
+}
+
+Coverage &Emulator::collect_coverage(const Coverage::Filter &filter) {
+    coverage = std::make_unique<Coverage>(filter);
+    cpu.setCoverage(coverage.get());
+    return *coverage;
+}
+
+void Emulator::take_snapshot() {
+    if (recorder || replayer) {
+        throw std::runtime_error("cannot take snapshots while recording or replaying inputs");
+    }
+    if (process) {
+        throw std::runtime_error("cannot take snapshots of a Linux program");
+    }
+    snapshot = std::make_unique<Snapshot>(Snapshot{cpu.save_state(), instret, halted, exit_status});
+    cpu.track_writes();
+}
+
+void Emulator::restore_snapshot() {
+    if (!snapshot) {
+        throw std::runtime_error("no snapshot taken");
+    }
+    cpu.roll_back_writes();
+    cpu.restore_state(snapshot->cpu);
+    instret = snapshot->instret;
+    halted = snapshot->halted;
+    exit_status = snapshot->exit_status;
+    error.clear();
+    stop_requested.store(false, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(input_lock);
+        host_input.clear();
+    }
+    if (coverage) {
+        coverage->restart();
+    }
+}
+
+void Emulator::use_translation(const std::string &path) {
+    aot = std::make_unique<AotCode>(path);
+}
+
+void Emulator::record_inputs(const std::string &path) {
+    recorder = std::make_unique<InputRecorder>(path);
+}
+
+void Emulator::replay_inputs(const std::string &path) {
+    replayer = std::make_unique<InputReplayer>(path);
+}
+
+void Emulator::set_exit_callback(std::function<void(int)> callback) {
+    exit_callback = callback;
+}
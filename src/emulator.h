@@ -0,0 +1,238 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "aot.h"
+#include "breakpoints.h"
+#include "cache.h"
+#include "coverage.h"
+#include "cpu.h"
+#include "htif.h"
+#include "linux_process.h"
+#include "replay.h"
+#include "sbi.h"
+#include "shared_memory.h"
+#include "timing.h"
+#include "trace.h"
+#include "virtio_9p.h"
+
+enum class StopReason {
+    // The instruction budget ran out.
+    Budget,
+    // The guest halted; see get_exit_status().
+    Halted,
+    // request_stop() was called.
+    Requested,
+    // A breakpoint or watchpoint triggered; see get_breakpoint_hit().
+    Breakpoint,
+};
+
+enum class IdlePolicy {
+    // Block the host thread until the next timer deadline or input.
+    Sleep,
+    // Skip straight to the next timer deadline; for guests without live input.
+    FastForward,
+};
+
+// One self-contained guest: hart, RAM, devices, console and exit status.
+// Emulators share no state, so any number can run in one process as long as
+// each is driven by a single thread at a time.
+class Emulator {
+private:
+    Cpu cpu;
+    bool halted;
+    int exit_status;
+    std::string error;
+    uint64_t instret;
+    // Set whenever another thread needs the run loop's attention, so the
+    // per-instruction check is a single relaxed load. It doubles as the futex
+    // an idle guest sleeps on.
+    std::atomic<uint32_t> attention;
+    IdlePolicy idle_policy;
+    std::atomic<bool> stop_requested;
+    std::mutex input_lock;
+    std::deque<uint8_t> host_input;
+    std::unique_ptr<InputRecorder> recorder;
+    std::unique_ptr<InputReplayer> replayer;
+    std::unique_ptr<TraceWriter> tracer;
+    std::unique_ptr<CacheHierarchy> caches;
+    std::unique_ptr<TimingModel> timing;
+    std::unique_ptr<AotCode> aot;
+    std::unique_ptr<Sbi> sbi;
+    std::unique_ptr<LinuxProcess> process;
+    std::unique_ptr<Coverage> coverage;
+    std::unique_ptr<Breakpoints> breakpoints;
+    std::unique_ptr<Htif> htif;
+    // Owned by the bus; nullptr unless share_directory() was called.
+    Virtio9p *shared_directory;
+    // Owned by the bus; nullptr unless share_memory() was called.
+    SharedMemory *shared_memory;
+    std::function<void(int)> exit_callback;
+    struct Snapshot {
+        Cpu::State cpu;
+        uint64_t instret;
+        bool halted;
+        int exit_status;
+    };
+    std::unique_ptr<Snapshot> snapshot;
+    template <bool Traced, bool Timed>
+    void step();
+    template <bool Traced, bool Timed>
+    void run_chunk(uint64_t chunk_end);
+    void run_chunk_translated(uint64_t chunk_end);
+    const AotBlock *find_block();
+    void run_block(const AotBlock &block);
+    void halt(int status);
+    Breakpoints &get_breakpoints();
+    void update_breakpoints();
+    bool service_attention();
+    void deliver_input(const InputEvent &event);
+    void notify();
+    uint64_t update_timer(uint64_t chunk_end);
+    void idle();
+    uint64_t sleep(uint64_t ticks);
+
+public:
+    // Takes over both images. Buffer::map_file() avoids copying them: the binary
+    // is copied once into RAM and the disk is used in place, copy-on-write.
+    Emulator(Buffer binary, Buffer disk_image);
+    // Executes at most budget instructions, stopping early if the guest halts
+    // or request_stop() is called.
+    StopReason run(uint64_t budget);
+    // Makes the current or next run() return; safe to call from any thread or callback.
+    void request_stop();
+    // Instructions retired since construction, including ones that trapped.
+    uint64_t get_instret() { return instret; };
+
+    uint64_t get_register(int index);
+    void set_register(int index, uint64_t value);
+    uint64_t get_pc() { return cpu.getPc(); };
+    void set_pc(uint64_t pc) { cpu.setPc(pc); };
+    uint64_t get_csr(uint16_t addr) { return cpu.load_csr(addr); };
+    void set_csr(uint16_t addr, uint64_t value) { cpu.store_csr(addr, value); };
+    Mode get_mode() { return cpu.getMode(); };
+    void set_mode(Mode mode) { cpu.setMode(mode); };
+    // The physical address the hart would access for a load from addr, or
+    // nothing if that faults.
+    std::optional<uint64_t> translate_address(uint64_t addr);
+    // Copies to or from guest RAM; returns false if the range is not RAM.
+    // Reads see the instructions breakpoints replaced.
+    bool read_memory(uint64_t addr, void *buffer, uint64_t nBytes);
+    bool write_memory(uint64_t addr, const void *buffer, uint64_t nBytes);
+
+    // Breakpoints stop run() before the instruction at a physical address
+    // executes; watchpoints stop it after an instruction loads or stores
+    // within [addr, addr + length) of the virtual address space. The guest runs
+    // at full speed until one triggers (see breakpoints.h). insert_breakpoint()
+    // returns false if p_addr is not RAM; the remove calls, if nothing matched.
+    bool insert_breakpoint(uint64_t p_addr);
+    bool remove_breakpoint(uint64_t p_addr);
+    void insert_watchpoint(uint64_t addr, uint64_t length, WatchType type);
+    bool remove_watchpoint(uint64_t addr, uint64_t length, WatchType type);
+    // Valid after run() returned StopReason::Breakpoint.
+    const BreakpointHit &get_breakpoint_hit() { return get_breakpoints().get_hit(); };
+
+    // Maps an extra MMIO device below RAM; the emulator takes ownership.
+    // Throws std::invalid_argument if the range overlaps RAM or another device.
+    void attach_device(uint64_t base, uint64_t size, std::unique_ptr<Device> device);
+
+    void set_console_output(std::function<void(uint8_t)> callback);
+    // Queues a console byte; it reaches the guest at the next instruction boundary.
+    // Safe to call from any thread. Ignored while replaying.
+    void console_input(uint8_t c);
+    void set_idle_policy(IdlePolicy policy) { idle_policy = policy; };
+    // Also treat loops that spin with interrupts enabled, waiting for one, as wfi.
+    void set_idle_detection(bool enabled) { cpu.setIdleDetection(enabled); };
+    // Streams every retired instruction to a compressed trace (see trace.h).
+    void trace_to(const std::string &path);
+    // Feeds guest fetches, loads and stores into a cache model. Needs a build
+    // with -DCACHE_SIM=ON; throws std::runtime_error otherwise.
+    void simulate_caches(const CacheHierarchy::Config &config);
+    // nullptr unless simulate_caches() was called.
+    const CacheHierarchy *get_caches() const { return caches.get(); };
+    // Estimates cycles per instruction and accumulates them in mcycle. Load and
+    // fetch latencies include cache misses when simulate_caches() is also used.
+    TimingModel &model_timing(const TimingConfig &config);
+    // nullptr unless model_timing() was called.
+    const TimingModel *get_timing() const { return timing.get(); };
+    // Boots the binary in S-mode, as firmware would hand over to a kernel: a0
+    // holds the hart ID and a1 the address of a generated device tree at the
+    // top of RAM, below which sp points. SBI calls (base, TIME, IPI, RFENCE,
+    // HSM, SRST and the legacy extensions) are served by the host, and the
+    // timer raises STIP directly. Call before the first run().
+    void boot_supervisor();
+    // Exports the host directory at path as a virtio-9p device, which a Linux
+    // guest mounts with "mount -t 9p -o trans=virtio,version=9p2000.L host <dir>".
+    // Call before boot_supervisor() so that the device tree lists it. Throws
+    // std::runtime_error.
+    void share_directory(const std::string &path);
+    // Creates a memfd of size bytes that the guest sees as memory at
+    // SHMEM_MEMORY_BASE, with doorbells both ways (see shared_memory.h). Call
+    // before boot_supervisor() so that the device tree lists it. Throws
+    // std::runtime_error.
+    SharedMemory &share_memory(uint64_t size);
+    // Loads a bare-metal ELF executable, such as a riscv-tests binary, in place
+    // of a flat binary: its segments go to their physical addresses and the hart
+    // starts at its entry point. If it defines tohost, its HTIF commands are
+    // served (see htif.h). Use an emulator built from an empty binary and call
+    // before the first run(). Returns the symbol table. Throws std::runtime_error.
+    std::map<std::string, uint64_t> load_elf(const Buffer &elf);
+    // Runs a static RV64 Linux executable in U-mode instead of a kernel; see
+    // LinuxProcess. Its system calls are served by the host and its exit status
+    // halts the machine. Use an emulator built from empty images and call before
+    // the first run(). Throws std::runtime_error if the program cannot be loaded.
+    void load_linux_program(const Buffer &elf, const std::vector<std::string> &args, const std::vector<std::string> &env);
+    // Runs guest code translated ahead of time by riscv-aot from the shared
+    // object at path. A block only runs while guest memory still holds the
+    // instructions it was translated from, and the interpreter takes over
+    // everywhere else. Interrupts and timer deadlines are taken between blocks.
+    // Not used while tracing, modelling timing or simulating caches. Throws
+    // std::runtime_error.
+    void use_translation(const std::string &path);
+    // Records edge coverage of branches, jumps and traps (see coverage.h).
+    // Translated code is not used while collecting it. Throws std::runtime_error.
+    Coverage &collect_coverage(const Coverage::Filter &filter);
+    // nullptr unless collect_coverage() was called.
+    const Coverage *get_coverage() const { return coverage.get(); };
+    // Logs every asynchronous input with the instruction count it was delivered at.
+    void record_inputs(const std::string &path);
+    // Delivers the inputs of a recorded log at their original instruction counts
+    // instead of live input, making the run identical to the recorded one.
+    void replay_inputs(const std::string &path);
+    // Forks the process; the child continues with a copy-on-write clone of this
+    // machine, so cloning costs O(touched pages) rather than O(RAM). Returns the
+    // child's pid in the parent and 0 in the child, which drops any queued
+    // console input. The child has only the calling thread, so it should set its
+    // own console output and leave with _exit(). Not possible while tracing,
+    // recording or replaying; throws std::runtime_error.
+    pid_t fork_clone();
+    // Saves the machine in memory and starts tracking the RAM pages and disk
+    // sectors the guest writes, so that restore_snapshot() copies back only
+    // those. Not possible while recording, replaying or running a Linux program;
+    // throws std::runtime_error.
+    void take_snapshot();
+    // Returns to the state of the last take_snapshot(), including a halted
+    // guest. Console input not yet delivered and a pending request_stop() are dropped.
+    // Throws std::runtime_error if no snapshot was taken.
+    void restore_snapshot();
+    // Called once, from the thread running the guest, when it halts.
+    void set_exit_callback(std::function<void(int)> callback);
+    bool is_halted() { return halted; };
+    int get_exit_status() { return exit_status; };
+    // Host-side failure that stopped the guest, empty if none.
+    const std::string &get_error() { return error; };
+};
+
+#endif
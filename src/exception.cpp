@@ -1,47 +1,9 @@
 #include "exception.h"
 
-#include <iostream>
+Exception::Exception(ExceptionType type, uint64_t tval) : Trap{(uint64_t)type, tval} {}
 
-Exception::Exception(ExceptionType type) : type{type} {}
-
-uint64_t Exception::get_code() {
-    switch (type) {
-    case ExceptionType::InstructionAddressMisaligned:
-        return 0;
-    case ExceptionType::InstructionAccessFault:
-        return 1;
-    case ExceptionType::IllegalInstruction:
-        return 2;
-    case ExceptionType::Breakpoint:
-        return 3;
-    case ExceptionType::LoadAddressMisaligned:
-        return 4;
-    case ExceptionType::LoadAccessFault:
-        return 5;
-    case ExceptionType::StoreAMOAddressMisaligned:
-        return 6;
-    case ExceptionType::StoreAMOAccessFault:
-        return 7;
-    case ExceptionType::EnvironmentCallFromUMode:
-        return 8;
-    case ExceptionType::EnvironmentCallFromSMode:
-        return 9;
-    case ExceptionType::EnvironmentCallFromMMode:
-        return 11;
-    case ExceptionType::InstructionPageFault:
-        return 12;
-    case ExceptionType::LoadPageFault:
-        return 13;
-    case ExceptionType::StoreAMOPageFault:
-        return 15;
-    default:
-        std::cerr << "error: illegal ExceptionType" << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
-}
-
-bool Exception::is_fatal() {
-    switch (type) {
+bool Exception::is_fatal() const {
+    switch (get_type()) {
     case ExceptionType::InstructionAddressMisaligned:
         return true;
     case ExceptionType::InstructionAccessFault:
@@ -56,3 +18,7 @@ bool Exception::is_fatal() {
         return false;
     }
 }
+
+__attribute__((cold, noinline)) void raise_exception(ExceptionType type, uint64_t tval) {
+    throw Exception(type, tval);
+}
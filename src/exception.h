@@ -4,30 +4,31 @@
 #include "trap.h"
 
 enum ExceptionType {
-    InstructionAddressMisaligned,
-    InstructionAccessFault,
-    IllegalInstruction,
-    Breakpoint,
-    LoadAddressMisaligned,
-    LoadAccessFault,
-    StoreAMOAddressMisaligned,
-    StoreAMOAccessFault,
-    EnvironmentCallFromUMode,
-    EnvironmentCallFromSMode,
-    EnvironmentCallFromMMode,
-    InstructionPageFault,
-    LoadPageFault,
-    StoreAMOPageFault,
+    InstructionAddressMisaligned = 0,
+    InstructionAccessFault = 1,
+    IllegalInstruction = 2,
+    Breakpoint = 3,
+    LoadAddressMisaligned = 4,
+    LoadAccessFault = 5,
+    StoreAMOAddressMisaligned = 6,
+    StoreAMOAccessFault = 7,
+    EnvironmentCallFromUMode = 8,
+    EnvironmentCallFromSMode = 9,
+    EnvironmentCallFromMMode = 11,
+    InstructionPageFault = 12,
+    LoadPageFault = 13,
+    StoreAMOPageFault = 15,
 };
 
 class Exception : public Trap {
-private:
-    ExceptionType type;
-
 public:
-    Exception(ExceptionType type);
-    uint64_t get_code();
-    bool is_fatal();
+    Exception(ExceptionType type, uint64_t tval);
+    ExceptionType get_type() const { return (ExceptionType)code; }
+    bool is_fatal() const;
 };
 
+// Leaves the execution fast path by throwing an Exception carrying cause and tval.
+// Successful accesses never pay for trap plumbing; the main loop catches and calls take_trap.
+[[noreturn]] void raise_exception(ExceptionType type, uint64_t tval);
+
 #endif
@@ -0,0 +1,232 @@
+#include "expect.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+Matcher::Matcher(const std::string &pattern) : pattern{pattern},
+                                               failure(pattern.size(), 0),
+                                               matched{0} {
+    size_t border = 0;
+    for (size_t i = 1; i < pattern.size(); i++) {
+        while (border > 0 && pattern[i] != pattern[border]) {
+            border = failure[border - 1];
+        }
+        if (pattern[i] == pattern[border]) {
+            border++;
+        }
+        failure[i] = border;
+    }
+}
+
+namespace {
+
+// The double-quoted string at the start of text, with its escapes resolved.
+std::string parse_string(const std::string &text) {
+    if (text.size() < 2 || text.front() != '"') {
+        throw std::invalid_argument("expected a quoted string");
+    }
+    std::string result;
+    size_t i = 1;
+    for (; i < text.size() && text[i] != '"'; i++) {
+        if (text[i] != '\\') {
+            result.push_back(text[i]);
+            continue;
+        }
+        if (++i == text.size()) {
+            break;
+        }
+        switch (text[i]) {
+        case 'n':
+            result.push_back('\n');
+            break;
+        case 'r':
+            result.push_back('\r');
+            break;
+        case 't':
+            result.push_back('\t');
+            break;
+        case '\\':
+        case '"':
+            result.push_back(text[i]);
+            break;
+        case 'x': {
+            auto digits = text.substr(i + 1, 2);
+            if (digits.size() != 2 || digits.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+                throw std::invalid_argument("\\x takes two hex digits");
+            }
+            result.push_back((char)std::stoi(digits, nullptr, 16));
+            i += 2;
+            break;
+        }
+        default:
+            throw std::invalid_argument(std::string("unknown escape \\") + text[i]);
+        }
+    }
+    if (i >= text.size()) {
+        throw std::invalid_argument("unterminated string");
+    }
+    if (text.find_first_not_of(" \t\r", i + 1) != std::string::npos) {
+        throw std::invalid_argument("text after the string");
+    }
+    return result;
+}
+
+uint64_t parse_number(const std::string &text) {
+    char *end;
+    errno = 0;
+    auto value = std::strtoull(text.c_str(), &end, 0);
+    if (text.empty() || !std::isdigit((unsigned char)text[0]) || errno != 0 ||
+        text.find_first_not_of(" \t\r", end - text.c_str()) != std::string::npos) {
+        throw std::invalid_argument("expected a number");
+    }
+    return value;
+}
+
+std::string parse_pattern(const std::string &text) {
+    auto pattern = parse_string(text);
+    if (pattern.empty()) {
+        throw std::invalid_argument("empty pattern");
+    }
+    return pattern;
+}
+
+} // namespace
+
+std::vector<ExpectStep> ExpectScript::parse(std::istream &in) {
+    std::vector<ExpectStep> steps;
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+        auto start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        auto end = line.find_first_of(" \t", start);
+        auto command = line.substr(start, end - start);
+        auto argument = end == std::string::npos ? "" : line.substr(line.find_first_not_of(" \t", end));
+        try {
+            if (command == "expect") {
+                steps.push_back({ExpectCommand::Expect, parse_pattern(argument), 0, number});
+            } else if (command == "send") {
+                steps.push_back({ExpectCommand::Send, parse_string(argument), 0, number});
+            } else if (command == "fail") {
+                steps.push_back({ExpectCommand::Fail, parse_pattern(argument), 0, number});
+            } else if (command == "timeout") {
+                steps.push_back({ExpectCommand::Timeout, "", parse_number(argument), number});
+            } else if (command == "exit") {
+                steps.push_back({ExpectCommand::Exit, "", parse_number(argument), number});
+            } else {
+                throw std::invalid_argument("unknown command " + command);
+            }
+        } catch (const std::invalid_argument &failure) {
+            throw std::invalid_argument("expect script line " + std::to_string(number) + ": " + failure.what());
+        }
+    }
+    return steps;
+}
+
+ExpectScript::ExpectScript(Emulator &emulator, std::vector<ExpectStep> steps, std::function<void(uint8_t)> echo) : emulator{emulator},
+                                                                                                                    steps{std::move(steps)},
+                                                                                                                    next{0},
+                                                                                                                    waiting{nullptr},
+                                                                                                                    expected{},
+                                                                                                                    failures{},
+                                                                                                                    timeout{EXPECT_TIMEOUT},
+                                                                                                                    deadline{UINT64_MAX},
+                                                                                                                    progressed{false},
+                                                                                                                    finished{false},
+                                                                                                                    status{EXIT_SUCCESS},
+                                                                                                                    echo{echo} {
+    emulator.set_console_output([this](uint8_t c) { output(c); });
+}
+
+// Carries out steps up to the next expect or exit.
+void ExpectScript::advance() {
+    waiting = nullptr;
+    while (next < steps.size()) {
+        const auto &step = steps[next++];
+        switch (step.command) {
+        case ExpectCommand::Expect: {
+            waiting = &step;
+            expected.emplace(step.text);
+            auto now = emulator.get_instret();
+            deadline = timeout > UINT64_MAX - now ? UINT64_MAX : now + timeout;
+            return;
+        }
+        case ExpectCommand::Send:
+            for (char c : step.text) {
+                emulator.console_input(c);
+            }
+            break;
+        case ExpectCommand::Timeout:
+            timeout = step.value;
+            break;
+        case ExpectCommand::Fail:
+            failures.emplace_back(Matcher(step.text), step.line);
+            break;
+        case ExpectCommand::Exit:
+            finished = true;
+            status = (int)step.value;
+            return;
+        }
+    }
+}
+
+// Runs on the emulator thread for every byte the guest writes.
+void ExpectScript::output(uint8_t c) {
+    echo(c);
+    if (finished) {
+        return;
+    }
+    for (auto &[matcher, line] : failures) {
+        if (matcher.feed(c)) {
+            finished = true;
+            status = fail("line " + std::to_string(line) + ": saw \"" + matcher.get_pattern() + "\"");
+            emulator.request_stop();
+            return;
+        }
+    }
+    if (waiting != nullptr && expected->feed(c)) {
+        advance();
+        progressed = true;
+        emulator.request_stop();
+    }
+}
+
+int ExpectScript::fail(const std::string &message) {
+    std::cout << std::flush;
+    std::cerr << "\nexpect: " << message << std::endl;
+    return EXIT_FAILURE;
+}
+
+std::string ExpectScript::where() const {
+    return waiting == nullptr ? "" : "line " + std::to_string(waiting->line) + ": ";
+}
+
+int ExpectScript::run() {
+    advance();
+    while (!finished) {
+        // Past the last expect, the guest runs until it halts.
+        auto budget = waiting == nullptr ? UINT64_MAX : deadline - std::min(deadline, emulator.get_instret());
+        progressed = false;
+        auto reason = budget == 0 ? StopReason::Budget : emulator.run(budget);
+        if (finished) {
+            break;
+        }
+        if (reason == StopReason::Halted) {
+            if (waiting == nullptr) {
+                return emulator.get_exit_status();
+            }
+            return fail(where() + "the guest halted waiting for \"" + waiting->text + "\"");
+        }
+        if (reason == StopReason::Requested && !progressed) {
+            return fail(where() + "stopped");
+        }
+        if (reason == StopReason::Budget && waiting != nullptr && emulator.get_instret() >= deadline) {
+            return fail(where() + "timed out after " + std::to_string(timeout) + " instructions waiting for \"" + waiting->text + "\"");
+        }
+    }
+    return status;
+}
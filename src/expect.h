@@ -0,0 +1,111 @@
+#ifndef EXPECT_H
+#define EXPECT_H
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "emulator.h"
+
+// Instructions an expect step may wait unless the script sets a timeout.
+#define EXPECT_TIMEOUT 1000000000
+
+// Incremental substring search (Knuth-Morris-Pratt): each byte costs amortized
+// constant time and no output is kept, however long the guest talks.
+class Matcher {
+private:
+    std::string pattern;
+    // failure[i]: length of the longest proper border of pattern[0, i].
+    std::vector<size_t> failure;
+    size_t matched;
+
+public:
+    // pattern must not be empty.
+    Matcher(const std::string &pattern);
+    // True if the pattern ends with c.
+    bool feed(uint8_t c) {
+        while (matched > 0 && (uint8_t)pattern[matched] != c) {
+            matched = failure[matched - 1];
+        }
+        if ((uint8_t)pattern[matched] == c) {
+            matched++;
+        }
+        if (matched == pattern.size()) {
+            matched = failure[matched - 1];
+            return true;
+        }
+        return false;
+    };
+    const std::string &get_pattern() const { return pattern; };
+};
+
+enum class ExpectCommand {
+    // Wait for text on the console.
+    Expect,
+    // Type text into the console.
+    Send,
+    // Later Expect steps fail after value instructions.
+    Timeout,
+    // From now on, text on the console fails the script.
+    Fail,
+    // Stop with exit status value.
+    Exit,
+};
+
+struct ExpectStep {
+    ExpectCommand command;
+    std::string text;
+    uint64_t value;
+    int line;
+};
+
+// Drives the guest console from a script, in-process: the UART's output is
+// matched byte by byte as the guest writes it, and input is queued the moment
+// the text it answers has appeared, so nothing depends on host timing.
+//
+// One command per line; # starts a comment. Strings are double-quoted and
+// take \n, \r, \t, \\, \" and \xNN escapes.
+//
+//   timeout <instructions>
+//   fail "<text>"
+//   expect "<text>"
+//   send "<text>"
+//   exit <status>
+class ExpectScript {
+private:
+    Emulator &emulator;
+    std::vector<ExpectStep> steps;
+    size_t next;
+    // The Expect step being waited for, if any.
+    const ExpectStep *waiting;
+    std::optional<Matcher> expected;
+    std::vector<std::pair<Matcher, int>> failures;
+    uint64_t timeout;
+    uint64_t deadline;
+    // Set by the console callback when the script moved on or ended.
+    bool progressed;
+    bool finished;
+    int status;
+    std::function<void(uint8_t)> echo;
+    void advance();
+    void output(uint8_t c);
+    std::string where() const;
+    // Prints why the script failed; returns EXIT_FAILURE.
+    int fail(const std::string &message);
+
+public:
+    // Throws std::invalid_argument with the line of the first malformed command.
+    static std::vector<ExpectStep> parse(std::istream &in);
+    // Takes over the console output, passing every byte on to echo.
+    ExpectScript(Emulator &emulator, std::vector<ExpectStep> steps, std::function<void(uint8_t)> echo);
+    // Runs the guest through the script. Returns the status of its exit
+    // command, or the guest's own if the guest halts after the last step;
+    // prints why and returns EXIT_FAILURE if a step times out, a fail pattern
+    // appears, or the guest halts or is stopped first.
+    int run();
+};
+
+#endif
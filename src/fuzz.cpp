@@ -0,0 +1,119 @@
+#include "fuzz.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+
+class FuzzPort : public Device {
+public:
+    uint64_t buffer;
+    uint64_t capacity;
+    uint64_t length;
+    // Last CONTROL value written since the harness cleared it.
+    uint64_t event;
+    std::function<void()> notify;
+
+    FuzzPort(std::function<void()> notify) : buffer{0},
+                                             capacity{0},
+                                             length{0},
+                                             event{0},
+                                             notify{notify} {}
+    const char *get_name() { return "fuzz"; };
+
+    uint64_t load(uint64_t addr, int nBytes) {
+        if (nBytes == 8 || nBytes == 4) {
+            switch (addr) {
+            case FUZZ_BUFFER:
+                return buffer;
+            case FUZZ_CAPACITY:
+                return capacity;
+            case FUZZ_LENGTH:
+                return length;
+            default:
+                return 0;
+            }
+        }
+        raise_exception(ExceptionType::LoadAccessFault, addr);
+    };
+
+    void store(uint64_t addr, int nBytes, uint64_t value) {
+        if (nBytes == 8 || nBytes == 4) {
+            switch (addr) {
+            case FUZZ_BUFFER:
+                buffer = value;
+                return;
+            case FUZZ_CAPACITY:
+                capacity = value;
+                return;
+            case FUZZ_CONTROL:
+                event = value;
+                notify();
+                return;
+            default:
+                return;
+            }
+        }
+        raise_exception(ExceptionType::StoreAMOAccessFault, addr);
+    };
+};
+
+FuzzHarness::FuzzHarness(Emulator &emulator, uint64_t timeout) : emulator{emulator},
+                                                                 port{nullptr},
+                                                                 timeout{timeout} {
+    auto device = std::make_unique<FuzzPort>([&emulator] { emulator.request_stop(); });
+    port = device.get();
+    emulator.attach_device(FUZZ_BASE, FUZZ_SIZE, std::move(device));
+}
+
+bool FuzzHarness::start() {
+    port->event = 0;
+    auto reason = StopReason::Budget;
+    while (reason == StopReason::Budget) {
+        reason = emulator.run(UINT64_MAX);
+    }
+    if (reason != StopReason::Requested || port->event != FUZZ_CONTROL_START) {
+        return false;
+    }
+    auto offset = port->buffer - MEMORY_BASE;
+    if (port->buffer < MEMORY_BASE || offset > MEMORY_SIZE || port->capacity > MEMORY_SIZE - offset) {
+        throw std::runtime_error("fuzzing input buffer outside RAM");
+    }
+    emulator.take_snapshot();
+    return true;
+}
+
+FuzzResult FuzzHarness::run(const uint8_t *input, uint64_t size) {
+    emulator.restore_snapshot();
+    port->event = 0;
+    port->length = std::min(size, port->capacity);
+    emulator.write_memory(port->buffer, input, port->length);
+
+    auto begin = emulator.get_instret();
+    auto reason = emulator.run(timeout);
+    FuzzResult result{FuzzOutcome::Ok, emulator.get_instret() - begin, 0};
+    // The last instruction of the budget may have been the one ending the input.
+    if (reason == StopReason::Budget && port->event != 0) {
+        reason = StopReason::Requested;
+    }
+    switch (reason) {
+    case StopReason::Budget:
+        result.outcome = FuzzOutcome::Timeout;
+        break;
+    case StopReason::Halted:
+        result.status = emulator.get_exit_status();
+        if (result.status != 0 || !emulator.get_error().empty()) {
+            result.outcome = FuzzOutcome::Crash;
+        }
+        break;
+    case StopReason::Requested:
+    case StopReason::Breakpoint:
+        if (port->event == FUZZ_CONTROL_CRASH) {
+            result.outcome = FuzzOutcome::Crash;
+        } else if (port->event != FUZZ_CONTROL_END) {
+            result.outcome = FuzzOutcome::Stopped;
+        }
+        break;
+    }
+    return result;
+}
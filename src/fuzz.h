@@ -0,0 +1,68 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <cstdint>
+
+#include "emulator.h"
+
+// The harness port the guest drives. Writes to CONTROL take effect before the
+// next instruction.
+#define FUZZ_BASE 0x10002000
+#define FUZZ_SIZE 0x1000
+// Physical address of the guest's input buffer.
+#define FUZZ_BUFFER (FUZZ_BASE + 0x00)
+// Size of the input buffer; longer inputs are truncated.
+#define FUZZ_CAPACITY (FUZZ_BASE + 0x08)
+// Read-only: length of the current input.
+#define FUZZ_LENGTH (FUZZ_BASE + 0x10)
+#define FUZZ_CONTROL (FUZZ_BASE + 0x18)
+
+// Snapshot here; the first input is in the buffer when the store retires.
+#define FUZZ_CONTROL_START 1
+// The input was handled.
+#define FUZZ_CONTROL_END 2
+// The guest detected a failure, such as a kernel panic.
+#define FUZZ_CONTROL_CRASH 3
+
+enum class FuzzOutcome {
+    Ok,
+    // FUZZ_CONTROL_CRASH, or the guest halted with a nonzero status.
+    Crash,
+    // The input ran out of instructions.
+    Timeout,
+    // request_stop() was called.
+    Stopped,
+};
+
+struct FuzzResult {
+    FuzzOutcome outcome;
+    uint64_t instructions;
+    // Exit status if the guest halted while running the input, otherwise 0.
+    int status;
+};
+
+class FuzzPort;
+
+// Persistent-mode fuzzing: the guest boots once, signals where each input
+// should start, and every input then runs from a snapshot of that point. RAM
+// pages and disk sectors are rolled back only where the previous input wrote
+// them, so a reset costs microseconds rather than a copy of all of RAM.
+class FuzzHarness {
+private:
+    Emulator &emulator;
+    FuzzPort *port;
+    uint64_t timeout;
+
+public:
+    // Attaches the port at FUZZ_BASE. Each input may run for timeout instructions.
+    FuzzHarness(Emulator &emulator, uint64_t timeout);
+    // Runs the guest until it writes FUZZ_CONTROL_START and snapshots it there.
+    // Returns false if it halted or was stopped first. Throws std::runtime_error
+    // if the buffer it announced is not in RAM.
+    bool start();
+    // Resets the guest to the snapshot, places input in its buffer and runs it
+    // to the end of the input, a crash or the timeout.
+    FuzzResult run(const uint8_t *input, uint64_t size);
+};
+
+#endif
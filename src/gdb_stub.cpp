@@ -0,0 +1,680 @@
+#include "gdb_stub.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Register numbers GDB gives RISC-V: x0-x31, pc, f0-f31 and the fcsrs, then
+// CSR n as 65 + n, and its virtual privilege register after the CSRs.
+#define GDB_REG_PC 32
+#define GDB_REG_CSR 65
+#define GDB_REG_PRIV (GDB_REG_CSR + 4096)
+
+namespace {
+
+const char *const register_names[] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+struct CsrName {
+    uint16_t addr;
+    const char *name;
+};
+
+const CsrName csr_names[] = {
+    {MSTATUS, "mstatus"},
+    {MISA, "misa"},
+    {MEDELEG, "medeleg"},
+    {MIDELEG, "mideleg"},
+    {MIE, "mie"},
+    {MTVEC, "mtvec"},
+    {MCOUNTEREN, "mcounteren"},
+    {MSCRATCH, "mscratch"},
+    {MEPC, "mepc"},
+    {MCAUSE, "mcause"},
+    {MTVAL, "mtval"},
+    {MIP, "mip"},
+    {MHARTID, "mhartid"},
+    {MCYCLE, "mcycle"},
+    {MINSTRET, "minstret"},
+    {SSTATUS, "sstatus"},
+    {SIE, "sie"},
+    {STVEC, "stvec"},
+    {SCOUNTEREN, "scounteren"},
+    {SSCRATCH, "sscratch"},
+    {SEPC, "sepc"},
+    {SCAUSE, "scause"},
+    {STVAL, "stval"},
+    {SIP, "sip"},
+    {SATP, "satp"},
+};
+
+std::string target_description() {
+    std::ostringstream xml;
+    xml << "<?xml version=\"1.0\"?>\n"
+        << "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+        << "<target version=\"1.0\">\n"
+        << "<architecture>riscv:rv64</architecture>\n"
+        << "<feature name=\"org.gnu.gdb.riscv.cpu\">\n";
+    for (int i = 0; i < 32; i++) {
+        auto type = i == 1 ? "code_ptr" : i == 2 ? "data_ptr"
+                                                 : "int";
+        xml << "<reg name=\"" << register_names[i] << "\" bitsize=\"64\" type=\"" << type << "\" regnum=\"" << i << "\"/>\n";
+    }
+    xml << "<reg name=\"pc\" bitsize=\"64\" type=\"code_ptr\" regnum=\"" << GDB_REG_PC << "\"/>\n"
+        << "</feature>\n"
+        << "<feature name=\"org.gnu.gdb.riscv.csr\">\n";
+    for (const auto &csr : csr_names) {
+        xml << "<reg name=\"" << csr.name << "\" bitsize=\"64\" type=\"int\" regnum=\"" << GDB_REG_CSR + csr.addr << "\" group=\"csr\"/>\n";
+    }
+    xml << "</feature>\n"
+        << "<feature name=\"org.gnu.gdb.riscv.virtual\">\n"
+        << "<reg name=\"priv\" bitsize=\"64\" type=\"int\" regnum=\"" << GDB_REG_PRIV << "\" group=\"general\"/>\n"
+        << "</feature>\n"
+        << "</target>\n";
+    return xml.str();
+}
+
+const char hex_digits[] = "0123456789abcdef";
+
+std::string to_hex(const uint8_t *data, uint64_t length) {
+    std::string hex;
+    for (uint64_t i = 0; i < length; i++) {
+        hex.push_back(hex_digits[data[i] >> 4]);
+        hex.push_back(hex_digits[data[i] & 0xf]);
+    }
+    return hex;
+}
+
+// Registers go over the wire in target byte order.
+std::string register_hex(uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = value >> (8 * i);
+    }
+    return to_hex(bytes, 8);
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+std::vector<uint8_t> from_hex(const std::string &hex) {
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        data.push_back(hex_value(hex[i]) << 4 | hex_value(hex[i + 1]));
+    }
+    return data;
+}
+
+uint64_t register_value(const std::string &hex) {
+    auto bytes = from_hex(hex);
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes.size() && i < 8; i++) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+// Parses a hex number at pos, leaving pos after it.
+uint64_t parse_number(const std::string &text, size_t &pos) {
+    uint64_t value = 0;
+    while (pos < text.size() && hex_value(text[pos]) >= 0) {
+        value = value << 4 | hex_value(text[pos]);
+        pos++;
+    }
+    return value;
+}
+
+// Parses "<addr>,<length>" at pos, leaving pos after it.
+bool parse_range(const std::string &text, size_t &pos, uint64_t &addr, uint64_t &length) {
+    addr = parse_number(text, pos);
+    if (pos >= text.size() || text[pos] != ',') {
+        return false;
+    }
+    pos++;
+    length = parse_number(text, pos);
+    return true;
+}
+
+} // namespace
+
+GdbStub::GdbStub(Emulator &emulator, const std::string &address) : emulator{emulator},
+                                                                   address{address},
+                                                                   listener{-1},
+                                                                   connection{-1},
+                                                                   acknowledge{true},
+                                                                   physical{false},
+                                                                   input{},
+                                                                   breakpoints{},
+                                                                   watches{} {
+    auto is_port = !address.empty() && std::all_of(address.begin(), address.end(), [](char c) { return c >= '0' && c <= '9'; });
+    if (is_port) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener < 0) {
+            throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+        }
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(std::stoi(address));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener, reinterpret_cast<sockaddr *>(&local), sizeof(local)) < 0) {
+            auto reason = std::strerror(errno);
+            close(listener);
+            throw std::runtime_error("cannot listen on port " + address + ": " + reason);
+        }
+    } else {
+        sockaddr_un local{};
+        if (address.size() >= sizeof(local.sun_path)) {
+            throw std::runtime_error("socket path too long: " + address);
+        }
+        // Replace a socket left behind by an earlier run, but nothing else.
+        struct stat info;
+        if (stat(address.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(address.c_str());
+        }
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+        }
+        local.sun_family = AF_UNIX;
+        std::memcpy(local.sun_path, address.c_str(), address.size());
+        if (bind(listener, reinterpret_cast<sockaddr *>(&local), sizeof(local)) < 0) {
+            auto reason = std::strerror(errno);
+            close(listener);
+            throw std::runtime_error("cannot listen on " + address + ": " + reason);
+        }
+    }
+    if (listen(listener, 1) < 0) {
+        auto reason = std::strerror(errno);
+        close(listener);
+        throw std::runtime_error("cannot listen on " + address + ": " + reason);
+    }
+}
+
+GdbStub::~GdbStub() {
+    if (connection >= 0) {
+        close(connection);
+    }
+    close(listener);
+}
+
+bool GdbStub::serve() {
+    connection = accept(listener, nullptr, nullptr);
+    if (connection < 0) {
+        throw std::runtime_error(std::string("accept: ") + std::strerror(errno));
+    }
+    int no_delay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    std::string packet;
+    while (receive(packet)) {
+        auto command = packet.empty() ? '\0' : packet[0];
+        if (command == 'k') {
+            return false;
+        }
+        if (packet.rfind("vKill", 0) == 0) {
+            send("OK");
+            return false;
+        }
+        if (command == 'D') {
+            send("OK");
+            detach();
+            return true;
+        }
+        std::string reply;
+        if (command == 'c' || command == 'C') {
+            reply = resume(false);
+        } else if (command == 's' || command == 'S') {
+            reply = resume(true);
+        } else if (packet.rfind("vCont;", 0) == 0) {
+            reply = resume(packet[6] == 's' || packet[6] == 'S');
+        } else {
+            reply = handle(packet);
+        }
+        send(reply);
+        // GDB still acknowledges the OK itself.
+        if (packet == "QStartNoAckMode") {
+            acknowledge = false;
+        }
+        if (emulator.is_halted()) {
+            return false;
+        }
+    }
+    // GDB went away without detaching; the guest carries on as if it had.
+    detach();
+    return true;
+}
+
+// Appends whatever the connection has to input; false once it is closed.
+bool GdbStub::fill() {
+    char bytes[4096];
+    auto n = read(connection, bytes, sizeof(bytes));
+    if (n <= 0) {
+        return false;
+    }
+    input.append(bytes, n);
+    return true;
+}
+
+bool GdbStub::receive(std::string &packet) {
+    while (true) {
+        auto start = input.find('$');
+        auto end = start == std::string::npos ? std::string::npos : input.find('#', start);
+        if (end != std::string::npos && end + 2 < input.size()) {
+            packet = input.substr(start + 1, end - start - 1);
+            uint8_t sum = 0;
+            for (char c : packet) {
+                sum += c;
+            }
+            auto expected = hex_value(input[end + 1]) << 4 | hex_value(input[end + 2]);
+            input.erase(0, end + 3);
+            if (acknowledge) {
+                auto ack = sum == expected ? "+" : "-";
+                if (::send(connection, ack, 1, MSG_NOSIGNAL) < 0) {
+                    return false;
+                }
+            }
+            if (sum == expected || !acknowledge) {
+                return true;
+            }
+            continue;
+        }
+        if (!fill()) {
+            return false;
+        }
+    }
+}
+
+void GdbStub::send(const std::string &payload) {
+    std::string frame = "$";
+    uint8_t sum = 0;
+    for (char c : payload) {
+        if (c == '$' || c == '#' || c == '}' || c == '*') {
+            frame.push_back('}');
+            sum += '}';
+            c ^= 0x20;
+        }
+        frame.push_back(c);
+        sum += c;
+    }
+    frame.push_back('#');
+    frame.push_back(hex_digits[sum >> 4]);
+    frame.push_back(hex_digits[sum & 0xf]);
+
+    while (true) {
+        size_t sent = 0;
+        while (sent < frame.size()) {
+            auto n = ::send(connection, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return;
+            }
+            sent += n;
+        }
+        if (!acknowledge) {
+            return;
+        }
+        // Anything but a retransmission request counts as received.
+        while (input.empty()) {
+            if (!fill()) {
+                return;
+            }
+        }
+        auto ack = input[0];
+        if (ack == '+' || ack == '-') {
+            input.erase(0, 1);
+        }
+        if (ack != '-') {
+            return;
+        }
+    }
+}
+
+// True if GDB sent its interrupt byte while the guest was running.
+bool GdbStub::interrupted() {
+    pollfd ready{connection, POLLIN, 0};
+    while (poll(&ready, 1, 0) > 0) {
+        if (!fill()) {
+            // Disconnected: stop so that serve() sees it.
+            return true;
+        }
+    }
+    auto position = input.find('\x03');
+    if (position == std::string::npos) {
+        return false;
+    }
+    input.erase(position, 1);
+    return true;
+}
+
+std::string GdbStub::resume(bool step) {
+    auto reason = StopReason::Budget;
+    if (step) {
+        reason = emulator.run(1);
+    } else {
+        while (reason == StopReason::Budget && !interrupted()) {
+            reason = emulator.run(GDB_SLICE);
+        }
+    }
+
+    switch (reason) {
+    case StopReason::Halted: {
+        uint8_t status = emulator.get_exit_status();
+        return "W" + to_hex(&status, 1);
+    }
+    case StopReason::Breakpoint: {
+        auto &hit = emulator.get_breakpoint_hit();
+        if (hit.watch) {
+            auto kind = hit.type == WatchType::Write ? "watch" : hit.type == WatchType::Read ? "rwatch"
+                                                                                             : "awatch";
+            std::ostringstream reply;
+            reply << "T05" << kind << ":" << std::hex << hit.addr << ";";
+            return reply.str();
+        }
+        auto hardware = std::any_of(breakpoints.begin(), breakpoints.end(), [&hit](const auto &entry) {
+            return entry.second.p_addr == hit.addr && entry.second.hardware;
+        });
+        return hardware ? "T05hwbreak:;" : "T05swbreak:;";
+    }
+    case StopReason::Requested:
+        return "T02";
+    default:
+        // Single step, or interrupted by GDB.
+        return step ? "T05" : "T02";
+    }
+}
+
+std::string GdbStub::handle(const std::string &packet) {
+    size_t pos = 1;
+    switch (packet.empty() ? '\0' : packet[0]) {
+    case '?':
+        return "S05";
+    case 'g':
+        return read_registers();
+    case 'G':
+        return write_registers(packet.substr(1));
+    case 'p':
+        return read_register(parse_number(packet, pos));
+    case 'P': {
+        auto number = parse_number(packet, pos);
+        if (pos >= packet.size() || packet[pos] != '=') {
+            return "E01";
+        }
+        return write_register(number, register_value(packet.substr(pos + 1)));
+    }
+    case 'm': {
+        uint64_t addr, length;
+        if (!parse_range(packet, pos, addr, length)) {
+            return "E01";
+        }
+        return read_memory(addr, std::min<uint64_t>(length, GDB_PACKET_SIZE / 2));
+    }
+    case 'M': {
+        uint64_t addr, length;
+        if (!parse_range(packet, pos, addr, length) || pos >= packet.size() || packet[pos] != ':') {
+            return "E01";
+        }
+        auto data = from_hex(packet.substr(pos + 1));
+        data.resize(std::min<uint64_t>(data.size(), length));
+        return write_memory(addr, data);
+    }
+    case 'X': {
+        uint64_t addr, length;
+        if (!parse_range(packet, pos, addr, length) || pos >= packet.size() || packet[pos] != ':') {
+            return "E01";
+        }
+        std::vector<uint8_t> data;
+        for (pos++; pos < packet.size(); pos++) {
+            if (packet[pos] == '}' && pos + 1 < packet.size()) {
+                data.push_back(packet[++pos] ^ 0x20);
+            } else {
+                data.push_back(packet[pos]);
+            }
+        }
+        data.resize(std::min<uint64_t>(data.size(), length));
+        return write_memory(addr, data);
+    }
+    case 'Z':
+        return insert_point(packet, true);
+    case 'z':
+        return insert_point(packet, false);
+    case 'H':
+    case 'T':
+        return "OK";
+    default:
+        break;
+    }
+
+    if (packet.rfind("qSupported", 0) == 0) {
+        std::ostringstream reply;
+        reply << "PacketSize=" << std::hex << GDB_PACKET_SIZE << ";qXfer:features:read+;swbreak+;hwbreak+;QStartNoAckMode+;vContSupported+";
+        return reply.str();
+    }
+    if (packet == "QStartNoAckMode") {
+        return "OK";
+    }
+    if (packet.rfind("qXfer:features:read:", 0) == 0) {
+        pos = packet.find(':', 20);
+        if (pos == std::string::npos || packet.substr(20, pos - 20) != "target.xml") {
+            return "E00";
+        }
+        pos++;
+        uint64_t offset, length;
+        if (!parse_range(packet, pos, offset, length)) {
+            return "E01";
+        }
+        auto xml = target_description();
+        if (offset >= xml.size()) {
+            return "l";
+        }
+        auto part = xml.substr(offset, length);
+        return (offset + part.size() < xml.size() ? "m" : "l") + part;
+    }
+    if (packet.rfind("qRcmd,", 0) == 0) {
+        auto command = from_hex(packet.substr(6));
+        return monitor(std::string(command.begin(), command.end()));
+    }
+    if (packet == "vCont?") {
+        return "vCont;c;C;s;S";
+    }
+    if (packet == "qC") {
+        return "QC1";
+    }
+    if (packet == "qfThreadInfo") {
+        return "m1";
+    }
+    if (packet == "qsThreadInfo") {
+        return "l";
+    }
+    if (packet == "qAttached") {
+        return "1";
+    }
+    return "";
+}
+
+std::string GdbStub::read_registers() {
+    std::string reply;
+    for (int i = 0; i < 32; i++) {
+        reply += register_hex(emulator.get_register(i));
+    }
+    return reply + register_hex(emulator.get_pc());
+}
+
+std::string GdbStub::write_registers(const std::string &hex) {
+    for (int i = 0; i <= GDB_REG_PC && (size_t)(i + 1) * 16 <= hex.size(); i++) {
+        write_register(i, register_value(hex.substr(i * 16, 16)));
+    }
+    return "OK";
+}
+
+std::string GdbStub::read_register(uint64_t number) {
+    if (number < 32) {
+        return register_hex(emulator.get_register(number));
+    }
+    if (number == GDB_REG_PC) {
+        return register_hex(emulator.get_pc());
+    }
+    if (number >= GDB_REG_CSR && number < GDB_REG_PRIV) {
+        return register_hex(emulator.get_csr(number - GDB_REG_CSR));
+    }
+    if (number == GDB_REG_PRIV) {
+        return register_hex(emulator.get_mode());
+    }
+    return "E01";
+}
+
+std::string GdbStub::write_register(uint64_t number, uint64_t value) {
+    if (number < 32) {
+        emulator.set_register(number, value);
+    } else if (number == GDB_REG_PC) {
+        emulator.set_pc(value);
+    } else if (number >= GDB_REG_CSR && number < GDB_REG_PRIV) {
+        emulator.set_csr(number - GDB_REG_CSR, value);
+    } else if (number == GDB_REG_PRIV && (value == Mode::User || value == Mode::Supervisor || value == Mode::Machine)) {
+        emulator.set_mode(static_cast<Mode>(value));
+    } else {
+        return "E01";
+    }
+    return "OK";
+}
+
+std::optional<uint64_t> GdbStub::physical_address(uint64_t addr) {
+    if (physical) {
+        return addr;
+    }
+    return emulator.translate_address(addr);
+}
+
+// Only RAM is accessible, so that GDB cannot trigger device side effects.
+std::string GdbStub::read_memory(uint64_t addr, uint64_t length) {
+    std::vector<uint8_t> data(length);
+    uint64_t done = 0;
+    while (done < length) {
+        auto chunk = std::min(length - done, PAGE_SIZE - (addr + done) % PAGE_SIZE);
+        auto p_addr = physical_address(addr + done);
+        if (!p_addr.has_value() || !emulator.read_memory(p_addr.value(), data.data() + done, chunk)) {
+            break;
+        }
+        done += chunk;
+    }
+    if (done == 0 && length > 0) {
+        return "E14";
+    }
+    return to_hex(data.data(), done);
+}
+
+std::string GdbStub::write_memory(uint64_t addr, const std::vector<uint8_t> &data) {
+    uint64_t done = 0;
+    while (done < data.size()) {
+        auto chunk = std::min(data.size() - done, PAGE_SIZE - (addr + done) % PAGE_SIZE);
+        auto p_addr = physical_address(addr + done);
+        if (!p_addr.has_value() || !emulator.write_memory(p_addr.value(), data.data() + done, chunk)) {
+            return "E14";
+        }
+        done += chunk;
+    }
+    return "OK";
+}
+
+// Z<type>,<addr>,<kind> and z<type>,<addr>,<kind>.
+std::string GdbStub::insert_point(const std::string &packet, bool insert) {
+    size_t pos = 1;
+    auto type = parse_number(packet, pos);
+    uint64_t addr, kind;
+    if (pos >= packet.size() || packet[pos] != ',' || !parse_range(packet, ++pos, addr, kind)) {
+        return "E01";
+    }
+
+    if (type == 0 || type == 1) {
+        auto it = breakpoints.find(addr);
+        if (!insert) {
+            if (it != breakpoints.end()) {
+                emulator.remove_breakpoint(it->second.p_addr);
+                breakpoints.erase(it);
+            }
+            return "OK";
+        }
+        if (it != breakpoints.end()) {
+            return "OK";
+        }
+        auto p_addr = physical_address(addr);
+        if (!p_addr.has_value() || !emulator.insert_breakpoint(p_addr.value())) {
+            return "E14";
+        }
+        breakpoints[addr] = {p_addr.value(), type == 1};
+        return "OK";
+    }
+
+    if (type > 4) {
+        return "";
+    }
+    auto watch_type = type == 2 ? WatchType::Write : type == 3 ? WatchType::Read
+                                                               : WatchType::Access;
+    if (insert) {
+        emulator.insert_watchpoint(addr, kind, watch_type);
+        watches.push_back({addr, kind, watch_type});
+        return "OK";
+    }
+    emulator.remove_watchpoint(addr, kind, watch_type);
+    for (auto it = watches.begin(); it != watches.end(); it++) {
+        if (it->addr == addr && it->length == kind && it->type == watch_type) {
+            watches.erase(it);
+            break;
+        }
+    }
+    return "OK";
+}
+
+std::string GdbStub::monitor(const std::string &command) {
+    std::string output;
+    if (command == "phys") {
+        physical = true;
+        output = "Memory accesses now use physical addresses.\n";
+    } else if (command == "virt") {
+        physical = false;
+        output = "Memory accesses now go through the current address space.\n";
+    } else {
+        output = "monitor phys: access memory by physical address\n"
+                 "monitor virt: access memory through the current address space (default)\n";
+    }
+    send("O" + to_hex(reinterpret_cast<const uint8_t *>(output.data()), output.size()));
+    return "OK";
+}
+
+// Leaves the guest as it would run without a debugger.
+void GdbStub::detach() {
+    for (const auto &[addr, inserted] : breakpoints) {
+        emulator.remove_breakpoint(inserted.p_addr);
+    }
+    breakpoints.clear();
+    for (const auto &watch : watches) {
+        emulator.remove_watchpoint(watch.addr, watch.length, watch.type);
+    }
+    watches.clear();
+    close(connection);
+    connection = -1;
+}
@@ -0,0 +1,78 @@
+#ifndef GDB_STUB_H
+#define GDB_STUB_H
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "emulator.h"
+
+// Instructions a continued guest runs between checks for GDB's interrupt.
+#define GDB_SLICE 100000
+// Largest packet GDB may send, announced in qSupported.
+#define GDB_PACKET_SIZE 0x4000
+
+// A GDB remote serial protocol server for one emulator, so that
+// "target remote" can stop, inspect and step the guest. Registers are the
+// integer registers, pc, the implemented CSRs and the privilege mode ("priv").
+// Memory is accessed through the hart's current address space unless
+// "monitor phys" switches to physical addresses. Breakpoints (software or
+// hardware alike) and watchpoints are the emulator's, so a guest that has none
+// set runs at full speed.
+class GdbStub {
+private:
+    struct Inserted {
+        uint64_t p_addr;
+        bool hardware;
+    };
+    struct Watch {
+        uint64_t addr;
+        uint64_t length;
+        WatchType type;
+    };
+    Emulator &emulator;
+    std::string address;
+    int listener;
+    int connection;
+    // Cleared by QStartNoAckMode.
+    bool acknowledge;
+    bool physical;
+    // Bytes received but not yet parsed.
+    std::string input;
+    // Keyed by the address GDB gave.
+    std::map<uint64_t, Inserted> breakpoints;
+    std::vector<Watch> watches;
+    bool fill();
+    bool receive(std::string &packet);
+    void send(const std::string &payload);
+    bool interrupted();
+    std::string handle(const std::string &packet);
+    std::string resume(bool step);
+    std::string read_registers();
+    std::string write_registers(const std::string &hex);
+    std::string read_register(uint64_t number);
+    std::string write_register(uint64_t number, uint64_t value);
+    std::string read_memory(uint64_t addr, uint64_t length);
+    std::string write_memory(uint64_t addr, const std::vector<uint8_t> &data);
+    std::string insert_point(const std::string &packet, bool insert);
+    std::string monitor(const std::string &command);
+    std::optional<uint64_t> physical_address(uint64_t addr);
+    void detach();
+
+public:
+    // Listens on 127.0.0.1:<address> if address is a port number, otherwise on
+    // a Unix socket at that path. Throws std::runtime_error.
+    GdbStub(Emulator &emulator, const std::string &address);
+    GdbStub(const GdbStub &) = delete;
+    GdbStub &operator=(const GdbStub &) = delete;
+    ~GdbStub();
+    const std::string &get_address() const { return address; };
+    // Waits for GDB to connect and serves it with the guest stopped until GDB
+    // resumes it. Returns true if GDB detached or disconnected, leaving the
+    // guest to run on, and false if it killed the guest or the guest halted.
+    bool serve();
+};
+
+#endif
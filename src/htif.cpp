@@ -0,0 +1,81 @@
+#include "htif.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "uart.h"
+
+Htif::Htif(Bus &bus, uint64_t tohost, uint64_t fromhost, std::function<void(int)> exit) : bus{bus},
+                                                                                          tohost{tohost},
+                                                                                          fromhost{fromhost},
+                                                                                          exit{exit} {
+}
+
+void Htif::write_word(uint64_t addr, uint64_t value) {
+    auto ram = bus.get_ram_pointer(addr, 8);
+    if (ram != nullptr) {
+        std::memcpy(ram, &value, 8);
+    }
+}
+
+void Htif::poll() {
+    auto word = bus.view_ram(tohost, 8);
+    uint64_t command = 0;
+    if (word != nullptr) {
+        std::memcpy(&command, word, 8);
+    }
+    if (command == 0) {
+        return;
+    }
+    write_word(tohost, 0);
+
+    auto device = command >> 56;
+    auto code = (command >> 48) & 0xff;
+    auto payload = command & 0xffff'ffff'ffff;
+    if (device == HTIF_DEVICE_SYSCALL && code == 0) {
+        if ((payload & 1) != 0) {
+            exit((int)(payload >> 1));
+            return;
+        }
+        write_word(payload, syscall(payload));
+    } else if (device == HTIF_DEVICE_CONSOLE && code == HTIF_CONSOLE_PUTCHAR) {
+        bus.store(UART_THR, 1, payload & 0xff);
+    } else {
+        // Console input and unknown devices are never answered.
+        return;
+    }
+    if (fromhost != 0) {
+        write_word(fromhost, device << 56 | code << 48 | 1);
+    }
+}
+
+int64_t Htif::syscall(uint64_t args_addr) {
+    auto words = bus.view_ram(args_addr, 8 * 8);
+    if (words == nullptr) {
+        return -EFAULT;
+    }
+    uint64_t args[8];
+    std::memcpy(args, words, sizeof(args));
+    switch (args[0]) {
+    case HTIF_SYS_WRITE: {
+        if (args[1] != 1 && args[1] != 2) {
+            return -EBADF;
+        }
+        auto length = std::min<uint64_t>(args[3], HTIF_WRITE_MAX);
+        auto buffer = bus.view_ram(args[2], length);
+        if (buffer == nullptr) {
+            return -EFAULT;
+        }
+        for (uint64_t i = 0; i < length; i++) {
+            bus.store(UART_THR, 1, buffer[i]);
+        }
+        return length;
+    }
+    case HTIF_SYS_EXIT:
+        exit((int)args[1]);
+        return 0;
+    default:
+        return -ENOSYS;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef HTIF_H
+#define HTIF_H
+
+#include <cstdint>
+#include <functional>
+
+#include "bus.h"
+
+// Instructions between two looks at tohost, as in spike.
+#define HTIF_INTERVAL 5000
+// A command is device << 56 | command << 48 | payload.
+#define HTIF_DEVICE_SYSCALL 0
+#define HTIF_DEVICE_CONSOLE 1
+#define HTIF_CONSOLE_PUTCHAR 1
+// Guest system call numbers served through the syscall device.
+#define HTIF_SYS_WRITE 64
+#define HTIF_SYS_EXIT 93
+// Bytes printed by one write; longer writes return a short count.
+#define HTIF_WRITE_MAX 4096
+
+// The Berkeley host-target interface, which riscv-tests, riscv-arch-test and
+// spike-targeted bare-metal programs use to print and exit. The guest writes
+// a command to the tohost word in its own RAM and the host acknowledges it in
+// fromhost. Like spike, the emulator polls tohost every HTIF_INTERVAL
+// instructions rather than checking stores, so a guest without one pays nothing.
+//
+// Syscall device, command 0: a payload with bit 0 set exits with status
+// payload >> 1; otherwise the payload points to eight words holding a system
+// call number and its arguments, and the result replaces the number. Only
+// write to stdout or stderr and exit are served. Console device, command 1:
+// prints the payload's low byte. Output goes to the UART's console.
+class Htif {
+private:
+    Bus &bus;
+    uint64_t tohost;
+    uint64_t fromhost;
+    std::function<void(int)> exit;
+    int64_t syscall(uint64_t args_addr);
+    void write_word(uint64_t addr, uint64_t value);
+
+public:
+    // exit is called with the guest's exit status.
+    Htif(Bus &bus, uint64_t tohost, uint64_t fromhost, std::function<void(int)> exit);
+    // Serves the command in tohost, if any.
+    void poll();
+};
+
+#endif
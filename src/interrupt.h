@@ -4,24 +4,20 @@
 #include "trap.h"
 
 enum InterruptType {
-    UserSoftwareInterrupt,
-    SupervisorSoftwareInterrupt,
-    MachineSoftwareInterrupt,
-    UserTimerInterrupt,
-    SupervisorTimerInterrupt,
-    MachineTimerInterrupt,
-    UserExternalInterrupt,
-    SupervisorExternalInterrupt,
-    MachineExternalInterrupt,
+    UserSoftwareInterrupt = 0,
+    SupervisorSoftwareInterrupt = 1,
+    MachineSoftwareInterrupt = 3,
+    UserTimerInterrupt = 4,
+    SupervisorTimerInterrupt = 5,
+    MachineTimerInterrupt = 7,
+    UserExternalInterrupt = 8,
+    SupervisorExternalInterrupt = 9,
+    MachineExternalInterrupt = 11,
 };
 
 class Interrupt : public Trap {
-private:
-    InterruptType type;
-
 public:
     Interrupt(InterruptType type);
-    uint64_t get_code();
 };
 
 #endif
@@ -0,0 +1,1207 @@
+#include "linux_process.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/times.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "cpu.h"
+
+// RV64 Linux system call numbers (asm-generic/unistd.h).
+#define LINUX_SYS_getcwd 17
+#define LINUX_SYS_dup 23
+#define LINUX_SYS_dup3 24
+#define LINUX_SYS_fcntl 25
+#define LINUX_SYS_ioctl 29
+#define LINUX_SYS_mkdirat 34
+#define LINUX_SYS_unlinkat 35
+#define LINUX_SYS_symlinkat 36
+#define LINUX_SYS_linkat 37
+#define LINUX_SYS_renameat 38
+#define LINUX_SYS_ftruncate 46
+#define LINUX_SYS_faccessat 48
+#define LINUX_SYS_chdir 49
+#define LINUX_SYS_fchmod 52
+#define LINUX_SYS_fchmodat 53
+#define LINUX_SYS_openat 56
+#define LINUX_SYS_close 57
+#define LINUX_SYS_pipe2 59
+#define LINUX_SYS_getdents64 61
+#define LINUX_SYS_lseek 62
+#define LINUX_SYS_read 63
+#define LINUX_SYS_write 64
+#define LINUX_SYS_readv 65
+#define LINUX_SYS_writev 66
+#define LINUX_SYS_pread64 67
+#define LINUX_SYS_pwrite64 68
+#define LINUX_SYS_readlinkat 78
+#define LINUX_SYS_newfstatat 79
+#define LINUX_SYS_fstat 80
+#define LINUX_SYS_fsync 82
+#define LINUX_SYS_fdatasync 83
+#define LINUX_SYS_utimensat 88
+#define LINUX_SYS_exit 93
+#define LINUX_SYS_exit_group 94
+#define LINUX_SYS_set_tid_address 96
+#define LINUX_SYS_futex 98
+#define LINUX_SYS_set_robust_list 99
+#define LINUX_SYS_nanosleep 101
+#define LINUX_SYS_clock_gettime 113
+#define LINUX_SYS_clock_getres 114
+#define LINUX_SYS_clock_nanosleep 115
+#define LINUX_SYS_sched_getaffinity 123
+#define LINUX_SYS_sched_yield 124
+#define LINUX_SYS_kill 129
+#define LINUX_SYS_tkill 130
+#define LINUX_SYS_tgkill 131
+#define LINUX_SYS_sigaltstack 132
+#define LINUX_SYS_rt_sigaction 134
+#define LINUX_SYS_rt_sigprocmask 135
+#define LINUX_SYS_times 153
+#define LINUX_SYS_uname 160
+#define LINUX_SYS_getrlimit 163
+#define LINUX_SYS_getrusage 165
+#define LINUX_SYS_umask 166
+#define LINUX_SYS_gettimeofday 169
+#define LINUX_SYS_getpid 172
+#define LINUX_SYS_getppid 173
+#define LINUX_SYS_getuid 174
+#define LINUX_SYS_geteuid 175
+#define LINUX_SYS_getgid 176
+#define LINUX_SYS_getegid 177
+#define LINUX_SYS_gettid 178
+#define LINUX_SYS_brk 214
+#define LINUX_SYS_munmap 215
+#define LINUX_SYS_mremap 216
+#define LINUX_SYS_mmap 222
+#define LINUX_SYS_mprotect 226
+#define LINUX_SYS_madvise 233
+#define LINUX_SYS_prlimit64 261
+#define LINUX_SYS_renameat2 276
+#define LINUX_SYS_getrandom 278
+#define LINUX_SYS_faccessat2 439
+
+// Guest ABI constants that are not the same on every host.
+#define LINUX_O_CREAT 00000100
+#define LINUX_O_EXCL 00000200
+#define LINUX_O_NOCTTY 00000400
+#define LINUX_O_TRUNC 00001000
+#define LINUX_O_APPEND 00002000
+#define LINUX_O_NONBLOCK 00004000
+#define LINUX_O_DSYNC 00010000
+#define LINUX_O_DIRECTORY 00200000
+#define LINUX_O_NOFOLLOW 00400000
+#define LINUX_O_CLOEXEC 02000000
+#define LINUX_O_SYNC 04010000
+#define LINUX_O_PATH 010000000
+
+#define LINUX_PROT_READ 0x1
+#define LINUX_PROT_WRITE 0x2
+#define LINUX_PROT_EXEC 0x4
+#define LINUX_MAP_FIXED 0x10
+#define LINUX_MAP_ANONYMOUS 0x20
+#define LINUX_MAP_FIXED_NOREPLACE 0x100000
+
+#define LINUX_F_DUPFD 0
+#define LINUX_F_GETFD 1
+#define LINUX_F_SETFD 2
+#define LINUX_F_GETFL 3
+#define LINUX_F_SETFL 4
+#define LINUX_F_DUPFD_CLOEXEC 1030
+
+#define LINUX_TCGETS 0x5401
+#define LINUX_TCSETS 0x5402
+#define LINUX_TCSETSW 0x5403
+#define LINUX_TCSETSF 0x5404
+#define LINUX_TIOCGWINSZ 0x5413
+// struct termios as the kernel sees it: four flag words, c_line and 19 c_cc.
+#define LINUX_TERMIOS_SIZE 36
+
+#define LINUX_AT_SYMLINK_NOFOLLOW 0x100
+#define LINUX_AT_REMOVEDIR 0x200
+#define LINUX_AT_EMPTY_PATH 0x1000
+
+#define LINUX_FUTEX_WAIT 0
+#define LINUX_FUTEX_WAKE 1
+
+#define PTE_V (1 << 0)
+#define PTE_R (1 << 1)
+#define PTE_W (1 << 2)
+#define PTE_X (1 << 3)
+#define PTE_U (1 << 4)
+#define PTE_A (1 << 6)
+#define PTE_D (1 << 7)
+
+namespace {
+
+// asm-generic struct stat, which RV64 uses.
+struct LinuxStat {
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t rdev;
+    uint64_t pad1;
+    int64_t size;
+    int32_t blksize;
+    int32_t pad2;
+    int64_t blocks;
+    int64_t atime;
+    uint64_t atime_nsec;
+    int64_t mtime;
+    uint64_t mtime_nsec;
+    int64_t ctime;
+    uint64_t ctime_nsec;
+    uint32_t unused[2];
+};
+static_assert(sizeof(LinuxStat) == 128, "struct stat is 128 bytes on RV64");
+
+LinuxStat to_linux(const struct stat &status) {
+    LinuxStat converted{};
+    converted.dev = status.st_dev;
+    converted.ino = status.st_ino;
+    converted.mode = status.st_mode;
+    converted.nlink = status.st_nlink;
+    converted.uid = status.st_uid;
+    converted.gid = status.st_gid;
+    converted.rdev = status.st_rdev;
+    converted.size = status.st_size;
+    converted.blksize = status.st_blksize;
+    converted.blocks = status.st_blocks;
+    converted.atime = status.st_atim.tv_sec;
+    converted.atime_nsec = status.st_atim.tv_nsec;
+    converted.mtime = status.st_mtim.tv_sec;
+    converted.mtime_nsec = status.st_mtim.tv_nsec;
+    converted.ctime = status.st_ctim.tv_sec;
+    converted.ctime_nsec = status.st_ctim.tv_nsec;
+    return converted;
+}
+
+const struct {
+    uint64_t guest;
+    int host;
+} open_flags[] = {
+    {LINUX_O_CREAT, O_CREAT},
+    {LINUX_O_EXCL, O_EXCL},
+    {LINUX_O_NOCTTY, O_NOCTTY},
+    {LINUX_O_TRUNC, O_TRUNC},
+    {LINUX_O_APPEND, O_APPEND},
+    {LINUX_O_NONBLOCK, O_NONBLOCK},
+    {LINUX_O_DIRECTORY, O_DIRECTORY},
+    {LINUX_O_NOFOLLOW, O_NOFOLLOW},
+    {LINUX_O_CLOEXEC, O_CLOEXEC},
+    // O_SYNC includes the O_DSYNC bit on both sides.
+    {LINUX_O_SYNC, O_SYNC},
+    {LINUX_O_DSYNC, O_DSYNC},
+    {LINUX_O_PATH, O_PATH},
+};
+
+int host_open_flags(uint64_t flags) {
+    int host = flags & O_ACCMODE;
+    for (const auto &flag : open_flags) {
+        if ((flags & flag.guest) == flag.guest) {
+            host |= flag.host;
+        }
+    }
+    return host;
+}
+
+uint64_t guest_open_flags(int flags) {
+    uint64_t guest = flags & O_ACCMODE;
+    for (const auto &flag : open_flags) {
+        if ((flags & flag.host) == flag.host) {
+            guest |= flag.guest;
+        }
+    }
+    return guest;
+}
+
+uint64_t page_down(uint64_t addr) {
+    return addr & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+uint64_t page_up(uint64_t addr) {
+    return (addr + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+uint64_t pte_flags(int prot) {
+    // Leaves need R or X, and W without R is reserved.
+    uint64_t flags = PTE_V | PTE_U | PTE_A | PTE_D | PTE_R;
+    if ((prot & LINUX_PROT_WRITE) != 0) {
+        flags |= PTE_W;
+    }
+    if ((prot & LINUX_PROT_EXEC) != 0) {
+        flags |= PTE_X;
+    }
+    return flags;
+}
+
+int64_t result(int64_t value) {
+    return value < 0 ? -errno : value;
+}
+
+} // namespace
+
+LinuxProcess::LinuxProcess(Cpu &cpu, std::function<void(int)> exit) : cpu{cpu},
+                                                                      exit{exit},
+                                                                      root{0},
+                                                                      next_page{MEMORY_BASE},
+                                                                      free_pages{},
+                                                                      areas{},
+                                                                      brk_start{0},
+                                                                      brk_end{0},
+                                                                      mmap_next{LINUX_MMAP_TOP},
+                                                                      executable{},
+                                                                      reported_syscalls{} {
+    root = allocate_page();
+}
+
+uint8_t *LinuxProcess::ram(uint64_t p_addr) {
+    return cpu.getBus().get_ram_pointer(p_addr, PAGE_SIZE);
+}
+
+// Returns a zeroed physical page, or 0 when RAM is exhausted.
+uint64_t LinuxProcess::allocate_page() {
+    uint64_t page;
+    if (!free_pages.empty()) {
+        page = free_pages.back();
+        free_pages.pop_back();
+    } else if (next_page < MEMORY_BASE + MEMORY_SIZE) {
+        page = next_page;
+        next_page += PAGE_SIZE;
+    } else {
+        return 0;
+    }
+    std::memset(ram(page), 0, PAGE_SIZE);
+    return page;
+}
+
+// The level-0 page table entry for vaddr, or nullptr if its table is missing
+// and create is false or RAM is exhausted.
+uint64_t *LinuxProcess::leaf(uint64_t vaddr, bool create) {
+    auto table = root;
+    for (int level = 2; level > 0; level--) {
+        auto entry = reinterpret_cast<uint64_t *>(ram(table)) + ((vaddr >> (12 + 9 * level)) & 0x1ff);
+        if ((*entry & PTE_V) == 0) {
+            uint64_t page;
+            if (!create || (page = allocate_page()) == 0) {
+                return nullptr;
+            }
+            *entry = (page >> 12) << 10 | PTE_V;
+        }
+        table = (*entry >> 10) << 12;
+    }
+    return reinterpret_cast<uint64_t *>(ram(table)) + ((vaddr >> 12) & 0x1ff);
+}
+
+const LinuxProcess::Area *LinuxProcess::find_area(uint64_t vaddr) {
+    auto next = areas.upper_bound(vaddr);
+    if (next == areas.begin()) {
+        return nullptr;
+    }
+    auto area = std::prev(next);
+    return vaddr < area->second.end ? &area->second : nullptr;
+}
+
+// Maps a zeroed page at vaddr on first touch. False outside the mapped areas
+// or for PROT_NONE ones; a full RAM ends the process.
+bool LinuxProcess::populate(uint64_t vaddr) {
+    auto area = find_area(vaddr);
+    if (area == nullptr || area->prot == 0) {
+        return false;
+    }
+    auto pte = leaf(vaddr, true);
+    if (pte != nullptr && (*pte & PTE_V) != 0) {
+        // Already mapped, so the fault was not about a missing page.
+        return false;
+    }
+    auto page = pte != nullptr ? allocate_page() : 0;
+    if (page == 0) {
+        terminate(SIGKILL, "out of guest memory", vaddr);
+        return true;
+    }
+    *pte = (page >> 12) << 10 | pte_flags(area->prot);
+    return true;
+}
+
+// The host address of the page holding vaddr, mapping it if needed whatever
+// its protection; nullptr outside the mapped areas.
+uint8_t *LinuxProcess::host_page(uint64_t vaddr) {
+    auto area = find_area(vaddr);
+    if (area == nullptr) {
+        return nullptr;
+    }
+    auto pte = leaf(vaddr, true);
+    if (pte == nullptr) {
+        return nullptr;
+    }
+    if ((*pte & PTE_V) == 0) {
+        auto page = allocate_page();
+        if (page == 0) {
+            return nullptr;
+        }
+        *pte = (page >> 12) << 10 | pte_flags(area->prot);
+    }
+    return ram((*pte >> 10) << 12);
+}
+
+// Splits the area containing vaddr, if any, so that one starts there.
+void LinuxProcess::split(uint64_t vaddr) {
+    auto next = areas.upper_bound(vaddr);
+    if (next == areas.begin()) {
+        return;
+    }
+    auto area = std::prev(next);
+    if (area->first < vaddr && vaddr < area->second.end) {
+        areas[vaddr] = {area->second.end, area->second.prot};
+        area->second.end = vaddr;
+    }
+}
+
+void LinuxProcess::unmap(uint64_t start, uint64_t end) {
+    split(start);
+    split(end);
+    areas.erase(areas.lower_bound(start), areas.lower_bound(end));
+    for (auto vaddr = start; vaddr < end;) {
+        auto pte = leaf(vaddr, false);
+        if (pte == nullptr) {
+            // No level-0 table: skip the whole 2 MiB it would cover.
+            vaddr = (vaddr | ((1 << 21) - 1)) + 1;
+            continue;
+        }
+        if ((*pte & PTE_V) != 0) {
+            free_pages.push_back((*pte >> 10) << 12);
+            *pte = 0;
+        }
+        vaddr += PAGE_SIZE;
+    }
+}
+
+// Maps [start, end). Parts already mapped keep their pages and gain prot, so
+// ELF segments sharing a page both get it.
+void LinuxProcess::add_area(uint64_t start, uint64_t end, int prot) {
+    split(start);
+    split(end);
+    auto vaddr = start;
+    for (auto area = areas.lower_bound(start); area != areas.end() && area->first < end; ++area) {
+        if (vaddr < area->first) {
+            areas[vaddr] = {area->first, prot};
+        }
+        area->second.prot |= prot;
+        vaddr = area->second.end;
+    }
+    if (vaddr < end) {
+        areas[vaddr] = {end, prot};
+    }
+}
+
+void LinuxProcess::protect(uint64_t start, uint64_t end, int prot) {
+    split(start);
+    split(end);
+    for (auto area = areas.lower_bound(start); area != areas.end() && area->first < end; ++area) {
+        area->second.prot = prot;
+        for (auto vaddr = area->first; vaddr < area->second.end; vaddr += PAGE_SIZE) {
+            auto pte = leaf(vaddr, false);
+            if (pte != nullptr && (*pte & PTE_V) != 0) {
+                *pte = (*pte & ~(uint64_t)0x3ff) | pte_flags(prot);
+            }
+        }
+    }
+}
+
+bool LinuxProcess::copy_in(void *destination, uint64_t source, uint64_t nBytes) {
+    auto bytes = static_cast<uint8_t *>(destination);
+    while (nBytes > 0) {
+        auto page = host_page(source);
+        if (page == nullptr) {
+            return false;
+        }
+        auto offset = source & (PAGE_SIZE - 1);
+        auto chunk = std::min<uint64_t>(nBytes, PAGE_SIZE - offset);
+        std::memcpy(bytes, page + offset, chunk);
+        bytes += chunk;
+        source += chunk;
+        nBytes -= chunk;
+    }
+    return true;
+}
+
+bool LinuxProcess::copy_out(uint64_t destination, const void *source, uint64_t nBytes) {
+    auto bytes = static_cast<const uint8_t *>(source);
+    while (nBytes > 0) {
+        auto page = host_page(destination);
+        if (page == nullptr) {
+            return false;
+        }
+        auto offset = destination & (PAGE_SIZE - 1);
+        auto chunk = std::min<uint64_t>(nBytes, PAGE_SIZE - offset);
+        std::memcpy(page + offset, bytes, chunk);
+        bytes += chunk;
+        destination += chunk;
+        nBytes -= chunk;
+    }
+    return true;
+}
+
+bool LinuxProcess::read_string(uint64_t addr, std::string &out) {
+    out.clear();
+    while (out.size() < PATH_MAX) {
+        auto page = host_page(addr);
+        if (page == nullptr) {
+            return false;
+        }
+        auto offset = addr & (PAGE_SIZE - 1);
+        auto start = reinterpret_cast<const char *>(page + offset);
+        auto length = strnlen(start, PAGE_SIZE - offset);
+        out.append(start, length);
+        if (offset + length < PAGE_SIZE) {
+            return true;
+        }
+        addr += length;
+    }
+    return false;
+}
+
+void LinuxProcess::terminate(int signal, const char *reason, uint64_t addr) {
+    std::cerr << "riscv-emulator: " << reason << " at 0x" << std::hex << addr
+              << ", pc 0x" << cpu.getPc() - 4 << std::dec << std::endl;
+    exit(128 + signal);
+}
+
+void LinuxProcess::load(const Buffer &elf, const std::vector<std::string> &args, const std::vector<std::string> &env) {
+    if (elf.size() < sizeof(Elf64_Ehdr) || std::memcmp(elf.data(), ELFMAG, SELFMAG) != 0) {
+        throw std::runtime_error("not an ELF file");
+    }
+    Elf64_Ehdr header;
+    std::memcpy(&header, elf.data(), sizeof(header));
+    if (header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_ident[EI_DATA] != ELFDATA2LSB || header.e_machine != EM_RISCV) {
+        throw std::runtime_error("not a little-endian RV64 ELF file");
+    }
+    if (header.e_type != ET_EXEC && header.e_type != ET_DYN) {
+        throw std::runtime_error("not an executable");
+    }
+    uint64_t bias = header.e_type == ET_DYN ? LINUX_PIE_BASE : 0;
+
+    uint64_t phdr = 0;
+    uint64_t end = 0;
+    for (uint64_t i = 0; i < header.e_phnum; i++) {
+        Elf64_Phdr program;
+        auto offset = header.e_phoff + i * header.e_phentsize;
+        if (offset + sizeof(program) > elf.size()) {
+            throw std::runtime_error("truncated ELF program headers");
+        }
+        std::memcpy(&program, elf.data() + offset, sizeof(program));
+        if (program.p_type == PT_INTERP) {
+            throw std::runtime_error("dynamically linked programs are not supported; link with -static");
+        }
+        if (program.p_type == PT_PHDR) {
+            phdr = program.p_vaddr + bias;
+        }
+        if (program.p_type != PT_LOAD) {
+            continue;
+        }
+        if (program.p_offset + program.p_filesz > elf.size() || program.p_filesz > program.p_memsz) {
+            throw std::runtime_error("truncated ELF segment");
+        }
+        auto vaddr = program.p_vaddr + bias;
+        if (vaddr + program.p_memsz > LINUX_MMAP_TOP) {
+            throw std::runtime_error("ELF segment outside the user address space");
+        }
+        int prot = 0;
+        prot |= (program.p_flags & PF_R) != 0 ? LINUX_PROT_READ : 0;
+        prot |= (program.p_flags & PF_W) != 0 ? LINUX_PROT_WRITE : 0;
+        prot |= (program.p_flags & PF_X) != 0 ? LINUX_PROT_EXEC : 0;
+        add_area(page_down(vaddr), page_up(vaddr + program.p_memsz), prot);
+        if (!copy_out(vaddr, elf.data() + program.p_offset, program.p_filesz)) {
+            throw std::runtime_error("program does not fit in guest memory");
+        }
+        if (phdr == 0 && program.p_offset <= header.e_phoff && header.e_phoff < program.p_offset + program.p_filesz) {
+            phdr = vaddr + header.e_phoff - program.p_offset;
+        }
+        end = std::max(end, page_up(vaddr + program.p_memsz));
+    }
+    if (end == 0) {
+        throw std::runtime_error("ELF file has no loadable segments");
+    }
+    brk_start = end;
+    brk_end = end;
+    char path[PATH_MAX];
+    executable = args.empty() || realpath(args[0].c_str(), path) == nullptr ? "" : path;
+
+    add_area(LINUX_STACK_TOP - LINUX_STACK_SIZE, LINUX_STACK_TOP, LINUX_PROT_READ | LINUX_PROT_WRITE);
+    auto sp = (uint64_t)LINUX_STACK_TOP;
+    auto push = [&](const void *bytes, uint64_t nBytes) {
+        sp -= nBytes;
+        if (!copy_out(sp, bytes, nBytes)) {
+            throw std::runtime_error("program does not fit in guest memory");
+        }
+        return sp;
+    };
+    auto push_string = [&](const std::string &s) { return push(s.c_str(), s.size() + 1); };
+
+    auto execfn = push_string(args.empty() ? "" : args[0]);
+    auto platform = push_string("riscv64");
+    uint8_t random[16];
+    if (getrandom(random, sizeof(random), 0) != sizeof(random)) {
+        std::memset(random, 0, sizeof(random));
+    }
+    auto random_addr = push(random, sizeof(random));
+    std::vector<uint64_t> arg_addrs;
+    for (const auto &arg : args) {
+        arg_addrs.push_back(push_string(arg));
+    }
+    std::vector<uint64_t> env_addrs;
+    for (const auto &var : env) {
+        env_addrs.push_back(push_string(var));
+    }
+
+    // 'I', 'M', 'A' and 'V', as the kernel reports them in AT_HWCAP, so that
+    // ifuncs can pick vector code.
+    uint64_t hwcap = (1 << ('I' - 'A')) | (1 << ('M' - 'A')) | (1 << ('A' - 'A')) | (1 << ('V' - 'A'));
+    std::vector<uint64_t> auxv = {
+        AT_PHDR, phdr,
+        AT_PHENT, header.e_phentsize,
+        AT_PHNUM, header.e_phnum,
+        AT_PAGESZ, PAGE_SIZE,
+        AT_BASE, 0,
+        AT_FLAGS, 0,
+        AT_ENTRY, header.e_entry + bias,
+        AT_UID, getuid(),
+        AT_EUID, geteuid(),
+        AT_GID, getgid(),
+        AT_EGID, getegid(),
+        AT_HWCAP, hwcap,
+        AT_CLKTCK, (uint64_t)sysconf(_SC_CLK_TCK),
+        AT_SECURE, 0,
+        AT_RANDOM, random_addr,
+        AT_EXECFN, execfn,
+        AT_PLATFORM, platform,
+        AT_NULL, 0,
+    };
+    std::vector<uint64_t> table;
+    table.push_back(args.size());
+    table.insert(table.end(), arg_addrs.begin(), arg_addrs.end());
+    table.push_back(0);
+    table.insert(table.end(), env_addrs.begin(), env_addrs.end());
+    table.push_back(0);
+    table.insert(table.end(), auxv.begin(), auxv.end());
+    sp = (sp - table.size() * 8) & ~(uint64_t)15;
+    if (!copy_out(sp, table.data(), table.size() * 8)) {
+        throw std::runtime_error("program does not fit in guest memory");
+    }
+
+    for (int i = 0; i < 32; i++) {
+        cpu.setRegister(i, 0);
+    }
+    cpu.setRegister(2, sp);
+    cpu.setPc(header.e_entry + bias);
+    cpu.store_csr(SATP, (uint64_t)8 << 60 | root >> 12);
+    cpu.setMode(Mode::User);
+}
+
+void LinuxProcess::trap(const Trap &trap) {
+    // The pc is already past the trapping instruction.
+    switch (trap.get_code()) {
+    case ExceptionType::EnvironmentCallFromUMode: {
+        uint64_t args[6];
+        for (int i = 0; i < 6; i++) {
+            args[i] = cpu.getRegister(10 + i);
+        }
+        auto value = syscall(cpu.getRegister(17), args);
+        cpu.setRegister(10, value);
+        return;
+    }
+    case ExceptionType::InstructionPageFault:
+    case ExceptionType::LoadPageFault:
+    case ExceptionType::StoreAMOPageFault:
+        if (populate(trap.get_tval())) {
+            cpu.setPc(cpu.getPc() - 4);
+            return;
+        }
+        terminate(SIGSEGV, "segmentation fault", trap.get_tval());
+        return;
+    case ExceptionType::IllegalInstruction:
+        terminate(SIGILL, "illegal instruction", trap.get_tval());
+        return;
+    case ExceptionType::Breakpoint:
+        terminate(SIGTRAP, "breakpoint", cpu.getPc() - 4);
+        return;
+    case ExceptionType::InstructionAddressMisaligned:
+    case ExceptionType::LoadAddressMisaligned:
+    case ExceptionType::StoreAMOAddressMisaligned:
+        terminate(SIGBUS, "misaligned access", trap.get_tval());
+        return;
+    default:
+        terminate(SIGSEGV, "access fault", trap.get_tval());
+        return;
+    }
+}
+
+// Returns the value for a0: a result, or -errno. The host is Linux too, so
+// errno values, clock IDs and *at() flags carry over unchanged.
+int64_t LinuxProcess::syscall(uint64_t number, const uint64_t args[6]) {
+    auto fd = (int)args[0];
+    std::string path;
+    std::string other;
+    switch (number) {
+    case LINUX_SYS_getcwd: {
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+            return -errno;
+        }
+        auto length = std::strlen(cwd) + 1;
+        if (length > args[1]) {
+            return -ERANGE;
+        }
+        return copy_out(args[0], cwd, length) ? length : -EFAULT;
+    }
+    case LINUX_SYS_dup:
+        return result(dup(fd));
+    case LINUX_SYS_dup3:
+        return result(dup3(fd, (int)args[1], (args[2] & LINUX_O_CLOEXEC) != 0 ? O_CLOEXEC : 0));
+    case LINUX_SYS_fcntl:
+        return sys_fcntl(fd, args[1], args[2]);
+    case LINUX_SYS_ioctl:
+        return sys_ioctl(fd, args[1], args[2]);
+    case LINUX_SYS_mkdirat:
+        if (!read_string(args[1], path)) {
+            return -EFAULT;
+        }
+        return result(mkdirat(fd, path.c_str(), args[2]));
+    case LINUX_SYS_unlinkat:
+        if (!read_string(args[1], path)) {
+            return -EFAULT;
+        }
+        return result(unlinkat(fd, path.c_str(), (args[2] & LINUX_AT_REMOVEDIR) != 0 ? AT_REMOVEDIR : 0));
+    case LINUX_SYS_symlinkat:
+        if (!read_string(args[0], other) || !read_string(args[2], path)) {
+            return -EFAULT;
+        }
+        return result(symlinkat(other.c_str(), (int)args[1], path.c_str()));
+    case LINUX_SYS_linkat:
+        if (!read_string(args[1], other) || !read_string(args[3], path)) {
+            return -EFAULT;
+        }
+        return result(linkat(fd, other.c_str(), (int)args[2], path.c_str(), args[4]));
+    case LINUX_SYS_renameat:
+    case LINUX_SYS_renameat2:
+        if (number == LINUX_SYS_renameat2 && args[4] != 0) {
+            return -EINVAL;
+        }
+        if (!read_string(args[1], other) || !read_string(args[3], path)) {
+            return -EFAULT;
+        }
+        return result(renameat(fd, other.c_str(), (int)args[2], path.c_str()));
+    case LINUX_SYS_ftruncate:
+        return result(ftruncate(fd, args[1]));
+    case LINUX_SYS_faccessat:
+    case LINUX_SYS_faccessat2:
+        if (!read_string(args[1], path)) {
+            return -EFAULT;
+        }
+        return result(faccessat(fd, path.c_str(), args[2], 0));
+    case LINUX_SYS_chdir:
+        if (!read_string(args[0], path)) {
+            return -EFAULT;
+        }
+        return result(chdir(path.c_str()));
+    case LINUX_SYS_fchmod:
+        return result(fchmod(fd, args[1]));
+    case LINUX_SYS_fchmodat:
+        if (!read_string(args[1], path)) {
+            return -EFAULT;
+        }
+        return result(fchmodat(fd, path.c_str(), args[2], 0));
+    case LINUX_SYS_openat:
+        return sys_openat(fd, args[1], args[2], args[3]);
+    case LINUX_SYS_close:
+        // The emulator's own standard streams stay open.
+        return fd <= STDERR_FILENO ? 0 : result(close(fd));
+    case LINUX_SYS_pipe2: {
+        int fds[2];
+        if (pipe2(fds, host_open_flags(args[1] & (LINUX_O_CLOEXEC | LINUX_O_NONBLOCK))) != 0) {
+            return -errno;
+        }
+        int32_t guest_fds[2] = {fds[0], fds[1]};
+        return copy_out(args[0], guest_fds, sizeof(guest_fds)) ? 0 : -EFAULT;
+    }
+    case LINUX_SYS_getdents64: {
+        // struct linux_dirent64 has the same layout everywhere.
+        std::vector<uint8_t> entries(std::min<uint64_t>(args[2], LINUX_IO_CHUNK));
+        auto n = getdents64(fd, entries.data(), entries.size());
+        if (n < 0) {
+            return -errno;
+        }
+        return copy_out(args[1], entries.data(), n) ? n : -EFAULT;
+    }
+    case LINUX_SYS_lseek:
+        return result(lseek(fd, args[1], args[2]));
+    case LINUX_SYS_read:
+        return sys_read(fd, args[1], args[2], -1);
+    case LINUX_SYS_write:
+        return sys_write(fd, args[1], args[2], -1);
+    case LINUX_SYS_readv:
+        return sys_vector_io(fd, args[1], args[2], false);
+    case LINUX_SYS_writev:
+        return sys_vector_io(fd, args[1], args[2], true);
+    case LINUX_SYS_pread64:
+        return (int64_t)args[3] < 0 ? -EINVAL : sys_read(fd, args[1], args[2], args[3]);
+    case LINUX_SYS_pwrite64:
+        return (int64_t)args[3] < 0 ? -EINVAL : sys_write(fd, args[1], args[2], args[3]);
+    case LINUX_SYS_readlinkat:
+        return sys_readlinkat(fd, args[1], args[2], args[3]);
+    case LINUX_SYS_newfstatat:
+        return sys_fstatat(fd, args[1], args[2], args[3]);
+    case LINUX_SYS_fstat: {
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            return -errno;
+        }
+        auto converted = to_linux(status);
+        return copy_out(args[1], &converted, sizeof(converted)) ? 0 : -EFAULT;
+    }
+    case LINUX_SYS_fsync:
+        return result(fsync(fd));
+    case LINUX_SYS_fdatasync:
+        return result(fdatasync(fd));
+    case LINUX_SYS_utimensat: {
+        struct timespec times[2];
+        if (args[2] != 0 && !copy_in(times, args[2], sizeof(times))) {
+            return -EFAULT;
+        }
+        if (args[1] != 0 && !read_string(args[1], path)) {
+            return -EFAULT;
+        }
+        auto flags = (args[3] & LINUX_AT_SYMLINK_NOFOLLOW) != 0 ? AT_SYMLINK_NOFOLLOW : 0;
+        auto times_ptr = args[2] != 0 ? times : nullptr;
+        if (args[1] == 0) {
+            return result(futimens(fd, times_ptr));
+        }
+        return result(utimensat(fd, path.c_str(), times_ptr, flags));
+    }
+    case LINUX_SYS_exit:
+    case LINUX_SYS_exit_group:
+        exit(args[0] & 0xff);
+        return 0;
+    case LINUX_SYS_set_tid_address:
+    case LINUX_SYS_gettid:
+    case LINUX_SYS_getpid:
+        return getpid();
+    case LINUX_SYS_futex: {
+        // With one thread, a wait could never be woken.
+        if ((args[1] & 0x7f) == LINUX_FUTEX_WAKE) {
+            return 0;
+        }
+        if ((args[1] & 0x7f) == LINUX_FUTEX_WAIT) {
+            uint32_t value;
+            if (!copy_in(&value, args[0], sizeof(value))) {
+                return -EFAULT;
+            }
+            return value != (uint32_t)args[2] ? -EAGAIN : -ETIMEDOUT;
+        }
+        return -ENOSYS;
+    }
+    case LINUX_SYS_set_robust_list:
+    case LINUX_SYS_sigaltstack:
+    case LINUX_SYS_madvise:
+        return 0;
+    case LINUX_SYS_nanosleep:
+    case LINUX_SYS_clock_nanosleep: {
+        // struct timespec is two 64-bit words on both sides.
+        auto request_addr = number == LINUX_SYS_nanosleep ? args[0] : args[2];
+        struct timespec request;
+        if (!copy_in(&request, request_addr, sizeof(request))) {
+            return -EFAULT;
+        }
+        if (number == LINUX_SYS_nanosleep) {
+            return result(nanosleep(&request, nullptr));
+        }
+        return -clock_nanosleep(args[0], args[1], &request, nullptr);
+    }
+    case LINUX_SYS_clock_gettime:
+    case LINUX_SYS_clock_getres: {
+        struct timespec time;
+        auto status = number == LINUX_SYS_clock_gettime ? clock_gettime(args[0], &time) : clock_getres(args[0], &time);
+        if (status != 0) {
+            return -errno;
+        }
+        return args[1] == 0 || copy_out(args[1], &time, sizeof(time)) ? 0 : -EFAULT;
+    }
+    case LINUX_SYS_sched_getaffinity: {
+        // One hart.
+        uint64_t mask = 1;
+        if (args[1] < sizeof(mask)) {
+            return -EINVAL;
+        }
+        return copy_out(args[2], &mask, sizeof(mask)) ? sizeof(mask) : -EFAULT;
+    }
+    case LINUX_SYS_sched_yield:
+        return 0;
+    case LINUX_SYS_kill:
+    case LINUX_SYS_tkill:
+    case LINUX_SYS_tgkill: {
+        auto signal = number == LINUX_SYS_tgkill ? args[2] : args[1];
+        if (signal == 0) {
+            return 0;
+        }
+        // No handlers are ever installed, so every signal is fatal.
+        terminate(signal, "killed by a signal", cpu.getPc() - 4);
+        return 0;
+    }
+    case LINUX_SYS_rt_sigaction:
+    case LINUX_SYS_rt_sigprocmask: {
+        // Accepted and ignored; report empty previous state.
+        // struct sigaction is a handler, flags and the mask; a3 is the mask size.
+        auto size = number == LINUX_SYS_rt_sigaction ? 16 + args[3] : args[3];
+        std::vector<uint8_t> zeros(std::min<uint64_t>(size, 128));
+        return args[2] == 0 || copy_out(args[2], zeros.data(), zeros.size()) ? 0 : -EFAULT;
+    }
+    case LINUX_SYS_times: {
+        struct tms buffer;
+        auto ticks = times(&buffer);
+        return args[0] == 0 || copy_out(args[0], &buffer, sizeof(buffer)) ? ticks : -EFAULT;
+    }
+    case LINUX_SYS_uname:
+        return sys_uname(args[0]);
+    case LINUX_SYS_getrlimit:
+    case LINUX_SYS_prlimit64: {
+        // Only ever reports the limits; the emulator does not enforce them.
+        auto resource = number == LINUX_SYS_getrlimit ? args[0] : args[1];
+        auto old = number == LINUX_SYS_getrlimit ? args[1] : args[3];
+        struct rlimit limit;
+        if (number == LINUX_SYS_prlimit64 && args[0] != 0 && args[0] != (uint64_t)getpid()) {
+            return -EPERM;
+        }
+        if (getrlimit(resource, &limit) != 0) {
+            return -errno;
+        }
+        if (resource == RLIMIT_STACK) {
+            limit.rlim_cur = limit.rlim_max = LINUX_STACK_SIZE;
+        }
+        return old == 0 || copy_out(old, &limit, sizeof(limit)) ? 0 : -EFAULT;
+    }
+    case LINUX_SYS_getrusage: {
+        struct rusage usage;
+        if (getrusage(args[0], &usage) != 0) {
+            return -errno;
+        }
+        return copy_out(args[1], &usage, sizeof(usage)) ? 0 : -EFAULT;
+    }
+    case LINUX_SYS_umask:
+        return umask(args[0]);
+    case LINUX_SYS_gettimeofday: {
+        struct timeval time;
+        gettimeofday(&time, nullptr);
+        return args[0] == 0 || copy_out(args[0], &time, sizeof(time)) ? 0 : -EFAULT;
+    }
+    case LINUX_SYS_getppid:
+        return getppid();
+    case LINUX_SYS_getuid:
+        return getuid();
+    case LINUX_SYS_geteuid:
+        return geteuid();
+    case LINUX_SYS_getgid:
+        return getgid();
+    case LINUX_SYS_getegid:
+        return getegid();
+    case LINUX_SYS_brk:
+        return sys_brk(args[0]);
+    case LINUX_SYS_munmap:
+        return sys_munmap(args[0], args[1]);
+    case LINUX_SYS_mremap:
+        // C libraries fall back to mmap and copy.
+        return -ENOMEM;
+    case LINUX_SYS_mmap:
+        return sys_mmap(args[0], args[1], args[2], args[3], (int)args[4], args[5]);
+    case LINUX_SYS_mprotect:
+        return sys_mprotect(args[0], args[1], args[2]);
+    case LINUX_SYS_getrandom: {
+        std::vector<uint8_t> bytes(std::min<uint64_t>(args[1], LINUX_IO_CHUNK));
+        auto n = getrandom(bytes.data(), bytes.size(), args[2] & (GRND_NONBLOCK | GRND_RANDOM));
+        if (n < 0) {
+            return -errno;
+        }
+        return copy_out(args[0], bytes.data(), n) ? n : -EFAULT;
+    }
+    default:
+        if (reported_syscalls.insert(number).second) {
+            std::cerr << "riscv-emulator: unsupported system call " << number << std::endl;
+        }
+        return -ENOSYS;
+    }
+}
+
+int64_t LinuxProcess::sys_read(int fd, uint64_t buffer, uint64_t count, int64_t offset) {
+    std::vector<uint8_t> bytes(std::min<uint64_t>(count, LINUX_IO_CHUNK));
+    auto n = offset < 0 ? read(fd, bytes.data(), bytes.size()) : pread(fd, bytes.data(), bytes.size(), offset);
+    if (n < 0) {
+        return -errno;
+    }
+    return copy_out(buffer, bytes.data(), n) ? n : -EFAULT;
+}
+
+int64_t LinuxProcess::sys_write(int fd, uint64_t buffer, uint64_t count, int64_t offset) {
+    std::vector<uint8_t> bytes(std::min<uint64_t>(count, LINUX_IO_CHUNK));
+    if (!copy_in(bytes.data(), buffer, bytes.size())) {
+        return -EFAULT;
+    }
+    if (fd == STDOUT_FILENO || fd == STDERR_FILENO) {
+        // Keep the guest's output in order with the emulator's own.
+        std::cout.flush();
+    }
+    auto n = offset < 0 ? write(fd, bytes.data(), bytes.size()) : pwrite(fd, bytes.data(), bytes.size(), offset);
+    return n < 0 ? -errno : n;
+}
+
+int64_t LinuxProcess::sys_vector_io(int fd, uint64_t iov, uint64_t count, bool is_write) {
+    if (count > IOV_MAX) {
+        return -EINVAL;
+    }
+    int64_t total = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t vector[2];
+        if (!copy_in(vector, iov + i * sizeof(vector), sizeof(vector))) {
+            return total > 0 ? total : -EFAULT;
+        }
+        if (vector[1] == 0) {
+            continue;
+        }
+        auto n = is_write ? sys_write(fd, vector[0], vector[1], -1) : sys_read(fd, vector[0], vector[1], -1);
+        if (n < 0) {
+            return total > 0 ? total : n;
+        }
+        total += n;
+        if ((uint64_t)n < vector[1]) {
+            break;
+        }
+    }
+    return total;
+}
+
+int64_t LinuxProcess::sys_openat(int dirfd, uint64_t path, uint64_t flags, uint64_t mode) {
+    std::string name;
+    if (!read_string(path, name)) {
+        return -EFAULT;
+    }
+    return result(openat(dirfd, name.c_str(), host_open_flags(flags), (mode_t)mode));
+}
+
+int64_t LinuxProcess::sys_fstatat(int dirfd, uint64_t path, uint64_t statbuf, uint64_t flags) {
+    std::string name;
+    if (!read_string(path, name)) {
+        return -EFAULT;
+    }
+    int host_flags = 0;
+    host_flags |= (flags & LINUX_AT_SYMLINK_NOFOLLOW) != 0 ? AT_SYMLINK_NOFOLLOW : 0;
+    host_flags |= (flags & LINUX_AT_EMPTY_PATH) != 0 ? AT_EMPTY_PATH : 0;
+    struct stat status;
+    if (fstatat(dirfd, name.c_str(), &status, host_flags) != 0) {
+        return -errno;
+    }
+    auto converted = to_linux(status);
+    return copy_out(statbuf, &converted, sizeof(converted)) ? 0 : -EFAULT;
+}
+
+int64_t LinuxProcess::sys_fcntl(int fd, uint64_t command, uint64_t argument) {
+    switch (command) {
+    case LINUX_F_DUPFD:
+        return result(fcntl(fd, F_DUPFD, (int)argument));
+    case LINUX_F_DUPFD_CLOEXEC:
+        return result(fcntl(fd, F_DUPFD_CLOEXEC, (int)argument));
+    case LINUX_F_GETFD:
+        return result(fcntl(fd, F_GETFD));
+    case LINUX_F_SETFD:
+        return result(fcntl(fd, F_SETFD, (int)argument & FD_CLOEXEC));
+    case LINUX_F_GETFL: {
+        auto flags = fcntl(fd, F_GETFL);
+        return flags < 0 ? -errno : guest_open_flags(flags);
+    }
+    case LINUX_F_SETFL:
+        return result(fcntl(fd, F_SETFL, host_open_flags(argument)));
+    default:
+        return -EINVAL;
+    }
+}
+
+int64_t LinuxProcess::sys_ioctl(int fd, uint64_t request, uint64_t argument) {
+    uint8_t buffer[64] = {};
+    switch (request) {
+    case LINUX_TCGETS:
+        if (ioctl(fd, TCGETS, buffer) != 0) {
+            return -errno;
+        }
+        return copy_out(argument, buffer, LINUX_TERMIOS_SIZE) ? 0 : -EFAULT;
+    case LINUX_TCSETS:
+    case LINUX_TCSETSW:
+    case LINUX_TCSETSF: {
+        if (!copy_in(buffer, argument, LINUX_TERMIOS_SIZE)) {
+            return -EFAULT;
+        }
+        auto host_request = request == LINUX_TCSETS ? TCSETS : request == LINUX_TCSETSW ? TCSETSW : TCSETSF;
+        return result(ioctl(fd, host_request, buffer));
+    }
+    case LINUX_TIOCGWINSZ: {
+        struct winsize size;
+        if (ioctl(fd, TIOCGWINSZ, &size) != 0) {
+            return -errno;
+        }
+        return copy_out(argument, &size, sizeof(size)) ? 0 : -EFAULT;
+    }
+    default:
+        return -ENOTTY;
+    }
+}
+
+int64_t LinuxProcess::sys_readlinkat(int dirfd, uint64_t path, uint64_t buffer, uint64_t size) {
+    std::string name;
+    if (!read_string(path, name)) {
+        return -EFAULT;
+    }
+    std::string target;
+    if (name == "/proc/self/exe" && !executable.empty()) {
+        // The guest program, not the emulator.
+        target = executable;
+    } else {
+        char link[PATH_MAX];
+        auto n = readlinkat(dirfd, name.c_str(), link, sizeof(link));
+        if (n < 0) {
+            return -errno;
+        }
+        target.assign(link, n);
+    }
+    auto n = std::min<uint64_t>(target.size(), size);
+    return copy_out(buffer, target.data(), n) ? n : -EFAULT;
+}
+
+int64_t LinuxProcess::sys_brk(uint64_t addr) {
+    if (addr < brk_start || addr >= mmap_next) {
+        return brk_end;
+    }
+    auto old_end = page_up(brk_end);
+    auto new_end = page_up(addr);
+    if (new_end > old_end) {
+        for (auto area = areas.lower_bound(old_end); area != areas.end() && area->first < new_end; ++area) {
+            // Something is mapped in the way.
+            return brk_end;
+        }
+        add_area(old_end, new_end, LINUX_PROT_READ | LINUX_PROT_WRITE);
+    } else if (new_end < old_end) {
+        unmap(new_end, old_end);
+    }
+    brk_end = addr;
+    return brk_end;
+}
+
+// Pages are private: MAP_SHARED file mappings are read in once and never
+// written back.
+int64_t LinuxProcess::sys_mmap(uint64_t addr, uint64_t length, int prot, uint64_t flags, int fd, int64_t offset) {
+    auto fixed = (flags & (LINUX_MAP_FIXED | LINUX_MAP_FIXED_NOREPLACE)) != 0;
+    if (length == 0 || (offset & (PAGE_SIZE - 1)) != 0 || (fixed && (addr & (PAGE_SIZE - 1)) != 0)) {
+        return -EINVAL;
+    }
+    length = page_up(length);
+    if (length == 0 || length > LINUX_MMAP_TOP) {
+        return -ENOMEM;
+    }
+    auto anonymous = (flags & LINUX_MAP_ANONYMOUS) != 0;
+    struct stat status;
+    if (!anonymous && fstat(fd, &status) != 0) {
+        return -EBADF;
+    }
+
+    uint64_t start;
+    if (fixed) {
+        if (addr + length > LINUX_STACK_TOP || addr + length < addr) {
+            return -ENOMEM;
+        }
+        start = addr;
+        if ((flags & LINUX_MAP_FIXED_NOREPLACE) != 0) {
+            auto area = areas.lower_bound(start);
+            auto overlaps = (area != areas.end() && area->first < start + length) || find_area(start) != nullptr;
+            if (overlaps) {
+                return -EEXIST;
+            }
+        }
+    } else {
+        // Compared without wrapping, as length may exceed mmap_next.
+        auto floor = page_up(brk_end);
+        if (mmap_next < floor || length > mmap_next - floor) {
+            return -ENOMEM;
+        }
+        start = mmap_next - length;
+        mmap_next = start;
+    }
+    unmap(start, start + length);
+    add_area(start, start + length, prot & (LINUX_PROT_READ | LINUX_PROT_WRITE | LINUX_PROT_EXEC));
+
+    if (!anonymous) {
+        for (uint64_t done = 0; done < length; done += PAGE_SIZE) {
+            auto page = host_page(start + done);
+            if (page == nullptr) {
+                unmap(start, start + length);
+                return -ENOMEM;
+            }
+            auto n = pread(fd, page, PAGE_SIZE, offset + done);
+            if (n < 0) {
+                auto error = errno;
+                unmap(start, start + length);
+                return -error;
+            }
+            if (n < PAGE_SIZE) {
+                break;
+            }
+        }
+    }
+    return start;
+}
+
+int64_t LinuxProcess::sys_munmap(uint64_t addr, uint64_t length) {
+    if ((addr & (PAGE_SIZE - 1)) != 0 || length == 0 || addr + length < addr) {
+        return -EINVAL;
+    }
+    unmap(addr, page_up(addr + length));
+    return 0;
+}
+
+int64_t LinuxProcess::sys_mprotect(uint64_t addr, uint64_t length, int prot) {
+    if ((addr & (PAGE_SIZE - 1)) != 0 || addr + length < addr) {
+        return -EINVAL;
+    }
+    protect(addr, page_up(addr + length), prot & (LINUX_PROT_READ | LINUX_PROT_WRITE | LINUX_PROT_EXEC));
+    return 0;
+}
+
+int64_t LinuxProcess::sys_uname(uint64_t buffer) {
+    struct utsname name;
+    if (uname(&name) != 0) {
+        return -errno;
+    }
+    // Six 65-byte fields.
+    char fields[6][65] = {};
+    const char *values[6] = {name.sysname, name.nodename, name.release, name.version, "riscv64", name.domainname};
+    for (int i = 0; i < 6; i++) {
+        std::memcpy(fields[i], values[i], strnlen(values[i], 64));
+    }
+    return copy_out(buffer, fields, sizeof(fields)) ? 0 : -EFAULT;
+}
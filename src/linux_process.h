@@ -0,0 +1,91 @@
+#ifndef LINUX_PROCESS_H
+#define LINUX_PROCESS_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "trap.h"
+
+class Cpu;
+
+// Guest virtual address space: Sv39 user addresses are below 2^38.
+#define LINUX_STACK_TOP 0x3fffff0000
+#define LINUX_STACK_SIZE (8 * 1024 * 1024)
+// mmap() hands out addresses downwards from here.
+#define LINUX_MMAP_TOP 0x3f00000000
+// Where position-independent executables are loaded.
+#define LINUX_PIE_BASE 0x10000000
+// Most bytes one read() or write() moves; the rest is a short count.
+#define LINUX_IO_CHUNK (1024 * 1024)
+
+// A single-threaded Linux process in U-mode, with the host as its kernel:
+// ecalls are RV64 Linux system calls, translated to host system calls, and
+// page faults fill in memory lazily. The address space lives in Sv39 page
+// tables in guest RAM, so RAM bounds the process's memory. File descriptors
+// are the host's own.
+class LinuxProcess {
+private:
+    struct Area {
+        uint64_t end;
+        int prot;
+    };
+
+    Cpu &cpu;
+    std::function<void(int)> exit;
+    uint64_t root;
+    uint64_t next_page;
+    std::vector<uint64_t> free_pages;
+    // Mapped ranges by start address, page-aligned and disjoint.
+    std::map<uint64_t, Area> areas;
+    uint64_t brk_start;
+    uint64_t brk_end;
+    uint64_t mmap_next;
+    std::string executable;
+    std::set<uint64_t> reported_syscalls;
+
+    uint8_t *ram(uint64_t p_addr);
+    uint64_t allocate_page();
+    uint64_t *leaf(uint64_t vaddr, bool create);
+    const Area *find_area(uint64_t vaddr);
+    bool populate(uint64_t vaddr);
+    uint8_t *host_page(uint64_t vaddr);
+    void split(uint64_t vaddr);
+    void unmap(uint64_t start, uint64_t end);
+    void add_area(uint64_t start, uint64_t end, int prot);
+    void protect(uint64_t start, uint64_t end, int prot);
+
+    bool copy_in(void *destination, uint64_t source, uint64_t nBytes);
+    bool copy_out(uint64_t destination, const void *source, uint64_t nBytes);
+    bool read_string(uint64_t addr, std::string &out);
+    void terminate(int signal, const char *reason, uint64_t addr);
+
+    int64_t syscall(uint64_t number, const uint64_t args[6]);
+    int64_t sys_read(int fd, uint64_t buffer, uint64_t count, int64_t offset);
+    int64_t sys_write(int fd, uint64_t buffer, uint64_t count, int64_t offset);
+    int64_t sys_vector_io(int fd, uint64_t iov, uint64_t count, bool is_write);
+    int64_t sys_openat(int dirfd, uint64_t path, uint64_t flags, uint64_t mode);
+    int64_t sys_fstatat(int dirfd, uint64_t path, uint64_t statbuf, uint64_t flags);
+    int64_t sys_fcntl(int fd, uint64_t command, uint64_t argument);
+    int64_t sys_ioctl(int fd, uint64_t request, uint64_t argument);
+    int64_t sys_readlinkat(int dirfd, uint64_t path, uint64_t buffer, uint64_t size);
+    int64_t sys_brk(uint64_t addr);
+    int64_t sys_mmap(uint64_t addr, uint64_t length, int prot, uint64_t flags, int fd, int64_t offset);
+    int64_t sys_munmap(uint64_t addr, uint64_t length);
+    int64_t sys_mprotect(uint64_t addr, uint64_t length, int prot);
+    int64_t sys_uname(uint64_t buffer);
+
+public:
+    LinuxProcess(Cpu &cpu, std::function<void(int)> exit);
+    // Maps a static RV64 ELF executable and builds its initial stack: argc,
+    // argv, envp and the auxiliary vector. Throws std::runtime_error.
+    void load(const Buffer &elf, const std::vector<std::string> &args, const std::vector<std::string> &env);
+    // Handles an exception taken in U-mode, in place of a kernel.
+    void trap(const Trap &trap);
+};
+
+#endif
@@ -1,68 +1,626 @@
-#include <bitset>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "cpu.h"
+#include <elf.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::cerr << "error: invalid number of parameters" << std::endl;
+#include "emulator.h"
+#include "expect.h"
+#include "fuzz.h"
+#include "gdb_stub.h"
+#include "metrics.h"
+#include "scheduler.h"
+
+#define BATCH_SLICE 100000
+// Instructions listed in the --cache report.
+#define CACHE_REPORT_PCS 20
+// Functions listed in the --timing report.
+#define TIMING_REPORT_FUNCTIONS 20
+// Instructions each --fuzz input may run unless --fuzz-timeout says otherwise.
+#define FUZZ_TIMEOUT 10000000
+// How often --metrics rewrites its file.
+#define METRICS_INTERVAL std::chrono::seconds(5)
+
+namespace {
+
+struct Options {
+    std::string record_path;
+    std::string replay_path;
+    std::string trace_path;
+    std::string cache_spec;
+    std::string coverage_spec;
+    std::string aot_path;
+    std::string symbols_path;
+    std::string metrics_path;
+    std::string batch_path;
+    int batch_threads = 0;
+    std::string clone_prefix;
+    int clone_count = 0;
+    uint64_t clone_at = 0;
+    bool idle_detect = false;
+    bool timing = false;
+    bool sbi = false;
+    bool user = false;
+    std::string fuzz_path;
+    uint64_t fuzz_timeout = FUZZ_TIMEOUT;
+    std::string gdb_address;
+    std::string signature_path;
+    std::string expect_path;
+    std::string share_path;
+    uint64_t shmem_size = 0;
+};
+
+// Lets Ctrl-C stop the guest cleanly so traces and input logs are flushed.
+std::atomic<Emulator *> interrupted_emulator{nullptr};
+
+void handle_interrupt(int) {
+    auto emulator = interrupted_emulator.load();
+    if (emulator != nullptr) {
+        emulator->request_stop();
+    }
+}
+
+// With --metrics, SIGUSR1 dumps the metrics to stderr.
+std::atomic<MetricsExporter *> metrics_exporter{nullptr};
+
+void handle_metrics_dump(int) {
+    auto exporter = metrics_exporter.load();
+    if (exporter != nullptr) {
+        exporter->request_dump();
+    }
+}
+
+// SIGUSR2 rings the guest through --shmem, on vector 0.
+std::atomic<SharedMemory *> shared_memory{nullptr};
+
+void handle_doorbell(int) {
+    auto device = shared_memory.load();
+    if (device != nullptr) {
+        device->ring(0);
+    }
+}
+
+// Child i of --clone reads its console input from <prefix>.<i>.in, if present,
+// and writes its console to <prefix>.<i>.log. Returns the guest's exit status.
+int run_clone(Emulator &emulator, const std::string &path) {
+    std::ofstream log(path + ".log", std::ofstream::binary);
+    emulator.set_console_output([&log](uint8_t c) { log.put(c); });
+    emulator.set_idle_policy(IdlePolicy::FastForward);
+    std::ifstream input(path + ".in", std::ifstream::binary);
+    char c;
+    while (input.get(c)) {
+        emulator.console_input(c);
+    }
+
+    auto reason = StopReason::Budget;
+    while (reason == StopReason::Budget) {
+        reason = emulator.run(UINT64_MAX);
+    }
+    log.flush();
+    if (!emulator.get_error().empty()) {
+        std::cerr << path << ": error: " << emulator.get_error() << std::endl;
+    }
+    return reason == StopReason::Requested ? EXIT_FAILURE : emulator.get_exit_status();
+}
+
+// Boots the guest once, up to --clone-at instructions, then forks it into
+// copy-on-write clones and waits for all of them.
+int run_clones(Emulator &emulator, const Options &options) {
+    while (!emulator.is_halted() && emulator.get_instret() < options.clone_at) {
+        if (emulator.run(options.clone_at - emulator.get_instret()) == StopReason::Requested) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (emulator.is_halted()) {
+        std::cerr << "error: guest halted before it was cloned" << std::endl;
         return EXIT_FAILURE;
     }
 
-    std::vector<uint8_t> binary;
-    std::vector<uint8_t> disk_image;
+    std::vector<pid_t> children;
+    auto status = EXIT_SUCCESS;
+    for (int i = 0; i < options.clone_count; i++) {
+        pid_t pid;
+        try {
+            pid = emulator.fork_clone();
+        } catch (const std::runtime_error &failure) {
+            std::cerr << "error: " << failure.what() << std::endl;
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (pid == 0) {
+            auto code = run_clone(emulator, options.clone_prefix + "." + std::to_string(i));
+            std::cout.flush();
+            std::cerr.flush();
+            _exit(code);
+        }
+        children.push_back(pid);
+    }
 
-    {
-        std::ifstream file(argv[1], std::ifstream::binary);
-        file.seekg(0, file.end);
-        auto binary_size = file.tellg();
-        file.seekg(0, file.beg);
-        binary.resize(binary_size / sizeof(uint8_t));
-        file.read(reinterpret_cast<char *>(binary.data()), binary.size() * sizeof(uint8_t));
-        file.close();
+    for (size_t i = 0; i < children.size(); i++) {
+        int wait_status;
+        waitpid(children[i], &wait_status, 0);
+        auto code = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+        std::cout << options.clone_prefix << "." << i << ".log: exit " << code << std::endl;
+        if (code != EXIT_SUCCESS) {
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
+
+// The options that observe or speed up execution rather than change what the
+// guest sees. Throws std::runtime_error.
+void configure_execution(Emulator &emulator, const Options &options) {
+    if (!options.trace_path.empty()) {
+        emulator.trace_to(options.trace_path);
+    }
+    if (!options.cache_spec.empty()) {
+        emulator.simulate_caches(CacheHierarchy::parse(options.cache_spec));
+    }
+    if (!options.aot_path.empty()) {
+        emulator.use_translation(options.aot_path);
     }
+    if (!options.coverage_spec.empty()) {
+        emulator.collect_coverage(Coverage::parse(options.coverage_spec));
+    }
+    if (options.timing) {
+        auto &timing = emulator.model_timing(TimingConfig());
+        if (!options.symbols_path.empty()) {
+            timing.load_symbols(options.symbols_path);
+        }
+    }
+}
 
-    {
-        std::ifstream file(argv[2], std::ifstream::binary);
-        file.seekg(0, file.end);
-        auto binary_size = file.tellg();
-        file.seekg(0, file.beg);
-        disk_image.resize(binary_size / sizeof(uint8_t));
-        file.read(reinterpret_cast<char *>(disk_image.data()), disk_image.size() * sizeof(uint8_t));
-        file.close();
-    }
-
-    Cpu cpu(binary, disk_image);
-
-    while (true) {
-        auto [instruction, f_err] = cpu.fetch();
-        if (f_err.has_value()) {
-            cpu.take_trap(f_err.value(), false);
-            if (f_err->is_fatal()) {
-                break;
+// Prints why the guest stopped and the reports asked for; returns the exit status.
+int finish(Emulator &emulator, StopReason reason) {
+    if (!emulator.get_error().empty()) {
+        std::cerr << "error: " << emulator.get_error() << std::endl;
+    }
+    if (emulator.get_caches() != nullptr) {
+        emulator.get_caches()->report(std::cerr, CACHE_REPORT_PCS);
+    }
+    if (emulator.get_timing() != nullptr) {
+        emulator.get_timing()->report(std::cerr, TIMING_REPORT_FUNCTIONS);
+    }
+    // A shared bitmap is for the fuzzer to read.
+    if (emulator.get_coverage() != nullptr && !emulator.get_coverage()->is_shared()) {
+        std::cerr << "coverage: " << emulator.get_coverage()->edges() << " edges" << std::endl;
+    }
+    if (reason == StopReason::Requested) {
+        return EXIT_FAILURE;
+    }
+    // Only the low eight bits reach the parent; a failure must not read as success.
+    auto status = emulator.get_exit_status();
+    return (status & 0xff) == 0 && status != 0 ? EXIT_FAILURE : status;
+}
+
+// Boots binary_path, a flat image or a bare-metal ELF executable, with the
+// disk image at disk_path, if any. Throws std::runtime_error.
+std::unique_ptr<Emulator> load_guest(const std::string &binary_path, const std::string &disk_path, std::map<std::string, uint64_t> &symbols) {
+    auto binary = Buffer::map_file(binary_path);
+    auto disk = disk_path.empty() ? Buffer() : Buffer::map_file(disk_path);
+    if (binary.size() < SELFMAG || std::memcmp(binary.data(), ELFMAG, SELFMAG) != 0) {
+        return std::make_unique<Emulator>(std::move(binary), std::move(disk));
+    }
+    auto emulator = std::make_unique<Emulator>(Buffer(), std::move(disk));
+    symbols = emulator->load_elf(binary);
+    return emulator;
+}
+
+// Writes the words from begin_signature to end_signature, one 32-bit word per
+// line in hex as riscv-arch-test references have them.
+void write_signature(Emulator &emulator, const std::map<std::string, uint64_t> &symbols, const std::string &path) {
+    auto begin = symbols.find("begin_signature");
+    auto end = symbols.find("end_signature");
+    if (begin == symbols.end() || end == symbols.end() || end->second < begin->second) {
+        throw std::runtime_error("the guest has no begin_signature and end_signature");
+    }
+    std::vector<uint8_t> words(end->second - begin->second);
+    if (!emulator.read_memory(begin->second, words.data(), words.size())) {
+        throw std::runtime_error("the signature is not in RAM");
+    }
+    std::ofstream out(path);
+    out << std::hex << std::setfill('0');
+    for (size_t i = 0; i + 4 <= words.size(); i += 4) {
+        out << std::setw(8) << (words[i] | words[i + 1] << 8 | words[i + 2] << 16 | (uint32_t)words[i + 3] << 24) << "\n";
+    }
+    if (!out.flush()) {
+        throw std::runtime_error("cannot write " + path);
+    }
+}
+
+// Hands the guest to GDB, if --gdb was given, until GDB detaches, then runs
+// it until it halts or is stopped.
+StopReason run_guest(Emulator &emulator, GdbStub *stub) {
+    if (stub != nullptr) {
+        std::cerr << "gdb: waiting for a connection on " << stub->get_address() << std::endl;
+        try {
+            if (!stub->serve()) {
+                return emulator.is_halted() ? StopReason::Halted : StopReason::Requested;
+            }
+        } catch (const std::runtime_error &failure) {
+            std::cerr << "error: " << failure.what() << std::endl;
+            return StopReason::Requested;
+        }
+    }
+    auto reason = StopReason::Budget;
+    while (reason == StopReason::Budget) {
+        reason = emulator.run(UINT64_MAX);
+    }
+    return reason;
+}
+
+// The script is the guest's only input, so idle time is skipped rather than waited out.
+int run_script(Emulator &emulator, ExpectScript &script) {
+    emulator.set_idle_policy(IdlePolicy::FastForward);
+    interrupted_emulator.store(&emulator);
+    std::signal(SIGINT, handle_interrupt);
+    std::signal(SIGTERM, handle_interrupt);
+    auto status = script.run();
+    interrupted_emulator.store(nullptr);
+    finish(emulator, StopReason::Budget);
+    return status;
+}
+
+int run_interactive(const std::string &binary_path, const std::string &disk_path, const Options &options) {
+    std::unique_ptr<Emulator> emulator;
+    std::unique_ptr<GdbStub> stub;
+    std::unique_ptr<ExpectScript> script;
+    std::map<std::string, uint64_t> symbols;
+    try {
+        if (!options.expect_path.empty() && !options.gdb_address.empty()) {
+            throw std::runtime_error("--expect and --gdb cannot be combined");
+        }
+        emulator = load_guest(binary_path, disk_path, symbols);
+        if (!options.record_path.empty()) {
+            emulator->record_inputs(options.record_path);
+        }
+        if (!options.replay_path.empty()) {
+            emulator->replay_inputs(options.replay_path);
+        }
+        if (!options.share_path.empty()) {
+            emulator->share_directory(options.share_path);
+        }
+        if (options.shmem_size != 0) {
+            auto &device = emulator->share_memory(options.shmem_size);
+            device.set_doorbell([](uint32_t value) { std::cerr << "shmem: doorbell " << value << std::endl; });
+            std::cerr << "shmem: " << device.get_size() << " bytes at 0x" << std::hex << SHMEM_MEMORY_BASE << std::dec
+                      << ", /proc/" << getpid() << "/fd/" << device.get_fd() << std::endl;
+            shared_memory.store(&device);
+            std::signal(SIGUSR2, handle_doorbell);
+        }
+        if (options.sbi) {
+            emulator->boot_supervisor();
+        }
+        configure_execution(*emulator, options);
+        if (!options.gdb_address.empty()) {
+            stub = std::make_unique<GdbStub>(*emulator, options.gdb_address);
+        }
+        if (!options.expect_path.empty()) {
+            std::ifstream file(options.expect_path);
+            if (!file) {
+                throw std::runtime_error("cannot open " + options.expect_path);
+            }
+            script = std::make_unique<ExpectScript>(*emulator, ExpectScript::parse(file), [](uint8_t c) { std::cout << (char)c << std::flush; });
+        }
+    } catch (const std::exception &failure) {
+        std::cerr << "error: " << failure.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!script) {
+        emulator->set_console_output([](uint8_t c) { std::cout << (char)c << std::flush; });
+    }
+    emulator->set_idle_detection(options.idle_detect);
+    if (options.clone_count > 0) {
+        interrupted_emulator.store(emulator.get());
+        std::signal(SIGINT, handle_interrupt);
+        std::signal(SIGTERM, handle_interrupt);
+        return run_clones(*emulator, options);
+    }
+    if (script) {
+        return run_script(*emulator, *script);
+    }
+
+    auto reader = std::thread([&emulator] {
+        std::string s;
+        while (std::getline(std::cin, s)) {
+            s.push_back('\n');
+            for (char c : s) {
+                emulator->console_input(c);
+            }
+        }
+    });
+    reader.detach();
+
+    // Under GDB, its interrupt stops the guest and Ctrl-C ends the emulator.
+    if (!stub) {
+        interrupted_emulator.store(emulator.get());
+        std::signal(SIGINT, handle_interrupt);
+        std::signal(SIGTERM, handle_interrupt);
+    }
+
+    auto reason = run_guest(*emulator, stub.get());
+    interrupted_emulator.store(nullptr);
+    auto status = finish(*emulator, reason);
+    if (!options.signature_path.empty()) {
+        try {
+            write_signature(*emulator, symbols, options.signature_path);
+        } catch (const std::runtime_error &failure) {
+            std::cerr << "error: " << failure.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    return status;
+}
+
+// Runs args[0], a static Linux program, with the host as its kernel. It shares
+// the emulator's standard streams, environment and working directory, and
+// Ctrl-C kills both as it would the program alone.
+int run_user(const std::vector<std::string> &args, const Options &options) {
+    std::unique_ptr<Emulator> emulator;
+    std::unique_ptr<GdbStub> stub;
+    try {
+        emulator = std::make_unique<Emulator>(Buffer(), Buffer());
+        std::vector<std::string> env;
+        for (auto var = environ; *var != nullptr; var++) {
+            env.emplace_back(*var);
+        }
+        emulator->load_linux_program(Buffer::map_file(args[0]), args, env);
+        configure_execution(*emulator, options);
+        if (!options.gdb_address.empty()) {
+            stub = std::make_unique<GdbStub>(*emulator, options.gdb_address);
+        }
+    } catch (const std::exception &failure) {
+        std::cerr << "error: " << failure.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return finish(*emulator, run_guest(*emulator, stub.get()));
+}
+
+// Boots the guest to its harness start, then runs every file in the input
+// directory from that snapshot. Fails if any input crashed.
+int run_fuzz(const std::string &binary_path, const std::string &disk_path, const Options &options) {
+    std::unique_ptr<Emulator> emulator;
+    std::unique_ptr<FuzzHarness> harness;
+    std::vector<std::filesystem::path> inputs;
+    std::map<std::string, uint64_t> symbols;
+    try {
+        emulator = load_guest(binary_path, disk_path, symbols);
+        if (options.sbi) {
+            emulator->boot_supervisor();
+        }
+        configure_execution(*emulator, options);
+        harness = std::make_unique<FuzzHarness>(*emulator, options.fuzz_timeout);
+        for (const auto &entry : std::filesystem::directory_iterator(options.fuzz_path)) {
+            if (entry.is_regular_file()) {
+                inputs.push_back(entry.path());
             }
         }
+        std::sort(inputs.begin(), inputs.end());
+    } catch (const std::exception &failure) {
+        std::cerr << "error: " << failure.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    emulator->set_console_output([](uint8_t c) { std::cout << (char)c << std::flush; });
+    emulator->set_idle_policy(IdlePolicy::FastForward);
+    interrupted_emulator.store(emulator.get());
+    std::signal(SIGINT, handle_interrupt);
+    std::signal(SIGTERM, handle_interrupt);
 
-        cpu.setPc(cpu.getPc() + 4);
+    try {
+        if (!harness->start()) {
+            std::cerr << "error: the guest stopped before starting the fuzzing harness" << std::endl;
+            interrupted_emulator.store(nullptr);
+            return finish(*emulator, StopReason::Requested);
+        }
+    } catch (const std::exception &failure) {
+        std::cerr << "error: " << failure.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
-        auto e_err = cpu.execute(instruction);
-        if (e_err.has_value()) {
-            cpu.take_trap(e_err.value(), false);
-            if (e_err->is_fatal()) {
-                break;
+    uint64_t counts[4] = {};
+    auto begin = std::chrono::steady_clock::now();
+    for (const auto &path : inputs) {
+        std::ifstream file(path, std::ifstream::binary);
+        std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        auto result = harness->run(input.data(), input.size());
+        if (result.outcome == FuzzOutcome::Stopped) {
+            break;
+        }
+        counts[(int)result.outcome]++;
+        std::cout << path.filename().string() << ": ";
+        switch (result.outcome) {
+        case FuzzOutcome::Ok:
+            std::cout << "ok";
+            break;
+        case FuzzOutcome::Crash:
+            std::cout << "crash";
+            if (result.status != 0) {
+                std::cout << " (exit " << result.status << ")";
             }
+            break;
+        default:
+            std::cout << "timeout";
+            break;
+        }
+        std::cout << ", " << result.instructions << " instructions" << std::endl;
+    }
+    interrupted_emulator.store(nullptr);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    auto runs = counts[0] + counts[1] + counts[2];
+    std::cout << runs << " inputs: " << counts[0] << " ok, " << counts[1] << " crashed, " << counts[2] << " timed out";
+    if (elapsed.count() > 0) {
+        std::cout << ", " << (uint64_t)(runs / elapsed.count()) << " per second";
+    }
+    std::cout << std::endl;
+    finish(*emulator, StopReason::Budget);
+    return counts[1] > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+struct BatchJob {
+    std::string log_path;
+    std::ofstream log;
+    std::unique_ptr<Emulator> emulator;
+};
+
+// Each job file line is "<kernel> <disk> <log>"; the guest console goes to <log>.
+int run_batch(unsigned threads, const std::string &job_path) {
+    std::vector<std::unique_ptr<BatchJob>> jobs;
+    std::ifstream job_file(job_path);
+    std::string line;
+    while (std::getline(job_file, line)) {
+        std::istringstream fields(line);
+        std::string binary_path, disk_path, log_path;
+        if (!(fields >> binary_path >> disk_path >> log_path)) {
+            continue;
+        }
+        auto job = std::make_unique<BatchJob>();
+        job->log_path = log_path;
+        job->log.open(log_path, std::ofstream::binary);
+        try {
+            job->emulator = std::make_unique<Emulator>(Buffer::map_file(binary_path), Buffer::map_file(disk_path));
+        } catch (const std::runtime_error &failure) {
+            std::cerr << "error: " << failure.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        auto log = &job->log;
+        job->emulator->set_console_output([log](uint8_t c) { log->put(c); });
+        // Batch guests have no live input, so waiting for a timer is never worth real time.
+        job->emulator->set_idle_policy(IdlePolicy::FastForward);
+        jobs.push_back(std::move(job));
+    }
+
+    {
+        Scheduler scheduler(threads, BATCH_SLICE);
+        for (auto &job : jobs) {
+            scheduler.add(job->emulator.get());
+        }
+        scheduler.wait();
+    }
+
+    auto status = EXIT_SUCCESS;
+    for (auto &job : jobs) {
+        std::cout << job->log_path << ": exit " << job->emulator->get_exit_status();
+        if (!job->emulator->get_error().empty()) {
+            std::cout << " (error: " << job->emulator->get_error() << ")";
         }
+        std::cout << std::endl;
+        if (job->emulator->get_exit_status() != EXIT_SUCCESS) {
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
+
+} // namespace
 
-        auto interrupt = cpu.check_pending_interrupt();
-        if (interrupt.has_value()) {
-            cpu.take_trap(interrupt.value(), true);
+int main(int argc, char *argv[]) {
+    Options options;
+    int i = 1;
+    for (; i + 1 < argc; i += 2) {
+        std::string option(argv[i]);
+        if (option == "--idle-detect") {
+            options.idle_detect = true;
+            i--;
+        } else if (option == "--timing") {
+            options.timing = true;
+            i--;
+        } else if (option == "--sbi") {
+            options.sbi = true;
+            i--;
+        } else if (option == "--user") {
+            options.user = true;
+            i--;
+        } else if (option == "--batch" && i + 2 < argc) {
+            options.batch_threads = std::max(1, std::atoi(argv[i + 1]));
+            options.batch_path = argv[i + 2];
+            i++;
+        } else if (option == "--clone" && i + 2 < argc) {
+            options.clone_count = std::max(1, std::atoi(argv[i + 1]));
+            options.clone_prefix = argv[i + 2];
+            i++;
+        } else if (option == "--clone-at") {
+            options.clone_at = std::strtoull(argv[i + 1], nullptr, 0);
+        } else if (option == "--metrics") {
+            options.metrics_path = argv[i + 1];
+        } else if (option == "--symbols") {
+            options.symbols_path = argv[i + 1];
+        } else if (option == "--record") {
+            options.record_path = argv[i + 1];
+        } else if (option == "--replay") {
+            options.replay_path = argv[i + 1];
+        } else if (option == "--trace") {
+            options.trace_path = argv[i + 1];
+        } else if (option == "--cache") {
+            options.cache_spec = argv[i + 1];
+        } else if (option == "--fuzz") {
+            options.fuzz_path = argv[i + 1];
+        } else if (option == "--fuzz-timeout") {
+            options.fuzz_timeout = std::strtoull(argv[i + 1], nullptr, 0);
+        } else if (option == "--signature") {
+            options.signature_path = argv[i + 1];
+        } else if (option == "--share") {
+            options.share_path = argv[i + 1];
+        } else if (option == "--shmem") {
+            options.shmem_size = std::strtoull(argv[i + 1], nullptr, 0);
+        } else if (option == "--expect") {
+            options.expect_path = argv[i + 1];
+        } else if (option == "--gdb") {
+            options.gdb_address = argv[i + 1];
+        } else if (option == "--coverage") {
+            options.coverage_spec = argv[i + 1];
+        } else if (option == "--aot") {
+            options.aot_path = argv[i + 1];
+        } else {
+            break;
         }
     }
+    auto batch = !options.batch_path.empty();
+    // --user takes the program and its arguments; the disk image is optional.
+    auto positional = argc - i;
+    auto valid = options.user ? positional >= 1 : batch ? positional == 0 : positional == 1 || positional == 2;
+    if (!valid) {
+        std::cerr << "error: invalid number of parameters" << std::endl;
+        return EXIT_FAILURE;
+    }
 
-    return EXIT_SUCCESS;
+    // Without --metrics there is no exporter thread: an idle guest keeps the
+    // process asleep, and fork_clone() forks a single thread.
+    std::unique_ptr<MetricsExporter> exporter;
+    if (!options.metrics_path.empty()) {
+        exporter = std::make_unique<MetricsExporter>(options.metrics_path, METRICS_INTERVAL);
+        metrics_exporter.store(exporter.get());
+    }
+    std::signal(SIGUSR1, handle_metrics_dump);
+    int status;
+    if (options.user) {
+        status = run_user(std::vector<std::string>(argv + i, argv + argc), options);
+    } else if (batch) {
+        status = run_batch(options.batch_threads, options.batch_path);
+    } else if (!options.fuzz_path.empty()) {
+        status = run_fuzz(argv[i], positional == 2 ? argv[i + 1] : "", options);
+    } else {
+        status = run_interactive(argv[i], positional == 2 ? argv[i + 1] : "", options);
+    }
+    metrics_exporter.store(nullptr);
+    return status;
 }
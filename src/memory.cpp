@@ -1,29 +1,68 @@
-#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
 
 #include "memory.h"
 
-Memory::Memory(std::vector<uint8_t> bytes) : data{bytes} {
-    data.resize(MEMORY_SIZE);
+namespace {
+
+uint8_t *map_ram() {
+    auto ram = mmap(nullptr, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return ram == MAP_FAILED ? nullptr : static_cast<uint8_t *>(ram);
+}
+
+void unmap_ram(uint8_t *ram) {
+    munmap(ram, MEMORY_SIZE);
+}
+
+} // namespace
+
+Memory::Memory(const Buffer &image) : data{map_ram(), &unmap_ram},
+                                      tracker{12} {
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    if (image.size() != 0) {
+        std::memcpy(data.get(), image.data(), std::min<uint64_t>(image.size(), MEMORY_SIZE));
+    }
 }
 
-std::pair<uint64_t, std::optional<Exception>> Memory::load(uint64_t addr, int nBytes) {
+uint64_t Memory::load(uint64_t addr, int nBytes) {
+    if (addr - MEMORY_BASE + nBytes > MEMORY_SIZE) {
+        raise_exception(ExceptionType::LoadAccessFault, addr);
+    }
     uint64_t result = 0;
-    for (int i = 0; i < nBytes; i++) {
-        if (addr - MEMORY_BASE + i >= data.size()) {
-            return std::make_pair(0, Exception(ExceptionType::LoadAccessFault));
-        }
-        result |= (uint64_t)data[addr - MEMORY_BASE + i] << i * 8;
+    std::memcpy(&result, data.get() + (addr - MEMORY_BASE), nBytes);
+    return result;
+}
+
+void Memory::store(uint64_t addr, int nBytes, uint64_t value) {
+    if (addr - MEMORY_BASE + nBytes > MEMORY_SIZE) {
+        raise_exception(ExceptionType::StoreAMOAccessFault, addr);
+    }
+    tracker.mark_range(addr - MEMORY_BASE, nBytes);
+    std::memcpy(data.get() + (addr - MEMORY_BASE), &value, nBytes);
+}
+
+uint8_t *Memory::get_pointer(uint64_t addr, uint64_t nBytes) {
+    // Written so that no large nBytes can wrap around.
+    if (addr < MEMORY_BASE || nBytes > MEMORY_SIZE || addr - MEMORY_BASE > MEMORY_SIZE - nBytes) {
+        return nullptr;
     }
-    return std::make_pair(result, std::nullopt);
+    tracker.mark_range(addr - MEMORY_BASE, nBytes);
+    return data.get() + (addr - MEMORY_BASE);
 }
 
-std::optional<Exception> Memory::store(uint64_t addr, int nBytes, uint64_t value) {
-    for (int i = 0; i < nBytes; i++) {
-        if (addr - MEMORY_BASE + i >= data.size()) {
-            return Exception(ExceptionType::StoreAMOAccessFault);
-        }
-        uint8_t byteToStore = (value & ((uint64_t)0xff << i * 8)) >> i * 8;
-        data[addr - MEMORY_BASE + i] = byteToStore;
+const uint8_t *Memory::view(uint64_t addr, uint64_t nBytes) {
+    // Written so that no large nBytes can wrap around.
+    if (addr < MEMORY_BASE || nBytes > MEMORY_SIZE || addr - MEMORY_BASE > MEMORY_SIZE - nBytes) {
+        return nullptr;
     }
-    return std::nullopt;
+    return data.get() + (addr - MEMORY_BASE);
+}
+
+void Memory::track_writes() {
+    tracker.start(data.get(), MEMORY_SIZE);
 }
@@ -2,10 +2,12 @@
 #define MEMORY_H
 
 #include <cstdint>
-#include <optional>
+#include <memory>
 #include <vector>
 
+#include "buffer.h"
 #include "device.h"
+#include "dirty_tracker.h"
 #include "exception.h"
 
 #define MEMORY_SIZE (1024 * 1024 * 128)
@@ -13,12 +15,23 @@
 
 class Memory : public Device {
 private:
-    std::vector<uint8_t> data;
+    // A private anonymous mapping: untouched guest RAM stays backed by the
+    // shared zero page, and a fork()ed clone shares RAM copy-on-write.
+    std::unique_ptr<uint8_t, void (*)(uint8_t *)> data;
+    DirtyTracker tracker;
 
 public:
-    Memory(std::vector<uint8_t> bytes);
-    std::pair<uint64_t, std::optional<Exception>> load(uint64_t addr, int nBytes);
-    std::optional<Exception> store(uint64_t addr, int nBytes, uint64_t value);
+    // Copies the image to the start of RAM.
+    Memory(const Buffer &image);
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
+    // For writing: the range counts as written for snapshots.
+    uint8_t *get_pointer(uint64_t addr, uint64_t nBytes);
+    const uint8_t *view(uint64_t addr, uint64_t nBytes);
+    // Takes the current contents as a snapshot that roll_back() returns to.
+    void track_writes();
+    void roll_back() { tracker.roll_back(); };
+    uint64_t dirty_pages() const { return tracker.dirty_blocks(); };
 };
 
 #endif
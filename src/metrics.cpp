@@ -0,0 +1,223 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+// How often the exporter thread checks for a dump request.
+#define METRICS_POLL_INTERVAL std::chrono::milliseconds(100)
+
+thread_local Metrics::Slot *Metrics::current = nullptr;
+std::mutex Metrics::slots_lock;
+std::vector<std::unique_ptr<Metrics::Slot>> Metrics::slots;
+
+namespace {
+
+const char *exception_names[METRICS_TRAP_CAUSES] = {
+    "instruction_address_misaligned",
+    "instruction_access_fault",
+    "illegal_instruction",
+    "breakpoint",
+    "load_address_misaligned",
+    "load_access_fault",
+    "store_address_misaligned",
+    "store_access_fault",
+    "ecall_from_u",
+    "ecall_from_s",
+    nullptr,
+    "ecall_from_m",
+    "instruction_page_fault",
+    "load_page_fault",
+    nullptr,
+    "store_page_fault",
+};
+
+const char *interrupt_names[METRICS_TRAP_CAUSES] = {
+    nullptr,
+    "supervisor_software",
+    nullptr,
+    "machine_software",
+    nullptr,
+    "supervisor_timer",
+    nullptr,
+    "machine_timer",
+    nullptr,
+    "supervisor_external",
+    nullptr,
+    "machine_external",
+};
+
+std::string cause_label(const char *names[], uint64_t cause) {
+    return names[cause] != nullptr ? names[cause] : std::to_string(cause);
+}
+
+void header(std::ostream &out, const char *name, const char *help) {
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " counter\n";
+}
+
+} // namespace
+
+Metrics::Slot &Metrics::register_slot() {
+    std::lock_guard<std::mutex> guard(slots_lock);
+    slots.push_back(std::make_unique<Slot>());
+    current = slots.back().get();
+    return *current;
+}
+
+void Metrics::trap(uint64_t cause, bool is_interrupt) {
+    auto &s = slot();
+    bump((is_interrupt ? s.interrupts : s.exceptions)[cause % METRICS_TRAP_CAUSES], 1);
+}
+
+void Metrics::irq(uint64_t irq) {
+    bump(slot().irqs[irq % METRICS_IRQS], 1);
+}
+
+void Metrics::mmio(const char *device, uint64_t offset, bool is_store) {
+    auto &s = slot();
+    auto hash = (reinterpret_cast<uintptr_t>(device) >> 3) ^ (offset * 0x9e3779b97f4a7c15) ^ is_store;
+    for (uint64_t probe = 0; probe < METRICS_MMIO_REGISTERS; probe++) {
+        auto &counter = s.mmio[(hash + probe) % METRICS_MMIO_REGISTERS];
+        auto name = counter.device.load(std::memory_order_relaxed);
+        if (name == nullptr) {
+            counter.offset = offset;
+            counter.is_store = is_store;
+            counter.device.store(device, std::memory_order_release);
+            bump(counter.count, 1);
+            return;
+        }
+        if (name == device && counter.offset == offset && counter.is_store == is_store) {
+            bump(counter.count, 1);
+            return;
+        }
+    }
+    bump(s.mmio_untracked, 1);
+}
+
+void Metrics::write(std::ostream &out) {
+    uint64_t counters[(size_t)Metric::Count] = {};
+    uint64_t exceptions[METRICS_TRAP_CAUSES] = {};
+    uint64_t interrupts[METRICS_TRAP_CAUSES] = {};
+    uint64_t irqs[METRICS_IRQS] = {};
+    uint64_t mmio_untracked = 0;
+    std::map<std::tuple<std::string, uint64_t, bool>, uint64_t> mmio;
+    {
+        std::lock_guard<std::mutex> guard(slots_lock);
+        for (auto &slot : slots) {
+            auto &s = *slot;
+            for (size_t i = 0; i < (size_t)Metric::Count; i++) {
+                counters[i] += s.counters[i].load(std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < METRICS_TRAP_CAUSES; i++) {
+                exceptions[i] += s.exceptions[i].load(std::memory_order_relaxed);
+                interrupts[i] += s.interrupts[i].load(std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < METRICS_IRQS; i++) {
+                irqs[i] += s.irqs[i].load(std::memory_order_relaxed);
+            }
+            mmio_untracked += s.mmio_untracked.load(std::memory_order_relaxed);
+            for (auto &counter : s.mmio) {
+                auto device = counter.device.load(std::memory_order_acquire);
+                if (device != nullptr) {
+                    mmio[{device, counter.offset, counter.is_store}] += counter.count.load(std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    auto counter = [&](const char *name, const char *help, Metric metric) {
+        header(out, name, help);
+        out << name << " " << counters[(size_t)metric] << "\n";
+    };
+    counter("riscv_instructions_retired_total", "Guest instructions retired.", Metric::InstructionsRetired);
+
+    header(out, "riscv_exceptions_total", "Synchronous traps taken, by cause.");
+    for (uint64_t i = 0; i < METRICS_TRAP_CAUSES; i++) {
+        if (exceptions[i] != 0) {
+            out << "riscv_exceptions_total{cause=\"" << cause_label(exception_names, i) << "\"} " << exceptions[i] << "\n";
+        }
+    }
+    header(out, "riscv_interrupts_total", "Interrupts taken, by cause.");
+    for (uint64_t i = 0; i < METRICS_TRAP_CAUSES; i++) {
+        if (interrupts[i] != 0) {
+            out << "riscv_interrupts_total{cause=\"" << cause_label(interrupt_names, i) << "\"} " << interrupts[i] << "\n";
+        }
+    }
+    header(out, "riscv_external_interrupts_total", "External interrupts raised through the PLIC, by source.");
+    for (uint64_t i = 0; i < METRICS_IRQS; i++) {
+        if (irqs[i] != 0) {
+            out << "riscv_external_interrupts_total{irq=\"" << i << "\"} " << irqs[i] << "\n";
+        }
+    }
+
+    counter("riscv_page_walks_total", "Sv39 page-table walks.", Metric::PageWalks);
+
+    header(out, "riscv_mmio_accesses_total", "Guest MMIO accesses, by device, register offset and direction.");
+    for (const auto &[key, count] : mmio) {
+        std::ostringstream offset;
+        offset << std::hex << "0x" << std::get<1>(key);
+        out << "riscv_mmio_accesses_total{device=\"" << std::get<0>(key) << "\",offset=\"" << offset.str()
+            << "\",op=\"" << (std::get<2>(key) ? "store" : "load") << "\"} " << count << "\n";
+    }
+    header(out, "riscv_mmio_untracked_total", "MMIO accesses beyond the per-thread register table.");
+    out << "riscv_mmio_untracked_total " << mmio_untracked << "\n";
+
+    counter("riscv_virtio_requests_total", "Virtio block requests completed.", Metric::VirtioRequests);
+    header(out, "riscv_virtio_bytes_total", "Virtio block bytes transferred, by direction.");
+    out << "riscv_virtio_bytes_total{direction=\"read\"} " << counters[(size_t)Metric::VirtioBytesRead] << "\n"
+        << "riscv_virtio_bytes_total{direction=\"write\"} " << counters[(size_t)Metric::VirtioBytesWritten] << "\n";
+    header(out, "riscv_uart_bytes_total", "UART bytes, by direction.");
+    out << "riscv_uart_bytes_total{direction=\"tx\"} " << counters[(size_t)Metric::UartBytesOut] << "\n"
+        << "riscv_uart_bytes_total{direction=\"rx\"} " << counters[(size_t)Metric::UartBytesIn] << "\n";
+    out.flush();
+}
+
+void Metrics::write_file(const std::string &path) {
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ofstream::trunc);
+        if (!file) {
+            return;
+        }
+        write(file);
+    }
+    std::rename(temporary.c_str(), path.c_str());
+}
+
+MetricsExporter::MetricsExporter(const std::string &path, std::chrono::milliseconds interval) : path{path},
+                                                                                                interval{interval},
+                                                                                                dump_requested{false},
+                                                                                                stopping{false} {
+    thread = std::thread(&MetricsExporter::work, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    stop_condvar.notify_all();
+    thread.join();
+    Metrics::write_file(path);
+}
+
+void MetricsExporter::work() {
+    auto next_write = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+        if (dump_requested.exchange(false, std::memory_order_relaxed)) {
+            Metrics::write(std::cerr);
+            next_write = std::chrono::steady_clock::now();
+        }
+        if (std::chrono::steady_clock::now() >= next_write) {
+            Metrics::write_file(path);
+            next_write = std::chrono::steady_clock::now() + interval;
+        }
+        stop_condvar.wait_for(guard, METRICS_POLL_INTERVAL);
+    }
+}
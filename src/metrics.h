@@ -0,0 +1,98 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define METRICS_TRAP_CAUSES 16
+#define METRICS_IRQS 64
+// Distinct (device, register, direction) triples counted per thread; the rest
+// only show up in riscv_mmio_untracked_total.
+#define METRICS_MMIO_REGISTERS 256
+
+enum class Metric : uint32_t {
+    InstructionsRetired,
+    PageWalks,
+    VirtioRequests,
+    // Disk bytes copied into and out of guest memory.
+    VirtioBytesRead,
+    VirtioBytesWritten,
+    UartBytesOut,
+    UartBytesIn,
+    Count,
+};
+
+// Process-wide engine counters. Every host thread increments its own
+// cache-line-aligned slot without locked instructions; readers sum the slots.
+class Metrics {
+private:
+    struct MmioCounter {
+        // nullptr while free; stored last, so a reader seeing it also sees the rest.
+        std::atomic<const char *> device;
+        uint64_t offset;
+        bool is_store;
+        std::atomic<uint64_t> count;
+    };
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> counters[(size_t)Metric::Count];
+        std::atomic<uint64_t> exceptions[METRICS_TRAP_CAUSES];
+        std::atomic<uint64_t> interrupts[METRICS_TRAP_CAUSES];
+        std::atomic<uint64_t> irqs[METRICS_IRQS];
+        std::atomic<uint64_t> mmio_untracked;
+        MmioCounter mmio[METRICS_MMIO_REGISTERS];
+    };
+
+    static thread_local Slot *current;
+    // Slots outlive their threads so the counts of finished threads still add up.
+    static std::mutex slots_lock;
+    static std::vector<std::unique_ptr<Slot>> slots;
+    static Slot &register_slot();
+    static Slot &slot() { return current != nullptr ? *current : register_slot(); };
+    // Only the owning thread writes a slot, so a relaxed load and store suffice.
+    static void bump(std::atomic<uint64_t> &counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    };
+
+public:
+    static void add(Metric metric, uint64_t n = 1) { bump(slot().counters[(size_t)metric], n); };
+    static void trap(uint64_t cause, bool is_interrupt);
+    // An external interrupt raised through the PLIC.
+    static void irq(uint64_t irq);
+    static void mmio(const char *device, uint64_t offset, bool is_store);
+    // Prometheus text exposition format.
+    static void write(std::ostream &out);
+    // Replaces path atomically, so scrapers never see a partial file.
+    static void write_file(const std::string &path);
+};
+
+// Rewrites a metrics file every interval and dumps the metrics to stderr when
+// asked to, e.g. from a SIGUSR1 handler.
+class MetricsExporter {
+private:
+    std::string path;
+    std::chrono::milliseconds interval;
+    std::atomic<bool> dump_requested;
+    std::mutex lock;
+    std::condition_variable stop_condvar;
+    bool stopping;
+    std::thread thread;
+    void work();
+
+public:
+    // Starts a thread that writes path every interval.
+    MetricsExporter(const std::string &path, std::chrono::milliseconds interval);
+    ~MetricsExporter();
+    // Async-signal-safe; the dump happens on the exporter thread shortly after.
+    void request_dump() { dump_requested.store(true, std::memory_order_relaxed); };
+};
+
+#endif
@@ -0,0 +1,798 @@
+#include "p9_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+// Request types; each reply's type is its request's plus one.
+#define P9_RLERROR 7
+#define P9_TSTATFS 8
+#define P9_TLOPEN 12
+#define P9_TLCREATE 14
+#define P9_TSYMLINK 16
+#define P9_TMKNOD 18
+#define P9_TRENAME 20
+#define P9_TREADLINK 22
+#define P9_TGETATTR 24
+#define P9_TSETATTR 26
+#define P9_TREADDIR 40
+#define P9_TFSYNC 50
+#define P9_TLOCK 52
+#define P9_TGETLOCK 54
+#define P9_TLINK 70
+#define P9_TMKDIR 72
+#define P9_TRENAMEAT 74
+#define P9_TUNLINKAT 76
+#define P9_TVERSION 100
+#define P9_TATTACH 104
+#define P9_TFLUSH 108
+#define P9_TWALK 110
+#define P9_TREAD 116
+#define P9_TWRITE 118
+#define P9_TCLUNK 120
+#define P9_TREMOVE 122
+
+#define P9_QTDIR 0x80
+#define P9_QTSYMLINK 0x02
+#define P9_QTFILE 0x00
+// type[1] version[4] path[8]
+#define P9_QID_SIZE 13
+// size[4] type[1] tag[2] count[4]: what precedes Rread and Rreaddir data.
+#define P9_IO_HEADER_SIZE 11
+
+// Tlopen and Tlcreate flags, which are Linux's generic open flags whatever
+// the host's are.
+#define P9_DOTL_ACCMODE 03
+#define P9_DOTL_CREATE 0100
+#define P9_DOTL_EXCL 0200
+#define P9_DOTL_TRUNC 01000
+#define P9_DOTL_APPEND 02000
+#define P9_DOTL_DSYNC 010000
+#define P9_DOTL_NOFOLLOW 0400000
+#define P9_DOTL_SYNC 04000000
+
+// Tsetattr valid bits.
+#define P9_SETATTR_MODE 0x1
+#define P9_SETATTR_UID 0x2
+#define P9_SETATTR_GID 0x4
+#define P9_SETATTR_SIZE 0x8
+#define P9_SETATTR_ATIME 0x10
+#define P9_SETATTR_MTIME 0x20
+#define P9_SETATTR_ATIME_SET 0x80
+#define P9_SETATTR_MTIME_SET 0x100
+// Rgetattr: everything but btime, gen and data_version.
+#define P9_GETATTR_BASIC 0x7ff
+#define P9_AT_REMOVEDIR 0x200
+#define P9_LOCK_SUCCESS 0
+#define P9_LOCK_TYPE_UNLCK 2
+// What statfs() reports as the file system type of a v9fs mount.
+#define V9FS_MAGIC 0x01021997
+
+ScatterList::ScatterList() : segments{},
+                             length{0} {
+}
+
+void ScatterList::append(void *base, size_t n) {
+    if (n != 0) {
+        segments.push_back({base, n});
+        length += n;
+    }
+}
+
+bool ScatterList::copy(size_t offset, uint8_t *data, size_t n, bool into) const {
+    if (offset > length || n > length - offset) {
+        return false;
+    }
+    for (const auto &segment : segments) {
+        if (n == 0) {
+            break;
+        }
+        if (offset >= segment.iov_len) {
+            offset -= segment.iov_len;
+            continue;
+        }
+        auto chunk = std::min(n, segment.iov_len - offset);
+        auto base = static_cast<uint8_t *>(segment.iov_base) + offset;
+        if (into) {
+            std::memcpy(base, data, chunk);
+        } else {
+            std::memcpy(data, base, chunk);
+        }
+        data += chunk;
+        n -= chunk;
+        offset = 0;
+    }
+    return true;
+}
+
+std::vector<iovec> ScatterList::slice(size_t offset, size_t n) const {
+    std::vector<iovec> result;
+    for (const auto &segment : segments) {
+        if (n == 0) {
+            break;
+        }
+        if (offset >= segment.iov_len) {
+            offset -= segment.iov_len;
+            continue;
+        }
+        auto chunk = std::min(n, segment.iov_len - offset);
+        result.push_back({static_cast<uint8_t *>(segment.iov_base) + offset, chunk});
+        n -= chunk;
+        offset = 0;
+    }
+    return result;
+}
+
+namespace {
+
+// Answered with Rlerror.
+struct Failure {
+    int error;
+};
+
+int check(int result) {
+    if (result < 0) {
+        throw Failure{errno};
+    }
+    return result;
+}
+
+std::string join(const std::string &directory, const std::string &name) {
+    // Names that would leave the directory or address it are not names.
+    if (name.empty() || name == "." || name == ".." || name.find('/') != std::string::npos) {
+        throw Failure{EINVAL};
+    }
+    return directory.empty() ? name : directory + "/" + name;
+}
+
+std::string parent(const std::string &path) {
+    auto slash = path.rfind('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash);
+}
+
+int host_flags(uint32_t flags) {
+    int result = flags & P9_DOTL_ACCMODE;
+    result |= (flags & P9_DOTL_CREATE) != 0 ? O_CREAT : 0;
+    result |= (flags & P9_DOTL_EXCL) != 0 ? O_EXCL : 0;
+    result |= (flags & P9_DOTL_TRUNC) != 0 ? O_TRUNC : 0;
+    result |= (flags & P9_DOTL_APPEND) != 0 ? O_APPEND : 0;
+    result |= (flags & P9_DOTL_DSYNC) != 0 ? O_DSYNC : 0;
+    result |= (flags & P9_DOTL_NOFOLLOW) != 0 ? O_NOFOLLOW : 0;
+    result |= (flags & P9_DOTL_SYNC) != 0 ? O_SYNC : 0;
+    return result | O_CLOEXEC;
+}
+
+} // namespace
+
+// Little-endian fields from a request.
+class P9Server::Reader {
+private:
+    const ScatterList &message;
+    size_t offset;
+
+public:
+    Reader(const ScatterList &message) : message{message},
+                                         offset{0} {
+    }
+    uint64_t field(size_t n) {
+        uint8_t bytes[8] = {};
+        if (!message.read(offset, bytes, n)) {
+            throw Failure{EPROTO};
+        }
+        offset += n;
+        uint64_t value = 0;
+        for (size_t i = 0; i < n; i++) {
+            value |= (uint64_t)bytes[i] << (8 * i);
+        }
+        return value;
+    };
+    uint8_t u8() { return field(1); };
+    uint16_t u16() { return field(2); };
+    uint32_t u32() { return field(4); };
+    uint64_t u64() { return field(8); };
+    std::string string() {
+        std::string value(u16(), '\0');
+        if (!message.read(offset, value.data(), value.size())) {
+            throw Failure{EPROTO};
+        }
+        offset += value.size();
+        return value;
+    };
+    size_t position() const { return offset; };
+};
+
+// Little-endian fields into a reply, after its header.
+class P9Server::Writer {
+private:
+    const ScatterList &message;
+    size_t offset;
+
+public:
+    Writer(const ScatterList &message) : message{message},
+                                         offset{P9_HEADER_SIZE} {
+    }
+    void field_at(size_t at, uint64_t value, size_t n) {
+        uint8_t bytes[8];
+        for (size_t i = 0; i < n; i++) {
+            bytes[i] = value >> (8 * i);
+        }
+        if (!message.write(at, bytes, n)) {
+            throw Failure{EMSGSIZE};
+        }
+    };
+    void field(uint64_t value, size_t n) {
+        field_at(offset, value, n);
+        offset += n;
+    };
+    void u8(uint8_t value) { field(value, 1); };
+    void u16(uint16_t value) { field(value, 2); };
+    void u32(uint32_t value) { field(value, 4); };
+    void u64(uint64_t value) { field(value, 8); };
+    void string(const std::string &value) {
+        u16(value.size());
+        if (!message.write(offset, value.data(), value.size())) {
+            throw Failure{EMSGSIZE};
+        }
+        offset += value.size();
+    };
+    void qid(uint8_t type, uint64_t path) {
+        u8(type);
+        u32(0);
+        u64(path);
+    };
+    void qid(const struct stat &status) {
+        qid(S_ISDIR(status.st_mode) ? P9_QTDIR : S_ISLNK(status.st_mode) ? P9_QTSYMLINK : P9_QTFILE, status.st_ino);
+    };
+    // Counts n bytes placed by other means, such as preadv().
+    void skip(size_t n) { offset += n; };
+    size_t position() const { return offset; };
+};
+
+// A path below the root as its directory, opened without following symbolic
+// links on the way, and its last name, "." for the root itself.
+class P9Server::Location {
+private:
+    int directory;
+    std::string last;
+
+public:
+    Location(int root, const std::string &path) : directory{-1},
+                                                  last{} {
+        directory = check(openat(root, ".", O_PATH | O_DIRECTORY | O_CLOEXEC));
+        size_t start = 0;
+        for (auto slash = path.find('/'); slash != std::string::npos; slash = path.find('/', start)) {
+            // A link opened with O_PATH | O_NOFOLLOW is not a directory.
+            auto next = openat(directory, path.substr(start, slash - start).c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            auto error = errno;
+            close(directory);
+            if (next < 0) {
+                throw Failure{error};
+            }
+            directory = next;
+            start = slash + 1;
+        }
+        last = path.empty() ? "." : path.substr(start);
+    }
+    Location(const Location &) = delete;
+    Location &operator=(const Location &) = delete;
+    ~Location() { close(directory); };
+    int dir() const { return directory; };
+    const char *name() const { return last.c_str(); };
+};
+
+P9Server::P9Server(const std::string &path) : root{-1},
+                                              msize{P9_MAX_MSIZE},
+                                              fids{} {
+    root = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0) {
+        throw std::runtime_error("cannot share " + path + ": " + std::strerror(errno));
+    }
+}
+
+P9Server::~P9Server() {
+    reset();
+    close(root);
+}
+
+void P9Server::reset() {
+    for (auto &[id, fid] : fids) {
+        close_fid(fid);
+    }
+    fids.clear();
+}
+
+P9Server::Fid &P9Server::get_fid(uint32_t fid) {
+    auto it = fids.find(fid);
+    if (it == fids.end()) {
+        throw Failure{EBADF};
+    }
+    return it->second;
+}
+
+void P9Server::close_fid(Fid &fid) {
+    // The stream owns the descriptor once it exists.
+    if (fid.dir != nullptr) {
+        closedir(fid.dir);
+    } else if (fid.fd >= 0) {
+        close(fid.fd);
+    }
+    fid.dir = nullptr;
+    fid.fd = -1;
+}
+
+void P9Server::clunk(uint32_t fid) {
+    close_fid(get_fid(fid));
+    fids.erase(fid);
+}
+
+// Fids below a renamed path follow it.
+void P9Server::rename_fids(const std::string &from, const std::string &to) {
+    for (auto &[id, fid] : fids) {
+        if (fid.path == from) {
+            fid.path = to;
+        } else if (fid.path.compare(0, from.size() + 1, from + "/") == 0) {
+            fid.path = to + fid.path.substr(from.size());
+        }
+    }
+}
+
+// A dfid[4] name[s] pair: the name in that directory.
+std::string P9Server::child(Reader &in) {
+    auto &directory = get_fid(in.u32());
+    auto name = in.string();
+    return join(directory.path, name);
+}
+
+struct stat P9Server::status(const Fid &fid) {
+    struct stat result;
+    if (fid.fd >= 0) {
+        check(fstat(fid.fd, &result));
+    } else {
+        Location at(root, fid.path);
+        check(fstatat(at.dir(), at.name(), &result, AT_SYMLINK_NOFOLLOW));
+    }
+    return result;
+}
+
+size_t P9Server::serve(const ScatterList &request, const ScatterList &reply, int error) {
+    Reader in(request);
+    uint8_t type;
+    uint16_t tag;
+    try {
+        in.u32();
+        type = in.u8();
+        tag = in.u16();
+    } catch (const Failure &) {
+        return 0;
+    }
+
+    Writer out(reply);
+    Writer error_out(reply);
+    try {
+        if (error == 0) {
+            handle(type, in, out, request, reply);
+        }
+    } catch (const Failure &failure) {
+        error = failure.error;
+    }
+    auto &result = error == 0 ? out : error_out;
+    try {
+        if (error != 0) {
+            type = P9_RLERROR - 1;
+            result.u32(error);
+        }
+        result.field_at(0, result.position(), 4);
+        result.field_at(4, type + 1, 1);
+        result.field_at(5, tag, 2);
+    } catch (const Failure &) {
+        return 0;
+    }
+    return result.position();
+}
+
+void P9Server::handle(uint8_t type, Reader &in, Writer &out, const ScatterList &request, const ScatterList &reply) {
+    switch (type) {
+    case P9_TVERSION: {
+        auto requested = in.u32();
+        auto version = in.string();
+        reset();
+        msize = std::min<uint32_t>(requested, P9_MAX_MSIZE);
+        out.u32(msize);
+        out.string(version.compare(0, 8, "9P2000.L") == 0 ? "9P2000.L" : "unknown");
+        return;
+    }
+    case P9_TATTACH: {
+        auto fid = in.u32();
+        if (fids.count(fid) != 0) {
+            throw Failure{EBADF};
+        }
+        struct stat root_status;
+        check(fstat(root, &root_status));
+        fids[fid] = {"", -1, nullptr};
+        out.qid(root_status);
+        return;
+    }
+    case P9_TWALK: {
+        auto fid = in.u32();
+        auto new_fid = in.u32();
+        auto names = in.u16();
+        auto path = get_fid(fid).path;
+        if (new_fid != fid && fids.count(new_fid) != 0) {
+            throw Failure{EBADF};
+        }
+        auto count_at = out.position();
+        out.u16(0);
+        uint16_t walked = 0;
+        for (; walked < names; walked++) {
+            auto name = in.string();
+            auto next = name == ".." ? parent(path) : name == "." ? path : join(path, name);
+            struct stat next_status;
+            auto error = 0;
+            try {
+                Location at(root, next);
+                if (fstatat(at.dir(), at.name(), &next_status, AT_SYMLINK_NOFOLLOW) < 0) {
+                    error = errno;
+                }
+            } catch (const Failure &failure) {
+                error = failure.error;
+            }
+            if (error != 0) {
+                // Only a walk that fails at its first name is an error.
+                if (walked == 0) {
+                    throw Failure{error};
+                }
+                break;
+            }
+            path = next;
+            out.qid(next_status);
+        }
+        out.field_at(count_at, walked, 2);
+        if (walked == names) {
+            if (new_fid == fid) {
+                close_fid(fids[fid]);
+            }
+            fids[new_fid] = {path, -1, nullptr};
+        }
+        return;
+    }
+    case P9_TCLUNK:
+        clunk(in.u32());
+        return;
+    case P9_TREMOVE: {
+        auto fid = in.u32();
+        auto path = get_fid(fid).path;
+        auto removed = path.empty() ? -1 : 0;
+        auto error = EBUSY;
+        if (removed == 0) {
+            auto directory = S_ISDIR(status(get_fid(fid)).st_mode);
+            Location at(root, path);
+            removed = unlinkat(at.dir(), at.name(), directory ? AT_REMOVEDIR : 0);
+            error = errno;
+        }
+        // The fid goes away even if the file does not.
+        clunk(fid);
+        if (removed < 0) {
+            throw Failure{error};
+        }
+        return;
+    }
+    case P9_TLOPEN: {
+        auto &fid = get_fid(in.u32());
+        auto flags = in.u32();
+        if (fid.fd >= 0) {
+            throw Failure{EBADF};
+        }
+        auto directory = S_ISDIR(status(fid).st_mode);
+        Location at(root, fid.path);
+        if (directory) {
+            fid.fd = check(openat(at.dir(), at.name(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+        } else {
+            fid.fd = check(openat(at.dir(), at.name(), (host_flags(flags) & ~(O_CREAT | O_EXCL)) | O_NOFOLLOW));
+        }
+        out.qid(status(fid));
+        out.u32(0);
+        return;
+    }
+    case P9_TLCREATE: {
+        auto &fid = get_fid(in.u32());
+        auto name = in.string();
+        auto path = join(fid.path, name);
+        auto flags = in.u32();
+        auto mode = in.u32();
+        if (fid.fd >= 0) {
+            throw Failure{EBADF};
+        }
+        Location at(root, path);
+        fid.fd = check(openat(at.dir(), at.name(), host_flags(flags) | O_CREAT | O_NOFOLLOW, mode & 07777));
+        fid.path = path;
+        out.qid(status(fid));
+        out.u32(0);
+        return;
+    }
+    case P9_TREAD: {
+        auto &fid = get_fid(in.u32());
+        auto offset = in.u64();
+        auto count = in.u32();
+        if (fid.fd < 0 || fid.dir != nullptr) {
+            throw Failure{EBADF};
+        }
+        if (reply.size() < P9_IO_HEADER_SIZE) {
+            throw Failure{EMSGSIZE};
+        }
+        count = std::min<uint64_t>({count, msize - P9_IO_HEADER_SIZE, reply.size() - P9_IO_HEADER_SIZE});
+        auto buffers = reply.slice(P9_IO_HEADER_SIZE, count);
+        auto n = preadv(fid.fd, buffers.data(), std::min<size_t>(buffers.size(), IOV_MAX), offset);
+        check(n);
+        out.u32(n);
+        out.skip(n);
+        return;
+    }
+    case P9_TWRITE: {
+        auto &fid = get_fid(in.u32());
+        auto offset = in.u64();
+        auto count = in.u32();
+        if (fid.fd < 0 || fid.dir != nullptr) {
+            throw Failure{EBADF};
+        }
+        if (count > request.size() - in.position()) {
+            throw Failure{EPROTO};
+        }
+        auto buffers = request.slice(in.position(), count);
+        auto n = pwritev(fid.fd, buffers.data(), std::min<size_t>(buffers.size(), IOV_MAX), offset);
+        check(n);
+        out.u32(n);
+        return;
+    }
+    case P9_TREADDIR: {
+        auto &fid = get_fid(in.u32());
+        auto offset = in.u64();
+        auto count = in.u32();
+        if (fid.fd < 0) {
+            throw Failure{EBADF};
+        }
+        if (fid.dir == nullptr) {
+            fid.dir = fdopendir(fid.fd);
+            if (fid.dir == nullptr) {
+                throw Failure{errno};
+            }
+        }
+        // Entry offsets are telldir() cookies.
+        if (offset == 0) {
+            rewinddir(fid.dir);
+        } else {
+            seekdir(fid.dir, offset);
+        }
+        count = std::min<uint64_t>({count, msize - P9_IO_HEADER_SIZE, reply.size() - std::min<size_t>(reply.size(), P9_IO_HEADER_SIZE)});
+        auto count_at = out.position();
+        out.u32(0);
+        uint32_t used = 0;
+        while (true) {
+            auto before = telldir(fid.dir);
+            errno = 0;
+            auto entry = readdir(fid.dir);
+            if (entry == nullptr) {
+                if (errno != 0) {
+                    throw Failure{errno};
+                }
+                break;
+            }
+            std::string name(entry->d_name);
+            // qid[13] offset[8] type[1] name[s]
+            auto size = P9_QID_SIZE + 8 + 1 + 2 + name.size();
+            if (used + size > count) {
+                seekdir(fid.dir, before);
+                break;
+            }
+            out.qid(entry->d_type == DT_DIR ? P9_QTDIR : entry->d_type == DT_LNK ? P9_QTSYMLINK : P9_QTFILE, entry->d_ino);
+            out.u64(telldir(fid.dir));
+            out.u8(entry->d_type);
+            out.string(name);
+            used += size;
+        }
+        out.field_at(count_at, used, 4);
+        return;
+    }
+    case P9_TGETATTR: {
+        auto status = this->status(get_fid(in.u32()));
+        out.u64(P9_GETATTR_BASIC);
+        out.qid(status);
+        out.u32(status.st_mode);
+        out.u32(status.st_uid);
+        out.u32(status.st_gid);
+        out.u64(status.st_nlink);
+        out.u64(status.st_rdev);
+        out.u64(status.st_size);
+        out.u64(status.st_blksize);
+        out.u64(status.st_blocks);
+        out.u64(status.st_atim.tv_sec);
+        out.u64(status.st_atim.tv_nsec);
+        out.u64(status.st_mtim.tv_sec);
+        out.u64(status.st_mtim.tv_nsec);
+        out.u64(status.st_ctim.tv_sec);
+        out.u64(status.st_ctim.tv_nsec);
+        // btime, gen and data_version
+        for (int i = 0; i < 4; i++) {
+            out.u64(0);
+        }
+        return;
+    }
+    case P9_TSETATTR: {
+        Location at(root, get_fid(in.u32()).path);
+        auto valid = in.u32();
+        auto mode = in.u32();
+        auto uid = in.u32();
+        auto gid = in.u32();
+        auto size = in.u64();
+        timespec times[2];
+        times[0] = {(time_t)in.u64(), (long)in.u64()};
+        times[1] = {(time_t)in.u64(), (long)in.u64()};
+        if ((valid & P9_SETATTR_MODE) != 0) {
+            // fchmodat() cannot leave a link alone; links have no mode to set anyway.
+            struct stat status;
+            check(fstatat(at.dir(), at.name(), &status, AT_SYMLINK_NOFOLLOW));
+            if (S_ISLNK(status.st_mode)) {
+                throw Failure{EOPNOTSUPP};
+            }
+            check(fchmodat(at.dir(), at.name(), mode & 07777, 0));
+        }
+        if ((valid & (P9_SETATTR_UID | P9_SETATTR_GID)) != 0) {
+            check(fchownat(at.dir(), at.name(), (valid & P9_SETATTR_UID) != 0 ? uid : -1, (valid & P9_SETATTR_GID) != 0 ? gid : -1, AT_SYMLINK_NOFOLLOW));
+        }
+        if ((valid & P9_SETATTR_SIZE) != 0) {
+            auto fd = check(openat(at.dir(), at.name(), O_WRONLY | O_NOFOLLOW | O_CLOEXEC));
+            auto truncated = ftruncate(fd, size);
+            auto error = errno;
+            close(fd);
+            if (truncated < 0) {
+                throw Failure{error};
+            }
+        }
+        if ((valid & (P9_SETATTR_ATIME | P9_SETATTR_MTIME)) != 0) {
+            if ((valid & P9_SETATTR_ATIME) == 0) {
+                times[0].tv_nsec = UTIME_OMIT;
+            } else if ((valid & P9_SETATTR_ATIME_SET) == 0) {
+                times[0].tv_nsec = UTIME_NOW;
+            }
+            if ((valid & P9_SETATTR_MTIME) == 0) {
+                times[1].tv_nsec = UTIME_OMIT;
+            } else if ((valid & P9_SETATTR_MTIME_SET) == 0) {
+                times[1].tv_nsec = UTIME_NOW;
+            }
+            check(utimensat(at.dir(), at.name(), times, AT_SYMLINK_NOFOLLOW));
+        }
+        return;
+    }
+    case P9_TSTATFS: {
+        get_fid(in.u32());
+        struct statvfs status;
+        check(fstatvfs(root, &status));
+        out.u32(V9FS_MAGIC);
+        out.u32(status.f_frsize);
+        out.u64(status.f_blocks);
+        out.u64(status.f_bfree);
+        out.u64(status.f_bavail);
+        out.u64(status.f_files);
+        out.u64(status.f_ffree);
+        out.u64(status.f_fsid);
+        out.u32(status.f_namemax);
+        return;
+    }
+    case P9_TMKDIR: {
+        auto path = child(in);
+        auto mode = in.u32();
+        Location at(root, path);
+        check(mkdirat(at.dir(), at.name(), mode & 07777));
+        out.qid(status({path, -1, nullptr}));
+        return;
+    }
+    case P9_TSYMLINK: {
+        auto path = child(in);
+        auto target = in.string();
+        // The target is only ever read back, never followed here.
+        Location at(root, path);
+        check(symlinkat(target.c_str(), at.dir(), at.name()));
+        out.qid(status({path, -1, nullptr}));
+        return;
+    }
+    case P9_TMKNOD: {
+        auto path = child(in);
+        auto mode = in.u32();
+        // major[4] minor[4]: there are no device nodes, which would give the
+        // guest the host's devices.
+        in.u32();
+        in.u32();
+        if (!S_ISFIFO(mode) && !S_ISSOCK(mode)) {
+            throw Failure{EPERM};
+        }
+        Location at(root, path);
+        check(mknodat(at.dir(), at.name(), (mode & S_IFMT) | (mode & 07777), 0));
+        out.qid(status({path, -1, nullptr}));
+        return;
+    }
+    case P9_TREADLINK: {
+        Location at(root, get_fid(in.u32()).path);
+        std::string target(PATH_MAX, '\0');
+        auto n = readlinkat(at.dir(), at.name(), target.data(), target.size());
+        check(n);
+        target.resize(n);
+        out.string(target);
+        return;
+    }
+    case P9_TLINK: {
+        auto directory = get_fid(in.u32()).path;
+        Location existing(root, get_fid(in.u32()).path);
+        auto name = in.string();
+        Location at(root, join(directory, name));
+        check(linkat(existing.dir(), existing.name(), at.dir(), at.name(), 0));
+        return;
+    }
+    case P9_TRENAME: {
+        auto &fid = get_fid(in.u32());
+        auto path = child(in);
+        if (fid.path.empty()) {
+            throw Failure{EBUSY};
+        }
+        Location from(root, fid.path);
+        Location to(root, path);
+        check(renameat(from.dir(), from.name(), to.dir(), to.name()));
+        rename_fids(fid.path, path);
+        return;
+    }
+    case P9_TRENAMEAT: {
+        auto from = child(in);
+        auto to = child(in);
+        Location from_at(root, from);
+        Location to_at(root, to);
+        check(renameat(from_at.dir(), from_at.name(), to_at.dir(), to_at.name()));
+        rename_fids(from, to);
+        return;
+    }
+    case P9_TUNLINKAT: {
+        auto path = child(in);
+        auto flags = in.u32();
+        Location at(root, path);
+        check(unlinkat(at.dir(), at.name(), (flags & P9_AT_REMOVEDIR) != 0 ? AT_REMOVEDIR : 0));
+        return;
+    }
+    case P9_TFSYNC: {
+        auto &fid = get_fid(in.u32());
+        auto data_only = in.u32();
+        if (fid.fd < 0) {
+            throw Failure{EBADF};
+        }
+        check(data_only != 0 ? fdatasync(fid.fd) : fsync(fid.fd));
+        return;
+    }
+    case P9_TFLUSH:
+        // Requests are served as they arrive, so none is ever outstanding.
+        return;
+    case P9_TLOCK:
+        get_fid(in.u32());
+        out.u8(P9_LOCK_SUCCESS);
+        return;
+    case P9_TGETLOCK: {
+        get_fid(in.u32());
+        in.u8();
+        auto start = in.u64();
+        auto length = in.u64();
+        auto process = in.u32();
+        auto client = in.string();
+        out.u8(P9_LOCK_TYPE_UNLCK);
+        out.u64(start);
+        out.u64(length);
+        out.u32(process);
+        out.string(client);
+        return;
+    }
+    default:
+        // Including Tauth and the extended attribute requests.
+        throw Failure{EOPNOTSUPP};
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef P9_SERVER_H
+#define P9_SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Largest message the server negotiates in Tversion.
+#define P9_MAX_MSIZE (512 * 1024)
+// size[4] type[1] tag[2]
+#define P9_HEADER_SIZE 7
+
+// A message spread over several buffers, as a descriptor chain delivers it.
+class ScatterList {
+private:
+    std::vector<iovec> segments;
+    size_t length;
+    bool copy(size_t offset, uint8_t *data, size_t n, bool into) const;
+
+public:
+    ScatterList();
+    void append(void *base, size_t n);
+    size_t size() const { return length; };
+    // Copy n bytes at offset out of or into the buffers; false if they are not
+    // all inside them.
+    bool read(size_t offset, void *data, size_t n) const { return copy(offset, static_cast<uint8_t *>(data), n, false); };
+    bool write(size_t offset, const void *data, size_t n) const { return copy(offset, static_cast<uint8_t *>(const_cast<void *>(data)), n, true); };
+    // The segments covering [offset, offset + n), for vectored I/O straight to
+    // and from the buffers.
+    std::vector<iovec> slice(size_t offset, size_t n) const;
+};
+
+// A 9P2000.L file server for one host directory, the dialect Linux's v9fs
+// speaks. Fids name paths below the directory, which the guest cannot walk
+// out of with "..". Paths are resolved a name at a time from the directory
+// without following symbolic links, which the guest resolves itself, so no
+// link can lead outside it. Files are opened with the emulator's own
+// permissions, and mknod only creates FIFOs and sockets. File data moves with
+// preadv() and pwritev() directly between the host file and the message
+// buffers, without a bounce buffer. Extended attributes, authentication and
+// locking between clients are not supported; locks always succeed.
+class P9Server {
+private:
+    struct Fid {
+        // Relative to the root, "" for the root itself.
+        std::string path;
+        int fd;
+        DIR *dir;
+    };
+    int root;
+    uint32_t msize;
+    std::map<uint32_t, Fid> fids;
+    class Reader;
+    class Writer;
+    class Location;
+    Fid &get_fid(uint32_t fid);
+    void close_fid(Fid &fid);
+    void clunk(uint32_t fid);
+    void rename_fids(const std::string &from, const std::string &to);
+    std::string child(Reader &in);
+    struct stat status(const Fid &fid);
+    void handle(uint8_t type, Reader &in, Writer &out, const ScatterList &request, const ScatterList &reply);
+
+public:
+    // Throws std::runtime_error if path is not a readable directory.
+    P9Server(const std::string &path);
+    P9Server(const P9Server &) = delete;
+    P9Server &operator=(const P9Server &) = delete;
+    ~P9Server();
+    // Serves one T-message and writes its R-message into reply. A non-zero
+    // error answers it with Rlerror instead, as for a request some of whose
+    // buffers could not be used. Returns the length of the reply, 0 if the
+    // request is malformed beyond answering.
+    size_t serve(const ScatterList &request, const ScatterList &reply, int error = 0);
+    // Forgets every fid, as a new Tversion does.
+    void reset();
+};
+
+#endif
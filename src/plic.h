@@ -18,9 +18,23 @@ private:
     uint64_t sclaim;
 
 public:
+    struct State {
+        uint64_t pending;
+        uint64_t senable;
+        uint64_t spriority;
+        uint64_t sclaim;
+    };
     PLIC();
-    std::pair<uint64_t, std::optional<Exception>> load(uint64_t addr, int nBytes);
-    std::optional<Exception> store(uint64_t addr, int nBytes, uint64_t value);
+    const char *get_name() { return "plic"; };
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
+    State save() { return {pending, senable, spriority, sclaim}; };
+    void restore(const State &state) {
+        pending = state.pending;
+        senable = state.senable;
+        spriority = state.spriority;
+        sclaim = state.sclaim;
+    };
 };
 
 #endif
@@ -0,0 +1,40 @@
+#include "replay.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#define REPLAY_MAGIC "RVINPUT1"
+#define REPLAY_MAGIC_SIZE 8
+
+InputRecorder::InputRecorder(const std::string &path) : file{path, std::ofstream::binary} {
+    if (!file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    file.write(REPLAY_MAGIC, REPLAY_MAGIC_SIZE);
+}
+
+void InputRecorder::record(const InputEvent &event) {
+    file.write(reinterpret_cast<const char *>(&event), sizeof(event));
+    // Inputs are rare; flushing each one keeps the log usable after a kill.
+    file.flush();
+}
+
+InputReplayer::InputReplayer(const std::string &path) : events{}, next{0} {
+    std::ifstream file(path, std::ifstream::binary);
+    char magic[REPLAY_MAGIC_SIZE];
+    if (!file.read(magic, REPLAY_MAGIC_SIZE) || std::memcmp(magic, REPLAY_MAGIC, REPLAY_MAGIC_SIZE) != 0) {
+        throw std::runtime_error("not an input log: " + path);
+    }
+    InputEvent event;
+    while (file.read(reinterpret_cast<char *>(&event), sizeof(event))) {
+        events.push_back(event);
+    }
+}
+
+uint64_t InputReplayer::next_instret() {
+    return next < events.size() ? events[next].instret : UINT64_MAX;
+}
+
+InputEvent InputReplayer::pop() {
+    return events[next++];
+}
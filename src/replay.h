@@ -0,0 +1,48 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Asynchronous inputs that can make two runs of the same guest diverge.
+// mtime counts retired instructions, so only time skipped while idle is logged.
+// Virtio completions are not listed: they run synchronously when the guest
+// notifies the queue, so they are already a function of the instruction stream.
+enum InputEventType : uint32_t {
+    UartRx = 0,
+    // mtime ticks skipped while the guest was idle; value is the tick count.
+    IdleSkip = 1,
+};
+
+// One delivered input. instret is the number of instructions retired before
+// delivery, so replaying at the same count reproduces the run exactly.
+struct InputEvent {
+    uint64_t instret;
+    uint32_t type;
+    uint32_t value;
+};
+
+class InputRecorder {
+private:
+    std::ofstream file;
+
+public:
+    InputRecorder(const std::string &path);
+    void record(const InputEvent &event);
+};
+
+class InputReplayer {
+private:
+    std::vector<InputEvent> events;
+    size_t next;
+
+public:
+    InputReplayer(const std::string &path);
+    // Instruction count of the next event, UINT64_MAX once the log is exhausted.
+    uint64_t next_instret();
+    InputEvent pop();
+};
+
+#endif
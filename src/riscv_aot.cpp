@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <elf.h>
+
+#include "aot.h"
+#include "cpu.h"
+
+// riscv-aot [--base addr] [--size bytes] <image> <output.cpp>
+//
+// Translates the basic blocks of a guest kernel ahead of time into C++ for the
+// emulator's --aot option. A raw image is translated as loaded at --base
+// (MEMORY_BASE by default), up to --size bytes; an ELF file by its executable
+// segments at their physical addresses. Only RV64I and mul are translated:
+// blocks end at control transfers and page boundaries, and before any other
+// instruction, which is left to the interpreter.
+
+// Instructions per block.
+#define AOT_MAX_BLOCK 256
+
+namespace {
+
+struct Segment {
+    uint64_t addr;
+    std::vector<uint32_t> words;
+};
+
+enum class Kind {
+    // Left to the interpreter; ends the block before it.
+    Untranslated,
+    Straight,
+    // A load or store, which may raise an exception.
+    Memory,
+    // Sets c->pc; ends the block after it.
+    Jump,
+};
+
+struct Translation {
+    Kind kind;
+    std::string code;
+};
+
+std::vector<uint8_t> read_file(const std::string &path) {
+    std::ifstream file(path, std::ifstream::binary);
+    if (!file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+}
+
+std::vector<uint32_t> to_words(const uint8_t *bytes, uint64_t size) {
+    std::vector<uint32_t> words(size / 4);
+    std::memcpy(words.data(), bytes, words.size() * 4);
+    return words;
+}
+
+std::vector<Segment> load_segments(const std::vector<uint8_t> &image, uint64_t base, uint64_t size) {
+    if (image.size() < sizeof(Elf64_Ehdr) || std::memcmp(image.data(), ELFMAG, SELFMAG) != 0) {
+        size = std::min<uint64_t>(size, image.size());
+        return {{base, to_words(image.data(), size)}};
+    }
+
+    Elf64_Ehdr header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    if (header.e_ident[EI_CLASS] != ELFCLASS64 || header.e_ident[EI_DATA] != ELFDATA2LSB || header.e_machine != EM_RISCV) {
+        throw std::runtime_error("not a little-endian RV64 ELF file");
+    }
+    std::vector<Segment> segments;
+    for (uint64_t i = 0; i < header.e_phnum; i++) {
+        Elf64_Phdr program;
+        auto offset = header.e_phoff + i * header.e_phentsize;
+        if (offset + sizeof(program) > image.size()) {
+            throw std::runtime_error("truncated ELF program headers");
+        }
+        std::memcpy(&program, image.data() + offset, sizeof(program));
+        if (program.p_type != PT_LOAD || (program.p_flags & PF_X) == 0) {
+            continue;
+        }
+        if (program.p_offset + program.p_filesz > image.size()) {
+            throw std::runtime_error("truncated ELF segment");
+        }
+        segments.push_back({program.p_paddr, to_words(image.data() + program.p_offset, program.p_filesz)});
+    }
+    return segments;
+}
+
+std::string hex(uint64_t value) {
+    std::ostringstream out;
+    out << "UINT64_C(0x" << std::hex << value << ")";
+    return out.str();
+}
+
+// x0 reads as zero whatever the interpreter last left in registers[0].
+std::string reg(uint32_t index) {
+    return index == 0 ? "UINT64_C(0)" : "x[" + std::to_string(index) + "]";
+}
+
+std::string set(uint32_t rd, const std::string &value) {
+    return rd == 0 ? "" : "x[" + std::to_string(rd) + "] = " + value + ";";
+}
+
+std::string join(const std::string &first, const std::string &second) {
+    return first.empty() || second.empty() ? first + second : first + " " + second;
+}
+
+// Mirrors Cpu::execute() for the instructions it translates; offset is the
+// instruction's distance from the start of the block.
+Translation translate(uint32_t instruction, uint64_t offset) {
+    auto opcode = instruction & 0x7f;
+    auto rd = (instruction >> 7) & 0x1f;
+    auto rs1 = (instruction >> 15) & 0x1f;
+    auto rs2 = (instruction >> 20) & 0x1f;
+    auto funct3 = (instruction >> 12) & 0x7;
+    auto funct7 = instruction >> 25;
+    uint64_t i_imm = (int64_t)(int32_t)instruction >> 20;
+    auto next = "pc + " + hex(offset + 4);
+    auto a = reg(rs1);
+    auto b = reg(rs2);
+
+    switch (opcode) {
+    case 0x03: {
+        static const char *const loads[] = {
+            "(uint64_t)(int64_t)(int8_t)",
+            "(uint64_t)(int64_t)(int16_t)",
+            "(uint64_t)(int64_t)(int32_t)",
+            "",
+            "(uint64_t)(uint8_t)",
+            "(uint64_t)(uint16_t)",
+            "(uint64_t)(uint32_t)",
+        };
+        if (funct3 == 0x7) {
+            break;
+        }
+        auto size = std::to_string(1 << (funct3 & 3));
+        auto access = "c->load(c->cpu, " + a + " + " + hex(i_imm) + ", " + size + ")";
+        return {Kind::Memory, rd == 0 ? access + ";" : set(rd, loads[funct3] + access)};
+    }
+    case 0x0f:
+        if (funct3 == 0x0) {
+            // fence
+            return {Kind::Straight, ""};
+        }
+        break;
+    case 0x13: {
+        auto shamt = std::to_string(i_imm & 0x3f);
+        switch (funct3) {
+        case 0x0:
+            return {Kind::Straight, set(rd, a + " + " + hex(i_imm))};
+        case 0x1:
+            if (funct7 >> 1 == 0x00) {
+                return {Kind::Straight, set(rd, a + " << " + shamt)};
+            }
+            break;
+        case 0x2:
+            return {Kind::Straight, set(rd, "(uint64_t)((int64_t)" + a + " < (int64_t)" + hex(i_imm) + ")")};
+        case 0x3:
+            return {Kind::Straight, set(rd, "(uint64_t)(" + a + " < " + hex(i_imm) + ")")};
+        case 0x4:
+            return {Kind::Straight, set(rd, a + " ^ " + hex(i_imm))};
+        case 0x5:
+            if (funct7 >> 1 == 0x00) {
+                return {Kind::Straight, set(rd, a + " >> " + shamt)};
+            } else if (funct7 >> 1 == 0x10) {
+                return {Kind::Straight, set(rd, "(uint64_t)((int64_t)" + a + " >> " + shamt + ")")};
+            }
+            break;
+        case 0x6:
+            return {Kind::Straight, set(rd, a + " | " + hex(i_imm))};
+        case 0x7:
+            return {Kind::Straight, set(rd, a + " & " + hex(i_imm))};
+        }
+        break;
+    }
+    case 0x17:
+        // auipc
+        return {Kind::Straight, set(rd, "pc + " + hex(offset + (uint64_t)(int64_t)(int32_t)(instruction & 0xfffff000)))};
+    case 0x1b: {
+        auto shamt = std::to_string(i_imm & 0x1f);
+        if (funct3 == 0x0) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)(int32_t)(" + a + " + " + hex(i_imm) + ")")};
+        } else if (funct3 == 0x1 && funct7 == 0x00) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)(int32_t)(" + a + " << " + shamt + ")")};
+        } else if (funct3 == 0x5 && funct7 == 0x00) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)(int32_t)((uint32_t)" + a + " >> " + shamt + ")")};
+        } else if (funct3 == 0x5 && funct7 == 0x20) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)((int32_t)" + a + " >> " + shamt + ")")};
+        }
+        break;
+    }
+    case 0x23: {
+        if (funct3 > 0x3) {
+            break;
+        }
+        uint64_t imm = (uint64_t)((int64_t)(int32_t)(instruction & 0xfe000000) >> 20) | ((instruction >> 7) & 0x1f);
+        return {Kind::Memory, "c->store(c->cpu, " + a + " + " + hex(imm) + ", " + std::to_string(1 << funct3) + ", " + b + ");"};
+    }
+    case 0x33: {
+        auto shamt = "(" + b + " & 0x3f)";
+        if (funct7 == 0x00) {
+            static const char *const operators[] = {" + ", " << ", "", "", " ^ ", " >> ", " | ", " & "};
+            switch (funct3) {
+            case 0x2:
+                return {Kind::Straight, set(rd, "(uint64_t)((int64_t)" + a + " < (int64_t)" + b + ")")};
+            case 0x3:
+                return {Kind::Straight, set(rd, "(uint64_t)(" + a + " < " + b + ")")};
+            case 0x1:
+            case 0x5:
+                return {Kind::Straight, set(rd, a + operators[funct3] + shamt)};
+            default:
+                return {Kind::Straight, set(rd, a + operators[funct3] + b)};
+            }
+        } else if (funct7 == 0x20 && funct3 == 0x0) {
+            return {Kind::Straight, set(rd, a + " - " + b)};
+        } else if (funct7 == 0x20 && funct3 == 0x5) {
+            return {Kind::Straight, set(rd, "(uint64_t)((int64_t)" + a + " >> " + shamt + ")")};
+        } else if (funct7 == 0x01 && funct3 == 0x0) {
+            return {Kind::Straight, set(rd, a + " * " + b)};
+        }
+        break;
+    }
+    case 0x37:
+        // lui
+        return {Kind::Straight, set(rd, hex((uint64_t)(int64_t)(int32_t)(instruction & 0xfffff000)))};
+    case 0x3b: {
+        auto shamt = "(" + b + " & 0x1f)";
+        if (funct7 == 0x00 && funct3 == 0x0) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)(int32_t)(" + a + " + " + b + ")")};
+        } else if (funct7 == 0x20 && funct3 == 0x0) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)(int32_t)(" + a + " - " + b + ")")};
+        } else if (funct7 == 0x00 && funct3 == 0x1) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)(int32_t)((uint32_t)" + a + " << " + shamt + ")")};
+        } else if (funct7 == 0x00 && funct3 == 0x5) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)(int32_t)((uint32_t)" + a + " >> " + shamt + ")")};
+        } else if (funct7 == 0x20 && funct3 == 0x5) {
+            return {Kind::Straight, set(rd, "(uint64_t)(int64_t)((int32_t)" + a + " >> " + shamt + ")")};
+        }
+        break;
+    }
+    case 0x63: {
+        static const char *const conditions[] = {
+            " == ", " != ", nullptr, nullptr, " < ", " >= ", " < ", " >= ",
+        };
+        if (conditions[funct3] == nullptr) {
+            break;
+        }
+        uint64_t imm = (uint64_t)((int64_t)(int32_t)(instruction & 0x80000000) >> 19) | ((instruction & 0x80) << 4) | ((instruction >> 20) & 0x7e0) | ((instruction >> 7) & 0x1e);
+        auto condition = funct3 < 0x6 ? "(int64_t)" + a + conditions[funct3] + "(int64_t)" + b : a + conditions[funct3] + b;
+        return {Kind::Jump, "c->pc = " + condition + " ? pc + " + hex(offset + imm) + " : " + next + ";"};
+    }
+    case 0x67:
+        if (funct3 == 0x0) {
+            // jalr: rd may be rs1, so the target comes first.
+            return {Kind::Jump, join("c->pc = (" + a + " + " + hex(i_imm) + ") & ~UINT64_C(1);", set(rd, next))};
+        }
+        break;
+    case 0x6f: {
+        uint64_t imm = (uint64_t)((int64_t)(int32_t)(instruction & 0x80000000) >> 11) | (instruction & 0xff000) | ((instruction >> 9) & 0x800) | ((instruction >> 20) & 0x7fe);
+        return {Kind::Jump, join(set(rd, next), "c->pc = pc + " + hex(offset + imm) + ";")};
+    }
+    }
+    return {Kind::Untranslated, ""};
+}
+
+// Block starts: segment and page starts, the instructions after control
+// transfers and untranslated ones, and static branch and jump targets.
+std::set<uint64_t> find_leaders(const Segment &segment) {
+    std::set<uint64_t> leaders;
+    auto end = segment.addr + segment.words.size() * 4;
+    leaders.insert(segment.addr);
+    for (uint64_t i = 0; i < segment.words.size(); i++) {
+        auto addr = segment.addr + i * 4;
+        auto instruction = segment.words[i];
+        if (addr % PAGE_SIZE == 0) {
+            leaders.insert(addr);
+        }
+        auto kind = translate(instruction, 0).kind;
+        if (kind == Kind::Untranslated || kind == Kind::Jump) {
+            leaders.insert(addr + 4);
+        }
+        uint64_t target = 0;
+        if ((instruction & 0x7f) == 0x63) {
+            target = addr + ((uint64_t)((int64_t)(int32_t)(instruction & 0x80000000) >> 19) | ((instruction & 0x80) << 4) | ((instruction >> 20) & 0x7e0) | ((instruction >> 7) & 0x1e));
+        } else if ((instruction & 0x7f) == 0x6f) {
+            target = addr + ((uint64_t)((int64_t)(int32_t)(instruction & 0x80000000) >> 11) | (instruction & 0xff000) | ((instruction >> 9) & 0x800) | ((instruction >> 20) & 0x7fe));
+        }
+        if (target >= segment.addr && target < end && target % 4 == 0) {
+            leaders.insert(target);
+        }
+    }
+    leaders.erase(end);
+    return leaders;
+}
+
+std::string block_name(uint64_t addr) {
+    std::ostringstream out;
+    out << "block_" << std::hex << addr;
+    return out.str();
+}
+
+const char *prelude = R"(#include <cstdint>
+
+extern "C" {
+
+struct AotContext {
+    uint64_t *registers;
+    void *cpu;
+    uint64_t (*load)(void *cpu, uint64_t addr, int nBytes);
+    void (*store)(void *cpu, uint64_t addr, int nBytes, uint64_t value);
+    uint64_t pc;
+    uint64_t retired;
+};
+
+struct AotBlock {
+    uint64_t addr;
+    uint32_t length;
+    const uint32_t *words;
+    void (*function)(AotContext *context);
+};
+
+}
+
+namespace {
+)";
+
+// Emits one block starting at the given word; returns its length in instructions.
+uint64_t emit_block(std::ostream &out, const Segment &segment, uint64_t first) {
+    auto addr = segment.addr + first * 4;
+    std::ostringstream body;
+    uint64_t length = 0;
+    auto ended = false;
+    while (!ended && first + length < segment.words.size() && length < AOT_MAX_BLOCK) {
+        auto offset = length * 4;
+        if (length > 0 && (addr + offset) % PAGE_SIZE == 0) {
+            break;
+        }
+        auto translation = translate(segment.words[first + length], offset);
+        if (translation.kind == Kind::Untranslated) {
+            break;
+        }
+        if (translation.kind == Kind::Memory) {
+            body << "    c->retired = " << length << ";\n";
+        }
+        if (!translation.code.empty()) {
+            body << "    " << translation.code << "\n";
+        }
+        ended = translation.kind == Kind::Jump;
+        length++;
+    }
+    if (length == 0) {
+        return 0;
+    }
+    if (!ended) {
+        body << "    c->pc = pc + " << hex(length * 4) << ";\n";
+    }
+
+    auto name = block_name(addr);
+    out << "const uint32_t " << name << "_words[] = {" << std::hex;
+    for (uint64_t i = 0; i < length; i++) {
+        out << (i == 0 ? "" : ", ") << "0x" << segment.words[first + i];
+    }
+    out << std::dec << "};\n"
+        << "void " << name << "(AotContext *c) {\n"
+        << "    [[maybe_unused]] uint64_t *x = c->registers;\n"
+        << "    [[maybe_unused]] uint64_t pc = c->pc;\n"
+        << body.str() << "}\n\n";
+    return length;
+}
+
+void emit(std::ostream &out, const std::string &source, const std::vector<Segment> &segments) {
+    out << "// Generated by riscv-aot from " << source << ".\n" << prelude << "\n";
+    std::vector<std::pair<uint64_t, uint64_t>> blocks;
+    for (const auto &segment : segments) {
+        for (auto leader : find_leaders(segment)) {
+            auto length = emit_block(out, segment, (leader - segment.addr) / 4);
+            if (length > 0) {
+                blocks.push_back({leader, length});
+            }
+        }
+    }
+    out << "} // namespace\n\n"
+        << "extern \"C\" const uint32_t riscv_aot_version = " << AOT_VERSION << ";\n"
+        << "extern \"C\" const uint64_t riscv_aot_block_count = " << blocks.size() << ";\n"
+        << "extern \"C\" const AotBlock riscv_aot_blocks[] = {\n";
+    for (const auto &[addr, length] : blocks) {
+        auto name = block_name(addr);
+        out << "    {" << hex(addr) << ", " << length << ", " << name << "_words, " << name << "},\n";
+    }
+    if (blocks.empty()) {
+        out << "    {0, 0, nullptr, nullptr},\n";
+    }
+    out << "};\n";
+    std::cerr << blocks.size() << " blocks" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    uint64_t base = MEMORY_BASE;
+    uint64_t size = UINT64_MAX;
+    int i = 1;
+    try {
+        for (; i + 1 < argc; i += 2) {
+            std::string option(argv[i]);
+            if (option == "--base") {
+                base = std::stoull(argv[i + 1], nullptr, 0);
+            } else if (option == "--size") {
+                size = std::stoull(argv[i + 1], nullptr, 0);
+            } else {
+                break;
+            }
+        }
+        if (argc - i != 2) {
+            std::cerr << "usage: riscv-aot [--base addr] [--size bytes] <image> <output.cpp>" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        auto segments = load_segments(read_file(argv[i]), base, size);
+        std::ofstream out(argv[i + 1]);
+        if (!out) {
+            throw std::runtime_error(std::string("cannot create ") + argv[i + 1]);
+        }
+        emit(out, argv[i], segments);
+        if (!out.flush()) {
+            throw std::runtime_error(std::string("cannot write ") + argv[i + 1]);
+        }
+    } catch (const std::exception &failure) {
+        std::cerr << "error: " << failure.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
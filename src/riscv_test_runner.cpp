@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// riscv-test-runner [-j jobs] [--timeout seconds] [--references dir] [--emulator path] <test|dir>...
+//
+// Runs riscv-tests and riscv-arch-test binaries, each in its own emulator
+// process and as many at once as there are jobs (one per host thread by
+// default), and reports which pass and how long each took. Directories are
+// searched recursively for ELF files. A test passes if the emulator exits
+// with status 0 within the timeout and, if <name>.reference_output exists next
+// to the test or in the references directory, the signature the test wrote
+// between begin_signature and end_signature matches it. Exits with failure if
+// any test failed.
+
+// Seconds a test may run before it is killed.
+#define RUNNER_TIMEOUT 10
+#define RUNNER_POLL std::chrono::milliseconds(1)
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Test {
+    fs::path path;
+    // Empty if the test has no reference signature.
+    fs::path reference;
+    fs::path log;
+    fs::path signature;
+    std::chrono::steady_clock::time_point start;
+};
+
+bool is_elf(const fs::path &path) {
+    std::ifstream file(path, std::ifstream::binary);
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+    return file && std::memcmp(magic, "\x7f" "ELF", 4) == 0;
+}
+
+std::vector<fs::path> find_tests(const std::vector<std::string> &arguments) {
+    std::vector<fs::path> tests;
+    for (const auto &argument : arguments) {
+        if (!fs::is_directory(argument)) {
+            tests.emplace_back(argument);
+            continue;
+        }
+        for (const auto &entry : fs::recursive_directory_iterator(argument)) {
+            if (entry.is_regular_file() && is_elf(entry.path())) {
+                tests.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(tests.begin(), tests.end());
+    return tests;
+}
+
+fs::path find_reference(const fs::path &test, const std::string &references) {
+    auto name = test.stem().string() + ".reference_output";
+    if (fs::exists(test.parent_path() / name)) {
+        return test.parent_path() / name;
+    }
+    if (!references.empty() && fs::exists(fs::path(references) / name)) {
+        return fs::path(references) / name;
+    }
+    return {};
+}
+
+// Signature lines, without surrounding blanks or letter case.
+std::vector<std::string> signature_lines(const fs::path &path) {
+    std::ifstream file(path);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line)) {
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        std::transform(line.begin(), line.end(), line.begin(), ::tolower);
+        if (!line.empty()) {
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+pid_t start(const std::string &emulator, Test &test) {
+    std::vector<std::string> args = {emulator};
+    if (!test.reference.empty()) {
+        args.insert(args.end(), {"--signature", test.signature.string()});
+    }
+    args.push_back(test.path.string());
+    test.start = std::chrono::steady_clock::now();
+
+    auto pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    auto log = open(test.log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    auto null = open("/dev/null", O_RDONLY);
+    if (log >= 0 && null >= 0) {
+        dup2(null, STDIN_FILENO);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+    }
+    std::vector<char *> argv;
+    for (auto &arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+}
+
+// Empty if the test passed, otherwise why it failed.
+std::string verdict(const Test &test, int wait_status, bool timed_out) {
+    if (timed_out) {
+        return "timed out";
+    }
+    if (WIFSIGNALED(wait_status)) {
+        return std::string("killed by ") + strsignal(WTERMSIG(wait_status));
+    }
+    if (WEXITSTATUS(wait_status) != 0) {
+        return "exit " + std::to_string(WEXITSTATUS(wait_status));
+    }
+    if (!test.reference.empty() && signature_lines(test.signature) != signature_lines(test.reference)) {
+        return "signature differs from " + test.reference.string();
+    }
+    return "";
+}
+
+std::string seconds(std::chrono::steady_clock::duration duration) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(3) << std::chrono::duration<double>(duration).count() << "s";
+    return text.str();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    double timeout = RUNNER_TIMEOUT;
+    std::string references;
+    std::string emulator;
+    int i = 1;
+    for (; i + 1 < argc; i += 2) {
+        std::string option(argv[i]);
+        if (option == "-j") {
+            jobs = std::max(1, std::atoi(argv[i + 1]));
+        } else if (option == "--timeout") {
+            timeout = std::atof(argv[i + 1]);
+        } else if (option == "--references") {
+            references = argv[i + 1];
+        } else if (option == "--emulator") {
+            emulator = argv[i + 1];
+        } else {
+            break;
+        }
+    }
+    if (argc - i < 1) {
+        std::cerr << "usage: riscv-test-runner [-j jobs] [--timeout seconds] [--references dir] [--emulator path] <test|dir>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Test> tests;
+    fs::path scratch;
+    try {
+        // The emulator built alongside the runner.
+        if (emulator.empty()) {
+            emulator = (fs::read_symlink("/proc/self/exe").parent_path() / "riscv-emulator").string();
+        }
+        char scratch_template[] = "/tmp/riscv-test-runner.XXXXXX";
+        if (mkdtemp(scratch_template) == nullptr) {
+            throw std::runtime_error(std::string("mkdtemp: ") + std::strerror(errno));
+        }
+        scratch = scratch_template;
+        for (const auto &path : find_tests(std::vector<std::string>(argv + i, argv + argc))) {
+            auto name = std::to_string(tests.size()) + "." + path.filename().string();
+            tests.push_back({path, find_reference(path, references), scratch / (name + ".log"), scratch / (name + ".signature"), {}});
+        }
+    } catch (const std::exception &failure) {
+        std::cerr << "error: " << failure.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    auto limit = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    std::map<pid_t, size_t> running;
+    std::map<pid_t, bool> timed_out;
+    size_t next = 0;
+    size_t failed = 0;
+    while (next < tests.size() || !running.empty()) {
+        while (running.size() < jobs && next < tests.size()) {
+            auto pid = start(emulator, tests[next]);
+            if (pid < 0) {
+                std::cerr << "error: fork: " << std::strerror(errno) << std::endl;
+                return EXIT_FAILURE;
+            }
+            running[pid] = next++;
+        }
+
+        int wait_status;
+        auto pid = waitpid(-1, &wait_status, WNOHANG);
+        if (pid <= 0) {
+            auto now = std::chrono::steady_clock::now();
+            for (const auto &[child, index] : running) {
+                if (now - tests[index].start > limit && !timed_out[child]) {
+                    timed_out[child] = true;
+                    kill(child, SIGKILL);
+                }
+            }
+            std::this_thread::sleep_for(RUNNER_POLL);
+            continue;
+        }
+        auto it = running.find(pid);
+        if (it == running.end()) {
+            continue;
+        }
+        auto &test = tests[it->second];
+        auto reason = verdict(test, wait_status, timed_out[pid]);
+        auto elapsed = seconds(std::chrono::steady_clock::now() - test.start);
+        if (reason.empty()) {
+            std::cout << "PASS " << test.path.string() << " (" << elapsed << ")" << std::endl;
+            fs::remove(test.log);
+            fs::remove(test.signature);
+        } else {
+            failed++;
+            std::cout << "FAIL " << test.path.string() << ": " << reason << " (" << elapsed << "), log in " << test.log.string() << std::endl;
+        }
+        running.erase(it);
+        timed_out.erase(pid);
+    }
+
+    std::cout << tests.size() << " tests: " << tests.size() - failed << " passed, " << failed << " failed in "
+              << seconds(std::chrono::steady_clock::now() - begin) << std::endl;
+    if (failed == 0) {
+        std::error_code ignored;
+        fs::remove_all(scratch, ignored);
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
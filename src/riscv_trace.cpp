@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+// riscv-trace [--summary] [--mode u|s|m] [--from addr] [--to addr] <trace>
+//
+// Prints the records whose pc lies in [from, to) and which executed in the given
+// privilege mode, or with --summary only aggregate counts over those records.
+
+namespace {
+
+const char *mode_name(uint8_t mode) {
+    switch (mode) {
+    case 0:
+        return "U";
+    case 1:
+        return "S";
+    case 3:
+        return "M";
+    default:
+        return "?";
+    }
+}
+
+int parse_mode(const std::string &name) {
+    if (name == "u") {
+        return 0;
+    } else if (name == "s") {
+        return 1;
+    } else if (name == "m") {
+        return 3;
+    }
+    throw std::runtime_error("invalid mode " + name);
+}
+
+void print_record(const TraceRecord &record) {
+    std::cout << std::hex << std::setfill('0') << std::setw(16) << record.pc << " " << mode_name(record.mode) << " " << std::setw(8) << record.instruction;
+    if ((record.flags & TRACE_RD) != 0) {
+        std::cout << " x" << std::dec << (int)record.rd << "=" << std::hex << record.rd_value;
+    }
+    if ((record.flags & TRACE_MEMORY) != 0) {
+        std::cout << " [" << record.memory_addr << "]";
+    }
+    if ((record.flags & TRACE_EXCEPTION) != 0) {
+        std::cout << " exception " << std::dec << record.cause << " tval=" << std::hex << record.tval;
+    }
+    if ((record.flags & TRACE_INTERRUPT) != 0) {
+        std::cout << " interrupt " << std::dec << (record.interrupt_cause & ~((uint64_t)1 << 63));
+    }
+    std::cout << std::dec << "\n";
+}
+
+struct Summary {
+    uint64_t records = 0;
+    uint64_t memory_accesses = 0;
+    std::map<uint8_t, uint64_t> per_mode;
+    std::map<uint32_t, uint64_t> per_opcode;
+    std::map<uint64_t, uint64_t> exceptions;
+    std::map<uint64_t, uint64_t> interrupts;
+    std::map<uint64_t, uint64_t> per_pc;
+
+    void add(const TraceRecord &record) {
+        records++;
+        per_mode[record.mode]++;
+        per_opcode[record.instruction & 0x7f]++;
+        per_pc[record.pc]++;
+        if ((record.flags & TRACE_MEMORY) != 0) {
+            memory_accesses++;
+        }
+        if ((record.flags & TRACE_EXCEPTION) != 0) {
+            exceptions[record.cause]++;
+        }
+        if ((record.flags & TRACE_INTERRUPT) != 0) {
+            interrupts[record.interrupt_cause & ~((uint64_t)1 << 63)]++;
+        }
+    }
+
+    void print() {
+        std::cout << "instructions: " << records << "\n";
+        std::cout << "memory accesses: " << memory_accesses << "\n";
+        for (auto [mode, count] : per_mode) {
+            std::cout << "mode " << mode_name(mode) << ": " << count << "\n";
+        }
+        for (auto [opcode, count] : per_opcode) {
+            std::cout << "opcode 0x" << std::hex << opcode << std::dec << ": " << count << "\n";
+        }
+        for (auto [cause, count] : exceptions) {
+            std::cout << "exception " << cause << ": " << count << "\n";
+        }
+        for (auto [cause, count] : interrupts) {
+            std::cout << "interrupt " << cause << ": " << count << "\n";
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> hottest(per_pc.begin(), per_pc.end());
+        auto top = std::min<size_t>(hottest.size(), 20);
+        std::partial_sort(hottest.begin(), hottest.begin() + top, hottest.end(), [](auto &a, auto &b) { return a.second > b.second; });
+        std::cout << "hottest pcs:\n";
+        for (size_t i = 0; i < top; i++) {
+            std::cout << "  " << std::hex << std::setfill('0') << std::setw(16) << hottest[i].first << std::dec << " " << hottest[i].second << "\n";
+        }
+    }
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    bool summary = false;
+    int mode = -1;
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    std::string path;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string option(argv[i]);
+            if (option == "--summary") {
+                summary = true;
+            } else if (option == "--mode" && i + 1 < argc) {
+                mode = parse_mode(argv[++i]);
+            } else if (option == "--from" && i + 1 < argc) {
+                from = std::stoull(argv[++i], nullptr, 0);
+            } else if (option == "--to" && i + 1 < argc) {
+                to = std::stoull(argv[++i], nullptr, 0);
+            } else if (path.empty()) {
+                path = option;
+            } else {
+                throw std::runtime_error("unexpected parameter " + option);
+            }
+        }
+        if (path.empty()) {
+            throw std::runtime_error("missing trace file");
+        }
+
+        TraceReader reader(path);
+        TraceRecord record;
+        Summary totals;
+        while (reader.next(record)) {
+            if (record.pc < from || record.pc >= to || (mode >= 0 && record.mode != mode)) {
+                continue;
+            }
+            if (summary) {
+                totals.add(record);
+            } else {
+                print_record(record);
+            }
+        }
+        if (summary) {
+            totals.print();
+        }
+    } catch (const std::exception &failure) {
+        std::cerr << "error: " << failure.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
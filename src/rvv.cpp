@@ -0,0 +1,914 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "cpu.h"
+#include "rvv_kernels.h"
+
+namespace {
+
+uint64_t vtype_sew(uint64_t vtype) {
+    return (uint64_t)1 << ((vtype >> 3) & 0b111);
+}
+
+// LMUL as a fraction num / den; vlmul 0b100 is reserved and rejected by vsetvl.
+std::pair<uint64_t, uint64_t> vtype_lmul(uint64_t vtype) {
+    auto vlmul = vtype & 0b111;
+    if (vlmul < 4) {
+        return std::make_pair((uint64_t)1 << vlmul, 1);
+    }
+    return std::make_pair(1, (uint64_t)1 << (8 - vlmul));
+}
+
+// Number of architectural registers covered by a group of EEW-sized elements.
+uint64_t group_size(uint64_t vtype, uint64_t eew) {
+    auto [num, den] = vtype_lmul(vtype);
+    auto regs = (eew * num) / (vtype_sew(vtype) * den);
+    return regs == 0 ? 1 : regs;
+}
+
+// Whether EEW-sized elements have an EMUL = (EEW / SEW) * LMUL within [1/8, 8].
+bool emul_valid(uint64_t vtype, uint64_t eew) {
+    auto [num, den] = vtype_lmul(vtype);
+    auto sew = vtype_sew(vtype);
+    return eew * num * 8 >= sew * den && eew * num <= sew * den * 8;
+}
+
+// Whether a group of regs registers starting at reg is aligned and ends by v31.
+bool group_valid(uint64_t reg, uint64_t regs) {
+    return reg % regs == 0 && reg + regs <= 32;
+}
+
+uint64_t vlmax(uint64_t vtype) {
+    auto [num, den] = vtype_lmul(vtype);
+    return VLEN_BYTES * num / den / vtype_sew(vtype);
+}
+
+bool vtype_valid(uint64_t vtype) {
+    auto vsew = (vtype >> 3) & 0b111;
+    auto vlmul = vtype & 0b111;
+    if ((vtype >> 8) != 0 || vsew > 3 || vlmul == 4) {
+        return false;
+    }
+    if (vlmul > 4) {
+        // Fractional LMUL requires SEW <= LMUL * ELEN.
+        return vtype_sew(vtype) * 8 <= (uint64_t)64 >> (8 - vlmul);
+    }
+    return true;
+}
+
+uint64_t element_mask(uint64_t eew) {
+    return eew == 8 ? UINT64_MAX : ((uint64_t)1 << (eew * 8)) - 1;
+}
+
+int64_t sext(uint64_t value, uint64_t eew) {
+    auto shift = 64 - eew * 8;
+    return (int64_t)(value << shift) >> shift;
+}
+
+uint64_t load_eew(uint32_t width) {
+    switch (width) {
+    case 0x0:
+        return 1;
+    case 0x5:
+        return 2;
+    case 0x6:
+        return 4;
+    case 0x7:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+std::optional<VectorOp> integer_kernel_op(uint32_t funct6) {
+    switch (funct6) {
+    case 0x00:
+        return VectorOp::VAdd;
+    case 0x02:
+    case 0x03:
+        return VectorOp::VSub;
+    case 0x04:
+        return VectorOp::VMinu;
+    case 0x05:
+        return VectorOp::VMin;
+    case 0x06:
+        return VectorOp::VMaxu;
+    case 0x07:
+        return VectorOp::VMax;
+    case 0x09:
+        return VectorOp::VAnd;
+    case 0x0a:
+        return VectorOp::VOr;
+    case 0x0b:
+        return VectorOp::VXor;
+    default:
+        return std::nullopt;
+    }
+}
+
+// Whether funct6 has a form for the operand kind in funct3, among the integer
+// operations implemented: OPIVV (0x0), OPIVI (0x3) or OPIVX (0x4).
+bool integer_op_exists(uint32_t funct3, uint32_t funct6) {
+    switch (funct6) {
+    case 0x02:
+        // vsub
+    case 0x04:
+    case 0x05:
+    case 0x06:
+    case 0x07:
+        // vminu, vmin, vmaxu, vmax
+    case 0x1a:
+    case 0x1b:
+        // vmsltu, vmslt
+        return funct3 != 0x3;
+    case 0x03:
+        // vrsub
+    case 0x1e:
+    case 0x1f:
+        // vmsgtu, vmsgt
+        return funct3 != 0x0;
+    default:
+        return true;
+    }
+}
+
+uint64_t log2_eew(uint64_t eew) {
+    return eew == 1 ? 0 : eew == 2 ? 1 : eew == 4 ? 2 : 3;
+}
+
+template <typename T>
+T to_float(uint64_t bits) {
+    T value;
+    std::memcpy(&value, &bits, sizeof(T));
+    return value;
+}
+
+template <typename T>
+uint64_t from_float(T value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    return bits;
+}
+
+} // namespace
+
+uint64_t Cpu::vreg_get(uint64_t reg, uint64_t i, uint64_t eew) {
+    uint64_t value = 0;
+    std::memcpy(&value, vregs + reg * VLEN_BYTES + i * eew, eew);
+    return value;
+}
+
+void Cpu::vreg_set(uint64_t reg, uint64_t i, uint64_t eew, uint64_t value) {
+    std::memcpy(vregs + reg * VLEN_BYTES + i * eew, &value, eew);
+}
+
+bool Cpu::vmask_get(uint64_t reg, uint64_t i) {
+    return ((vregs[reg * VLEN_BYTES + i / 8] >> (i % 8)) & 1) == 1;
+}
+
+void Cpu::vmask_set(uint64_t reg, uint64_t i, bool value) {
+    auto &byte = vregs[reg * VLEN_BYTES + i / 8];
+    byte = value ? (byte | (1 << (i % 8))) : (byte & ~(1 << (i % 8)));
+}
+
+// Copies nBytes between guest virtual memory and buffer one page at a time. RAM pages are
+// copied in bulk; `done` tracks progress so a trap can report the faulting element.
+void Cpu::vector_transfer(uint64_t addr, uint8_t *buffer, uint64_t nBytes, AccessType access_type, uint64_t &done) {
+    done = 0;
+    while (done < nBytes) {
+        auto page_left = PAGE_SIZE - ((addr + done) % PAGE_SIZE);
+        auto chunk = nBytes - done < page_left ? nBytes - done : page_left;
+
+        auto p_addr = translate(addr + done, access_type);
+        if (breakpoints != nullptr) {
+            breakpoints->access(addr + done, chunk, access_type == AccessType::Store);
+        }
+        // Only stores count as writes for snapshots.
+        auto is_store = access_type == AccessType::Store;
+        auto ram = is_store ? bus.get_ram_pointer(p_addr, chunk) : nullptr;
+        auto source = is_store ? nullptr : bus.view_ram(p_addr, chunk);
+        if (ram != nullptr || source != nullptr) {
+#ifdef CACHE_SIM
+            if (caches != nullptr) {
+                caches->data(pc - 4, p_addr, chunk);
+            }
+#endif
+            if (is_store) {
+                std::memcpy(ram, buffer + done, chunk);
+            } else {
+                std::memcpy(buffer + done, source, chunk);
+            }
+            done += chunk;
+            continue;
+        }
+
+        for (uint64_t i = 0; i < chunk; i++, done++) {
+            if (access_type == AccessType::Store) {
+                bus.store(p_addr + i, 1, buffer[done]);
+            } else {
+                buffer[done] = bus.load(p_addr + i, 1);
+            }
+        }
+    }
+}
+
+void Cpu::execute_vector(uint32_t instruction) {
+    auto funct3 = (instruction & 0x00007000) >> 12;
+
+    if (funct3 == 0x7) {
+        return execute_vsetvl(instruction);
+    }
+    if ((vtype & VTYPE_VILL) != 0) {
+        std::cout << "IllegalInstruction(22): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    switch (funct3) {
+    case 0x0:
+    case 0x3:
+    case 0x4:
+        execute_vector_integer(instruction);
+        break;
+    case 0x2:
+    case 0x6:
+        execute_vector_mask(instruction);
+        break;
+    case 0x1:
+    case 0x5:
+        execute_vector_float(instruction);
+        break;
+    }
+    vstart = 0;
+}
+
+void Cpu::execute_vsetvl(uint32_t instruction) {
+    auto rd = (instruction & 0x00000f80) >> 7;
+    auto rs1 = (instruction & 0x000f8000) >> 15;
+    auto rs2 = (instruction & 0x01f00000) >> 20;
+
+    uint64_t new_vtype;
+    uint64_t avl;
+    bool keep_vl = false;
+    if ((instruction >> 31) == 0) {
+        // vsetvli
+        new_vtype = (instruction >> 20) & 0x7ff;
+    } else if ((instruction >> 30) == 0b11) {
+        // vsetivli
+        new_vtype = (instruction >> 20) & 0x3ff;
+    } else if ((instruction >> 25) == 0b1000000) {
+        // vsetvl
+        new_vtype = registers[rs2];
+    } else {
+        std::cout << "IllegalInstruction(23): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    if ((instruction >> 30) == 0b11) {
+        avl = rs1;
+    } else if (rs1 != 0) {
+        avl = registers[rs1];
+    } else if (rd != 0) {
+        avl = UINT64_MAX;
+    } else {
+        avl = vl;
+        keep_vl = true;
+    }
+
+    if (!vtype_valid(new_vtype)) {
+        vtype = VTYPE_VILL;
+        vl = 0;
+    } else {
+        auto max = vlmax(new_vtype);
+        if (keep_vl && vl > max) {
+            // vsetvli x0, x0 may not change VLMAX; treat a shrinking VLMAX as vill.
+            vtype = VTYPE_VILL;
+            vl = 0;
+        } else {
+            vtype = new_vtype;
+            vl = avl < max ? avl : max;
+        }
+    }
+
+    registers[rd] = vl;
+    vstart = 0;
+    return;
+}
+
+void Cpu::execute_vector_memory(uint32_t instruction, bool is_store) {
+    auto vd = (instruction & 0x00000f80) >> 7;
+    auto rs1 = (instruction & 0x000f8000) >> 15;
+    auto rs2 = (instruction & 0x01f00000) >> 20;
+    auto width = (instruction & 0x00007000) >> 12;
+    auto vm = (instruction >> 25) & 1;
+    auto mop = (instruction >> 26) & 0b11;
+    auto mew = (instruction >> 28) & 1;
+    auto nf = (instruction >> 29) + 1;
+
+    auto eew = load_eew(width);
+    // Whole-register moves do not depend on vtype, so context switches can use
+    // them before any vsetvli.
+    auto whole_register = mop == 0 && rs2 == 0x08;
+    if (eew == 0 || mew != 0 || ((vtype & VTYPE_VILL) != 0 && !whole_register)) {
+        std::cout << "IllegalInstruction(24): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    auto access_type = is_store ? AccessType::Store : AccessType::Load;
+    auto base = registers[rs1];
+
+    // Unit-stride forms whose register image is contiguous in memory go through bulk page copies.
+    if (mop == 0 && (rs2 == 0x08 || rs2 == 0x0b || ((rs2 == 0x00 || (rs2 == 0x10 && !is_store)) && nf == 1 && vm == 1))) {
+        uint64_t evl;
+        if (rs2 == 0x08) {
+            // vl<nf>r.v / vs<nf>r.v
+            if ((nf & (nf - 1)) != 0 || vd % nf != 0 || vm != 1) {
+                std::cout << "IllegalInstruction(25): " << instruction << std::endl;
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
+            }
+            evl = nf * VLEN_BYTES / eew;
+        } else if (rs2 == 0x0b) {
+            // vlm.v / vsm.v
+            if (eew != 1 || nf != 1 || vm != 1) {
+                std::cout << "IllegalInstruction(26): " << instruction << std::endl;
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
+            }
+            evl = (vl + 7) / 8;
+        } else {
+            if (!emul_valid(vtype, eew) || !group_valid(vd, group_size(vtype, eew))) {
+                std::cout << "IllegalInstruction(27): " << instruction << std::endl;
+                raise_exception(ExceptionType::IllegalInstruction, instruction);
+            }
+            evl = vl;
+        }
+
+        if (vstart < evl) {
+            auto offset = vstart * eew;
+            uint64_t done = 0;
+            try {
+                vector_transfer(base + offset, vregs + vd * VLEN_BYTES + offset, (evl - vstart) * eew, access_type, done);
+            } catch (const Exception &) {
+                auto failed = (offset + done) / eew;
+                if (rs2 != 0x10 || failed == 0) {
+                    vstart = failed;
+                    throw;
+                }
+                // Fault-only-first: trim vl instead of trapping past element 0.
+                vl = failed;
+            }
+        }
+        vstart = 0;
+        return;
+    }
+
+    if (mop == 0 && rs2 != 0x00 && rs2 != 0x10) {
+        std::cout << "IllegalInstruction(28): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    bool indexed = (mop & 1) == 1;
+    auto data_eew = indexed ? vtype_sew(vtype) : eew;
+    auto field_regs = group_size(vtype, data_eew);
+    if (!emul_valid(vtype, data_eew) || nf * field_regs > 8 || !group_valid(vd, field_regs) || vd + nf * field_regs > 32) {
+        std::cout << "IllegalInstruction(29): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+    // Indices are eew wide, with their own EMUL.
+    if (indexed && (!emul_valid(vtype, eew) || !group_valid(rs2, group_size(vtype, eew)))) {
+        std::cout << "IllegalInstruction(49): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    int64_t stride = mop == 2 ? (int64_t)registers[rs2] : (int64_t)(nf * data_eew);
+    for (uint64_t i = vstart; i < vl; i++) {
+        if (vm == 0 && !vmask_get(0, i)) {
+            continue;
+        }
+        uint64_t element_addr = indexed ? base + vreg_get(rs2, i, eew) : base + (uint64_t)(stride * (int64_t)i);
+        for (uint64_t f = 0; f < nf; f++) {
+            auto addr = element_addr + f * data_eew;
+            uint64_t value = is_store ? vreg_get(vd + f * field_regs, i, data_eew) : 0;
+            uint64_t done = 0;
+            try {
+                vector_transfer(addr, reinterpret_cast<uint8_t *>(&value), data_eew, access_type, done);
+            } catch (const Exception &) {
+                if (rs2 == 0x10 && mop == 0 && i > 0) {
+                    vl = i;
+                    vstart = 0;
+                    return;
+                }
+                vstart = i;
+                throw;
+            }
+            if (!is_store) {
+                vreg_set(vd + f * field_regs, i, data_eew, value);
+            }
+        }
+    }
+    vstart = 0;
+    return;
+}
+
+void Cpu::execute_vector_integer(uint32_t instruction) {
+    auto vd = (instruction & 0x00000f80) >> 7;
+    auto rs1 = (instruction & 0x000f8000) >> 15;
+    auto vs2 = (instruction & 0x01f00000) >> 20;
+    auto funct3 = (instruction & 0x00007000) >> 12;
+    auto funct6 = instruction >> 26;
+    auto vm = (instruction >> 25) & 1;
+
+    auto sew = vtype_sew(vtype);
+    auto mask = element_mask(sew);
+    auto group = group_size(vtype, sew);
+    bool writes_mask = funct6 >= 0x18 && funct6 <= 0x1f;
+
+    if (!integer_op_exists(funct3, funct6)) {
+        std::cout << "IllegalInstruction(48): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    if ((!writes_mask && vd % group != 0) || vs2 % group != 0 || (funct3 == 0x0 && rs1 % group != 0)) {
+        std::cout << "IllegalInstruction(30): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    uint64_t scalar;
+    if (funct3 == 0x4) {
+        scalar = registers[rs1] & mask;
+    } else if (funct3 == 0x3) {
+        // Shifts take a zero-extended immediate, everything else sign-extends simm5.
+        bool is_shift = funct6 == 0x25 || funct6 == 0x28 || funct6 == 0x29;
+        scalar = is_shift ? rs1 : (uint64_t)(((int64_t)rs1 << 59) >> 59) & mask;
+    } else {
+        scalar = 0;
+    }
+
+    auto kernel_op = integer_kernel_op(funct6);
+    if (kernel_op.has_value() && vstart < vl) {
+        auto kernel = vector_kernels().kernels[kernel_op.value()][log2_eew(sew)];
+        alignas(64) uint8_t splat[8 * VLEN_BYTES];
+        alignas(64) uint8_t result[8 * VLEN_BYTES];
+        auto n = vl - vstart;
+        auto offset = vstart * sew;
+
+        const uint8_t *operand1;
+        if (funct3 == 0x0) {
+            operand1 = vregs + rs1 * VLEN_BYTES + offset;
+        } else {
+            for (uint64_t i = 0; i < n; i++) {
+                std::memcpy(splat + i * sew, &scalar, sew);
+            }
+            operand1 = splat;
+        }
+        const uint8_t *operand2 = vregs + vs2 * VLEN_BYTES + offset;
+        if (funct6 == 0x03) {
+            // vrsub computes scalar - vs2
+            std::swap(operand1, operand2);
+        }
+
+        if (vm == 1) {
+            kernel(vregs + vd * VLEN_BYTES + offset, operand2, operand1, n);
+        } else {
+            kernel(result, operand2, operand1, n);
+            for (uint64_t i = vstart; i < vl; i++) {
+                if (vmask_get(0, i)) {
+                    std::memcpy(vregs + vd * VLEN_BYTES + i * sew, result + (i - vstart) * sew, sew);
+                }
+            }
+        }
+        return;
+    }
+
+    for (uint64_t i = vstart; i < vl; i++) {
+        bool active = vm == 1 || vmask_get(0, i);
+        if (!active && funct6 != 0x17) {
+            continue;
+        }
+        auto a = vreg_get(vs2, i, sew);
+        auto b = funct3 == 0x0 ? vreg_get(rs1, i, sew) : scalar;
+        auto shamt = b & (sew * 8 - 1);
+
+        switch (funct6) {
+        case 0x17:
+            // vmerge / vmv.v
+            vreg_set(vd, i, sew, active ? b : a);
+            break;
+        case 0x18:
+            // vmseq
+            vmask_set(vd, i, a == b);
+            break;
+        case 0x19:
+            // vmsne
+            vmask_set(vd, i, a != b);
+            break;
+        case 0x1a:
+            // vmsltu
+            vmask_set(vd, i, a < b);
+            break;
+        case 0x1b:
+            // vmslt
+            vmask_set(vd, i, sext(a, sew) < sext(b, sew));
+            break;
+        case 0x1c:
+            // vmsleu
+            vmask_set(vd, i, a <= b);
+            break;
+        case 0x1d:
+            // vmsle
+            vmask_set(vd, i, sext(a, sew) <= sext(b, sew));
+            break;
+        case 0x1e:
+            // vmsgtu
+            vmask_set(vd, i, a > b);
+            break;
+        case 0x1f:
+            // vmsgt
+            vmask_set(vd, i, sext(a, sew) > sext(b, sew));
+            break;
+        case 0x25:
+            // vsll
+            vreg_set(vd, i, sew, (a << shamt) & mask);
+            break;
+        case 0x28:
+            // vsrl
+            vreg_set(vd, i, sew, a >> shamt);
+            break;
+        case 0x29:
+            // vsra
+            vreg_set(vd, i, sew, (uint64_t)(sext(a, sew) >> shamt) & mask);
+            break;
+        default:
+            std::cout << "IllegalInstruction(31): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
+        }
+    }
+    return;
+}
+
+void Cpu::execute_vector_mask(uint32_t instruction) {
+    auto rd = (instruction & 0x00000f80) >> 7;
+    auto rs1 = (instruction & 0x000f8000) >> 15;
+    auto vs2 = (instruction & 0x01f00000) >> 20;
+    auto funct3 = (instruction & 0x00007000) >> 12;
+    auto funct6 = instruction >> 26;
+    auto vm = (instruction >> 25) & 1;
+
+    auto sew = vtype_sew(vtype);
+    auto mask = element_mask(sew);
+    bool is_vx = funct3 == 0x6;
+
+    if (funct6 <= 0x07 && !is_vx) {
+        // Integer reductions: vd[0] = vs1[0] op vs2[active elements].
+        if (vl == 0) {
+            return;
+        }
+        auto acc = vreg_get(rs1, 0, sew);
+        for (uint64_t i = 0; i < vl; i++) {
+            if (vm == 0 && !vmask_get(0, i)) {
+                continue;
+            }
+            auto e = vreg_get(vs2, i, sew);
+            switch (funct6) {
+            case 0x00:
+                acc = (acc + e) & mask;
+                break;
+            case 0x01:
+                acc &= e;
+                break;
+            case 0x02:
+                acc |= e;
+                break;
+            case 0x03:
+                acc ^= e;
+                break;
+            case 0x04:
+                acc = e < acc ? e : acc;
+                break;
+            case 0x05:
+                acc = sext(e, sew) < sext(acc, sew) ? e : acc;
+                break;
+            case 0x06:
+                acc = e > acc ? e : acc;
+                break;
+            case 0x07:
+                acc = sext(e, sew) > sext(acc, sew) ? e : acc;
+                break;
+            }
+        }
+        vreg_set(rd, 0, sew, acc);
+        return;
+    }
+
+    if (funct6 == 0x10) {
+        if (!is_vx && rs1 == 0x00) {
+            // vmv.x.s
+            registers[rd] = (uint64_t)sext(vreg_get(vs2, 0, sew), sew);
+            return;
+        }
+        if (!is_vx && (rs1 == 0x10 || rs1 == 0x11)) {
+            uint64_t count = 0;
+            int64_t first = -1;
+            for (uint64_t i = 0; i < vl; i++) {
+                if ((vm == 1 || vmask_get(0, i)) && vmask_get(vs2, i)) {
+                    if (first < 0) {
+                        first = (int64_t)i;
+                    }
+                    count++;
+                }
+            }
+            // vcpop.m / vfirst.m
+            registers[rd] = rs1 == 0x10 ? count : (uint64_t)first;
+            return;
+        }
+        if (is_vx && vs2 == 0x00) {
+            // vmv.s.x
+            if (vstart < vl) {
+                vreg_set(rd, 0, sew, registers[rs1] & mask);
+            }
+            return;
+        }
+    }
+
+    if (funct6 == 0x14 && !is_vx && (rs1 == 0x10 || rs1 == 0x11)) {
+        // viota.m / vid.v
+        uint64_t count = 0;
+        for (uint64_t i = 0; i < vl; i++) {
+            if (vm == 0 && !vmask_get(0, i)) {
+                continue;
+            }
+            if (i >= vstart) {
+                vreg_set(rd, i, sew, (rs1 == 0x10 ? count : i) & mask);
+            }
+            if (rs1 == 0x10 && vmask_get(vs2, i)) {
+                count++;
+            }
+        }
+        return;
+    }
+
+    if (funct6 >= 0x18 && funct6 <= 0x1f && !is_vx) {
+        for (uint64_t i = vstart; i < vl; i++) {
+            auto a = vmask_get(vs2, i);
+            auto b = vmask_get(rs1, i);
+            bool value;
+            switch (funct6) {
+            case 0x18:
+                // vmandn
+                value = a && !b;
+                break;
+            case 0x19:
+                // vmand
+                value = a && b;
+                break;
+            case 0x1a:
+                // vmor
+                value = a || b;
+                break;
+            case 0x1b:
+                // vmxor
+                value = a != b;
+                break;
+            case 0x1c:
+                // vmorn
+                value = a || !b;
+                break;
+            case 0x1d:
+                // vmnand
+                value = !(a && b);
+                break;
+            case 0x1e:
+                // vmnor
+                value = !(a || b);
+                break;
+            default:
+                // vmxnor
+                value = a == b;
+                break;
+            }
+            vmask_set(rd, i, value);
+        }
+        return;
+    }
+
+    if (funct6 < 0x20 || funct6 > 0x27) {
+        std::cout << "IllegalInstruction(32): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    auto group = group_size(vtype, sew);
+    if (rd % group != 0 || vs2 % group != 0 || (!is_vx && rs1 % group != 0)) {
+        std::cout << "IllegalInstruction(33): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    auto scalar = registers[rs1] & mask;
+    auto kernel = vector_kernels().kernels[VectorOp::VMul][log2_eew(sew)];
+    if (funct6 == 0x25 && vm == 1 && !is_vx && vstart < vl) {
+        // vmul.vv
+        auto offset = vstart * sew;
+        kernel(vregs + rd * VLEN_BYTES + offset, vregs + vs2 * VLEN_BYTES + offset, vregs + rs1 * VLEN_BYTES + offset, vl - vstart);
+        return;
+    }
+
+    auto bits = sew * 8;
+    for (uint64_t i = vstart; i < vl; i++) {
+        if (vm == 0 && !vmask_get(0, i)) {
+            continue;
+        }
+        auto a = vreg_get(vs2, i, sew);
+        auto b = is_vx ? scalar : vreg_get(rs1, i, sew);
+        auto sa = sext(a, sew);
+        auto sb = sext(b, sew);
+        uint64_t value;
+        switch (funct6) {
+        case 0x20:
+            // vdivu
+            value = b == 0 ? mask : a / b;
+            break;
+        case 0x21:
+            // vdiv
+            if (b == 0) {
+                value = mask;
+            } else if (sb == -1 && a == ((uint64_t)1 << (bits - 1))) {
+                value = a;
+            } else {
+                value = (uint64_t)(sa / sb);
+            }
+            break;
+        case 0x22:
+            // vremu
+            value = b == 0 ? a : a % b;
+            break;
+        case 0x23:
+            // vrem
+            if (b == 0) {
+                value = a;
+            } else if (sb == -1) {
+                value = 0;
+            } else {
+                value = (uint64_t)(sa % sb);
+            }
+            break;
+        case 0x24:
+            // vmulhu
+            value = (uint64_t)(((unsigned __int128)a * b) >> bits);
+            break;
+        case 0x25:
+            // vmul
+            value = a * b;
+            break;
+        case 0x26:
+            // vmulhsu
+            value = (uint64_t)(((__int128)sa * (__int128)b) >> bits);
+            break;
+        default:
+            // vmulh
+            value = (uint64_t)(((__int128)sa * sb) >> bits);
+            break;
+        }
+        vreg_set(rd, i, sew, value & mask);
+    }
+    return;
+}
+
+void Cpu::execute_vector_float(uint32_t instruction) {
+    auto vd = (instruction & 0x00000f80) >> 7;
+    auto vs1 = (instruction & 0x000f8000) >> 15;
+    auto vs2 = (instruction & 0x01f00000) >> 20;
+    auto funct3 = (instruction & 0x00007000) >> 12;
+    auto funct6 = instruction >> 26;
+    auto vm = (instruction >> 25) & 1;
+
+    auto sew = vtype_sew(vtype);
+    auto group = group_size(vtype, sew);
+
+    // OPFVF takes its scalar from the F register file, which this core does not implement.
+    if (funct3 != 0x1 || (sew != 4 && sew != 8) || vs2 % group != 0) {
+        std::cout << "IllegalInstruction(34): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    std::optional<VectorOp> kernel_op;
+    switch (funct6) {
+    case 0x00:
+        kernel_op = VectorOp::VFAdd;
+        break;
+    case 0x02:
+        kernel_op = VectorOp::VFSub;
+        break;
+    case 0x20:
+        kernel_op = VectorOp::VFDiv;
+        break;
+    case 0x24:
+        kernel_op = VectorOp::VFMul;
+        break;
+    }
+
+    if (kernel_op.has_value()) {
+        if (vd % group != 0 || vs1 % group != 0) {
+            std::cout << "IllegalInstruction(35): " << instruction << std::endl;
+            raise_exception(ExceptionType::IllegalInstruction, instruction);
+        }
+        if (vstart >= vl) {
+            return;
+        }
+        auto kernel = vector_kernels().kernels[kernel_op.value()][log2_eew(sew)];
+        auto offset = vstart * sew;
+        if (vm == 1) {
+            kernel(vregs + vd * VLEN_BYTES + offset, vregs + vs2 * VLEN_BYTES + offset, vregs + vs1 * VLEN_BYTES + offset, vl - vstart);
+            return;
+        }
+        alignas(64) uint8_t result[8 * VLEN_BYTES];
+        kernel(result, vregs + vs2 * VLEN_BYTES + offset, vregs + vs1 * VLEN_BYTES + offset, vl - vstart);
+        for (uint64_t i = vstart; i < vl; i++) {
+            if (vmask_get(0, i)) {
+                std::memcpy(vregs + vd * VLEN_BYTES + i * sew, result + (i - vstart) * sew, sew);
+            }
+        }
+        return;
+    }
+
+    auto get = [&](uint64_t reg, uint64_t i) {
+        auto bits = vreg_get(reg, i, sew);
+        return sew == 4 ? (double)to_float<float>(bits) : to_float<double>(bits);
+    };
+    auto put = [&](uint64_t reg, uint64_t i, double value) {
+        vreg_set(reg, i, sew, sew == 4 ? from_float<float>((float)value) : from_float<double>(value));
+    };
+
+    switch (funct6) {
+    case 0x01:
+    case 0x03:
+    case 0x05:
+    case 0x07: {
+        // vfredusum / vfredosum / vfredmin / vfredmax, accumulated in element order
+        if (vl == 0) {
+            return;
+        }
+        auto acc = get(vs1, 0);
+        for (uint64_t i = 0; i < vl; i++) {
+            if (vm == 0 && !vmask_get(0, i)) {
+                continue;
+            }
+            auto e = get(vs2, i);
+            if (funct6 == 0x05) {
+                acc = std::fmin(acc, e);
+            } else if (funct6 == 0x07) {
+                acc = std::fmax(acc, e);
+            } else if (sew == 4) {
+                acc = (float)acc + (float)e;
+            } else {
+                acc = acc + e;
+            }
+        }
+        put(vd, 0, acc);
+        return;
+    }
+    case 0x04:
+    case 0x06:
+    case 0x18:
+    case 0x19:
+    case 0x1b:
+    case 0x1c:
+        break;
+    default:
+        std::cout << "IllegalInstruction(36): " << instruction << std::endl;
+        raise_exception(ExceptionType::IllegalInstruction, instruction);
+    }
+
+    for (uint64_t i = vstart; i < vl; i++) {
+        if (vm == 0 && !vmask_get(0, i)) {
+            continue;
+        }
+        auto a = get(vs2, i);
+        auto b = get(vs1, i);
+        switch (funct6) {
+        case 0x04:
+            // vfmin
+            put(vd, i, std::fmin(a, b));
+            break;
+        case 0x06:
+            // vfmax
+            put(vd, i, std::fmax(a, b));
+            break;
+        case 0x18:
+            // vmfeq
+            vmask_set(vd, i, a == b);
+            break;
+        case 0x19:
+            // vmfle
+            vmask_set(vd, i, a <= b);
+            break;
+        case 0x1b:
+            // vmflt
+            vmask_set(vd, i, a < b);
+            break;
+        default:
+            // vmfne
+            vmask_set(vd, i, a != b);
+            break;
+        }
+    }
+    return;
+}
@@ -0,0 +1,313 @@
+#include "rvv_kernels.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RVV_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+struct Add {
+    template <typename T>
+    T operator()(T a, T b) const { return a + b; }
+};
+
+struct Sub {
+    template <typename T>
+    T operator()(T a, T b) const { return a - b; }
+};
+
+struct And {
+    template <typename T>
+    T operator()(T a, T b) const { return a & b; }
+};
+
+struct Or {
+    template <typename T>
+    T operator()(T a, T b) const { return a | b; }
+};
+
+struct Xor {
+    template <typename T>
+    T operator()(T a, T b) const { return a ^ b; }
+};
+
+struct Min {
+    template <typename T>
+    T operator()(T a, T b) const { return b < a ? b : a; }
+};
+
+struct Max {
+    template <typename T>
+    T operator()(T a, T b) const { return a < b ? b : a; }
+};
+
+struct Mul {
+    template <typename T>
+    T operator()(T a, T b) const { return (T)((uint64_t)a * (uint64_t)b); }
+};
+
+struct FMul {
+    template <typename T>
+    T operator()(T a, T b) const { return a * b; }
+};
+
+struct FDiv {
+    template <typename T>
+    T operator()(T a, T b) const { return a / b; }
+};
+
+template <typename T, typename Op>
+void scalar_kernel(uint8_t *vd, const uint8_t *vs2, const uint8_t *vs1, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        T a;
+        T b;
+        std::memcpy(&a, vs2 + i * sizeof(T), sizeof(T));
+        std::memcpy(&b, vs1 + i * sizeof(T), sizeof(T));
+        T result = Op()(a, b);
+        std::memcpy(vd + i * sizeof(T), &result, sizeof(T));
+    }
+}
+
+#define FILL_INT_KERNELS(table, op, kernel, u8, u16, u32, u64) \
+    table.kernels[op][0] = kernel<u8>;                         \
+    table.kernels[op][1] = kernel<u16>;                        \
+    table.kernels[op][2] = kernel<u32>;                        \
+    table.kernels[op][3] = kernel<u64>;
+
+template <typename Op>
+struct Scalar {
+    template <typename T>
+    static void kernel(uint8_t *vd, const uint8_t *vs2, const uint8_t *vs1, uint64_t n) {
+        scalar_kernel<T, Op>(vd, vs2, vs1, n);
+    }
+};
+
+VectorKernels make_scalar_kernels() {
+    VectorKernels table{};
+    table.name = "scalar";
+    FILL_INT_KERNELS(table, VectorOp::VAdd, Scalar<Add>::kernel, uint8_t, uint16_t, uint32_t, uint64_t);
+    FILL_INT_KERNELS(table, VectorOp::VSub, Scalar<Sub>::kernel, uint8_t, uint16_t, uint32_t, uint64_t);
+    FILL_INT_KERNELS(table, VectorOp::VAnd, Scalar<And>::kernel, uint8_t, uint16_t, uint32_t, uint64_t);
+    FILL_INT_KERNELS(table, VectorOp::VOr, Scalar<Or>::kernel, uint8_t, uint16_t, uint32_t, uint64_t);
+    FILL_INT_KERNELS(table, VectorOp::VXor, Scalar<Xor>::kernel, uint8_t, uint16_t, uint32_t, uint64_t);
+    FILL_INT_KERNELS(table, VectorOp::VMinu, Scalar<Min>::kernel, uint8_t, uint16_t, uint32_t, uint64_t);
+    FILL_INT_KERNELS(table, VectorOp::VMin, Scalar<Min>::kernel, int8_t, int16_t, int32_t, int64_t);
+    FILL_INT_KERNELS(table, VectorOp::VMaxu, Scalar<Max>::kernel, uint8_t, uint16_t, uint32_t, uint64_t);
+    FILL_INT_KERNELS(table, VectorOp::VMax, Scalar<Max>::kernel, int8_t, int16_t, int32_t, int64_t);
+    FILL_INT_KERNELS(table, VectorOp::VMul, Scalar<Mul>::kernel, uint8_t, uint16_t, uint32_t, uint64_t);
+    table.kernels[VectorOp::VFAdd][2] = Scalar<Add>::kernel<float>;
+    table.kernels[VectorOp::VFAdd][3] = Scalar<Add>::kernel<double>;
+    table.kernels[VectorOp::VFSub][2] = Scalar<Sub>::kernel<float>;
+    table.kernels[VectorOp::VFSub][3] = Scalar<Sub>::kernel<double>;
+    table.kernels[VectorOp::VFMul][2] = Scalar<FMul>::kernel<float>;
+    table.kernels[VectorOp::VFMul][3] = Scalar<FMul>::kernel<double>;
+    table.kernels[VectorOp::VFDiv][2] = Scalar<FDiv>::kernel<float>;
+    table.kernels[VectorOp::VFDiv][3] = Scalar<FDiv>::kernel<double>;
+    return table;
+}
+
+#ifdef RVV_X86_KERNELS
+
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+// Load/store adaptors so a single loop body serves every lane type of a tier.
+#define SIMD_TRAITS(NAME, TARGET, VEC, LOAD, STORE, CAST)                                                                  \
+    struct NAME {                                                                                                          \
+        static constexpr uint64_t bytes = sizeof(VEC);                                                                     \
+        TARGET static VEC load(const uint8_t *p) { return LOAD(reinterpret_cast<const CAST *>(p)); }                       \
+        TARGET static void store(uint8_t *p, VEC v) { STORE(reinterpret_cast<CAST *>(p), v); }                             \
+    };
+
+SIMD_TRAITS(SseInt, TARGET_SSE41, __m128i, _mm_loadu_si128, _mm_storeu_si128, __m128i)
+SIMD_TRAITS(SsePs, TARGET_SSE41, __m128, _mm_loadu_ps, _mm_storeu_ps, float)
+SIMD_TRAITS(SsePd, TARGET_SSE41, __m128d, _mm_loadu_pd, _mm_storeu_pd, double)
+SIMD_TRAITS(AvxInt, TARGET_AVX2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, __m256i)
+SIMD_TRAITS(AvxPs, TARGET_AVX2, __m256, _mm256_loadu_ps, _mm256_storeu_ps, float)
+SIMD_TRAITS(AvxPd, TARGET_AVX2, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, double)
+
+#define SIMD_OP(NAME, TARGET, VEC, INTRINSIC) \
+    struct NAME {                             \
+        TARGET VEC operator()(VEC a, VEC b) const { return INTRINSIC(a, b); } \
+    };
+
+SIMD_OP(SseAdd8, TARGET_SSE41, __m128i, _mm_add_epi8)
+SIMD_OP(SseAdd16, TARGET_SSE41, __m128i, _mm_add_epi16)
+SIMD_OP(SseAdd32, TARGET_SSE41, __m128i, _mm_add_epi32)
+SIMD_OP(SseAdd64, TARGET_SSE41, __m128i, _mm_add_epi64)
+SIMD_OP(SseSub8, TARGET_SSE41, __m128i, _mm_sub_epi8)
+SIMD_OP(SseSub16, TARGET_SSE41, __m128i, _mm_sub_epi16)
+SIMD_OP(SseSub32, TARGET_SSE41, __m128i, _mm_sub_epi32)
+SIMD_OP(SseSub64, TARGET_SSE41, __m128i, _mm_sub_epi64)
+SIMD_OP(SseAnd, TARGET_SSE41, __m128i, _mm_and_si128)
+SIMD_OP(SseOr, TARGET_SSE41, __m128i, _mm_or_si128)
+SIMD_OP(SseXor, TARGET_SSE41, __m128i, _mm_xor_si128)
+SIMD_OP(SseMinu8, TARGET_SSE41, __m128i, _mm_min_epu8)
+SIMD_OP(SseMinu16, TARGET_SSE41, __m128i, _mm_min_epu16)
+SIMD_OP(SseMinu32, TARGET_SSE41, __m128i, _mm_min_epu32)
+SIMD_OP(SseMin8, TARGET_SSE41, __m128i, _mm_min_epi8)
+SIMD_OP(SseMin16, TARGET_SSE41, __m128i, _mm_min_epi16)
+SIMD_OP(SseMin32, TARGET_SSE41, __m128i, _mm_min_epi32)
+SIMD_OP(SseMaxu8, TARGET_SSE41, __m128i, _mm_max_epu8)
+SIMD_OP(SseMaxu16, TARGET_SSE41, __m128i, _mm_max_epu16)
+SIMD_OP(SseMaxu32, TARGET_SSE41, __m128i, _mm_max_epu32)
+SIMD_OP(SseMax8, TARGET_SSE41, __m128i, _mm_max_epi8)
+SIMD_OP(SseMax16, TARGET_SSE41, __m128i, _mm_max_epi16)
+SIMD_OP(SseMax32, TARGET_SSE41, __m128i, _mm_max_epi32)
+SIMD_OP(SseMul16, TARGET_SSE41, __m128i, _mm_mullo_epi16)
+SIMD_OP(SseMul32, TARGET_SSE41, __m128i, _mm_mullo_epi32)
+SIMD_OP(SseAddPs, TARGET_SSE41, __m128, _mm_add_ps)
+SIMD_OP(SseAddPd, TARGET_SSE41, __m128d, _mm_add_pd)
+SIMD_OP(SseSubPs, TARGET_SSE41, __m128, _mm_sub_ps)
+SIMD_OP(SseSubPd, TARGET_SSE41, __m128d, _mm_sub_pd)
+SIMD_OP(SseMulPs, TARGET_SSE41, __m128, _mm_mul_ps)
+SIMD_OP(SseMulPd, TARGET_SSE41, __m128d, _mm_mul_pd)
+SIMD_OP(SseDivPs, TARGET_SSE41, __m128, _mm_div_ps)
+SIMD_OP(SseDivPd, TARGET_SSE41, __m128d, _mm_div_pd)
+
+SIMD_OP(AvxAdd8, TARGET_AVX2, __m256i, _mm256_add_epi8)
+SIMD_OP(AvxAdd16, TARGET_AVX2, __m256i, _mm256_add_epi16)
+SIMD_OP(AvxAdd32, TARGET_AVX2, __m256i, _mm256_add_epi32)
+SIMD_OP(AvxAdd64, TARGET_AVX2, __m256i, _mm256_add_epi64)
+SIMD_OP(AvxSub8, TARGET_AVX2, __m256i, _mm256_sub_epi8)
+SIMD_OP(AvxSub16, TARGET_AVX2, __m256i, _mm256_sub_epi16)
+SIMD_OP(AvxSub32, TARGET_AVX2, __m256i, _mm256_sub_epi32)
+SIMD_OP(AvxSub64, TARGET_AVX2, __m256i, _mm256_sub_epi64)
+SIMD_OP(AvxAnd, TARGET_AVX2, __m256i, _mm256_and_si256)
+SIMD_OP(AvxOr, TARGET_AVX2, __m256i, _mm256_or_si256)
+SIMD_OP(AvxXor, TARGET_AVX2, __m256i, _mm256_xor_si256)
+SIMD_OP(AvxMinu8, TARGET_AVX2, __m256i, _mm256_min_epu8)
+SIMD_OP(AvxMinu16, TARGET_AVX2, __m256i, _mm256_min_epu16)
+SIMD_OP(AvxMinu32, TARGET_AVX2, __m256i, _mm256_min_epu32)
+SIMD_OP(AvxMin8, TARGET_AVX2, __m256i, _mm256_min_epi8)
+SIMD_OP(AvxMin16, TARGET_AVX2, __m256i, _mm256_min_epi16)
+SIMD_OP(AvxMin32, TARGET_AVX2, __m256i, _mm256_min_epi32)
+SIMD_OP(AvxMaxu8, TARGET_AVX2, __m256i, _mm256_max_epu8)
+SIMD_OP(AvxMaxu16, TARGET_AVX2, __m256i, _mm256_max_epu16)
+SIMD_OP(AvxMaxu32, TARGET_AVX2, __m256i, _mm256_max_epu32)
+SIMD_OP(AvxMax8, TARGET_AVX2, __m256i, _mm256_max_epi8)
+SIMD_OP(AvxMax16, TARGET_AVX2, __m256i, _mm256_max_epi16)
+SIMD_OP(AvxMax32, TARGET_AVX2, __m256i, _mm256_max_epi32)
+SIMD_OP(AvxMul16, TARGET_AVX2, __m256i, _mm256_mullo_epi16)
+SIMD_OP(AvxMul32, TARGET_AVX2, __m256i, _mm256_mullo_epi32)
+SIMD_OP(AvxAddPs, TARGET_AVX2, __m256, _mm256_add_ps)
+SIMD_OP(AvxAddPd, TARGET_AVX2, __m256d, _mm256_add_pd)
+SIMD_OP(AvxSubPs, TARGET_AVX2, __m256, _mm256_sub_ps)
+SIMD_OP(AvxSubPd, TARGET_AVX2, __m256d, _mm256_sub_pd)
+SIMD_OP(AvxMulPs, TARGET_AVX2, __m256, _mm256_mul_ps)
+SIMD_OP(AvxMulPd, TARGET_AVX2, __m256d, _mm256_mul_pd)
+SIMD_OP(AvxDivPs, TARGET_AVX2, __m256, _mm256_div_ps)
+SIMD_OP(AvxDivPd, TARGET_AVX2, __m256d, _mm256_div_pd)
+
+// The vector loop covers whole host registers and leaves the remainder to the scalar kernel.
+template <typename Traits, typename T, typename Op, typename ScalarOp>
+struct Avx2 {
+    TARGET_AVX2 static void kernel(uint8_t *vd, const uint8_t *vs2, const uint8_t *vs1, uint64_t n) {
+        constexpr uint64_t lanes = Traits::bytes / sizeof(T);
+        uint64_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            auto a = Traits::load(vs2 + i * sizeof(T));
+            auto b = Traits::load(vs1 + i * sizeof(T));
+            Traits::store(vd + i * sizeof(T), Op()(a, b));
+        }
+        scalar_kernel<T, ScalarOp>(vd + i * sizeof(T), vs2 + i * sizeof(T), vs1 + i * sizeof(T), n - i);
+    }
+};
+
+template <typename Traits, typename T, typename Op, typename ScalarOp>
+struct Sse {
+    TARGET_SSE41 static void kernel(uint8_t *vd, const uint8_t *vs2, const uint8_t *vs1, uint64_t n) {
+        constexpr uint64_t lanes = Traits::bytes / sizeof(T);
+        uint64_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            auto a = Traits::load(vs2 + i * sizeof(T));
+            auto b = Traits::load(vs1 + i * sizeof(T));
+            Traits::store(vd + i * sizeof(T), Op()(a, b));
+        }
+        scalar_kernel<T, ScalarOp>(vd + i * sizeof(T), vs2 + i * sizeof(T), vs1 + i * sizeof(T), n - i);
+    }
+};
+
+#define FILL_SIMD_KERNELS(table, TIER, I, F, P)                                                                   \
+    table.kernels[VectorOp::VAdd][0] = TIER<I, uint8_t, P##Add8, Add>::kernel;                                   \
+    table.kernels[VectorOp::VAdd][1] = TIER<I, uint16_t, P##Add16, Add>::kernel;                                 \
+    table.kernels[VectorOp::VAdd][2] = TIER<I, uint32_t, P##Add32, Add>::kernel;                                 \
+    table.kernels[VectorOp::VAdd][3] = TIER<I, uint64_t, P##Add64, Add>::kernel;                                 \
+    table.kernels[VectorOp::VSub][0] = TIER<I, uint8_t, P##Sub8, Sub>::kernel;                                   \
+    table.kernels[VectorOp::VSub][1] = TIER<I, uint16_t, P##Sub16, Sub>::kernel;                                 \
+    table.kernels[VectorOp::VSub][2] = TIER<I, uint32_t, P##Sub32, Sub>::kernel;                                 \
+    table.kernels[VectorOp::VSub][3] = TIER<I, uint64_t, P##Sub64, Sub>::kernel;                                 \
+    table.kernels[VectorOp::VAnd][0] = TIER<I, uint8_t, P##And, And>::kernel;                                    \
+    table.kernels[VectorOp::VAnd][1] = TIER<I, uint16_t, P##And, And>::kernel;                                   \
+    table.kernels[VectorOp::VAnd][2] = TIER<I, uint32_t, P##And, And>::kernel;                                   \
+    table.kernels[VectorOp::VAnd][3] = TIER<I, uint64_t, P##And, And>::kernel;                                   \
+    table.kernels[VectorOp::VOr][0] = TIER<I, uint8_t, P##Or, Or>::kernel;                                       \
+    table.kernels[VectorOp::VOr][1] = TIER<I, uint16_t, P##Or, Or>::kernel;                                      \
+    table.kernels[VectorOp::VOr][2] = TIER<I, uint32_t, P##Or, Or>::kernel;                                      \
+    table.kernels[VectorOp::VOr][3] = TIER<I, uint64_t, P##Or, Or>::kernel;                                      \
+    table.kernels[VectorOp::VXor][0] = TIER<I, uint8_t, P##Xor, Xor>::kernel;                                    \
+    table.kernels[VectorOp::VXor][1] = TIER<I, uint16_t, P##Xor, Xor>::kernel;                                   \
+    table.kernels[VectorOp::VXor][2] = TIER<I, uint32_t, P##Xor, Xor>::kernel;                                   \
+    table.kernels[VectorOp::VXor][3] = TIER<I, uint64_t, P##Xor, Xor>::kernel;                                   \
+    table.kernels[VectorOp::VMinu][0] = TIER<I, uint8_t, P##Minu8, Min>::kernel;                                 \
+    table.kernels[VectorOp::VMinu][1] = TIER<I, uint16_t, P##Minu16, Min>::kernel;                               \
+    table.kernels[VectorOp::VMinu][2] = TIER<I, uint32_t, P##Minu32, Min>::kernel;                               \
+    table.kernels[VectorOp::VMin][0] = TIER<I, int8_t, P##Min8, Min>::kernel;                                    \
+    table.kernels[VectorOp::VMin][1] = TIER<I, int16_t, P##Min16, Min>::kernel;                                  \
+    table.kernels[VectorOp::VMin][2] = TIER<I, int32_t, P##Min32, Min>::kernel;                                  \
+    table.kernels[VectorOp::VMaxu][0] = TIER<I, uint8_t, P##Maxu8, Max>::kernel;                                 \
+    table.kernels[VectorOp::VMaxu][1] = TIER<I, uint16_t, P##Maxu16, Max>::kernel;                               \
+    table.kernels[VectorOp::VMaxu][2] = TIER<I, uint32_t, P##Maxu32, Max>::kernel;                               \
+    table.kernels[VectorOp::VMax][0] = TIER<I, int8_t, P##Max8, Max>::kernel;                                    \
+    table.kernels[VectorOp::VMax][1] = TIER<I, int16_t, P##Max16, Max>::kernel;                                  \
+    table.kernels[VectorOp::VMax][2] = TIER<I, int32_t, P##Max32, Max>::kernel;                                  \
+    table.kernels[VectorOp::VMul][1] = TIER<I, uint16_t, P##Mul16, Mul>::kernel;                                 \
+    table.kernels[VectorOp::VMul][2] = TIER<I, uint32_t, P##Mul32, Mul>::kernel;                                 \
+    table.kernels[VectorOp::VFAdd][2] = TIER<F##Ps, float, P##AddPs, Add>::kernel;                               \
+    table.kernels[VectorOp::VFAdd][3] = TIER<F##Pd, double, P##AddPd, Add>::kernel;                              \
+    table.kernels[VectorOp::VFSub][2] = TIER<F##Ps, float, P##SubPs, Sub>::kernel;                               \
+    table.kernels[VectorOp::VFSub][3] = TIER<F##Pd, double, P##SubPd, Sub>::kernel;                              \
+    table.kernels[VectorOp::VFMul][2] = TIER<F##Ps, float, P##MulPs, FMul>::kernel;                              \
+    table.kernels[VectorOp::VFMul][3] = TIER<F##Pd, double, P##MulPd, FMul>::kernel;                             \
+    table.kernels[VectorOp::VFDiv][2] = TIER<F##Ps, float, P##DivPs, FDiv>::kernel;                              \
+    table.kernels[VectorOp::VFDiv][3] = TIER<F##Pd, double, P##DivPd, FDiv>::kernel;
+
+VectorKernels make_sse41_kernels() {
+    // Start from the scalar table so widths without an SSE4.1 instruction keep a kernel.
+    VectorKernels table = make_scalar_kernels();
+    table.name = "sse4.1";
+    FILL_SIMD_KERNELS(table, Sse, SseInt, Sse, Sse)
+    return table;
+}
+
+VectorKernels make_avx2_kernels() {
+    VectorKernels table = make_scalar_kernels();
+    table.name = "avx2";
+    FILL_SIMD_KERNELS(table, Avx2, AvxInt, Avx, Avx)
+    return table;
+}
+
+#endif
+
+VectorKernels select_kernels() {
+#ifdef RVV_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return make_avx2_kernels();
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return make_sse41_kernels();
+    }
+#endif
+    return make_scalar_kernels();
+}
+
+} // namespace
+
+const VectorKernels &vector_kernels() {
+    static const VectorKernels kernels = select_kernels();
+    return kernels;
+}
@@ -0,0 +1,36 @@
+#ifndef RVV_KERNELS_H
+#define RVV_KERNELS_H
+
+#include <cstdint>
+
+enum VectorOp {
+    VAdd,
+    VSub,
+    VAnd,
+    VOr,
+    VXor,
+    VMinu,
+    VMin,
+    VMaxu,
+    VMax,
+    VMul,
+    VFAdd,
+    VFSub,
+    VFMul,
+    VFDiv,
+    VectorOpCount,
+};
+
+// Computes vd[i] = vs2[i] op vs1[i] for n elements of the given width.
+typedef void (*VectorKernel)(uint8_t *vd, const uint8_t *vs2, const uint8_t *vs1, uint64_t n);
+
+struct VectorKernels {
+    const char *name;
+    // Indexed by op and log2(SEW / 8); nullptr where no kernel exists for that width.
+    VectorKernel kernels[VectorOpCount][4];
+};
+
+// Returns the best kernel set for the host, chosen once by CPUID.
+const VectorKernels &vector_kernels();
+
+#endif
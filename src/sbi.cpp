@@ -0,0 +1,205 @@
+#include "sbi.h"
+
+#include <cstdlib>
+
+#include "cpu.h"
+
+#define SBI_HSM_STARTED 0
+#define SBI_HSM_SUSPEND_RETENTIVE 0
+
+#define SBI_SRST_SHUTDOWN 0
+#define SBI_SRST_COLD_REBOOT 1
+#define SBI_SRST_WARM_REBOOT 2
+#define SBI_SRST_NO_REASON 0
+#define SBI_SRST_SYSTEM_FAILURE 1
+
+Sbi::Sbi(std::function<void(int)> shutdown) : shutdown{shutdown} {}
+
+void Sbi::call(Cpu &cpu) {
+    auto extension = cpu.getRegister(17);
+    auto function = cpu.getRegister(16);
+    auto a0 = cpu.getRegister(10);
+    auto a1 = cpu.getRegister(11);
+
+    // The legacy extensions return their value in a0 alone.
+    switch (extension) {
+    case SBI_EXT_LEGACY_SET_TIMER:
+        set_timer(cpu, a0);
+        cpu.setRegister(10, 0);
+        return;
+    case SBI_EXT_LEGACY_CONSOLE_PUTCHAR:
+        cpu.getUart().store(UART_THR, 1, a0);
+        cpu.setRegister(10, 0);
+        return;
+    case SBI_EXT_LEGACY_CONSOLE_GETCHAR: {
+        auto &uart = cpu.getUart();
+        auto ready = (uart.load(UART_LSR, 1) & UART_LSR_RX) != 0;
+        cpu.setRegister(10, ready ? uart.load(UART_RHR, 1) : (uint64_t)-1);
+        return;
+    }
+    case SBI_EXT_LEGACY_CLEAR_IPI:
+        cpu.store_csr(MIP, cpu.load_csr(MIP) & ~MIP_SSIP);
+        cpu.setRegister(10, 0);
+        return;
+    case SBI_EXT_LEGACY_SEND_IPI: {
+        // a0 points to the hart mask in supervisor memory.
+        uint64_t hart_mask;
+        try {
+            hart_mask = cpu.load(a0, 8);
+        } catch (const Exception &) {
+            cpu.setRegister(10, SBI_ERR_INVALID_PARAM);
+            return;
+        }
+        cpu.setRegister(10, send_ipi(cpu, hart_mask, 0));
+        return;
+    }
+    case SBI_EXT_LEGACY_REMOTE_FENCE_I:
+    case SBI_EXT_LEGACY_REMOTE_SFENCE_VMA:
+    case SBI_EXT_LEGACY_REMOTE_SFENCE_VMA_ASID:
+        cpu.setRegister(10, 0);
+        return;
+    case SBI_EXT_LEGACY_SHUTDOWN:
+        shutdown(EXIT_SUCCESS);
+        cpu.setRegister(10, 0);
+        return;
+    }
+
+    int64_t error = SBI_ERR_NOT_SUPPORTED;
+    uint64_t value = 0;
+    switch (extension) {
+    case SBI_EXT_BASE:
+        error = base(cpu, function, value);
+        break;
+    case SBI_EXT_TIME:
+        if (function == 0) {
+            set_timer(cpu, a0);
+            error = SBI_SUCCESS;
+        }
+        break;
+    case SBI_EXT_IPI:
+        if (function == 0) {
+            error = send_ipi(cpu, a0, a1);
+        }
+        break;
+    case SBI_EXT_RFENCE:
+        // remote_fence_i, remote_sfence_vma and remote_sfence_vma_asid; the
+        // others fence hypervisor translations.
+        if (function <= 2) {
+            error = SBI_SUCCESS;
+        }
+        break;
+    case SBI_EXT_HSM:
+        error = hsm(cpu, function, value);
+        break;
+    case SBI_EXT_SRST:
+        if (function == 0) {
+            error = system_reset(a0, a1);
+        }
+        break;
+    }
+    cpu.setRegister(10, error);
+    cpu.setRegister(11, value);
+}
+
+int64_t Sbi::base(Cpu &cpu, uint64_t function, uint64_t &value) {
+    switch (function) {
+    case 0:
+        value = SBI_SPEC_VERSION;
+        return SBI_SUCCESS;
+    case 1:
+        value = SBI_IMPLEMENTATION_ID;
+        return SBI_SUCCESS;
+    case 2:
+        value = SBI_IMPLEMENTATION_VERSION;
+        return SBI_SUCCESS;
+    case 3:
+        // probe_extension
+        switch (cpu.getRegister(10)) {
+        case SBI_EXT_BASE:
+        case SBI_EXT_TIME:
+        case SBI_EXT_IPI:
+        case SBI_EXT_RFENCE:
+        case SBI_EXT_HSM:
+        case SBI_EXT_SRST:
+            value = 1;
+            break;
+        default:
+            value = cpu.getRegister(10) <= SBI_EXT_LEGACY_SHUTDOWN ? 1 : 0;
+        }
+        return SBI_SUCCESS;
+    case 4:
+        value = cpu.load_csr(MVENDORID);
+        return SBI_SUCCESS;
+    case 5:
+        value = cpu.load_csr(MARCHID);
+        return SBI_SUCCESS;
+    case 6:
+        value = cpu.load_csr(MIMPID);
+        return SBI_SUCCESS;
+    default:
+        return SBI_ERR_NOT_SUPPORTED;
+    }
+}
+
+int64_t Sbi::hsm(Cpu &cpu, uint64_t function, uint64_t &value) {
+    auto hart = cpu.getRegister(10);
+    switch (function) {
+    case 0:
+        // hart_start: hart 0 is the one making the call.
+        return hart == 0 ? SBI_ERR_ALREADY_AVAILABLE : SBI_ERR_INVALID_PARAM;
+    case 1:
+        // hart_stop: the last hart cannot stop.
+        return SBI_ERR_FAILED;
+    case 2:
+        if (hart != 0) {
+            return SBI_ERR_INVALID_PARAM;
+        }
+        value = SBI_HSM_STARTED;
+        return SBI_SUCCESS;
+    case 3:
+        // hart_suspend(type): a retentive suspend is a wfi; the hart resumes
+        // after the ecall once an interrupt is pending.
+        if (cpu.getRegister(10) != SBI_HSM_SUSPEND_RETENTIVE) {
+            return SBI_ERR_NOT_SUPPORTED;
+        }
+        cpu.setWaiting(true);
+        return SBI_SUCCESS;
+    default:
+        return SBI_ERR_NOT_SUPPORTED;
+    }
+}
+
+int64_t Sbi::system_reset(uint64_t type, uint64_t reason) {
+    if (reason > SBI_SRST_SYSTEM_FAILURE && reason < 0xf0000000) {
+        return SBI_ERR_INVALID_PARAM;
+    }
+    switch (type) {
+    case SBI_SRST_SHUTDOWN:
+        shutdown(reason == SBI_SRST_NO_REASON ? EXIT_SUCCESS : EXIT_FAILURE);
+        return SBI_SUCCESS;
+    case SBI_SRST_COLD_REBOOT:
+    case SBI_SRST_WARM_REBOOT:
+        return SBI_ERR_NOT_SUPPORTED;
+    default:
+        return type < 0xf0000000 ? SBI_ERR_INVALID_PARAM : SBI_ERR_NOT_SUPPORTED;
+    }
+}
+
+// Also clears a pending timer interrupt, as the spec requires, without waiting
+// for the emulator to notice the new mtimecmp.
+void Sbi::set_timer(Cpu &cpu, uint64_t stime) {
+    auto &clint = cpu.getClint();
+    clint.store(CLINT_MTIMECMP, 8, stime);
+    cpu.setTimerPending(clint.get_mtime() >= stime);
+}
+
+int64_t Sbi::send_ipi(Cpu &cpu, uint64_t hart_mask, uint64_t hart_mask_base) {
+    auto to_hart0 = hart_mask_base == UINT64_MAX || (hart_mask_base == 0 && (hart_mask & 1) != 0);
+    if (hart_mask_base != UINT64_MAX && (hart_mask_base != 0 || (hart_mask & ~(uint64_t)1) != 0)) {
+        return SBI_ERR_INVALID_PARAM;
+    }
+    if (to_hart0) {
+        cpu.store_csr(MIP, cpu.load_csr(MIP) | MIP_SSIP);
+    }
+    return SBI_SUCCESS;
+}
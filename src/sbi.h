@@ -0,0 +1,57 @@
+#ifndef SBI_H
+#define SBI_H
+
+#include <cstdint>
+#include <functional>
+
+class Cpu;
+
+// Extension IDs, in a7.
+#define SBI_EXT_LEGACY_SET_TIMER 0x00
+#define SBI_EXT_LEGACY_CONSOLE_PUTCHAR 0x01
+#define SBI_EXT_LEGACY_CONSOLE_GETCHAR 0x02
+#define SBI_EXT_LEGACY_CLEAR_IPI 0x03
+#define SBI_EXT_LEGACY_SEND_IPI 0x04
+#define SBI_EXT_LEGACY_REMOTE_FENCE_I 0x05
+#define SBI_EXT_LEGACY_REMOTE_SFENCE_VMA 0x06
+#define SBI_EXT_LEGACY_REMOTE_SFENCE_VMA_ASID 0x07
+#define SBI_EXT_LEGACY_SHUTDOWN 0x08
+#define SBI_EXT_BASE 0x10
+#define SBI_EXT_TIME 0x54494d45
+#define SBI_EXT_IPI 0x735049
+#define SBI_EXT_RFENCE 0x52464e43
+#define SBI_EXT_HSM 0x48534d
+#define SBI_EXT_SRST 0x53525354
+
+#define SBI_SUCCESS 0
+#define SBI_ERR_FAILED -1
+#define SBI_ERR_NOT_SUPPORTED -2
+#define SBI_ERR_INVALID_PARAM -3
+#define SBI_ERR_ALREADY_AVAILABLE -6
+
+// SBI v1.0.
+#define SBI_SPEC_VERSION 0x01000000
+// Not a registered implementation ID.
+#define SBI_IMPLEMENTATION_ID 0x7265
+#define SBI_IMPLEMENTATION_VERSION 1
+
+// The supervisor binary interface a firmware would otherwise provide, served
+// in the host: S-mode ecalls never reach guest M-mode code. There is one hart,
+// hart 0, and the fences are no-ops since translations are never cached.
+class Sbi {
+private:
+    std::function<void(int)> shutdown;
+    int64_t base(Cpu &cpu, uint64_t function, uint64_t &value);
+    int64_t hsm(Cpu &cpu, uint64_t function, uint64_t &value);
+    int64_t system_reset(uint64_t type, uint64_t reason);
+    void set_timer(Cpu &cpu, uint64_t stime);
+    int64_t send_ipi(Cpu &cpu, uint64_t hart_mask, uint64_t hart_mask_base);
+
+public:
+    // shutdown is called with the exit status when the guest powers off.
+    Sbi(std::function<void(int)> shutdown);
+    // Serves the ecall in a7/a6/a0-a5 and returns to the instruction after it.
+    void call(Cpu &cpu);
+};
+
+#endif
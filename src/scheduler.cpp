@@ -0,0 +1,65 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler(unsigned threads, uint64_t slice) : lock{},
+                                                         ready_condvar{},
+                                                         idle_condvar{},
+                                                         ready{},
+                                                         slice{slice},
+                                                         active{0},
+                                                         stopping{false},
+                                                         workers{} {
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back(&Scheduler::work, this);
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready_condvar.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void Scheduler::add(Emulator *emulator) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ready.push_back(emulator);
+        active++;
+    }
+    ready_condvar.notify_one();
+}
+
+void Scheduler::wait() {
+    std::unique_lock<std::mutex> ulock(lock);
+    idle_condvar.wait(ulock, [this] { return active == 0; });
+}
+
+void Scheduler::work() {
+    std::unique_lock<std::mutex> ulock(lock);
+    while (true) {
+        ready_condvar.wait(ulock, [this] { return stopping || !ready.empty(); });
+        if (stopping) {
+            return;
+        }
+        auto emulator = ready.front();
+        ready.pop_front();
+
+        ulock.unlock();
+        emulator->run(slice);
+        ulock.lock();
+
+        if (emulator->is_halted()) {
+            active--;
+            if (active == 0) {
+                idle_condvar.notify_all();
+            }
+        } else {
+            ready.push_back(emulator);
+            ready_condvar.notify_one();
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "emulator.h"
+
+// Runs many emulators on a fixed pool of host threads. Each turn a worker takes
+// the next ready emulator, runs it for one slice of instructions and requeues it
+// unless it halted.
+class Scheduler {
+private:
+    std::mutex lock;
+    std::condition_variable ready_condvar;
+    std::condition_variable idle_condvar;
+    std::deque<Emulator *> ready;
+    uint64_t slice;
+    uint64_t active;
+    bool stopping;
+    std::vector<std::thread> workers;
+    void work();
+
+public:
+    Scheduler(unsigned threads, uint64_t slice);
+    ~Scheduler();
+    // The emulator must stay alive until wait() returns.
+    void add(Emulator *emulator);
+    // Blocks until every added emulator has halted.
+    void wait();
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "shared_memory.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+SharedMemory::SharedMemory(uint64_t size, std::function<void()> notify) : fd{-1},
+                                                                          region{nullptr},
+                                                                          size{0},
+                                                                          notify{notify},
+                                                                          doorbell{nullptr},
+                                                                          incoming{0},
+                                                                          pending{0} {
+    auto page = (uint64_t)sysconf(_SC_PAGESIZE);
+    if (size == 0 || size > UINT64_MAX - page) {
+        throw std::runtime_error("invalid shared memory size");
+    }
+    this->size = (size + page - 1) / page * page;
+    fd = memfd_create("riscv-emulator-shmem", MFD_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("memfd_create: ") + std::strerror(errno));
+    }
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, this->size) == 0) {
+        mapping = mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        auto error = errno;
+        close(fd);
+        throw std::runtime_error(std::string("cannot map shared memory: ") + std::strerror(error));
+    }
+    region = static_cast<uint8_t *>(mapping);
+}
+
+SharedMemory::~SharedMemory() {
+    munmap(region, size);
+    close(fd);
+}
+
+uint64_t SharedMemory::load(uint64_t addr, int nBytes) {
+    switch (addr) {
+    case SHMEM_REGION_BASE:
+        return nBytes == 8 ? SHMEM_MEMORY_BASE : SHMEM_MEMORY_BASE & 0xffffffff;
+    case SHMEM_REGION_BASE + 4:
+        return SHMEM_MEMORY_BASE >> 32;
+    case SHMEM_REGION_SIZE:
+        return nBytes == 8 ? size : size & 0xffffffff;
+    case SHMEM_REGION_SIZE + 4:
+        return size >> 32;
+    case SHMEM_PENDING:
+        return pending;
+    default:
+        return 0;
+    }
+}
+
+void SharedMemory::store(uint64_t addr, int nBytes, uint64_t value) {
+    if (nBytes != 4) {
+        raise_exception(ExceptionType::StoreAMOAccessFault, addr);
+    }
+    switch (addr) {
+    case SHMEM_DOORBELL:
+        if (doorbell) {
+            doorbell(value);
+        }
+        return;
+    case SHMEM_ACK:
+        pending &= ~value;
+        return;
+    default:
+        return;
+    }
+}
+
+void SharedMemory::ring(uint32_t vector) {
+    // Release the host's writes to the region to the guest.
+    incoming.fetch_or((uint32_t)1 << (vector % 32), std::memory_order_release);
+    notify();
+}
+
+bool SharedMemory::is_interrupting() {
+    auto rung = incoming.exchange(0, std::memory_order_acquire);
+    pending |= rung;
+    return rung != 0;
+}
@@ -0,0 +1,68 @@
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+#include "device.h"
+
+#define SHMEM_BASE 0x10004000
+#define SHMEM_SIZE 0x1000
+#define SHMEM_IRQ 3
+// Where the guest finds the shared region: above RAM, so that it is never
+// mistaken for MMIO.
+#define SHMEM_MEMORY_BASE 0x100000000
+// Read-only, 64-bit: the region's guest physical address and size.
+#define SHMEM_REGION_BASE (SHMEM_BASE + 0x00)
+#define SHMEM_REGION_SIZE (SHMEM_BASE + 0x08)
+// Write: rings the host with the value written.
+#define SHMEM_DOORBELL (SHMEM_BASE + 0x10)
+// Read: the vectors the host rang, one bit each, until acknowledged.
+#define SHMEM_PENDING (SHMEM_BASE + 0x14)
+// Write: clears the pending bits that are set in the value.
+#define SHMEM_ACK (SHMEM_BASE + 0x18)
+
+// An ivshmem-like channel: a memfd the guest sees as memory at
+// SHMEM_MEMORY_BASE, so host and guest exchange data in place, and doorbells
+// both ways. The host rings the guest with ring(), which raises SHMEM_IRQ; the
+// guest rings the host by writing SHMEM_DOORBELL. The contents are shared
+// rather than owned by the guest: they are not part of snapshots, replay does
+// not reproduce them, and clones made with fork_clone() share them.
+class SharedMemory : public Device {
+private:
+    int fd;
+    uint8_t *region;
+    uint64_t size;
+    std::function<void()> notify;
+    std::function<void(uint32_t)> doorbell;
+    // Vectors rung by the host and not yet moved to pending.
+    std::atomic<uint32_t> incoming;
+    uint32_t pending;
+
+public:
+    // Creates a memfd of size bytes, rounded up to whole pages. notify is
+    // called by ring() to get the emulator's attention. Throws std::runtime_error.
+    SharedMemory(uint64_t size, std::function<void()> notify);
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+    ~SharedMemory();
+    const char *get_name() { return "shmem"; };
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
+    // The memfd, for other processes to map; see also /proc/<pid>/fd/<fd>.
+    int get_fd() const { return fd; };
+    uint8_t *data() { return region; };
+    uint64_t get_size() const { return size; };
+    // Called on the thread running the guest with each value it writes to
+    // SHMEM_DOORBELL.
+    void set_doorbell(std::function<void(uint32_t)> callback) { doorbell = callback; };
+    // Rings the guest on vector, 0 to 31. Safe to call from any thread or a
+    // signal handler.
+    void ring(uint32_t vector);
+    bool has_incoming() const { return incoming.load(std::memory_order_relaxed) != 0; };
+    // Moves the host's rings to SHMEM_PENDING; true if there were any.
+    bool is_interrupting();
+};
+
+#endif
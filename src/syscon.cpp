@@ -0,0 +1,35 @@
+#include "syscon.h"
+
+#include <cstdlib>
+
+Syscon::Syscon(std::function<void(int)> shutdown) : shutdown{shutdown} {
+}
+
+uint64_t Syscon::load(uint64_t addr, int nBytes) {
+    if (nBytes == 4 || nBytes == 8) {
+        return 0;
+    }
+    raise_exception(ExceptionType::LoadAccessFault, addr);
+}
+
+void Syscon::store(uint64_t addr, int nBytes, uint64_t value) {
+    if (nBytes != 4 && nBytes != 8) {
+        raise_exception(ExceptionType::StoreAMOAccessFault, addr);
+    }
+    if (addr != SYSCON_BASE) {
+        return;
+    }
+    auto status = (int)((value >> 16) & 0xffff);
+    switch (value & 0xffff) {
+    case SYSCON_FAIL:
+        // A failure never reads as success.
+        shutdown(status != 0 ? status : EXIT_FAILURE);
+        return;
+    case SYSCON_PASS:
+    case SYSCON_RESET:
+        shutdown(EXIT_SUCCESS);
+        return;
+    default:
+        return;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SYSCON_H
+#define SYSCON_H
+
+#include <functional>
+
+#include "device.h"
+
+// SiFive's test finisher, where QEMU's virt board has it. Linux drives it
+// through the syscon-poweroff and syscon-reboot drivers.
+#define SYSCON_BASE 0x100000
+#define SYSCON_SIZE 0x1000
+// The low half of a 32-bit write selects the command; for FAIL the high half
+// is the exit status.
+#define SYSCON_FAIL 0x3333
+#define SYSCON_PASS 0x5555
+#define SYSCON_RESET 0x7777
+
+// Powers the machine off with an exit status. There is no reset, so a reboot
+// request powers off too, successfully.
+class Syscon : public Device {
+private:
+    std::function<void(int)> shutdown;
+
+public:
+    // shutdown is called with the exit status when the guest powers off.
+    Syscon(std::function<void(int)> shutdown);
+    const char *get_name() { return "syscon"; };
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
+};
+
+#endif
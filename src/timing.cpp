@@ -0,0 +1,194 @@
+#include "timing.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+bool is_link(uint64_t reg) {
+    return reg == 1 || reg == 5;
+}
+
+} // namespace
+
+TimingModel::TimingModel(const TimingConfig &config) : config{config},
+                                                       return_stack{},
+                                                       return_top{0},
+                                                       cycles{0},
+                                                       instructions{0},
+                                                       branches{0},
+                                                       mispredicts{0},
+                                                       recent(TIMING_RECENT_PCS, {0, nullptr}) {
+    // Weakly taken, so backward loop branches start out predicted.
+    std::fill(std::begin(predictor), std::end(predictor), 2);
+}
+
+void TimingModel::load_symbols(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("cannot open symbol file " + path);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (fields >> token) {
+            tokens.push_back(token);
+        }
+        if (tokens.size() != 3 && tokens.size() != 4) {
+            continue;
+        }
+        auto &type = tokens[tokens.size() - 2];
+        if (type != "T" && type != "t") {
+            continue;
+        }
+        symbols.push_back({std::stoull(tokens[0], nullptr, 16), tokens.back()});
+    }
+    std::sort(symbols.begin(), symbols.end(), [](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+}
+
+bool TimingModel::predict(uint64_t pc, bool taken) {
+    auto &counter = predictor[(pc >> 2) % PREDICTOR_ENTRIES];
+    auto predicted = counter >= 2;
+    if (taken && counter < 3) {
+        counter++;
+    } else if (!taken && counter > 0) {
+        counter--;
+    }
+    return predicted == taken;
+}
+
+uint64_t &TimingModel::cycles_for(uint64_t key) {
+    auto &entry = recent[(key >> 2) % TIMING_RECENT_PCS];
+    if (entry.second == nullptr || entry.first != key) {
+        entry = {key, &pc_cycles[key]};
+    }
+    return *entry.second;
+}
+
+uint64_t TimingModel::retire(uint64_t pc, bool user, uint32_t instruction, uint64_t next_pc, bool trapped,
+                             uint64_t l1_misses, uint64_t l2_misses) {
+    auto opcode = instruction & 0x7f;
+    auto rd = (instruction >> 7) & 0x1f;
+    auto rs1 = (instruction >> 15) & 0x1f;
+    auto funct3 = (instruction >> 12) & 0x7;
+    auto funct7 = instruction >> 25;
+
+    uint64_t cost = 1;
+    if (trapped) {
+        cost = config.trap;
+    } else {
+        switch (opcode) {
+        case 0x03:
+        case 0x07:
+        case 0x2f:
+            // load, vector load, atomic
+            cost = config.load;
+            break;
+        case 0x33:
+        case 0x3b:
+            if (funct7 == 0x01) {
+                cost = funct3 < 4 ? config.multiply : config.divide;
+            }
+            break;
+        case 0x63: {
+            branches++;
+            auto taken = next_pc != pc + 4;
+            if (!predict(pc, taken)) {
+                mispredicts++;
+                cost += config.mispredict;
+            } else if (taken) {
+                cost += config.taken;
+            }
+            break;
+        }
+        case 0x6f:
+            // jal: the target is known at decode.
+            if (is_link(rd)) {
+                return_stack[return_top++ % RETURN_STACK_DEPTH] = pc + 4;
+            }
+            cost += config.taken;
+            break;
+        case 0x67: {
+            // jalr: returns are predicted by the return stack and auipc+jalr calls
+            // (rd == rs1 == ra) like jal; other indirect jumps are not predicted.
+            branches++;
+            auto predicted = is_link(rd) && rd == rs1;
+            if (is_link(rs1) && rs1 != rd && return_top > 0) {
+                predicted = return_stack[--return_top % RETURN_STACK_DEPTH] == next_pc;
+            }
+            if (is_link(rd)) {
+                return_stack[return_top++ % RETURN_STACK_DEPTH] = pc + 4;
+            }
+            if (predicted) {
+                cost += config.taken;
+            } else {
+                mispredicts++;
+                cost += config.mispredict;
+            }
+            break;
+        }
+        case 0x73:
+            // mret, sret
+            if (instruction == 0x30200073 || instruction == 0x10200073) {
+                cost = config.trap;
+            }
+            break;
+        }
+    }
+    cost += l1_misses * config.l1_miss + l2_misses * config.l2_miss;
+
+    cycles += cost;
+    instructions++;
+    cycles_for(pc | user) += cost;
+    return cost;
+}
+
+uint64_t TimingModel::interrupt(uint64_t pc, bool user) {
+    cycles += config.trap;
+    cycles_for(pc | user) += config.trap;
+    return config.trap;
+}
+
+void TimingModel::report(std::ostream &out, size_t top_n) const {
+    out << "cycles       " << cycles << std::endl
+        << "instructions " << instructions << std::endl
+        << "cpi          " << std::fixed << std::setprecision(3)
+        << (instructions == 0 ? 0.0 : (double)cycles / instructions) << std::endl
+        << "branches     " << branches << " (" << mispredicts << " mispredicted)" << std::endl
+        << std::endl;
+
+    std::map<std::string, uint64_t> totals;
+    for (const auto &[key, count] : pc_cycles) {
+        std::string name;
+        if (key & 1) {
+            name = "[user]";
+        } else if (symbols.empty()) {
+            std::ostringstream hex;
+            hex << "0x" << std::hex << std::setfill('0') << std::setw(16) << key;
+            name = hex.str();
+        } else {
+            auto next = std::upper_bound(symbols.begin(), symbols.end(), key,
+                                         [](uint64_t pc, const Symbol &symbol) { return pc < symbol.addr; });
+            name = next == symbols.begin() ? "[unknown]" : std::prev(next)->name;
+        }
+        totals[name] += count;
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> sorted(totals.begin(), totals.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (sorted.size() > top_n) {
+        sorted.resize(top_n);
+    }
+    for (const auto &[name, count] : sorted) {
+        out << std::setw(16) << count << std::setw(8) << std::fixed << std::setprecision(2)
+            << (cycles == 0 ? 0.0 : 100.0 * count / cycles) << "%  " << name << std::endl;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 2-bit counters in the bimodal branch predictor, indexed by pc.
+#define PREDICTOR_ENTRIES 4096
+#define RETURN_STACK_DEPTH 8
+// Entries in the direct-mapped lookup in front of the per-pc cycle counts.
+#define TIMING_RECENT_PCS 4096
+
+// Cycles charged per instruction class on a single-issue in-order pipeline.
+// Everything not listed costs one cycle.
+struct TimingConfig {
+    uint64_t multiply = 3;
+    uint64_t divide = 34;
+    // Load-to-use latency on an L1 hit; atomics cost the same.
+    uint64_t load = 2;
+    // Added for every L1 miss (instruction or data) and every L2 miss.
+    uint64_t l1_miss = 12;
+    uint64_t l2_miss = 100;
+    // Fetch bubble after a correctly predicted taken branch or jump.
+    uint64_t taken = 1;
+    uint64_t mispredict = 5;
+    // Pipeline flush on an exception, interrupt or xRET.
+    uint64_t trap = 10;
+};
+
+// Estimates the cycles each retired instruction would take, and where they go.
+class TimingModel {
+private:
+    struct Symbol {
+        uint64_t addr;
+        std::string name;
+    };
+
+    TimingConfig config;
+    uint8_t predictor[PREDICTOR_ENTRIES];
+    uint64_t return_stack[RETURN_STACK_DEPTH];
+    uint64_t return_top;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t branches;
+    uint64_t mispredicts;
+    // Keyed by pc, with bit 0 set for user-mode pcs.
+    std::unordered_map<uint64_t, uint64_t> pc_cycles;
+    std::vector<std::pair<uint64_t, uint64_t *>> recent;
+    // Sorted by address.
+    std::vector<Symbol> symbols;
+    bool predict(uint64_t pc, bool taken);
+    uint64_t &cycles_for(uint64_t key);
+
+public:
+    TimingModel(const TimingConfig &config);
+    // Reads `nm` output ("addr type name" or "addr size type name" per line)
+    // to name functions in the report. Throws std::runtime_error.
+    void load_symbols(const std::string &path);
+    // Charges one retired instruction and returns its cycles. next_pc is the pc
+    // after it; misses are the cache misses it caused (zero without caches).
+    uint64_t retire(uint64_t pc, bool user, uint32_t instruction, uint64_t next_pc, bool trapped,
+                    uint64_t l1_misses, uint64_t l2_misses);
+    // Charges an interrupt taken before the instruction at pc; returns its cycles.
+    uint64_t interrupt(uint64_t pc, bool user);
+    uint64_t get_cycles() const { return cycles; };
+    // Totals, then the top_n functions (or pcs, without symbols) by cycles.
+    void report(std::ostream &out, size_t top_n) const;
+};
+
+#endif
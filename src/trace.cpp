@@ -0,0 +1,259 @@
+#include "trace.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+// Bound on chunks waiting for the writer; the emulator blocks beyond it
+// rather than growing without limit when compression falls behind.
+#define TRACE_MAX_PENDING 16
+// flags, pc delta, instruction, rd and value, address delta, exception, interrupt, mode
+#define TRACE_MAX_RECORD_SIZE (1 + 10 + 4 + 11 + 10 + 20 + 10 + 1)
+
+namespace {
+
+inline uint8_t *put_varint(uint8_t *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+inline uint8_t *put_signed(uint8_t *out, int64_t value) {
+    return put_varint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+uint64_t get_varint(const std::vector<uint8_t> &in, size_t &position) {
+    uint64_t value = 0;
+    for (int shift = 0; position < in.size() && shift < 64; shift += 7) {
+        auto byte = in[position++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::runtime_error("corrupt trace record");
+}
+
+int64_t get_signed(const std::vector<uint8_t> &in, size_t &position) {
+    auto value = get_varint(in, position);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+void put_u32(std::ofstream &file, uint32_t value) {
+    file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+} // namespace
+
+TraceWriter::TraceWriter(const std::string &path) : file{path, std::ofstream::binary},
+                                                     chunk(TRACE_CHUNK_SIZE + TRACE_MAX_RECORD_SIZE),
+                                                     used{0},
+                                                     next_pc{0},
+                                                     last_addr{0},
+                                                     last_mode{UINT8_MAX},
+                                                     last_registers{0},
+                                                     words{0},
+                                                     lock{},
+                                                     condvar{},
+                                                     pending{},
+                                                     closing{false},
+                                                     writer{} {
+    if (!file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    file.write(TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    reset_deltas();
+    writer = std::thread(&TraceWriter::write_chunks, this);
+}
+
+TraceWriter::~TraceWriter() {
+    flush_chunk();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    condvar.notify_all();
+    writer.join();
+}
+
+void TraceWriter::append(const TraceRecord &record) {
+    auto flags = record.flags;
+    if (record.pc != next_pc) {
+        flags |= TRACE_PC;
+    }
+    if (record.mode != last_mode) {
+        flags |= TRACE_MODE;
+        last_mode = record.mode;
+    }
+    auto &word = words[(record.pc >> 2) % TRACE_WORD_CACHE];
+    if (word != record.instruction) {
+        flags |= TRACE_WORD;
+        word = record.instruction;
+    }
+    // The chunk always has TRACE_MAX_RECORD_SIZE bytes of slack past its fill level.
+    auto start = chunk.data() + used;
+    auto out = start;
+    *out++ = flags;
+    if ((flags & TRACE_PC) != 0) {
+        out = put_signed(out, (int64_t)(record.pc - next_pc));
+    }
+    next_pc = record.pc + 4;
+    if ((flags & TRACE_WORD) != 0) {
+        std::memcpy(out, &record.instruction, 4);
+        out += 4;
+    }
+    if ((flags & TRACE_RD) != 0) {
+        *out++ = record.rd;
+        out = put_signed(out, (int64_t)(record.rd_value - last_registers[record.rd & 0x1f]));
+        last_registers[record.rd & 0x1f] = record.rd_value;
+    }
+    if ((flags & TRACE_MEMORY) != 0) {
+        out = put_signed(out, (int64_t)(record.memory_addr - last_addr));
+        last_addr = record.memory_addr;
+    }
+    if ((flags & TRACE_EXCEPTION) != 0) {
+        out = put_varint(out, record.cause);
+        out = put_varint(out, record.tval);
+    }
+    if ((flags & TRACE_INTERRUPT) != 0) {
+        out = put_varint(out, record.interrupt_cause);
+    }
+    if ((flags & TRACE_MODE) != 0) {
+        *out++ = record.mode;
+    }
+    used += out - start;
+    if (used >= TRACE_CHUNK_SIZE) {
+        flush_chunk();
+    }
+}
+
+void TraceWriter::flush_chunk() {
+    if (used == 0) {
+        return;
+    }
+    chunk.resize(used);
+    {
+        std::unique_lock<std::mutex> ulock(lock);
+        condvar.wait(ulock, [this] { return pending.size() < TRACE_MAX_PENDING; });
+        pending.push_back(std::move(chunk));
+    }
+    condvar.notify_all();
+    chunk = std::vector<uint8_t>(TRACE_CHUNK_SIZE + TRACE_MAX_RECORD_SIZE);
+    used = 0;
+    reset_deltas();
+}
+
+void TraceWriter::reset_deltas() {
+    next_pc = 0;
+    last_addr = 0;
+    last_mode = UINT8_MAX;
+    std::memset(last_registers, 0, sizeof(last_registers));
+    std::memset(words, 0, sizeof(words));
+}
+
+void TraceWriter::write_chunks() {
+    std::vector<uint8_t> compressed;
+    while (true) {
+        std::vector<uint8_t> raw;
+        {
+            std::unique_lock<std::mutex> ulock(lock);
+            condvar.wait(ulock, [this] { return closing || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            raw = std::move(pending.front());
+            pending.pop_front();
+        }
+        condvar.notify_all();
+
+        uLongf size = compressBound(raw.size());
+        compressed.resize(size);
+        compress2(compressed.data(), &size, raw.data(), raw.size(), Z_BEST_SPEED);
+        put_u32(file, raw.size());
+        put_u32(file, size);
+        file.write(reinterpret_cast<const char *>(compressed.data()), size);
+    }
+}
+
+TraceReader::TraceReader(const std::string &path) : file{path, std::ifstream::binary},
+                                                     chunk{},
+                                                     position{0},
+                                                     next_pc{0},
+                                                     last_addr{0},
+                                                     mode{0},
+                                                     last_registers{0},
+                                                     words{0} {
+    char magic[TRACE_MAGIC_SIZE];
+    if (!file.read(magic, TRACE_MAGIC_SIZE) || std::memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        throw std::runtime_error("not a trace file: " + path);
+    }
+}
+
+bool TraceReader::read_chunk() {
+    uint32_t sizes[2];
+    if (!file.read(reinterpret_cast<char *>(sizes), sizeof(sizes))) {
+        return false;
+    }
+    std::vector<uint8_t> compressed(sizes[1]);
+    if (!file.read(reinterpret_cast<char *>(compressed.data()), compressed.size())) {
+        throw std::runtime_error("truncated trace chunk");
+    }
+    chunk.resize(sizes[0]);
+    uLongf size = chunk.size();
+    if (uncompress(chunk.data(), &size, compressed.data(), compressed.size()) != Z_OK || size != chunk.size()) {
+        throw std::runtime_error("corrupt trace chunk");
+    }
+    position = 0;
+    next_pc = 0;
+    last_addr = 0;
+    std::memset(last_registers, 0, sizeof(last_registers));
+    std::memset(words, 0, sizeof(words));
+    return true;
+}
+
+bool TraceReader::next(TraceRecord &record) {
+    while (position >= chunk.size()) {
+        if (!read_chunk()) {
+            return false;
+        }
+    }
+    record.flags = chunk[position++];
+    record.pc = next_pc;
+    if ((record.flags & TRACE_PC) != 0) {
+        record.pc += get_signed(chunk, position);
+    }
+    next_pc = record.pc + 4;
+    auto &word = words[(record.pc >> 2) % TRACE_WORD_CACHE];
+    if ((record.flags & TRACE_WORD) != 0) {
+        if (position + 4 > chunk.size()) {
+            throw std::runtime_error("corrupt trace record");
+        }
+        std::memcpy(&word, &chunk[position], 4);
+        position += 4;
+    }
+    record.instruction = word;
+    if ((record.flags & TRACE_RD) != 0) {
+        record.rd = chunk.at(position++) & 0x1f;
+        record.rd_value = last_registers[record.rd] + get_signed(chunk, position);
+        last_registers[record.rd] = record.rd_value;
+    }
+    if ((record.flags & TRACE_MEMORY) != 0) {
+        last_addr += get_signed(chunk, position);
+        record.memory_addr = last_addr;
+    }
+    if ((record.flags & TRACE_EXCEPTION) != 0) {
+        record.cause = get_varint(chunk, position);
+        record.tval = get_varint(chunk, position);
+    }
+    if ((record.flags & TRACE_INTERRUPT) != 0) {
+        record.interrupt_cause = get_varint(chunk, position);
+    }
+    if ((record.flags & TRACE_MODE) != 0) {
+        mode = chunk.at(position++);
+    }
+    record.mode = mode;
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A trace file is TRACE_MAGIC followed by chunks of
+// [u32 raw size][u32 compressed size][zlib data]. Each chunk decodes on its
+// own: the delta state below is reset at every chunk boundary.
+//
+// A record is a flags byte, then the fields selected by the flags in this order:
+//   TRACE_PC         zigzag varint of pc minus the previous pc + 4
+//                    (sequential instructions store nothing)
+//   TRACE_WORD       u32 instruction word, present unless it matches the word
+//                    last seen at the same slot of a TRACE_WORD_CACHE entry
+//                    table indexed by pc
+//   TRACE_RD         u8 register, zigzag varint of the value written back
+//                    minus the register's previous traced value
+//   TRACE_MEMORY     zigzag varint of the address minus the previous one
+//   TRACE_EXCEPTION  varint cause, varint tval
+//   TRACE_INTERRUPT  varint cause
+//   TRACE_MODE       u8 privilege mode after the instruction, present when it
+//                    changed and in the first record of a chunk
+#define TRACE_MAGIC "RVTRACE1"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_CHUNK_SIZE (1024 * 1024)
+
+#define TRACE_PC (1 << 0)
+#define TRACE_RD (1 << 1)
+#define TRACE_MEMORY (1 << 2)
+#define TRACE_EXCEPTION (1 << 3)
+#define TRACE_INTERRUPT (1 << 4)
+#define TRACE_MODE (1 << 5)
+#define TRACE_WORD (1 << 6)
+
+#define TRACE_WORD_CACHE 4096
+
+// The writer derives TRACE_PC, TRACE_WORD and TRACE_MODE itself; pc, instruction and mode
+// are always meaningful, the other fields only when their flag is set.
+struct TraceRecord {
+    uint8_t flags;
+    uint64_t pc;
+    uint32_t instruction;
+    uint8_t rd;
+    uint64_t rd_value;
+    uint64_t memory_addr;
+    uint64_t cause;
+    uint64_t tval;
+    uint64_t interrupt_cause;
+    uint8_t mode;
+};
+
+// Encodes records into chunks on the emulator thread and leaves compression
+// and file I/O to a background writer thread.
+class TraceWriter {
+private:
+    std::ofstream file;
+    std::vector<uint8_t> chunk;
+    size_t used;
+    uint64_t next_pc;
+    uint64_t last_addr;
+    uint8_t last_mode;
+    uint64_t last_registers[32];
+    uint32_t words[TRACE_WORD_CACHE];
+    void reset_deltas();
+
+    std::mutex lock;
+    std::condition_variable condvar;
+    std::deque<std::vector<uint8_t>> pending;
+    bool closing;
+    std::thread writer;
+
+    void flush_chunk();
+    void write_chunks();
+
+public:
+    TraceWriter(const std::string &path);
+    ~TraceWriter();
+    void append(const TraceRecord &record);
+};
+
+class TraceReader {
+private:
+    std::ifstream file;
+    std::vector<uint8_t> chunk;
+    size_t position;
+    uint64_t next_pc;
+    uint64_t last_addr;
+    uint8_t mode;
+    uint64_t last_registers[32];
+    uint32_t words[TRACE_WORD_CACHE];
+    bool read_chunk();
+
+public:
+    TraceReader(const std::string &path);
+    // Returns false at the end of the trace.
+    bool next(TraceRecord &record);
+};
+
+#endif
@@ -4,8 +4,14 @@
 #include <cstdint>
 
 class Trap {
+protected:
+    uint64_t code;
+    uint64_t tval;
+
 public:
-    virtual uint64_t get_code() = 0;
+    Trap(uint64_t code, uint64_t tval) : code{code}, tval{tval} {}
+    uint64_t get_code() const { return code; }
+    uint64_t get_tval() const { return tval; }
 };
 
 #endif
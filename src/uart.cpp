@@ -1,58 +1,77 @@
 #include "uart.h"
 
-#include <iostream>
-#include <string>
-#include <thread>
+#include "metrics.h"
 
 Uart::Uart() : lock{std::mutex()},
-               condvar{std::condition_variable()},
                buffer{std::vector<uint8_t>(UART_SIZE, 0)},
+               input{std::deque<uint8_t>()},
+               output{nullptr},
                interrupting{false} {
     buffer[UART_LSR - UART_BASE] |= UART_LSR_TX;
-    auto reader = std::thread(&Uart::listen, this);
-    reader.detach();
-}
-
-void Uart::listen() {
-    std::string s;
-    while (std::getline(std::cin, s)) {
-        s.push_back('\n');
-        for (char c : s) {
-            std::unique_lock<std::mutex> ulock(lock);
-            while ((buffer[UART_LSR - UART_BASE] & UART_LSR_RX) == 1) {
-                condvar.wait(ulock);
-            }
-            buffer[UART_RHR - UART_BASE] = c;
-            interrupting.store(true);
-            buffer[UART_LSR - UART_BASE] |= UART_LSR_RX;
-        }
+}
+
+void Uart::deliver() {
+    if ((buffer[UART_LSR - UART_BASE] & UART_LSR_RX) == 1 || input.empty()) {
+        return;
     }
+    buffer[UART_RHR - UART_BASE] = input.front();
+    input.pop_front();
+    buffer[UART_LSR - UART_BASE] |= UART_LSR_RX;
+    interrupting.store(true);
 }
 
-std::pair<uint64_t, std::optional<Exception>> Uart::load(uint64_t addr, int nBytes) {
+void Uart::receive(uint8_t c) {
+    std::lock_guard<std::mutex> guard(lock);
+    Metrics::add(Metric::UartBytesIn);
+    input.push_back(c);
+    deliver();
+}
+
+void Uart::set_output(std::function<void(uint8_t)> callback) {
+    std::lock_guard<std::mutex> guard(lock);
+    output = callback;
+}
+
+uint64_t Uart::load(uint64_t addr, int nBytes) {
     if (nBytes == 1) {
         std::lock_guard<std::mutex> guard(lock);
         if (addr == UART_RHR) {
-            condvar.notify_one();
+            auto c = buffer[UART_RHR - UART_BASE];
             buffer[UART_LSR - UART_BASE] &= ~UART_LSR_RX;
-            return std::make_pair(buffer[UART_RHR - UART_BASE], std::nullopt);
+            deliver();
+            return c;
         }
-        return std::make_pair(buffer[addr - UART_BASE], std::nullopt);
+        return buffer[addr - UART_BASE];
     }
-    return std::make_pair(0, Exception(ExceptionType::LoadAccessFault));
+    raise_exception(ExceptionType::LoadAccessFault, addr);
 }
 
-std::optional<Exception> Uart::store(uint64_t addr, int nBytes, uint64_t value) {
+void Uart::store(uint64_t addr, int nBytes, uint64_t value) {
     if (nBytes == 1) {
         std::lock_guard<std::mutex> guard(lock);
         if (addr == UART_THR) {
-            std::cout << (char)value << std::flush;
-            return std::nullopt;
+            Metrics::add(Metric::UartBytesOut);
+            if (output) {
+                output(value);
+            }
+            return;
         }
         buffer[addr - UART_BASE] = value;
-        return std::nullopt;
+        return;
     }
-    return Exception(ExceptionType::StoreAMOAccessFault);
+    raise_exception(ExceptionType::StoreAMOAccessFault, addr);
+}
+
+Uart::State Uart::save() {
+    std::lock_guard<std::mutex> guard(lock);
+    return {buffer, input, interrupting.load()};
+}
+
+void Uart::restore(const State &state) {
+    std::lock_guard<std::mutex> guard(lock);
+    buffer = state.buffer;
+    input = state.input;
+    interrupting.store(state.interrupting);
 }
 
 bool Uart::is_interrupting() {
@@ -2,7 +2,8 @@
 #define UART_H
 
 #include <atomic>
-#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <vector>
 
@@ -21,16 +22,29 @@
 class Uart : public Device {
 private:
     std::mutex lock;
-    std::condition_variable condvar;
     std::vector<uint8_t> buffer;
+    std::deque<uint8_t> input;
+    std::function<void(uint8_t)> output;
     std::atomic<bool> interrupting;
+    void deliver();
 
 public:
+    struct State {
+        std::vector<uint8_t> buffer;
+        std::deque<uint8_t> input;
+        bool interrupting;
+    };
     Uart();
-    std::pair<uint64_t, std::optional<Exception>> load(uint64_t addr, int nBytes);
-    std::optional<Exception> store(uint64_t addr, int nBytes, uint64_t value);
-    void listen();
+    const char *get_name() { return "uart"; };
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
+    // Queues a byte for the guest; safe to call from any thread.
+    void receive(uint8_t c);
+    // Transmitted bytes go to the callback; without one they are discarded.
+    void set_output(std::function<void(uint8_t)> callback);
     bool is_interrupting();
+    State save();
+    void restore(const State &state);
 };
 
 #endif
@@ -1,76 +1,78 @@
 #include "virtio.h"
 
 #include <iostream>
+#include <utility>
 
-Virtio::Virtio(std::vector<uint8_t> disk_image) : id{0},
-                                                  driver_features{0},
-                                                  page_size{0},
-                                                  queue_sel{0},
-                                                  queue_num{0},
-                                                  queue_pfn{0},
-                                                  queue_notify{UINT32_MAX},
-                                                  status{0},
-                                                  disk{disk_image} {
+Virtio::Virtio(Buffer disk_image) : id{0},
+                                    driver_features{0},
+                                    page_size{0},
+                                    queue_sel{0},
+                                    queue_num{0},
+                                    queue_pfn{0},
+                                    queue_notify{UINT32_MAX},
+                                    status{0},
+                                    disk{std::move(disk_image)},
+                                    tracker{9} {
 }
 
-std::pair<uint64_t, std::optional<Exception>> Virtio::load(uint64_t addr, int nBytes) {
+uint64_t Virtio::load(uint64_t addr, int nBytes) {
     if (nBytes == 4) {
         switch (addr) {
         case VIRTIO_MAGIC:
-            return std::make_pair(0x74726976, std::nullopt);
+            return 0x74726976;
         case VIRTIO_VERSION:
-            return std::make_pair(0x1, std::nullopt);
+            return 0x1;
         case VIRTIO_DEVICE_ID:
-            return std::make_pair(0x2, std::nullopt);
+            return 0x2;
         case VIRTIO_VENDOR_ID:
-            return std::make_pair(0x554d4551, std::nullopt);
+            return 0x554d4551;
         case VIRTIO_DEVICE_FEATURES:
-            return std::make_pair(0, std::nullopt);
+            return 0;
         case VIRTIO_DRIVER_FEATURES:
-            return std::make_pair(driver_features, std::nullopt);
+            return driver_features;
         case VIRTIO_QUEUE_NUM_MAX:
-            return std::make_pair(8, std::nullopt);
+            return 8;
         case VIRTIO_QUEUE_PFN:
-            return std::make_pair(queue_pfn, std::nullopt);
+            return queue_pfn;
         case VIRTIO_STATUS:
-            return std::make_pair(status, std::nullopt);
+            return status;
         default:
-            return std::make_pair(0, std::nullopt);
+            return 0;
             ;
         }
     }
-    return std::make_pair(0, Exception(ExceptionType::LoadAccessFault));
+    raise_exception(ExceptionType::LoadAccessFault, addr);
 }
 
-std::optional<Exception> Virtio::store(uint64_t addr, int nBytes, uint64_t value) {
+void Virtio::store(uint64_t addr, int nBytes, uint64_t value) {
     if (nBytes == 4) {
         switch (addr) {
         case VIRTIO_DEVICE_FEATURES:
             driver_features = value;
-            return std::nullopt;
+            return;
         case VIRTIO_GUEST_PAGE_SIZE:
             page_size = value;
-            return std::nullopt;
+            return;
         case VIRTIO_QUEUE_SEL:
             queue_sel = value;
-            return std::nullopt;
+            return;
         case VIRTIO_QUEUE_NUM:
             queue_num = value;
-            return std::nullopt;
+            return;
         case VIRTIO_QUEUE_PFN:
             queue_pfn = value;
-            return std::nullopt;
+            return;
         case VIRTIO_QUEUE_NOTIFY:
             queue_notify = value;
-            return std::nullopt;
+            return;
         case VIRTIO_STATUS:
             status = value;
-            return std::nullopt;
+            return;
         default:
-            return std::nullopt;
+            return;
         }
     }
-    return Exception(ExceptionType::StoreAMOAccessFault);
+    raise_exception(ExceptionType::StoreAMOAccessFault, addr);
 }
 
 bool Virtio::is_interrupting() {
@@ -91,9 +93,25 @@ uint64_t Virtio::desc_addr() {
 }
 
 uint64_t Virtio::read_disk(uint64_t addr) {
-    return disk[addr];
+    return disk.data()[addr];
 }
 
 void Virtio::write_disk(uint64_t addr, uint64_t value) {
-    disk[addr] = value;
+    tracker.mark(addr);
+    disk.data()[addr] = value;
+}
+
+Virtio::State Virtio::save() {
+    return {id, driver_features, page_size, queue_sel, queue_num, queue_pfn, queue_notify, status};
+}
+
+void Virtio::restore(const State &state) {
+    id = state.id;
+    driver_features = state.driver_features;
+    page_size = state.page_size;
+    queue_sel = state.queue_sel;
+    queue_num = state.queue_num;
+    queue_pfn = state.queue_pfn;
+    queue_notify = state.queue_notify;
+    status = state.status;
 }
@@ -1,9 +1,9 @@
 #ifndef VIRTIO_H
 #define VIRTIO_H
 
+#include "buffer.h"
 #include "device.h"
-
-#include <vector>
+#include "dirty_tracker.h"
 
 #define VIRTIO_IRQ 1
 
@@ -17,14 +17,20 @@
 #define VIRTIO_DEVICE_ID (VIRTIO_BASE + 0x008)
 #define VIRTIO_VENDOR_ID (VIRTIO_BASE + 0x00c)
 #define VIRTIO_DEVICE_FEATURES (VIRTIO_BASE + 0x010)
+#define VIRTIO_DEVICE_FEATURES_SEL (VIRTIO_BASE + 0x014)
 #define VIRTIO_DRIVER_FEATURES (VIRTIO_BASE + 0x020)
+#define VIRTIO_DRIVER_FEATURES_SEL (VIRTIO_BASE + 0x024)
 #define VIRTIO_GUEST_PAGE_SIZE (VIRTIO_BASE + 0x028)
 #define VIRTIO_QUEUE_SEL (VIRTIO_BASE + 0x030)
 #define VIRTIO_QUEUE_NUM_MAX (VIRTIO_BASE + 0x034)
 #define VIRTIO_QUEUE_NUM (VIRTIO_BASE + 0x038)
+#define VIRTIO_QUEUE_ALIGN (VIRTIO_BASE + 0x03c)
 #define VIRTIO_QUEUE_PFN (VIRTIO_BASE + 0x040)
 #define VIRTIO_QUEUE_NOTIFY (VIRTIO_BASE + 0x050)
+#define VIRTIO_INTERRUPT_STATUS (VIRTIO_BASE + 0x060)
+#define VIRTIO_INTERRUPT_ACK (VIRTIO_BASE + 0x064)
 #define VIRTIO_STATUS (VIRTIO_BASE + 0x070)
+#define VIRTIO_CONFIG (VIRTIO_BASE + 0x100)
 
 class Virtio : public Device {
 private:
@@ -36,17 +42,37 @@ private:
     uint32_t queue_pfn;
     uint32_t queue_notify;
     uint32_t status;
-    std::vector<uint8_t> disk;
+    // Writes stay private to this guest; the image file is never modified.
+    Buffer disk;
+    // Sector-granular, for snapshots.
+    DirtyTracker tracker;
 
 public:
-    Virtio(std::vector<uint8_t> disk_image);
-    std::pair<uint64_t, std::optional<Exception>> load(uint64_t addr, int nBytes);
-    std::optional<Exception> store(uint64_t addr, int nBytes, uint64_t value);
+    struct State {
+        uint64_t id;
+        uint32_t driver_features;
+        uint32_t page_size;
+        uint32_t queue_sel;
+        uint32_t queue_num;
+        uint32_t queue_pfn;
+        uint32_t queue_notify;
+        uint32_t status;
+    };
+    Virtio(Buffer disk_image);
+    const char *get_name() { return "virtio"; };
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
     bool is_interrupting();
     uint64_t get_new_id();
     uint64_t desc_addr();
     uint64_t read_disk(uint64_t addr);
     void write_disk(uint64_t addr, uint64_t value);
+    State save();
+    void restore(const State &state);
+    // Takes the current disk contents as a snapshot that roll_back_disk() returns to.
+    void track_disk_writes() { tracker.start(disk.data(), disk.size()); };
+    void roll_back_disk() { tracker.roll_back(); };
+    uint64_t dirty_sectors() const { return tracker.dirty_blocks(); };
 };
 
 #endif
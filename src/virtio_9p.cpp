@@ -0,0 +1,213 @@
+#include "virtio_9p.h"
+
+#include <cerrno>
+#include <stdexcept>
+
+Virtio9p::Virtio9p(Bus &bus, const std::string &path) : bus{bus},
+                                                        server{path},
+                                                        config{},
+                                                        device_features_sel{0},
+                                                        driver_features{0},
+                                                        page_size{0},
+                                                        queue_sel{0},
+                                                        queue_num{0},
+                                                        queue_align{0},
+                                                        queue_pfn{0},
+                                                        interrupt_status{0},
+                                                        status{0},
+                                                        last_avail{0},
+                                                        raised{false} {
+    // tag_len[2] tag[tag_len]
+    std::string tag(VIRTIO_9P_TAG);
+    config.push_back(tag.size());
+    config.push_back(tag.size() >> 8);
+    config += tag;
+}
+
+void Virtio9p::reset() {
+    device_features_sel = 0;
+    driver_features = 0;
+    queue_sel = 0;
+    queue_num = 0;
+    queue_align = 0;
+    queue_pfn = 0;
+    interrupt_status = 0;
+    status = 0;
+    last_avail = 0;
+    raised = false;
+    server.reset();
+}
+
+uint64_t Virtio9p::load(uint64_t addr, int nBytes) {
+    // Registers are at the disk's offsets.
+    auto reg = addr - VIRTIO_9P_BASE + VIRTIO_BASE;
+    if (reg >= VIRTIO_CONFIG) {
+        // Legacy drivers read the configuration a byte at a time.
+        uint64_t value = 0;
+        for (int i = 0; i < nBytes; i++) {
+            auto offset = reg - VIRTIO_CONFIG + i;
+            value |= (uint64_t)(offset < config.size() ? (uint8_t)config[offset] : 0) << (8 * i);
+        }
+        return value;
+    }
+    if (nBytes == 4) {
+        switch (reg) {
+        case VIRTIO_MAGIC:
+            return 0x74726976;
+        case VIRTIO_VERSION:
+            return 0x1;
+        case VIRTIO_DEVICE_ID:
+            return VIRTIO_ID_9P;
+        case VIRTIO_VENDOR_ID:
+            return 0x554d4551;
+        case VIRTIO_DEVICE_FEATURES:
+            return device_features_sel == 0 ? 1 << VIRTIO_9P_MOUNT_TAG | 1 << VIRTIO_RING_F_INDIRECT_DESC : 0;
+        case VIRTIO_QUEUE_NUM_MAX:
+            return queue_sel == 0 ? VIRTIO_9P_QUEUE_NUM : 0;
+        case VIRTIO_QUEUE_PFN:
+            return queue_sel == 0 ? queue_pfn : 0;
+        case VIRTIO_INTERRUPT_STATUS:
+            return interrupt_status;
+        case VIRTIO_STATUS:
+            return status;
+        default:
+            return 0;
+        }
+    }
+    raise_exception(ExceptionType::LoadAccessFault, addr);
+}
+
+void Virtio9p::store(uint64_t addr, int nBytes, uint64_t value) {
+    auto reg = addr - VIRTIO_9P_BASE + VIRTIO_BASE;
+    if (nBytes != 4) {
+        raise_exception(ExceptionType::StoreAMOAccessFault, addr);
+    }
+    switch (reg) {
+    case VIRTIO_DEVICE_FEATURES_SEL:
+        device_features_sel = value;
+        return;
+    case VIRTIO_DRIVER_FEATURES:
+        driver_features = value;
+        return;
+    case VIRTIO_GUEST_PAGE_SIZE:
+        page_size = value;
+        return;
+    case VIRTIO_QUEUE_SEL:
+        queue_sel = value;
+        return;
+    case VIRTIO_QUEUE_NUM:
+        if (queue_sel == 0) {
+            queue_num = value;
+        }
+        return;
+    case VIRTIO_QUEUE_ALIGN:
+        if (queue_sel == 0) {
+            queue_align = value;
+        }
+        return;
+    case VIRTIO_QUEUE_PFN:
+        if (queue_sel == 0) {
+            queue_pfn = value;
+            last_avail = 0;
+        }
+        return;
+    case VIRTIO_QUEUE_NOTIFY:
+        if (value == 0 && queue_pfn != 0) {
+            process_queue();
+        }
+        return;
+    case VIRTIO_INTERRUPT_ACK:
+        interrupt_status &= ~value;
+        return;
+    case VIRTIO_STATUS:
+        if (value == 0) {
+            reset();
+        } else {
+            status = value;
+        }
+        return;
+    default:
+        return;
+    }
+}
+
+bool Virtio9p::is_interrupting() {
+    if (raised) {
+        raised = false;
+        return true;
+    }
+    return false;
+}
+
+// Appends the buffers of the chain starting at index in the descriptor table
+// of size entries: device-readable ones to request, writable ones to reply.
+// Buffers outside RAM are left out and set faulted.
+void Virtio9p::gather(uint64_t table, uint64_t size, uint16_t index, bool top, ScatterList &request, ScatterList &reply, bool &faulted) {
+    for (uint64_t count = 0;; count++) {
+        if (count == size || index >= size) {
+            throw std::runtime_error("virtio-9p: malformed descriptor chain");
+        }
+        auto descriptor = table + VRING_DESC_SIZE * index;
+        auto addr = bus.load(descriptor, 8);
+        auto len = bus.load(descriptor + 8, 4);
+        auto flags = bus.load(descriptor + 12, 2);
+        if ((flags & VRING_DESC_F_INDIRECT) != 0) {
+            if (!top) {
+                throw std::runtime_error("virtio-9p: nested indirect descriptors");
+            }
+            gather(addr, len / VRING_DESC_SIZE, 0, false, request, reply, faulted);
+        } else if ((flags & VRING_DESC_F_WRITE) != 0) {
+            auto buffer = bus.get_ram_pointer(addr, len);
+            if (buffer == nullptr) {
+                faulted = true;
+            } else {
+                reply.append(buffer, len);
+            }
+        } else {
+            // Read-only buffers are not marked as written for snapshots.
+            auto buffer = bus.view_ram(addr, len);
+            if (buffer == nullptr) {
+                faulted = true;
+            } else {
+                request.append(const_cast<uint8_t *>(buffer), len);
+            }
+        }
+        if ((flags & VRING_DESC_F_NEXT) == 0) {
+            return;
+        }
+        index = bus.load(descriptor + 14, 2);
+    }
+}
+
+void Virtio9p::process_queue() {
+    if (queue_num == 0 || queue_num > VIRTIO_9P_QUEUE_NUM || queue_align == 0) {
+        throw std::runtime_error("virtio-9p: queue not set up");
+    }
+    // Legacy layout: descriptors, then the available ring, then the used ring
+    // at the next queue_align boundary.
+    auto desc = (uint64_t)queue_pfn * page_size;
+    auto avail = desc + VRING_DESC_SIZE * queue_num;
+    auto used = (avail + 6 + 2 * queue_num + queue_align - 1) / queue_align * queue_align;
+    try {
+        uint16_t avail_idx = bus.load(avail + 2, 2);
+        while (last_avail != avail_idx) {
+            uint16_t head = bus.load(avail + 4 + 2 * (last_avail % queue_num), 2);
+            ScatterList request;
+            ScatterList reply;
+            bool faulted = false;
+            gather(desc, queue_num, head, true, request, reply, faulted);
+            auto written = server.serve(request, reply, faulted ? EFAULT : 0);
+
+            uint16_t used_idx = bus.load(used + 2, 2);
+            auto element = used + 4 + 8 * (used_idx % queue_num);
+            bus.store(element, 4, head);
+            bus.store(element + 4, 4, written);
+            bus.store(used + 2, 2, (uint16_t)(used_idx + 1));
+            last_avail++;
+        }
+    } catch (const Exception &) {
+        throw std::runtime_error("virtio-9p: queue outside RAM");
+    }
+    interrupt_status |= 1;
+    raised = true;
+}
@@ -0,0 +1,67 @@
+#ifndef VIRTIO_9P_H
+#define VIRTIO_9P_H
+
+#include <cstdint>
+#include <string>
+
+#include "bus.h"
+#include "device.h"
+#include "p9_server.h"
+#include "virtio.h"
+
+#define VIRTIO_9P_BASE 0x10003000
+#define VIRTIO_9P_SIZE 0x1000
+#define VIRTIO_9P_IRQ 2
+#define VIRTIO_ID_9P 9
+// The name the guest mounts the share by.
+#define VIRTIO_9P_TAG "host"
+// Descriptors in the request queue. With indirect descriptors one request can
+// use a whole table, so messages are limited by P9_MAX_MSIZE instead.
+#define VIRTIO_9P_QUEUE_NUM 128
+
+// Feature bits.
+#define VIRTIO_9P_MOUNT_TAG 0
+#define VIRTIO_RING_F_INDIRECT_DESC 28
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2
+#define VRING_DESC_F_INDIRECT 4
+
+// A legacy virtio-mmio transport, laid out like the disk's registers, for a
+// 9P server exporting a host directory. Requests are served synchronously
+// when the guest notifies the queue, with the message buffers in guest RAM
+// handed to the server as they are, so file data is read and written in place.
+// The share is not part of snapshots: the host files the guest changes stay
+// changed, and open fids are not rolled back.
+class Virtio9p : public Device {
+private:
+    Bus &bus;
+    P9Server server;
+    std::string config;
+    uint32_t device_features_sel;
+    uint32_t driver_features;
+    uint32_t page_size;
+    uint32_t queue_sel;
+    uint32_t queue_num;
+    uint32_t queue_align;
+    uint32_t queue_pfn;
+    uint32_t interrupt_status;
+    uint32_t status;
+    // Requests taken from the available ring so far.
+    uint16_t last_avail;
+    bool raised;
+    void reset();
+    void process_queue();
+    void gather(uint64_t table, uint64_t size, uint16_t index, bool top, ScatterList &request, ScatterList &reply, bool &faulted);
+
+public:
+    // Throws std::runtime_error if path is not a readable directory.
+    Virtio9p(Bus &bus, const std::string &path);
+    const char *get_name() { return "virtio-9p"; };
+    uint64_t load(uint64_t addr, int nBytes);
+    void store(uint64_t addr, int nBytes, uint64_t value);
+    // True once after each batch of completed requests.
+    bool is_interrupting();
+};
+
+#endif
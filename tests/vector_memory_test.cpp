@@ -0,0 +1,82 @@
+// Vector loads and stores whose register groups would run past v31 must raise
+// IllegalInstruction instead of touching memory beyond the register file.
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "emulator.h"
+
+namespace {
+
+uint32_t vsetvli(uint32_t rd, uint32_t vtype) {
+    return vtype << 20 | 0x7 << 12 | rd << 7 | 0x57;
+}
+
+// vle<eew>.v vd, (a0)
+uint32_t vle(uint32_t width, uint32_t vd) {
+    return 1 << 25 | 10 << 15 | width << 12 | vd << 7 | 0x07;
+}
+
+// vl<nf>re8.v vd, (a0)
+uint32_t vlr(uint32_t nf, uint32_t vd) {
+    return (nf - 1) << 29 | 1 << 25 | 0x08 << 20 | 10 << 15 | vd << 7 | 0x07;
+}
+
+// vs<nf>r.v vs3, (a0)
+uint32_t vsr(uint32_t nf, uint32_t vs3) {
+    return (nf - 1) << 29 | 1 << 25 | 0x08 << 20 | 10 << 15 | vs3 << 7 | 0x27;
+}
+
+// vluxei<eew>.v vd, (a0), vs2
+uint32_t vluxei(uint32_t width, uint32_t vd, uint32_t vs2) {
+    return 1 << 26 | 1 << 25 | vs2 << 20 | 10 << 15 | width << 12 | vd << 7 | 0x07;
+}
+
+// Runs vsetvli t0, zero, vtype followed by instruction. True if the second
+// instruction trapped as illegal.
+bool is_illegal(uint32_t vtype, uint32_t instruction) {
+    std::vector<uint32_t> code = {vsetvli(5, vtype), instruction};
+    std::vector<uint8_t> binary(reinterpret_cast<uint8_t *>(code.data()), reinterpret_cast<uint8_t *>(code.data() + code.size()));
+    Emulator emulator(Buffer(binary), Buffer(std::vector<uint8_t>(512, 0)));
+    emulator.set_register(10, MEMORY_BASE + 0x1000);
+    emulator.run(2);
+    return emulator.get_csr(MEPC) == MEMORY_BASE + 4 && emulator.get_csr(MCAUSE) == 2;
+}
+
+} // namespace
+
+int main() {
+    const uint32_t e8m1 = 0x00;
+    const uint32_t e8m8 = 0x03;
+    const uint32_t e64m8 = 0x1b;
+    const uint32_t e64m1 = 0x18;
+    // LMUL 0b100 is reserved, so vsetvli sets vill.
+    const uint32_t vill = 0x04;
+    struct {
+        const char *name;
+        uint32_t vtype;
+        uint32_t instruction;
+        bool illegal;
+    } cases[] = {
+        {"vle64.v v8 at e64,m8", e64m8, vle(7, 8), false},
+        {"vle64.v v0 at e8,m8 (EMUL 64)", e8m8, vle(7, 0), true},
+        {"vle64.v v28 at e8,m1 (v28-v35)", e8m1, vle(7, 28), true},
+        {"vle64.v v24 at e8,m1", e8m1, vle(7, 24), false},
+        {"vluxei8.v v0, v1 at e64,m1", e64m1, vluxei(0, 0, 1), false},
+        {"vluxei64.v v0, v24 at e8,m8 (index EMUL 64)", e8m8, vluxei(7, 0, 24), true},
+        {"vluxei64.v v0, v31 at e8,m1 (v31-v38)", e8m1, vluxei(7, 0, 31), true},
+        {"vs8r.v v0 with vill", vill, vsr(8, 0), false},
+        {"vl8r.v v8 with vill", vill, vlr(8, 8), false},
+        {"vl8r.v v4 (misaligned) with vill", vill, vlr(8, 4), true},
+        {"vle8.v v0 with vill", vill, vle(0, 0), true},
+    };
+    int failures = 0;
+    for (const auto &c : cases) {
+        if (is_illegal(c.vtype, c.instruction) != c.illegal) {
+            std::cerr << "FAIL: " << c.name << (c.illegal ? " did not trap" : " trapped") << std::endl;
+            failures++;
+        }
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
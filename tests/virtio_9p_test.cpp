@@ -0,0 +1,107 @@
+// Requests whose descriptors point outside guest RAM, including ranges that
+// wrap around the address space, must be answered with Rlerror(EFAULT)
+// without the device touching host memory beyond RAM.
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "bus.h"
+#include "virtio_9p.h"
+
+#define QUEUE (MEMORY_BASE + 0x100000)
+#define MESSAGE (MEMORY_BASE + 0x200000)
+#define REPLY (MEMORY_BASE + 0x201000)
+#define QUEUE_NUM 8
+#define QUEUE_ALIGN 4096
+
+namespace {
+
+struct Descriptor {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+};
+
+// Writes a register, given at the disk's offsets like the device's own code.
+void set_register(Virtio9p &device, uint64_t reg, uint32_t value) {
+    device.store(reg - VIRTIO_BASE + VIRTIO_9P_BASE, 4, value);
+}
+
+// Queues a Tversion whose chain is made of descriptors and returns the reply.
+std::vector<uint8_t> request(Bus &bus, Virtio9p &device, const std::vector<Descriptor> &chain, uint16_t &avail_idx) {
+    // size[4] Tversion[1] tag[2] msize[4] version[s]
+    std::string version = "9P2000.L";
+    std::vector<uint8_t> message = {0, 0, 0, 0, 100, 0x34, 0x12, 0x00, 0x20, 0, 0, (uint8_t)version.size(), 0};
+    message.insert(message.end(), version.begin(), version.end());
+    message[0] = message.size();
+    std::memcpy(bus.get_ram_pointer(MESSAGE, message.size()), message.data(), message.size());
+
+    for (size_t i = 0; i < chain.size(); i++) {
+        auto descriptor = QUEUE + VRING_DESC_SIZE * i;
+        auto next = i + 1 < chain.size();
+        bus.store(descriptor, 8, chain[i].addr);
+        bus.store(descriptor + 8, 4, chain[i].len);
+        bus.store(descriptor + 12, 2, chain[i].flags | (next ? VRING_DESC_F_NEXT : 0));
+        bus.store(descriptor + 14, 2, next ? i + 1 : 0);
+    }
+    auto avail = QUEUE + VRING_DESC_SIZE * QUEUE_NUM;
+    bus.store(avail + 4 + 2 * (avail_idx % QUEUE_NUM), 2, 0);
+    bus.store(avail + 2, 2, ++avail_idx);
+    set_register(device, VIRTIO_QUEUE_NOTIFY, 0);
+
+    auto used = (avail + 6 + 2 * QUEUE_NUM + QUEUE_ALIGN - 1) / QUEUE_ALIGN * QUEUE_ALIGN;
+    auto length = bus.load(used + 4 + 8 * ((avail_idx - 1) % QUEUE_NUM) + 4, 4);
+    std::vector<uint8_t> reply(length);
+    std::memcpy(reply.data(), bus.view_ram(REPLY, length), length);
+    return reply;
+}
+
+bool is_error(const std::vector<uint8_t> &reply, uint32_t error) {
+    // size[4] Rlerror[1] tag[2] ecode[4]
+    return reply.size() == 11 && reply[4] == 7 && reply[5] == 0x34 && reply[6] == 0x12 && reply[7] == error;
+}
+
+} // namespace
+
+int main() {
+    char path[] = "/tmp/virtio-9p-test.XXXXXX";
+    if (mkdtemp(path) == nullptr) {
+        std::cerr << "FAIL: mkdtemp" << std::endl;
+        return EXIT_FAILURE;
+    }
+    Bus bus{Buffer()};
+    Virtio9p device(bus, path);
+    set_register(device, VIRTIO_GUEST_PAGE_SIZE, 4096);
+    set_register(device, VIRTIO_QUEUE_SEL, 0);
+    set_register(device, VIRTIO_QUEUE_NUM, QUEUE_NUM);
+    set_register(device, VIRTIO_QUEUE_ALIGN, QUEUE_ALIGN);
+    set_register(device, VIRTIO_QUEUE_PFN, QUEUE / 4096);
+
+    int failures = 0;
+    uint16_t avail_idx = 0;
+    Descriptor message = {MESSAGE, 21, 0};
+    Descriptor reply = {REPLY, 64, VRING_DESC_F_WRITE};
+    if (request(bus, device, {message, reply}, avail_idx)[4] != 101) {
+        std::cerr << "FAIL: Tversion was not answered" << std::endl;
+        failures++;
+    }
+    // addr - MEMORY_BASE + len wraps to 0x1000.
+    Descriptor wrapping = {0xfffffffffffff000, 0x80002000, 0};
+    if (!is_error(request(bus, device, {message, wrapping, reply}, avail_idx), EFAULT)) {
+        std::cerr << "FAIL: a wrapping request buffer was not refused" << std::endl;
+        failures++;
+    }
+    Descriptor beyond = {MEMORY_BASE + MEMORY_SIZE - 16, 32, VRING_DESC_F_WRITE};
+    if (!is_error(request(bus, device, {message, reply, beyond}, avail_idx), EFAULT)) {
+        std::cerr << "FAIL: a reply buffer past RAM was not refused" << std::endl;
+        failures++;
+    }
+    rmdir(path);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}